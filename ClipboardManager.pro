@@ -1,4 +1,4 @@
-QT += core widgets gui
+QT += core widgets gui network
 
 CONFIG += c++17
 
@@ -20,7 +20,28 @@ SOURCES += \
     src/SystemTrayManager.cpp \
     src/ClipboardItem.cpp \
     src/ClipboardHistoryWidget.cpp \
-    src/TrayPopupWidget.cpp
+    src/TrayPopupWidget.cpp \
+    src/FuzzyMatcher.cpp \
+    src/ClipboardItemDelegate.cpp \
+    src/Diagnostics.cpp \
+    src/IpcProtocol.cpp \
+    src/HistoryServer.cpp \
+    src/HistoryClient.cpp \
+    src/ThumbnailCache.cpp \
+    src/ImageHashIndex.cpp \
+    src/SimHashIndex.cpp \
+    src/IngestionFilter.cpp \
+    src/SecretScanner.cpp \
+    src/HistoryLog.cpp \
+    src/HistoryArchive.cpp \
+    src/TimestampIndex.cpp \
+    src/RelativeTimeClock.cpp \
+    src/StallWatchdog.cpp \
+    src/HtmlText.cpp \
+    src/EntryViewer.cpp \
+    src/SyntaxHighlighter.cpp \
+    src/HighlightCache.cpp \
+    src/HistoryTransfer.cpp
 
 # Header files
 HEADERS += \
@@ -29,7 +50,28 @@ HEADERS += \
     src/SystemTrayManager.h \
     src/ClipboardItem.h \
     src/ClipboardHistoryWidget.h \
-    src/TrayPopupWidget.h
+    src/TrayPopupWidget.h \
+    src/FuzzyMatcher.h \
+    src/ClipboardItemDelegate.h \
+    src/Diagnostics.h \
+    src/IpcProtocol.h \
+    src/HistoryServer.h \
+    src/HistoryClient.h \
+    src/ThumbnailCache.h \
+    src/ImageHashIndex.h \
+    src/SimHashIndex.h \
+    src/IngestionFilter.h \
+    src/SecretScanner.h \
+    src/HistoryLog.h \
+    src/HistoryArchive.h \
+    src/TimestampIndex.h \
+    src/RelativeTimeClock.h \
+    src/StallWatchdog.h \
+    src/HtmlText.h \
+    src/EntryViewer.h \
+    src/SyntaxHighlighter.h \
+    src/HighlightCache.h \
+    src/HistoryTransfer.h
 
 # Resources
 RESOURCES += resources/resources.qrc
@@ -0,0 +1,27 @@
+QT += core network
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = clipctl
+TEMPLATE = app
+
+# Command-line client for the local query API of ClipboardManager
+SOURCES += \
+    src/clipctl.cpp \
+    src/IpcProtocol.cpp
+
+HEADERS += \
+    src/IpcProtocol.h
+
+# Include directory
+INCLUDEPATH += src
+
+unix:!macx {
+    target.path = /usr/local/bin
+    INSTALLS += target
+}
+
+# Compiler flags
+QMAKE_CXXFLAGS += -Wall -Wextra
@@ -1,34 +1,93 @@
 #include "ClipboardHistoryWidget.h"
+#include "ClipboardItemDelegate.h"
+#include "HighlightCache.h"
+#include "RelativeTimeClock.h"
+#include "StallWatchdog.h"
+#include "ThumbnailCache.h"
 #include <QMenu>
 #include <QApplication>
 #include <QClipboard>
+#include <QCursor>
+#include <QFileDialog>
+#include <QLocale>
 #include <QMessageBox>
+#include <QShortcut>
+#include <QToolTip>
+
+namespace {
+// Ranked searches only fully score and sort this many results
+const int kMaxSearchResults = 500;
+
+const int kSectionCount = 4;
+const char* const kSectionNames[kSectionCount] = {"Today", "Yesterday", "This Week", "Earlier"};
+}
 
 ClipboardHistoryWidget::ClipboardHistoryWidget(QWidget* parent)
     : QWidget(parent)
     , m_clipboardManager(nullptr)
+    , m_resultCount(0)
+    , m_dayTimer(new QTimer(this))
 {
     setupUI();
     applyMacStyle();
+    
+    // Sections move at midnight; the timer only runs while shown
+    m_dayTimer->setSingleShot(true);
+    m_dayTimer->setTimerType(Qt::VeryCoarseTimer);
+    connect(m_dayTimer, &QTimer::timeout, this, &ClipboardHistoryWidget::onDayChanged);
+    updateSectionStarts();
+}
+
+void ClipboardHistoryWidget::showEvent(QShowEvent* event)
+{
+    QWidget::showEvent(event);
+    
+    // Midnight may have passed while hidden
+    const std::array<qint64, 3> sectionStarts = m_sectionStarts;
+    updateSectionStarts();
+    if (m_sectionStarts != sectionStarts) {
+        updateHistoryList();
+    }
+}
+
+void ClipboardHistoryWidget::hideEvent(QHideEvent* event)
+{
+    QWidget::hideEvent(event);
+    m_dayTimer->stop();
 }
 
 void ClipboardHistoryWidget::setClipboardManager(ClipboardManager* manager)
 {
     if (m_clipboardManager) {
         disconnect(m_clipboardManager, nullptr, this, nullptr);
+        disconnect(m_clipboardManager->thumbnailCache(), nullptr, m_historyList->viewport(), nullptr);
+        disconnect(m_clipboardManager->highlightCache(), nullptr, m_historyList->viewport(), nullptr);
     }
     
     m_clipboardManager = manager;
     
+    ClipboardItemDelegate* delegate = static_cast<ClipboardItemDelegate*>(m_historyList->itemDelegate());
+    delegate->setThumbnailCache(m_clipboardManager ? m_clipboardManager->thumbnailCache() : nullptr);
+    delegate->setHighlightCache(m_clipboardManager ? m_clipboardManager->highlightCache() : nullptr);
+    
     if (m_clipboardManager) {
         connect(m_clipboardManager, &ClipboardManager::historyChanged,
                 this, &ClipboardHistoryWidget::onHistoryChanged);
+        connect(m_clipboardManager->thumbnailCache(), &ThumbnailCache::thumbnailReady,
+                m_historyList->viewport(), QOverload<>::of(&QWidget::update));
+        connect(m_clipboardManager->highlightCache(), &HighlightCache::highlightReady,
+                m_historyList->viewport(), QOverload<>::of(&QWidget::update));
         
         updateHistoryList();
         updateStats();
     }
 }
 
+Diagnostics::PaintStats ClipboardHistoryWidget::measureScrollPaint()
+{
+    return Diagnostics::measureScrollPaint(m_historyList);
+}
+
 void ClipboardHistoryWidget::setupUI()
 {
     m_mainLayout = new QVBoxLayout(this);
@@ -61,26 +120,44 @@ void ClipboardHistoryWidget::setupUI()
     m_historyList = new QListWidget();
     m_historyList->setObjectName("historyList");
     m_historyList->setAlternatingRowColors(true);
+    m_historyList->setUniformItemSizes(true);
     m_historyList->setSelectionMode(QAbstractItemView::ExtendedSelection);
     m_historyList->setContextMenuPolicy(Qt::CustomContextMenu);
+    ClipboardItemDelegate* delegate = new ClipboardItemDelegate(m_historyList);
+    m_historyList->setItemDelegate(delegate);
+    
+    // Relative times are repainted when one of the visible labels changes
+    RelativeTimeClock::instance()->watch(m_historyList->viewport());
+    connect(delegate, &ClipboardItemDelegate::clusterToggled, this, &ClipboardHistoryWidget::onClusterToggled);
     
     connect(m_historyList, &QListWidget::itemClicked, this, &ClipboardHistoryWidget::onItemClicked);
     connect(m_historyList, &QListWidget::itemDoubleClicked, this, &ClipboardHistoryWidget::onItemDoubleClicked);
+    connect(m_historyList, &QListWidget::currentItemChanged, this, &ClipboardHistoryWidget::onCurrentItemChanged);
     connect(m_historyList, &QListWidget::customContextMenuRequested,
             this, &ClipboardHistoryWidget::showItemContextMenu);
     
+    QShortcut* removeShortcut = new QShortcut(QKeySequence::Delete, m_historyList, nullptr, nullptr,
+                                              Qt::WidgetShortcut);
+    connect(removeShortcut, &QShortcut::activated, this, &ClipboardHistoryWidget::removeSelectedItems);
+    
     // Stats and controls layout
     m_statsLayout = new QHBoxLayout();
     
     m_statsLabel = new QLabel("0 items");
     m_statsLabel->setObjectName("statsLabel");
     
+    m_groupCheck = new QCheckBox("Group similar");
+    m_groupCheck->setObjectName("groupCheck");
+    m_groupCheck->setChecked(true);
+    connect(m_groupCheck, &QCheckBox::toggled, this, &ClipboardHistoryWidget::onFilterChanged);
+    
     m_clearButton = new QPushButton("Clear History");
     m_clearButton->setObjectName("clearButton");
     connect(m_clearButton, &QPushButton::clicked, this, &ClipboardHistoryWidget::onClearHistoryClicked);
     
     m_statsLayout->addWidget(m_statsLabel);
     m_statsLayout->addStretch();
+    m_statsLayout->addWidget(m_groupCheck);
     m_statsLayout->addWidget(m_clearButton);
     
     // Add to main layout
@@ -135,28 +212,7 @@ void ClipboardHistoryWidget::applyMacStyle()
             padding: 4px;
         }
         
-        QListWidget#historyList::item {
-            border: none;
-            border-radius: 6px;
-            padding: 12px;
-            margin: 2px;
-            min-height: 40px;
-        }
-        
-        QListWidget#historyList::item:hover {
-            background-color: rgba(0, 122, 255, 0.1);
-        }
-        
-        QListWidget#historyList::item:selected {
-            background-color: rgba(0, 122, 255, 0.2);
-            color: black;
-        }
-        
-        QListWidget#historyList::item:alternate {
-            background-color: rgba(0, 0, 0, 0.02);
-        }
-        
-        QLabel#statsLabel {
+        QLabel#statsLabel, QCheckBox#groupCheck {
             color: #666;
             font-size: 13px;
         }
@@ -195,7 +251,7 @@ void ClipboardHistoryWidget::onItemClicked(QListWidgetItem* item)
 {
     if (!item || !m_clipboardManager) return;
     
-    int index = item->data(Qt::UserRole).toInt();
+    const int index = m_clipboardManager->indexOf(item->data(ClipboardItemDelegate::ItemIdRole).toULongLong());
     const QList<ClipboardItem>& history = m_clipboardManager->history();
     
     if (index >= 0 && index < history.size()) {
@@ -203,21 +259,27 @@ void ClipboardHistoryWidget::onItemClicked(QListWidgetItem* item)
     }
 }
 
+void ClipboardHistoryWidget::onCurrentItemChanged(QListWidgetItem* current)
+{
+    // Rebuilding the list clears the current row; that is not a new choice
+    const quint64 id = current ? current->data(ClipboardItemDelegate::ItemIdRole).toULongLong() : 0;
+    if (id != 0) {
+        emit currentItemChanged(id);
+    }
+}
+
 void ClipboardHistoryWidget::onItemDoubleClicked(QListWidgetItem* item)
 {
     if (!item || !m_clipboardManager) return;
     
-    int index = item->data(Qt::UserRole).toInt();
+    const int index = m_clipboardManager->indexOf(item->data(ClipboardItemDelegate::ItemIdRole).toULongLong());
     const QList<ClipboardItem>& history = m_clipboardManager->history();
     
     if (index >= 0 && index < history.size()) {
-        history[index].copyToClipboard();
+        m_clipboardManager->copyToClipboard(index);
         
-        // Show feedback
-        m_historyList->setToolTip("Copied to clipboard!");
-        QTimer::singleShot(1000, [this]() {
-            m_historyList->setToolTip("");
-        });
+        // Show feedback; the tooltip times itself out and goes away with the window
+        QToolTip::showText(QCursor::pos(), "Copied to clipboard!", m_historyList, QRect(), 1000);
     }
 }
 
@@ -249,49 +311,239 @@ void ClipboardHistoryWidget::showItemContextMenu(const QPoint& position)
     QListWidgetItem* item = m_historyList->itemAt(position);
     if (!item || !m_clipboardManager) return;
     
-    int index = item->data(Qt::UserRole).toInt();
+    const int index = m_clipboardManager->indexOf(item->data(ClipboardItemDelegate::ItemIdRole).toULongLong());
     const QList<ClipboardItem>& history = m_clipboardManager->history();
     
     if (index < 0 || index >= history.size()) return;
     
+    // Inside the selection the menu acts on all of it, elsewhere on the
+    // clicked item alone
+    const QSet<quint64> ids = item->isSelected() ? selectedIds() : QSet<quint64>{history[index].id()};
+    const bool multiple = ids.size() > 1;
+    const QString count = multiple ? QString(" %1 Items").arg(ids.size()) : QString();
+    bool allPinned = true;
+    for (const quint64 id : ids) {
+        const int selected = m_clipboardManager->indexOf(id);
+        allPinned = allPinned && selected >= 0 && history[selected].isPinned();
+    }
+    
     QMenu contextMenu(this);
     
-    QAction* copyAction = contextMenu.addAction("Copy to Clipboard");
-    copyAction->setIcon(QApplication::style()->standardIcon(QStyle::SP_DialogApplyButton));
+    QAction* copyAction = nullptr;
+    QAction* clusterAction = nullptr;
+    if (!multiple) {
+        copyAction = contextMenu.addAction("Copy to Clipboard");
+        copyAction->setIcon(QApplication::style()->standardIcon(QStyle::SP_DialogApplyButton));
+        
+        const int similar = item->data(ClipboardItemDelegate::SimilarCountRole).toInt();
+        if (similar > 0) {
+            clusterAction = contextMenu.addAction(item->data(ClipboardItemDelegate::ExpandedRole).toBool()
+                                                  ? "Hide Similar Items"
+                                                  : QString("Show %1 Similar Item%2").arg(similar).arg(similar == 1 ? "" : "s"));
+        }
+        contextMenu.addSeparator();
+    }
+    
+    QAction* pinAction = contextMenu.addAction((allPinned ? "Unpin" : "Pin") + count);
+    QAction* mergeAction = multiple ? contextMenu.addAction("Merge" + count) : nullptr;
+    QAction* exportAction = contextMenu.addAction("Export" + count + "...");
     
     contextMenu.addSeparator();
     
-    QAction* removeAction = contextMenu.addAction("Remove");
+    QAction* removeAction = contextMenu.addAction("Remove" + count);
     removeAction->setIcon(QApplication::style()->standardIcon(QStyle::SP_TrashIcon));
     
     QAction* selectedAction = contextMenu.exec(m_historyList->mapToGlobal(position));
+    if (!selectedAction) {
+        return;
+    }
     
     if (selectedAction == copyAction) {
-        history[index].copyToClipboard();
+        m_clipboardManager->copyToClipboard(index);
     } else if (selectedAction == removeAction) {
-        m_clipboardManager->removeItem(index);
+        m_clipboardManager->removeItems(ids);
+    } else if (selectedAction == pinAction) {
+        m_clipboardManager->setPinned(ids, !allPinned);
+    } else if (selectedAction == mergeAction) {
+        m_clipboardManager->mergeItems(ids);
+    } else if (selectedAction == exportAction) {
+        const QString path = QFileDialog::getSaveFileName(this, "Export Items", "clipboard.txt",
+                                                          "Text files (*.txt);;All files (*)");
+        if (!path.isEmpty() && m_clipboardManager->exportItems(ids, path) < 0) {
+            QMessageBox::warning(this, "Export Items", "Cannot write " + path);
+        }
+    } else if (selectedAction == clusterAction) {
+        onClusterToggled(history[index].id());
+    }
+}
+
+void ClipboardHistoryWidget::removeSelectedItems()
+{
+    if (m_clipboardManager) {
+        m_clipboardManager->removeItems(selectedIds());
     }
 }
 
+QSet<quint64> ClipboardHistoryWidget::selectedIds() const
+{
+    // Headings and placeholders carry no id
+    QSet<quint64> ids;
+    const QList<QListWidgetItem*> selected = m_historyList->selectedItems();
+    ids.reserve(selected.size());
+    for (const QListWidgetItem* item : selected) {
+        const quint64 id = item->data(ClipboardItemDelegate::ItemIdRole).toULongLong();
+        if (id != 0) {
+            ids.insert(id);
+        }
+    }
+    return ids;
+}
+
+void ClipboardHistoryWidget::onClusterToggled(quint64 id)
+{
+    const int index = m_clipboardManager ? m_clipboardManager->indexOf(id) : -1;
+    if (index < 0) {
+        return;
+    }
+    
+    const quint64 clusterId = m_clipboardManager->history()[index].clusterId();
+    if (!m_expandedClusters.remove(clusterId)) {
+        m_expandedClusters.insert(clusterId);
+    }
+    
+    updateHistoryList();
+}
+
+void ClipboardHistoryWidget::onDayChanged()
+{
+    updateSectionStarts();
+    updateHistoryList();
+}
+
+void ClipboardHistoryWidget::updateSectionStarts()
+{
+    const QDate today = QDate::currentDate();
+    const QDate yesterday = today.addDays(-1);
+    const int daysIntoWeek = (today.dayOfWeek() - QLocale().firstDayOfWeek() + 7) % 7;
+    const QDate weekStart = qMin(today.addDays(-daysIntoWeek), yesterday);
+    
+    m_sectionStarts = {today.startOfDay().toMSecsSinceEpoch(), yesterday.startOfDay().toMSecsSinceEpoch(),
+                       weekStart.startOfDay().toMSecsSinceEpoch()};
+    if (!isVisible()) {
+        return;
+    }
+    m_dayTimer->start(static_cast<int>(qMax<qint64>(1000, QDateTime::currentDateTime().msecsTo(
+                                                                today.addDays(1).startOfDay()))));
+}
+
 void ClipboardHistoryWidget::updateHistoryList()
 {
     if (!m_clipboardManager) return;
     
-    const QList<ClipboardItem> items = getFilteredItems();
-    updateHistoryList(items);
+    const QList<ClipboardManager::SearchResult> results = getFilteredResults();
+    updateHistoryList(results);
 }
 
-void ClipboardHistoryWidget::updateHistoryList(const QList<ClipboardItem>& items)
+void ClipboardHistoryWidget::updateHistoryList(const QList<ClipboardManager::SearchResult>& results)
 {
-    m_historyList->clear();
+    StallWatchdog::Scope scope("updateHistoryList", results.size());
+    m_resultCount = results.size();
+    
+    // Rows are keyed by item id, so rows that are still shown are reused and
+    // only new items pay for building a row. Taking from the end keeps this
+    // linear in the number of rows.
+    QHash<quint64, QListWidgetItem*> rows;
+    rows.reserve(m_historyList->count());
+    while (m_historyList->count() > 0) {
+        QListWidgetItem* row = m_historyList->takeItem(m_historyList->count() - 1);
+        const quint64 id = row->data(ClipboardItemDelegate::ItemIdRole).toULongLong();
+        if (id != 0) {
+            rows.insert(id, row);
+        } else {
+            delete row;
+        }
+    }
     
-    for (int i = 0; i < items.size(); ++i) {
-        const ClipboardItem& item = items[i];
-        QListWidgetItem* listItem = createHistoryItem(item, i);
-        m_historyList->addItem(listItem);
+    const QList<ClipboardItem>& history = m_clipboardManager->history();
+    const auto rowFor = [&](const ClipboardItem& clipboardItem, const ClipboardManager::SearchResult& result) {
+        QListWidgetItem* row = rows.take(clipboardItem.id());
+        if (!row) {
+            row = createHistoryItem(clipboardItem);
+        }
+        updateHistoryItem(row, clipboardItem, result);
+        return row;
+    };
+    
+    // Browsing groups rows by their own capture time, so pinned or imported
+    // items whose position doesn't follow it land under the right heading
+    // instead of repeating one. Matches are ranked by score and not sectioned.
+    const bool sectioned = m_searchEdit->text().trimmed().isEmpty() && !results.isEmpty();
+    std::array<QList<QListWidgetItem*>, kSectionCount> sections;
+    const auto sectionOf = [&](const ClipboardItem& clipboardItem) {
+        const qint64 msecs = clipboardItem.timestamp().toMSecsSinceEpoch();
+        int section = 0;
+        while (sectioned && section < int(m_sectionStarts.size()) && msecs < m_sectionStarts[section]) {
+            ++section;
+        }
+        return section;
+    };
+    
+    if (!m_groupCheck->isChecked()) {
+        for (const ClipboardManager::SearchResult& result : results) {
+            const ClipboardItem& item = history[result.index];
+            sections[sectionOf(item)].append(rowFor(item, result));
+        }
+    } else {
+        // Each cluster is shown at its best-ranked result, members listed
+        // below it only when expanded
+        QHash<quint64, int> groupOf;
+        QList<QList<int>> groups;
+        for (int i = 0; i < results.size(); ++i) {
+            const ClipboardItem& item = history[results[i].index];
+            const quint64 clusterId = item.clusterId() ? item.clusterId() : item.id();
+            const auto it = groupOf.constFind(clusterId);
+            if (it == groupOf.constEnd()) {
+                groupOf.insert(clusterId, groups.size());
+                groups.append(QList<int>{i});
+            } else {
+                groups[it.value()].append(i);
+            }
+        }
+        
+        for (const QList<int>& group : groups) {
+            const ClipboardManager::SearchResult& first = results[group.first()];
+            const ClipboardItem& head = history[first.index];
+            const bool expanded = group.size() > 1 && m_expandedClusters.contains(head.clusterId());
+            
+            QList<QListWidgetItem*>& section = sections[sectionOf(head)];
+            QListWidgetItem* listItem = rowFor(head, first);
+            listItem->setData(ClipboardItemDelegate::SimilarCountRole, group.size() - 1);
+            listItem->setData(ClipboardItemDelegate::ExpandedRole, expanded);
+            section.append(listItem);
+            
+            for (int i = 1; expanded && i < group.size(); ++i) {
+                const ClipboardManager::SearchResult& result = results[group[i]];
+                QListWidgetItem* memberItem = rowFor(history[result.index], result);
+                memberItem->setData(ClipboardItemDelegate::ClusterMemberRole, true);
+                section.append(memberItem);
+            }
+        }
+    }
+    qDeleteAll(rows);
+    
+    for (int i = 0; i < kSectionCount; ++i) {
+        if (sectioned && !sections[i].isEmpty()) {
+            QListWidgetItem* header = new QListWidgetItem(kSectionNames[i]);
+            header->setFlags(Qt::NoItemFlags);
+            header->setData(ClipboardItemDelegate::SectionHeaderRole, true);
+            m_historyList->addItem(header);
+        }
+        for (QListWidgetItem* row : sections[i]) {
+            m_historyList->addItem(row);
+        }
     }
     
-    if (items.isEmpty()) {
+    if (results.isEmpty()) {
         QListWidgetItem* emptyItem = new QListWidgetItem("No clipboard items match your search");
         emptyItem->setFlags(Qt::NoItemFlags);
         emptyItem->setTextAlignment(Qt::AlignCenter);
@@ -307,7 +559,7 @@ void ClipboardHistoryWidget::updateStats()
     }
     
     const int totalItems = m_clipboardManager->itemCount();
-    const int filteredItems = getFilteredItems().size();
+    const int filteredItems = m_resultCount;
     
     if (m_searchEdit->text().isEmpty() && m_filterCombo->currentData().toInt() == -1) {
         m_statsLabel->setText(QString("%1 item%2").arg(totalItems).arg(totalItems == 1 ? "" : "s"));
@@ -316,49 +568,50 @@ void ClipboardHistoryWidget::updateStats()
     }
 }
 
-QListWidgetItem* ClipboardHistoryWidget::createHistoryItem(const ClipboardItem& clipboardItem, int index)
+QListWidgetItem* ClipboardHistoryWidget::createHistoryItem(const ClipboardItem& clipboardItem)
 {
     QListWidgetItem* item = new QListWidgetItem();
     
-    // Set main text
-    QString mainText = clipboardItem.preview();
-    
-    // Add type and timestamp info
-    QString subtitle = QString("%1 • %2")
-                      .arg(clipboardItem.typeString())
-                      .arg(clipboardItem.formattedTimestamp());
-    
-    QString displayText = QString("%1\n%2").arg(mainText).arg(subtitle);
-    
-    item->setText(displayText);
+    // The delegate lays out preview, type and relative time at paint time
+    item->setText(clipboardItem.preview());
     item->setIcon(clipboardItem.icon());
-    item->setData(Qt::UserRole, index); // Store index for reference
-    item->setToolTip(QString("Double-click to copy\nOriginal: %1").arg(clipboardItem.text()));
+    item->setData(ClipboardItemDelegate::ItemIdRole, clipboardItem.id());
+    item->setData(ClipboardItemDelegate::TypeRole, clipboardItem.typeString());
+    item->setData(ClipboardItemDelegate::TimestampRole, clipboardItem.timestamp().toMSecsSinceEpoch());
+    if (clipboardItem.type() == ClipboardItem::Code) {
+        item->setData(ClipboardItemDelegate::CodeTextRole, clipboardItem.text());
+    }
+    const QString text = clipboardItem.text();
+    const int toolTipLength = ClipboardItemDelegate::kToolTipLength;
+    item->setToolTip(QString("Double-click to copy\nOriginal: %1")
+                         .arg(text.size() > toolTipLength ? text.left(toolTipLength) + "..." : text));
     
     return item;
 }
 
-QList<ClipboardItem> ClipboardHistoryWidget::getFilteredItems() const
+void ClipboardHistoryWidget::updateHistoryItem(QListWidgetItem* item, const ClipboardItem& clipboardItem,
+                                               const ClipboardManager::SearchResult& result)
+{
+    item->setData(ClipboardItemDelegate::MatchPositionsRole, QVariant::fromValue(result.positions));
+    item->setData(ClipboardItemDelegate::PinnedRole, clipboardItem.isPinned());
+    item->setData(ClipboardItemDelegate::SimilarCountRole, QVariant());
+    item->setData(ClipboardItemDelegate::ExpandedRole, QVariant());
+    item->setData(ClipboardItemDelegate::ClusterMemberRole, QVariant());
+    if (clipboardItem.type() == ClipboardItem::Image) {
+        item->setData(ClipboardItemDelegate::ImageDataRole, clipboardItem.imageData());
+    }
+}
+
+QList<ClipboardManager::SearchResult> ClipboardHistoryWidget::getFilteredResults() const
 {
     if (!m_clipboardManager) {
-        return QList<ClipboardItem>();
+        return QList<ClipboardManager::SearchResult>();
     }
     
-    // Start with search results
     const QString searchText = m_searchEdit->text();
-    QList<ClipboardItem> items = m_clipboardManager->search(searchText);
-    
-    // Apply type filter
     const int filterType = m_filterCombo->currentData().toInt();
-    if (filterType != -1) {
-        QList<ClipboardItem> filteredItems;
-        for (const ClipboardItem& item : items) {
-            if (item.type() == static_cast<ClipboardItem::ItemType>(filterType)) {
-                filteredItems.append(item);
-            }
-        }
-        items = filteredItems;
-    }
     
-    return items;
+    // Browsing shows everything; a query only keeps the best matches
+    const int limit = searchText.trimmed().isEmpty() ? m_clipboardManager->itemCount() : kMaxSearchResults;
+    return m_clipboardManager->rankedSearch(searchText, limit, filterType);
 }
\ No newline at end of file
@@ -9,7 +9,12 @@
 #include <QPushButton>
 #include <QLabel>
 #include <QComboBox>
+#include <QCheckBox>
+#include <QSet>
+#include <QTimer>
+#include <array>
 #include "ClipboardManager.h"
+#include "Diagnostics.h"
 
 class ClipboardHistoryWidget : public QWidget
 {
@@ -19,15 +24,28 @@ public:
     explicit ClipboardHistoryWidget(QWidget* parent = nullptr);
     
     void setClipboardManager(ClipboardManager* manager);
+    Diagnostics::PaintStats measureScrollPaint();
+    
+signals:
+    // The user moved to another item, e.g. to show it in full
+    void currentItemChanged(quint64 id);
+    
+protected:
+    void showEvent(QShowEvent* event) override;
+    void hideEvent(QHideEvent* event) override;
     
 private slots:
     void onSearchTextChanged();
     void onFilterChanged();
     void onItemClicked(QListWidgetItem* item);
+    void onCurrentItemChanged(QListWidgetItem* current);
     void onItemDoubleClicked(QListWidgetItem* item);
     void onClearHistoryClicked();
     void onHistoryChanged();
     void showItemContextMenu(const QPoint& position);
+    void removeSelectedItems();
+    void onClusterToggled(quint64 id);
+    void onDayChanged();
     
 private:
     ClipboardManager* m_clipboardManager;
@@ -41,15 +59,28 @@ private:
     QComboBox* m_filterCombo;
     QListWidget* m_historyList;
     QLabel* m_statsLabel;
+    QCheckBox* m_groupCheck;
     QPushButton* m_clearButton;
     
+    int m_resultCount;
+    QSet<quint64> m_expandedClusters;
+    
+    // Browsing groups rows under Today / Yesterday / This Week / Earlier;
+    // these are where the first three start, in epoch ms
+    std::array<qint64, 3> m_sectionStarts;
+    QTimer* m_dayTimer;
+    
     void setupUI();
     void applyMacStyle();
     void updateHistoryList();
-    void updateHistoryList(const QList<ClipboardItem>& items);
+    void updateHistoryList(const QList<ClipboardManager::SearchResult>& results);
     void updateStats();
-    QListWidgetItem* createHistoryItem(const ClipboardItem& clipboardItem, int index);
-    QList<ClipboardItem> getFilteredItems() const;
+    void updateSectionStarts();
+    QListWidgetItem* createHistoryItem(const ClipboardItem& clipboardItem);
+    void updateHistoryItem(QListWidgetItem* item, const ClipboardItem& clipboardItem,
+                           const ClipboardManager::SearchResult& result);
+    QList<ClipboardManager::SearchResult> getFilteredResults() const;
+    QSet<quint64> selectedIds() const;
 };
 
 #endif // CLIPBOARDHISTORYWIDGET_H
\ No newline at end of file
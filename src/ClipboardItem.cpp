@@ -1,24 +1,78 @@
 #include "ClipboardItem.h"
+#include "HtmlText.h"
+#include "SimHashIndex.h"
 #include <QApplication>
+#include <QGuiApplication>
 #include <QClipboard>
 #include <QMimeData>
 #include <QUrl>
 #include <QRegularExpression>
 #include <QPainter>
 #include <QStyle>
+#include <QHash>
+#include <QBuffer>
+#include <QImageReader>
+#include <QStringDecoder>
 
-ClipboardItem::ClipboardItem(const QMimeData* mimeData)
-    : m_timestamp(QDateTime::currentDateTime())
+namespace {
+// Markup up to this long is converted right away, in well under a
+// millisecond; longer markup goes to ClipboardManager's ingestion worker
+const int kInlineExtractLength = 64 * 1024;
+
+// Reads only the image header, without decoding any pixels
+QSize encodedImageSize(const QByteArray& imageData)
+{
+    QBuffer buffer;
+    buffer.setData(imageData);
+    buffer.open(QIODevice::ReadOnly);
+    return QImageReader(&buffer).size();
+}
+}
+
+ClipboardItem::ClipboardItem()
+    : m_id(0), m_type(Text), m_fingerprint(0), m_clusterId(0), m_useCount(0), m_frecency(0.0), m_pinned(false)
+{
+}
+
+ClipboardItem::ClipboardItem(const QMimeData* mimeData, const QString& format, const QByteArray& data)
+    : m_id(0)
+    , m_timestamp(QDateTime::currentDateTime())
+    , m_fingerprint(0)
+    , m_clusterId(0)
+    , m_useCount(0)
+    , m_frecency(0.0)
+    , m_pinned(false)
 {
     if (mimeData->hasImage()) {
-        m_image = qvariant_cast<QPixmap>(mimeData->imageData());
+        // Keep the source's own PNG bytes when it offers them
+        if (mimeData->hasFormat("image/png")) {
+            const QByteArray imageData = format == "image/png" ? data : mimeData->data("image/png");
+            m_imageSize = encodedImageSize(imageData);
+            if (m_imageSize.isValid()) {
+                m_imageData = imageData;
+            }
+        }
+        if (m_imageData.isEmpty()) {
+            m_pendingImage = qvariant_cast<QImage>(mimeData->imageData());
+            m_imageSize = m_pendingImage.size();
+        }
         m_type = Image;
-        m_text = QString("Image (%1x%2)").arg(m_image.width()).arg(m_image.height());
+        m_text = QString("Image (%1x%2)").arg(m_imageSize.width()).arg(m_imageSize.height());
     } else if (mimeData->hasHtml()) {
-        m_text = mimeData->html();
+        // HTML may arrive as UTF-16 with a BOM, or declare its charset
+        if (format == "text/html" && !data.isEmpty()) {
+            QStringDecoder decoder = QStringDecoder::decoderForHtml(data);
+            m_html = decoder.isValid() ? decoder.decode(data) : QString::fromUtf8(data);
+        } else {
+            m_html = mimeData->html();
+        }
         m_type = Html;
+        if (m_html.size() <= kInlineExtractLength) {
+            m_text = HtmlText::toPlainText(m_html);
+            determineMarkupType();
+        }
     } else if (mimeData->hasText()) {
-        m_text = mimeData->text();
+        m_text = format == "text/plain" && !data.isEmpty() ? QString::fromUtf8(data) : mimeData->text();
         determineType();
     } else {
         m_text = "Unknown format";
@@ -26,17 +80,38 @@ ClipboardItem::ClipboardItem(const QMimeData* mimeData)
     }
     
     generatePreview();
-    loadIcon();
+    if (m_type != Image) {
+        m_fingerprint = SimHashIndex::fingerprint(m_text);
+    }
 }
 
 ClipboardItem::ClipboardItem(const QString& text, ItemType type)
-    : m_text(text), m_type(type), m_timestamp(QDateTime::currentDateTime())
+    : m_id(0), m_text(text), m_type(type), m_timestamp(QDateTime::currentDateTime())
+    , m_fingerprint(0), m_clusterId(0), m_useCount(0), m_frecency(0.0), m_pinned(false)
 {
     if (type == Text) {
         determineType();
+    } else if (type == Html) {
+        m_html = text;
+        m_text = HtmlText::toPlainText(m_html);
+        determineMarkupType();
     }
     generatePreview();
-    loadIcon();
+    if (m_type != Image) {
+        m_fingerprint = SimHashIndex::fingerprint(m_text);
+    }
+}
+
+ClipboardItem ClipboardItem::fromImageData(const QByteArray& imageData)
+{
+    ClipboardItem item;
+    item.m_type = Image;
+    item.m_timestamp = QDateTime::currentDateTime();
+    item.m_imageData = imageData;
+    item.m_imageSize = encodedImageSize(imageData);
+    item.m_text = QString("Image (%1x%2)").arg(item.m_imageSize.width()).arg(item.m_imageSize.height());
+    item.generatePreview();
+    return item;
 }
 
 QString ClipboardItem::typeString() const
@@ -54,8 +129,17 @@ QString ClipboardItem::typeString() const
 
 QString ClipboardItem::formattedTimestamp() const
 {
-    const QDateTime now = QDateTime::currentDateTime();
-    const qint64 secondsAgo = m_timestamp.secsTo(now);
+    return formatRelativeTime(m_timestamp, QDateTime::currentDateTime());
+}
+
+QString ClipboardItem::formatRelativeTime(const QDateTime& timestamp, const QDateTime& now)
+{
+    return formatRelativeTime(timestamp.toMSecsSinceEpoch(), now.toMSecsSinceEpoch());
+}
+
+QString ClipboardItem::formatRelativeTime(qint64 timestampMsecs, qint64 nowMsecs)
+{
+    const qint64 secondsAgo = (nowMsecs - timestampMsecs) / 1000;
     
     if (secondsAgo < 60) {
         return "Just now";
@@ -66,23 +150,113 @@ QString ClipboardItem::formattedTimestamp() const
         const int hours = secondsAgo / 3600;
         return QString("%1 hour%2 ago").arg(hours).arg(hours == 1 ? "" : "s");
     } else {
-        return m_timestamp.toString("MMM dd, hh:mm");
+        return QDateTime::fromMSecsSinceEpoch(timestampMsecs).toString("MMM dd, hh:mm");
+    }
+}
+
+qint64 ClipboardItem::relativeTimeChangesAt(qint64 timestampMsecs, qint64 nowMsecs)
+{
+    const qint64 age = nowMsecs - timestampMsecs;
+    if (age < 60 * 1000) {
+        return timestampMsecs + 60 * 1000;
     }
+    
+    // The next whole minute, or hour, of age
+    const qint64 step = age < 3600 * 1000 ? 60 * 1000 : age < 86400 * 1000 ? 3600 * 1000 : 0;
+    return step > 0 ? timestampMsecs + (age / step + 1) * step : -1;
 }
 
 void ClipboardItem::copyToClipboard() const
 {
-    QClipboard* clipboard = QApplication::clipboard();
-    if (m_type == Image && !m_image.isNull()) {
-        clipboard->setPixmap(m_image);
+    QClipboard* clipboard = QGuiApplication::clipboard();
+    if (m_type == Image && hasImage()) {
+        // Also offer the stored PNG, so other apps and our own capture get
+        // the exact bytes back
+        QMimeData* mimeData = new QMimeData();
+        mimeData->setImageData(image());
+        if (!m_imageData.isEmpty()) {
+            mimeData->setData("image/png", m_imageData);
+        }
+        clipboard->setMimeData(mimeData);
+    } else if (!m_html.isEmpty()) {
+        QMimeData* mimeData = new QMimeData();
+        mimeData->setHtml(m_html);
+        mimeData->setText(m_text);
+        clipboard->setMimeData(mimeData);
     } else {
         clipboard->setText(m_text);
     }
 }
 
+void ClipboardItem::setImageData(const QByteArray& imageData)
+{
+    m_imageData = imageData;
+    m_pendingImage = QImage();
+}
+
+QImage ClipboardItem::image() const
+{
+    if (!m_pendingImage.isNull()) {
+        return m_pendingImage;
+    }
+    return QImage::fromData(m_imageData);
+}
+
+QByteArray ClipboardItem::encodedImage() const
+{
+    if (!m_imageData.isEmpty() || m_pendingImage.isNull()) {
+        return m_imageData;
+    }
+    
+    QByteArray imageData;
+    QBuffer buffer(&imageData);
+    buffer.open(QIODevice::WriteOnly);
+    m_pendingImage.save(&buffer, "PNG");
+    return imageData;
+}
+
+void ClipboardItem::setExtractedText(const QString& text)
+{
+    m_text = text;
+    determineMarkupType();
+    generatePreview();
+    m_fingerprint = SimHashIndex::fingerprint(m_text);
+}
+
+void ClipboardItem::replaceText(const QString& text)
+{
+    m_html.clear();
+    m_text = text;
+    generatePreview();
+    m_fingerprint = SimHashIndex::fingerprint(m_text);
+}
+
+void ClipboardItem::setUsage(int useCount, double frecency)
+{
+    m_useCount = useCount;
+    m_frecency = frecency;
+}
+
 bool ClipboardItem::operator==(const ClipboardItem& other) const
 {
-    return m_text == other.m_text && m_type == other.m_type;
+    if (m_type != other.m_type) {
+        return false;
+    }
+    
+    // The markup decides for HTML; its text may not be extracted yet
+    if (!m_html.isEmpty() || !other.m_html.isEmpty()) {
+        return m_html == other.m_html;
+    }
+    if (m_text != other.m_text) {
+        return false;
+    }
+    
+    // Image text is only "Image (WxH)"; compare the encoded bytes. Images
+    // still waiting to be encoded are caught by the perceptual hash instead.
+    if (m_type == Image) {
+        return !m_imageData.isEmpty() && m_imageData == other.m_imageData;
+    }
+    return true;
 }
 
 void ClipboardItem::determineType()
@@ -112,21 +286,40 @@ void ClipboardItem::determineType()
     m_type = Text;
 }
 
+void ClipboardItem::determineMarkupType()
+{
+    // Markup is typed by its visible text, so a copied link or code block is
+    // a Url or Code item that still pastes as HTML; anything else stays Html
+    determineType();
+    if (m_type == Text) {
+        m_type = Html;
+    }
+}
+
 void ClipboardItem::generatePreview()
 {
     if (m_type == Image) {
-        m_preview = QString("Image (%1x%2)").arg(m_image.width()).arg(m_image.height());
+        m_preview = QString("Image (%1x%2)").arg(m_imageSize.width()).arg(m_imageSize.height());
     } else {
         m_preview = truncateText(m_text.simplified());
     }
 }
 
-void ClipboardItem::loadIcon()
+QPixmap ClipboardItem::iconForType(ItemType type)
 {
+    // Icons come from the widget style, so they are only resolved in processes
+    // that run a QApplication and are shared by all items of a type
+    static QHash<int, QPixmap> icons;
+    
+    const auto it = icons.constFind(type);
+    if (it != icons.constEnd()) {
+        return it.value();
+    }
+    
     QStyle* style = QApplication::style();
     QPixmap baseIcon;
     
-    switch (m_type) {
+    switch (type) {
         case Text:
             baseIcon = style->standardIcon(QStyle::SP_FileDialogDetailView).pixmap(16, 16);
             break;
@@ -147,7 +340,8 @@ void ClipboardItem::loadIcon()
             break;
     }
     
-    m_icon = baseIcon;
+    icons.insert(type, baseIcon);
+    return baseIcon;
 }
 
 QString ClipboardItem::truncateText(const QString& text, int maxLength) const
@@ -156,4 +350,53 @@ QString ClipboardItem::truncateText(const QString& text, int maxLength) const
         return text;
     }
     return text.left(maxLength) + "...";
+}
+
+QDataStream& operator<<(QDataStream& stream, const ClipboardItem& item)
+{
+    // Images go over the wire encoded; an item sent before its background
+    // encode finished is encoded here
+    stream << item.m_id << static_cast<qint32>(item.m_type) << item.m_text << item.m_preview
+           << item.m_timestamp << item.encodedImage() << item.m_imageSize
+           << item.m_fingerprint << item.m_clusterId
+           << static_cast<qint32>(item.m_useCount) << item.m_frecency << item.m_html << item.m_pinned;
+    return stream;
+}
+
+QDataStream& operator>>(QDataStream& stream, ClipboardItem& item)
+{
+    item.readBaseFields(stream);
+    stream >> item.m_html >> item.m_pinned;
+    return stream;
+}
+
+void ClipboardItem::readLegacy(QDataStream& stream, ClipboardItem& item)
+{
+    // The markup, then the pin, were appended to the layout; items written
+    // before the markup was kept apart hold it as the text
+    item.readBaseFields(stream);
+    if (stream.atEnd()) {
+        if (item.m_type == Html) {
+            item.m_html = item.m_text;
+            item.setExtractedText(HtmlText::toPlainText(item.m_html));
+        }
+        return;
+    }
+    stream >> item.m_html;
+    if (!stream.atEnd()) {
+        stream >> item.m_pinned;
+    }
+}
+
+void ClipboardItem::readBaseFields(QDataStream& stream)
+{
+    qint32 type = Text;
+    qint32 useCount = 0;
+    
+    stream >> m_id >> type >> m_text >> m_preview
+           >> m_timestamp >> m_imageData >> m_imageSize
+           >> m_fingerprint >> m_clusterId >> useCount >> m_frecency;
+    
+    m_type = static_cast<ItemType>(type);
+    m_useCount = useCount;
 }
\ No newline at end of file
@@ -5,6 +5,9 @@
 #include <QDateTime>
 #include <QMimeData>
 #include <QPixmap>
+#include <QImage>
+#include <QByteArray>
+#include <QDataStream>
 
 class ClipboardItem
 {
@@ -18,37 +21,121 @@ public:
         Code
     };
     
-    ClipboardItem(const QMimeData* mimeData);
+    ClipboardItem();
+    // format/data are the payload bytes IngestionFilter already fetched, if any
+    ClipboardItem(const QMimeData* mimeData, const QString& format = QString(),
+                  const QByteArray& data = QByteArray());
     ClipboardItem(const QString& text, ItemType type = Text);
     
+    // An image item from encoded bytes, e.g. read back from an export
+    static ClipboardItem fromImageData(const QByteArray& imageData);
+    
     // Getters
+    quint64 id() const { return m_id; }
     QString text() const { return m_text; }
     QString preview() const { return m_preview; }
     ItemType type() const { return m_type; }
     QDateTime timestamp() const { return m_timestamp; }
-    QPixmap icon() const { return m_icon; }
-    bool hasImage() const { return !m_image.isNull(); }
-    QPixmap image() const { return m_image; }
+    QPixmap icon() const { return iconForType(m_type); }
+    
+    // Images are kept encoded (PNG). The clipboard sometimes only hands over
+    // decoded pixels; those are held until ClipboardManager has them encoded
+    // off the GUI thread.
+    bool hasImage() const { return !m_imageData.isEmpty() || !m_pendingImage.isNull(); }
+    QByteArray imageData() const { return m_imageData; }
+    QSize imageSize() const { return m_imageSize; }
+    bool needsEncoding() const { return m_imageData.isEmpty() && !m_pendingImage.isNull(); }
+    QImage pendingImage() const { return m_pendingImage; }
+    void setImageData(const QByteArray& imageData);
+    
+    // Full-resolution decode, for copy-back and full-size previews only
+    QImage image() const;
+    
+    // Encoded image, encoding pending pixels synchronously if needed
+    QByteArray encodedImage() const;
+    
+    // SimHash of the text, computed at capture (0 for images and very short
+    // texts), and the id of the near-duplicate cluster assigned by ClipboardManager
+    quint64 fingerprint() const { return m_fingerprint; }
+    quint64 clusterId() const { return m_clusterId; }
+    void setClusterId(quint64 clusterId) { m_clusterId = clusterId; }
+    
+    // Items copied as HTML: text() is the visible text, html() the markup as
+    // copied, kept only for copy-back. They are typed by the visible text,
+    // Html unless it reads as a URL, code or a path. Large markup is left for
+    // ClipboardManager to convert off the GUI thread; until then text() is
+    // empty and the type Html.
+    QString html() const { return m_html; }
+    bool needsTextExtraction() const { return m_type == Html && m_text.isEmpty() && !m_html.isEmpty(); }
+    void setExtractedText(const QString& text);
+    
+    // Replaces the text (after secrets were masked out of it), keeping the
+    // type; an Html item's markup, which still holds the original, is dropped
+    void replaceText(const QString& text);
+    
+    // Replaces an Html item's markup (after secrets were masked out of it),
+    // keeping the visible text
+    void replaceHtml(const QString& html) { m_html = html; }
+    
+    // Items holding a likely secret are removed at this time; invalid if never
+    QDateTime expiresAt() const { return m_expiresAt; }
+    void setExpiresAt(const QDateTime& expiresAt) { m_expiresAt = expiresAt; }
+    
+    // Usage statistics maintained by ClipboardManager
+    int useCount() const { return m_useCount; }
+    double frecency() const { return m_frecency; }
+    void setId(quint64 id) { m_id = id; }
+    void setTimestamp(const QDateTime& timestamp) { m_timestamp = timestamp; }
+    void setUsage(int useCount, double frecency);
+    
+    // Pinned items are never evicted to make room for new ones
+    bool isPinned() const { return m_pinned; }
+    void setPinned(bool pinned) { m_pinned = pinned; }
     
     // Utility methods
     QString typeString() const;
     QString formattedTimestamp() const;
+    static QString formatRelativeTime(const QDateTime& timestamp, const QDateTime& now);
+    static QString formatRelativeTime(qint64 timestampMsecs, qint64 nowMsecs);
+    
+    // When formatRelativeTime() next gives a different label, in epoch ms;
+    // -1 once it shows the absolute date
+    static qint64 relativeTimeChangesAt(qint64 timestampMsecs, qint64 nowMsecs);
+    static QPixmap iconForType(ItemType type);
     void copyToClipboard() const;
     
     // Comparison
     bool operator==(const ClipboardItem& other) const;
     
+    // Serialization for IPC, the history log and archive segments
+    friend QDataStream& operator<<(QDataStream& stream, const ClipboardItem& item);
+    friend QDataStream& operator>>(QDataStream& stream, ClipboardItem& item);
+    
+    // Reads an item from a log or segment version that predates the markup
+    // and pin fields; such items may end early, so one must end the stream
+    static void readLegacy(QDataStream& stream, ClipboardItem& item);
+    
 private:
+    quint64 m_id;
     QString m_text;
+    QString m_html;
     QString m_preview;
     ItemType m_type;
     QDateTime m_timestamp;
-    QPixmap m_icon;
-    QPixmap m_image;
+    QDateTime m_expiresAt;
+    QByteArray m_imageData;
+    QSize m_imageSize;
+    QImage m_pendingImage;
+    quint64 m_fingerprint;
+    quint64 m_clusterId;
+    int m_useCount;
+    double m_frecency;
+    bool m_pinned;
     
+    void readBaseFields(QDataStream& stream);
     void determineType();
+    void determineMarkupType();
     void generatePreview();
-    void loadIcon();
     QString truncateText(const QString& text, int maxLength = 100) const;
 };
 
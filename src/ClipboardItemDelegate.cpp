@@ -0,0 +1,418 @@
+#include "ClipboardItemDelegate.h"
+#include "ClipboardItem.h"
+#include "HighlightCache.h"
+#include "RelativeTimeClock.h"
+#include "ThumbnailCache.h"
+#include <QApplication>
+#include <QIcon>
+#include <QMouseEvent>
+#include <QPainter>
+
+namespace {
+const int kIconSize = 16;
+const int kIconSpacing = 10;
+const int kLineSpacing = 4;
+
+// Row geometry, matching the old per-item stylesheet rules
+const int kMargin = 2;
+const int kPadding = 12;
+const int kRadius = 6;
+const int kCompactMargin = 1;
+const int kCompactPadding = 8;
+const int kCompactRadius = 4;
+
+// Near-duplicate groups
+const int kClusterIndent = 20;
+const int kBadgePadding = 6;
+
+const QColor kSelectedColor(0, 122, 255, 51);
+const QColor kHoverColor(0, 122, 255, 26);
+const QColor kAlternateColor(0, 0, 0, 5);
+const QColor kMatchColor(0, 122, 255);
+const QColor kSecondaryTextColor(136, 136, 136);
+const QColor kBadgeColor(0, 122, 255, 31);
+
+// Rendered title lines of code rows, a screenful or two
+const int kMaxCodeLineBytes = 4 * 1024 * 1024;
+}
+
+ClipboardItemDelegate::FontCache::FontCache(const QFont& font)
+    : baseFont(font)
+    , titleFont(font)
+    , matchFont(font)
+    , subtitleFont(font)
+    , titleMetrics(font)
+    , matchMetrics(font)
+    , subtitleMetrics(font)
+{
+    matchFont.setBold(true);
+    matchMetrics = QFontMetrics(matchFont);
+    
+    if (font.pointSizeF() > 0) {
+        subtitleFont.setPointSizeF(font.pointSizeF() * 0.85);
+    } else {
+        subtitleFont.setPixelSize(qMax(1, qRound(font.pixelSize() * 0.85)));
+    }
+    subtitleMetrics = QFontMetrics(subtitleFont);
+}
+
+ClipboardItemDelegate::ClipboardItemDelegate(QObject* parent)
+    : QStyledItemDelegate(parent)
+    , m_compact(false)
+    , m_thumbnails(nullptr)
+    , m_highlights(nullptr)
+    , m_fonts(QFont())
+    , m_codeLines(kMaxCodeLineBytes)
+{
+}
+
+void ClipboardItemDelegate::setCompact(bool compact)
+{
+    m_compact = compact;
+}
+
+void ClipboardItemDelegate::setThumbnailCache(ThumbnailCache* thumbnails)
+{
+    m_thumbnails = thumbnails;
+}
+
+void ClipboardItemDelegate::setHighlightCache(HighlightCache* highlights)
+{
+    m_highlights = highlights;
+    m_codeLines.clear();
+}
+
+const ClipboardItemDelegate::FontCache& ClipboardItemDelegate::fonts(const QFont& font) const
+{
+    if (font != m_fonts.baseFont) {
+        m_fonts = FontCache(font);
+        m_codeLines.clear();
+    }
+    return m_fonts;
+}
+
+void ClipboardItemDelegate::paint(QPainter* painter, const QStyleOptionViewItem& option,
+                                  const QModelIndex& index) const
+{
+    // Headings sit at the bottom of a full-height row, since the list assumes
+    // uniform row sizes
+    if (index.data(SectionHeaderRole).toBool()) {
+        const FontCache& cache = fonts(option.font);
+        const int padding = m_compact ? kCompactPadding : kPadding;
+        const QRect heading = rowRect(option, index).adjusted(padding, 0, -padding, -kLineSpacing);
+        painter->save();
+        painter->setFont(cache.matchFont);
+        painter->setPen(kSecondaryTextColor);
+        painter->drawText(heading, Qt::AlignLeft | Qt::AlignBottom | Qt::TextSingleLine,
+                          index.data(Qt::DisplayRole).toString());
+        painter->restore();
+        return;
+    }
+    
+    // Placeholder rows such as "No clipboard items" keep the default look
+    if (index.data(ItemIdRole).toULongLong() == 0) {
+        QStyledItemDelegate::paint(painter, option, index);
+        return;
+    }
+    
+    const FontCache& cache = fonts(option.font);
+    const int padding = m_compact ? kCompactPadding : kPadding;
+    const int radius = m_compact ? kCompactRadius : kRadius;
+    const QRect row = rowRect(option, index);
+    
+    painter->save();
+    
+    // Background
+    QColor background;
+    if (option.state & QStyle::State_Selected) {
+        background = kSelectedColor;
+    } else if (option.state & QStyle::State_MouseOver) {
+        background = kHoverColor;
+    } else if (option.features & QStyleOptionViewItem::Alternate) {
+        background = kAlternateColor;
+    }
+    if (background.isValid()) {
+        painter->setRenderHint(QPainter::Antialiasing);
+        painter->setPen(Qt::NoPen);
+        painter->setBrush(background);
+        painter->drawRoundedRect(row, radius, radius);
+    }
+    
+    QRect content = row.adjusted(padding, padding, -padding, -padding);
+    
+    // Thumbnail for images, decoded off-thread; the type icon until it is ready
+    QPixmap thumbnail;
+    const QVariant imageData = index.data(ImageDataRole);
+    if (m_thumbnails && imageData.isValid()) {
+        thumbnail = m_thumbnails->thumbnail(index.data(ItemIdRole).toULongLong(), imageData.toByteArray());
+    }
+    
+    // Icon
+    const QIcon icon = qvariant_cast<QIcon>(index.data(Qt::DecorationRole));
+    if (!thumbnail.isNull()) {
+        // Spans both lines of a full row
+        const int slot = m_compact
+            ? kIconSize
+            : cache.titleMetrics.height() + kLineSpacing + cache.subtitleMetrics.height();
+        const int top = m_compact ? content.top() + (cache.titleMetrics.height() - kIconSize) / 2 : content.top();
+        const QSize size = thumbnail.size().scaled(slot, slot, Qt::KeepAspectRatio);
+        const QRect slotRect(content.left(), top, slot, slot);
+        const QRect thumbnailRect(QPoint(0, 0), size);
+        painter->setRenderHint(QPainter::SmoothPixmapTransform);
+        painter->drawPixmap(thumbnailRect.translated(slotRect.center() - thumbnailRect.center()), thumbnail);
+        content.setLeft(slotRect.right() + kIconSpacing);
+    } else if (!icon.isNull()) {
+        const QRect iconRect(content.left(), content.top() + (cache.titleMetrics.height() - kIconSize) / 2,
+                             kIconSize, kIconSize);
+        icon.paint(painter, iconRect);
+        content.setLeft(iconRect.right() + kIconSpacing);
+    }
+    
+    const QColor textColor = option.palette.color(QPalette::Text);
+    const QString preview = index.data(Qt::DisplayRole).toString();
+    const QList<int> positions = index.data(MatchPositionsRole).value<QList<int>>();
+    QString type = index.data(TypeRole).toString();
+    if (index.data(PinnedRole).toBool()) {
+        type += QString::fromUtf8(" • Pinned");
+    }
+    
+    QRect titleRect(content.left(), content.top(), content.width(), cache.titleMetrics.height());
+    
+    // "▸ N similar" badge of a collapsed or expanded group
+    const QRect badge = badgeRect(option, index);
+    if (badge.isValid()) {
+        painter->setRenderHint(QPainter::Antialiasing);
+        painter->setPen(Qt::NoPen);
+        painter->setBrush(kBadgeColor);
+        painter->drawRoundedRect(badge, badge.height() / 2.0, badge.height() / 2.0);
+        painter->setFont(cache.subtitleFont);
+        painter->setPen(kMatchColor);
+        painter->drawText(badge, Qt::AlignCenter | Qt::TextSingleLine, badgeText(index));
+        titleRect.setRight(badge.left() - kIconSpacing);
+    }
+    
+    if (m_compact) {
+        // "Type • preview" on one line
+        const QString prefix = type + QString::fromUtf8(" • ");
+        painter->setFont(cache.titleFont);
+        painter->setPen(kSecondaryTextColor);
+        painter->drawText(titleRect, Qt::AlignLeft | Qt::AlignVCenter | Qt::TextSingleLine, prefix);
+        titleRect.setLeft(titleRect.left() + cache.titleMetrics.horizontalAdvance(prefix));
+        if (!positions.isEmpty() || !drawCodeText(painter, titleRect, index, textColor)) {
+            drawHighlightedText(painter, titleRect, preview, positions, textColor);
+        }
+    } else {
+        // Search matches take precedence over syntax colors
+        if (!positions.isEmpty() || !drawCodeText(painter, titleRect, index, textColor)) {
+            drawHighlightedText(painter, titleRect, preview, positions, textColor);
+        }
+        
+        // Relative time is formatted here, only for rows that are actually
+        // painted, and the clock ticks when this label would change
+        RelativeTimeClock* clock = RelativeTimeClock::instance();
+        const qint64 timestamp = index.data(TimestampRole).toLongLong();
+        const qint64 now = clock->now();
+        clock->requestTick(ClipboardItem::relativeTimeChangesAt(timestamp, now));
+        const QString subtitle = QString("%1 • %2").arg(type, ClipboardItem::formatRelativeTime(timestamp, now));
+        const QRect subtitleRect(content.left(), titleRect.bottom() + 1 + kLineSpacing,
+                                 content.width(), cache.subtitleMetrics.height());
+        painter->setFont(cache.subtitleFont);
+        painter->setPen(kSecondaryTextColor);
+        painter->drawText(subtitleRect, Qt::AlignLeft | Qt::AlignVCenter | Qt::TextSingleLine,
+                          cache.subtitleMetrics.elidedText(subtitle, Qt::ElideRight, subtitleRect.width()));
+    }
+    
+    painter->restore();
+}
+
+bool ClipboardItemDelegate::editorEvent(QEvent* event, QAbstractItemModel* model,
+                                        const QStyleOptionViewItem& option, const QModelIndex& index)
+{
+    // Clicks on the badge toggle the group instead of selecting or copying
+    if (event->type() == QEvent::MouseButtonRelease || event->type() == QEvent::MouseButtonDblClick) {
+        const QMouseEvent* mouseEvent = static_cast<QMouseEvent*>(event);
+        if (badgeRect(option, index).contains(mouseEvent->position().toPoint())) {
+            if (event->type() == QEvent::MouseButtonRelease) {
+                emit clusterToggled(index.data(ItemIdRole).toULongLong());
+            }
+            return true;
+        }
+    }
+    return QStyledItemDelegate::editorEvent(event, model, option, index);
+}
+
+QRect ClipboardItemDelegate::rowRect(const QStyleOptionViewItem& option, const QModelIndex& index) const
+{
+    QRect row = m_compact
+        ? option.rect.adjusted(0, kCompactMargin, 0, -kCompactMargin)
+        : option.rect.adjusted(kMargin, kMargin, -kMargin, -kMargin);
+    if (index.data(ClusterMemberRole).toBool()) {
+        row.setLeft(row.left() + kClusterIndent);
+    }
+    return row;
+}
+
+QString ClipboardItemDelegate::badgeText(const QModelIndex& index) const
+{
+    const int similar = index.data(SimilarCountRole).toInt();
+    if (similar <= 0) {
+        return QString();
+    }
+    const QString arrow = index.data(ExpandedRole).toBool() ? QString::fromUtf8("▾") : QString::fromUtf8("▸");
+    return QString("%1 %2 similar").arg(arrow).arg(similar);
+}
+
+QRect ClipboardItemDelegate::badgeRect(const QStyleOptionViewItem& option, const QModelIndex& index) const
+{
+    const QString text = badgeText(index);
+    if (text.isEmpty()) {
+        return QRect();
+    }
+    
+    // Right end of the title line
+    const FontCache& cache = fonts(option.font);
+    const int padding = m_compact ? kCompactPadding : kPadding;
+    const QRect content = rowRect(option, index).adjusted(padding, padding, -padding, -padding);
+    const int width = cache.subtitleMetrics.horizontalAdvance(text) + 2 * kBadgePadding;
+    const int height = cache.subtitleMetrics.height() + 2;
+    return QRect(content.right() - width + 1, content.top() + (cache.titleMetrics.height() - height) / 2,
+                 width, height);
+}
+
+QSize ClipboardItemDelegate::sizeHint(const QStyleOptionViewItem& option, const QModelIndex& index) const
+{
+    if (index.data(ItemIdRole).toULongLong() == 0 && !index.data(SectionHeaderRole).toBool()) {
+        return QStyledItemDelegate::sizeHint(option, index);
+    }
+    
+    const FontCache& cache = fonts(option.font);
+    int height;
+    if (m_compact) {
+        height = 2 * kCompactMargin + 2 * kCompactPadding + qMax(kIconSize, cache.titleMetrics.height());
+    } else {
+        height = 2 * kMargin + 2 * kPadding
+               + qMax(kIconSize, cache.titleMetrics.height()) + kLineSpacing + cache.subtitleMetrics.height();
+    }
+    
+    return QSize(option.rect.width(), height);
+}
+
+void ClipboardItemDelegate::drawHighlightedText(QPainter* painter, const QRect& rect, const QString& text,
+                                                const QList<int>& positions, const QColor& color) const
+{
+    const QString elided = m_fonts.titleMetrics.elidedText(text, Qt::ElideRight, rect.width());
+    const int flags = Qt::AlignLeft | Qt::AlignVCenter | Qt::TextSingleLine;
+    
+    if (positions.isEmpty()) {
+        painter->setFont(m_fonts.titleFont);
+        painter->setPen(color);
+        painter->drawText(rect, flags, elided);
+        return;
+    }
+    
+    // Matches past the elision point are not visible; never highlight the ellipsis
+    const int highlightLimit = elided != text ? elided.size() - 1 : elided.size();
+    
+    // Draw alternating runs of plain and matched text
+    int x = rect.left();
+    int next = 0;
+    int start = 0;
+    while (start < elided.size() && x <= rect.right()) {
+        while (next < positions.size() && positions[next] < start) {
+            ++next;
+        }
+        
+        const bool matched = next < positions.size() && positions[next] == start && start < highlightLimit;
+        int end = start + 1;
+        if (matched) {
+            ++next;
+            while (end < highlightLimit && next < positions.size() && positions[next] == end) {
+                ++next;
+                ++end;
+            }
+        } else if (next < positions.size() && positions[next] < highlightLimit) {
+            end = positions[next];
+        } else {
+            end = elided.size();
+        }
+        
+        const QString run = elided.mid(start, end - start);
+        const QFontMetrics& metrics = matched ? m_fonts.matchMetrics : m_fonts.titleMetrics;
+        painter->setFont(matched ? m_fonts.matchFont : m_fonts.titleFont);
+        painter->setPen(matched ? kMatchColor : color);
+        painter->drawText(QRect(x, rect.top(), rect.right() - x + 1, rect.height()), flags, run);
+        
+        x += metrics.horizontalAdvance(run);
+        start = end;
+    }
+}
+
+bool ClipboardItemDelegate::drawCodeText(QPainter* painter, const QRect& rect, const QModelIndex& index,
+                                         const QColor& color) const
+{
+    const QVariant code = index.data(CodeTextRole);
+    if (!m_highlights || !code.isValid() || rect.width() <= 0) {
+        return false;
+    }
+    
+    // Highlighting runs on the cache's worker; rows stay plain until it is done
+    const quint64 id = index.data(ItemIdRole).toULongLong();
+    const QString preview = index.data(Qt::DisplayRole).toString();
+    const HighlightCache::HighlightPtr highlight = m_highlights->previewHighlight(id, code.toString(), preview);
+    if (!highlight || highlight->previewSpans.empty()) {
+        return false;
+    }
+    
+    const qreal ratio = painter->device() ? painter->device()->devicePixelRatio() : 1.0;
+    if (const CodeLine* line = m_codeLines.object(id)) {
+        if (line->width == rect.width() && line->color == color.rgba() && line->pixmap.devicePixelRatio() == ratio) {
+            painter->drawPixmap(rect.topLeft(), line->pixmap);
+            return true;
+        }
+    }
+    
+    // Elide and lay out the runs once; scrolling back over the row is a blit
+    QPixmap pixmap(rect.size() * ratio);
+    pixmap.setDevicePixelRatio(ratio);
+    pixmap.fill(Qt::transparent);
+    {
+        QPainter linePainter(&pixmap);
+        linePainter.setFont(m_fonts.titleFont);
+        
+        const QString elided = m_fonts.titleMetrics.elidedText(preview, Qt::ElideRight, rect.width());
+        const int colorLimit = elided != preview ? elided.size() - 1 : elided.size();
+        const int flags = Qt::AlignLeft | Qt::AlignVCenter | Qt::TextSingleLine;
+        const QRect lineRect(QPoint(0, 0), rect.size());
+        
+        int x = 0;
+        int start = 0;
+        size_t next = 0;
+        const std::vector<SyntaxHighlighter::Span>& spans = highlight->previewSpans;
+        while (start < elided.size() && x < rect.width()) {
+            while (next < spans.size() && int(spans[next].start + spans[next].length) <= start) {
+                ++next;
+            }
+            
+            const bool colored = next < spans.size() && int(spans[next].start) <= start && start < colorLimit;
+            int end;
+            if (colored) {
+                end = qMin<int>(spans[next].start + spans[next].length, colorLimit);
+            } else if (next < spans.size() && int(spans[next].start) < colorLimit) {
+                end = spans[next].start;
+            } else {
+                end = elided.size();
+            }
+            
+            const QString run = elided.mid(start, end - start);
+            linePainter.setPen(colored ? SyntaxHighlighter::color(spans[next].kind) : color);
+            linePainter.drawText(lineRect.adjusted(x, 0, 0, 0), flags, run);
+            x += m_fonts.titleMetrics.horizontalAdvance(run);
+            start = end;
+        }
+    }
+    
+    painter->drawPixmap(rect.topLeft(), pixmap);
+    const qint64 cost = qint64(pixmap.width()) * pixmap.height() * 4;
+    m_codeLines.insert(id, new CodeLine{pixmap, rect.width(), color.rgba()}, static_cast<int>(cost));
+    return true;
+}
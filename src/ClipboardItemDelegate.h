@@ -0,0 +1,101 @@
+#ifndef CLIPBOARDITEMDELEGATE_H
+#define CLIPBOARDITEMDELEGATE_H
+
+#include <QStyledItemDelegate>
+#include <QCache>
+#include <QFont>
+#include <QFontMetrics>
+#include <QPixmap>
+
+class HighlightCache;
+class ThumbnailCache;
+
+// Paints history rows directly: icon, preview with match highlights, and a
+// "type • time" subtitle, plus section headings. Fonts and metrics are cached
+// per view font, so rows don't go through the stylesheet engine or build
+// display strings up front.
+class ClipboardItemDelegate : public QStyledItemDelegate
+{
+    Q_OBJECT
+    
+public:
+    enum Roles {
+        ItemIdRole = Qt::UserRole,  // quint64, ClipboardItem::id()
+        MatchPositionsRole,         // QList<int>, offsets into the preview (Qt::DisplayRole)
+        TypeRole,                   // QString, ClipboardItem::typeString()
+        TimestampRole,              // qint64, ClipboardItem::timestamp() in epoch ms
+        ImageDataRole,              // QByteArray, ClipboardItem::imageData(); image items only
+        SimilarCountRole,           // int, near-duplicates grouped under this row; shows a badge
+        ExpandedRole,               // bool, the group's members are listed below this row
+        ClusterMemberRole,          // bool, an expanded group member; drawn indented
+        SectionHeaderRole,          // bool, a "Today" / "Yesterday" heading row, the text in Qt::DisplayRole
+        CodeTextRole,               // QString, ClipboardItem::text(); code items only
+        PinnedRole                  // bool, ClipboardItem::isPinned(); shown next to the type
+    };
+    
+    // Row tooltips show the start of the text; the whole of a large entry is
+    // for the viewer in the main window
+    static const int kToolTipLength = 500;
+    
+    explicit ClipboardItemDelegate(QObject* parent = nullptr);
+    
+    // Compact rows show "type • preview" on a single line and no timestamp
+    bool isCompact() const { return m_compact; }
+    void setCompact(bool compact);
+    
+    // Image rows show a thumbnail from this cache in place of the type icon
+    void setThumbnailCache(ThumbnailCache* thumbnails);
+    
+    // Code rows outside a search show their preview highlighted from this cache
+    void setHighlightCache(HighlightCache* highlights);
+    
+    void paint(QPainter* painter, const QStyleOptionViewItem& option,
+               const QModelIndex& index) const override;
+    QSize sizeHint(const QStyleOptionViewItem& option, const QModelIndex& index) const override;
+    
+signals:
+    // The "N similar" badge of a group row was clicked
+    void clusterToggled(quint64 id);
+    
+protected:
+    bool editorEvent(QEvent* event, QAbstractItemModel* model, const QStyleOptionViewItem& option,
+                     const QModelIndex& index) override;
+    
+private:
+    struct FontCache
+    {
+        QFont baseFont;
+        QFont titleFont;
+        QFont matchFont;
+        QFont subtitleFont;
+        QFontMetrics titleMetrics;
+        QFontMetrics matchMetrics;
+        QFontMetrics subtitleMetrics;
+        
+        explicit FontCache(const QFont& font);
+    };
+    
+    // A code row's title line as last drawn
+    struct CodeLine
+    {
+        QPixmap pixmap;
+        int width;
+        QRgb color;
+    };
+    
+    bool m_compact;
+    ThumbnailCache* m_thumbnails;
+    HighlightCache* m_highlights;
+    mutable FontCache m_fonts;
+    mutable QCache<quint64, CodeLine> m_codeLines;  // Cost is pixel bytes
+    
+    const FontCache& fonts(const QFont& font) const;
+    QRect rowRect(const QStyleOptionViewItem& option, const QModelIndex& index) const;
+    QString badgeText(const QModelIndex& index) const;
+    QRect badgeRect(const QStyleOptionViewItem& option, const QModelIndex& index) const;
+    void drawHighlightedText(QPainter* painter, const QRect& rect, const QString& text,
+                             const QList<int>& positions, const QColor& color) const;
+    bool drawCodeText(QPainter* painter, const QRect& rect, const QModelIndex& index, const QColor& color) const;
+};
+
+#endif // CLIPBOARDITEMDELEGATE_H
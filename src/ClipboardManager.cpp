@@ -1,64 +1,483 @@
 #include "ClipboardManager.h"
-#include <QApplication>
+#include "Diagnostics.h"
+#include "FuzzyMatcher.h"
+#include "HighlightCache.h"
+#include "HistoryArchive.h"
+#include "HistoryClient.h"
+#include "HtmlText.h"
+#include "StallWatchdog.h"
+#include "ThumbnailCache.h"
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QHash>
 #include <QMimeData>
+#include <QSaveFile>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <queue>
+#include <vector>
+
+namespace {
+// Recency is worth at most one matched character, so it only breaks near-ties
+const int kRecencyBonus = 16;
+
+// Retries back off while the daemon stays down, so a client left running
+// without one doesn't wake up every second
+const int kReconnectDelayMsecs = 1000;
+const int kMaxReconnectDelayMsecs = 60 * 1000;
+
+// A use counts half as much after this long
+const double kFrecencyHalfLifeMsecs = 3.0 * 24 * 60 * 60 * 1000;
+
+// Frecency is kept as log2(sum of 2^(t / halfLife)) over all uses. Every score
+// decays at the same rate, so the relative order never changes over time and
+// the ranking only needs updating when an item is used.
+// log2(2^a + 2^b) without overflowing
+double logSum(double a, double b)
+{
+    const double high = qMax(a, b);
+    const double low = qMin(a, b);
+    return high + std::log2(1.0 + std::exp2(low - high));
+}
+
+double accumulateFrecency(double frecency, int useCount, const QDateTime& when)
+{
+    const double point = when.toMSecsSinceEpoch() / kFrecencyHalfLifeMsecs;
+    return useCount == 0 ? point : logSum(frecency, point);
+}
+
+const int kDefaultNearDuplicateDistance = 4;
+
+const int kDefaultSecretExpiryMsecs = 5 * 60 * 1000;
+
+// Some apps announce one copy several times within a few ms; a copy loop
+// still gets through every kMaxCoalesceLatencyMsecs
+const int kDefaultCoalesceDelayMsecs = 100;
+const int kDefaultMaxCoalesceLatencyMsecs = 500;
+
+// Masked secrets keep a short prefix ("AKIA", "ghp_") so the user can tell
+// what was there; the mask has a fixed length so it doesn't leak the length
+const int kMaskedPrefixLength = 4;
+const int kMaskLength = 8;
+
+// Images encoded close together, e.g. after an import, refresh the views once
+const int kEncodedRefreshDelayMsecs = 100;
+
+// Captured items are numbered from here up; the ids below are left for
+// imported items, which are older than anything captured
+const quint64 kFirstCapturedId = quint64(1) << 32;
+
+bool rankedBefore(double frecencyA, quint64 idA, double frecencyB, quint64 idB)
+{
+    return frecencyA != frecencyB ? frecencyA > frecencyB : idA > idB;
+}
+
+// Scores an item against the matcher, -1 if it does not match. The preview is
+// matched fuzzily; long items whose match lies past the preview fall back to a
+// plain substring test on the full text.
+int matchItem(const FuzzyMatcher& matcher, const ClipboardItem& item, QList<int>* positions)
+{
+    const int score = matcher.match(item.preview(), positions);
+    if (score >= 0) {
+        return score;
+    }
+    
+    // Long items can match past their preview; "image" or "code" finds items
+    // by type, as the list rows show it
+    if (item.text().size() > item.preview().size() &&
+        item.text().contains(matcher.pattern(), Qt::CaseInsensitive)) {
+        return 0;
+    }
+    if (item.typeString().contains(matcher.pattern(), Qt::CaseInsensitive)) {
+        return 0;
+    }
+    return -1;
+}
+}
 
 ClipboardManager::ClipboardManager(QObject* parent)
     : QObject(parent)
-    , m_clipboard(QApplication::clipboard())
+    , m_clipboard(QGuiApplication::clipboard())
     , m_maxHistorySize(100)
     , m_updateTimer(new QTimer(this))
+    , m_nextId(kFirstCapturedId - 1)
+    , m_importNextId(0)
+    , m_importEndId(0)
+    , m_copyBackId(0)
+    , m_daemonClient(nullptr)
+    , m_reconnectTimer(nullptr)
+    , m_reconnectDelayMsecs(kReconnectDelayMsecs)
+    , m_thumbnails(new ThumbnailCache(this))
+    , m_highlights(new HighlightCache(this))
+    , m_transfer(new HistoryTransfer(this))
+    , m_nearDuplicateDistance(kDefaultNearDuplicateDistance)
+    , m_nextSequence(0)
+    , m_secretExpiryMsecs(kDefaultSecretExpiryMsecs)
+    , m_expiryTimer(new QTimer(this))
+    , m_encodedTimer(new QTimer(this))
+    , m_archive(new HistoryArchive(this))
+    , m_coalesceDelayMsecs(kDefaultCoalesceDelayMsecs)
+    , m_maxCoalesceLatencyMsecs(kDefaultMaxCoalesceLatencyMsecs)
+    , m_maxIngestRate(0.0)
+    , m_rateLimitPolicy(KeepLatest)
+    , m_ingestTokens(0.0)
+    , m_tokensRefilledAt(0)
+    , m_rateLimitedUntil(0)
 {
     // Connect clipboard signals
-    connect(m_clipboard, &QClipboard::dataChanged, this, &ClipboardManager::onClipboardChanged);
+    connect(m_clipboard, &QClipboard::dataChanged, this, &ClipboardManager::onClipboardDataChanged);
     
-    // Timer to prevent rapid updates
+    // Bursts of changes are processed once, when the timer fires
     m_updateTimer->setSingleShot(true);
-    m_updateTimer->setInterval(100); // 100ms delay
     connect(m_updateTimer, &QTimer::timeout, this, &ClipboardManager::onClipboardChanged);
+    m_changeClock.start();
+    
+    connect(m_thumbnails, &ThumbnailCache::imageEncoded, this, &ClipboardManager::onImageEncoded);
+    m_encodedTimer->setSingleShot(true);
+    m_encodedTimer->setInterval(kEncodedRefreshDelayMsecs);
+    connect(m_encodedTimer, &QTimer::timeout, this, &ClipboardManager::historyChanged);
+    connect(m_thumbnails, &ThumbnailCache::imageHashed, this, &ClipboardManager::onImageHashed);
+    connect(m_transfer, &HistoryTransfer::importStarted, this, &ClipboardManager::onImportStarted);
+    connect(m_transfer, &HistoryTransfer::itemsImported, this, &ClipboardManager::onItemsImported);
+    
+    // One worker keeps scans in capture order
+    m_ingestionPool.setMaxThreadCount(1);
+    
+    // Keys are masked; private keys are never stored; bare high-entropy
+    // tokens are often hashes or ids, so they only expire
+    m_secretActions.fill(MaskSecret);
+    m_secretActions[SecretScanner::PrivateKey] = DropSecret;
+    m_secretActions[SecretScanner::HighEntropyToken] = ExpireSecret;
+    
+    m_expiryTimer->setSingleShot(true);
+    connect(m_expiryTimer, &QTimer::timeout, this, &ClipboardManager::onExpiryTimeout);
     
     // Initialize with current clipboard content
     onClipboardChanged();
 }
 
+ClipboardManager::~ClipboardManager()
+{
+    // Scans post their results back to this object
+    m_ingestionPool.clear();
+    m_ingestionPool.waitForDone();
+}
+
+void ClipboardManager::attachToDaemon(const QString& serverName)
+{
+    if (m_daemonClient) {
+        return;
+    }
+    
+    // The daemon owns capture from now on
+    disconnect(m_clipboard, nullptr, this, nullptr);
+    m_updateTimer->stop();
+    m_burstStart.invalidate();
+    m_expiryTimer->stop();
+    m_pendingCaptures.clear();
+    clearAll();
+    
+    m_daemonClient = new HistoryClient(serverName, this);
+    connect(m_daemonClient, &HistoryClient::historyReset, this, &ClipboardManager::onDaemonReset);
+    connect(m_daemonClient, &HistoryClient::pageReceived, this, &ClipboardManager::onDaemonPage);
+    connect(m_daemonClient, &HistoryClient::itemAdded, this, &ClipboardManager::onDaemonItemAdded);
+    
+    // Keep retrying while the daemon is not running
+    m_reconnectTimer = new QTimer(this);
+    m_reconnectTimer->setSingleShot(true);
+    connect(m_reconnectTimer, &QTimer::timeout, m_daemonClient, &HistoryClient::connectToDaemon);
+    connect(m_daemonClient, &HistoryClient::disconnected, this, [this]() {
+        m_reconnectTimer->start(m_reconnectDelayMsecs);
+        m_reconnectDelayMsecs = qMin(m_reconnectDelayMsecs * 2, kMaxReconnectDelayMsecs);
+    });
+    connect(m_daemonClient, &HistoryClient::connected, this, [this]() {
+        m_reconnectDelayMsecs = kReconnectDelayMsecs;
+    });
+    
+    m_daemonClient->connectToDaemon();
+    emit historyChanged();
+}
+
+bool ClipboardManager::openHistoryLog(const QString& path)
+{
+    if (m_daemonClient) {
+        return false;
+    }
+    
+    HistoryLog::Recovered recovered;
+    if (!m_historyLog.open(path, &recovered)) {
+        return false;
+    }
+    
+    const QList<ClipboardItem> captured = m_history;
+    clearAll();
+    if (recovered.maxHistorySize > 0) {
+        m_maxHistorySize = recovered.maxHistorySize;
+    }
+    m_history = recovered.items;
+    
+    // Removed and expired items leave no record, but archived ones keep
+    // their ids; new ids continue above both
+    m_nextId = std::max({kFirstCapturedId - 1, m_history.isEmpty() ? 0 : m_history.first().id(), m_archive->maxId()});
+    for (const ClipboardItem& item : m_history) {
+        insertRanking(item);
+        m_textIndex.insert(item.fingerprint(), item.id());
+        m_timeIndex.insert(item.timestamp().toMSecsSinceEpoch(), item.id());
+        if (item.type() == ClipboardItem::Image && item.hasImage()) {
+            m_thumbnails->analyzeImage(item.id(), item.imageData());
+        }
+    }
+    
+    // Replay trims to the size recorded last, so record the current one
+    m_historyLog.appendMaxSize(m_maxHistorySize);
+    
+    // Items captured before the log was opened are newer than all of it
+    for (auto it = captured.crbegin(); it != captured.crend(); ++it) {
+        addItem(*it);
+    }
+    trimHistory();
+    
+    qCDebug(lcPerf) << "Recovered" << m_history.size() << "items from" << recovered.records << "log records";
+    emit historyChanged();
+    return true;
+}
+
+bool ClipboardManager::openArchive(const QString& directory)
+{
+    if (!m_archive->open(directory)) {
+        return false;
+    }
+    
+    // Ids must stay unique across the archive, which looks items up and
+    // names segments by id. Items captured before it was opened are
+    // renumbered above everything archived.
+    const quint64 archivedMaxId = m_archive->maxId();
+    if (archivedMaxId > m_nextId) {
+        const QList<ClipboardItem> captured = m_history;
+        clearAll();
+        m_nextId = archivedMaxId;
+        for (auto it = captured.crbegin(); it != captured.crend(); ++it) {
+            insertItem(*it);
+        }
+        if (!captured.isEmpty()) {
+            emit historyChanged();
+        }
+    }
+    return true;
+}
+
 void ClipboardManager::clearHistory()
 {
-    m_history.clear();
+    if (m_daemonClient) {
+        m_daemonClient->clearHistory();
+        return;
+    }
+    
+    clearAll();
+    m_historyLog.appendClear();
+    m_archive->clear();
     emit historyChanged();
 }
 
 void ClipboardManager::removeItem(int index)
 {
     if (index >= 0 && index < m_history.size()) {
-        m_history.removeAt(index);
+        if (m_daemonClient) {
+            m_daemonClient->removeItem(m_history[index].id());
+            return;
+        }
+        
+        const quint64 id = m_history[index].id();
+        removeAt(index);
+        m_historyLog.appendRemove(id);
         emit historyChanged();
     }
 }
 
+void ClipboardManager::removeItems(const QSet<quint64>& ids)
+{
+    if (ids.isEmpty()) {
+        return;
+    }
+    if (m_daemonClient) {
+        m_daemonClient->removeItems(ids);
+        return;
+    }
+    
+    StallWatchdog::Scope scope("removeItems", ids.size());
+    const QList<quint64> removed = removeIds(ids);
+    if (!removed.isEmpty()) {
+        m_historyLog.appendRemove(removed);
+        emit historyChanged();
+    }
+}
+
+void ClipboardManager::setPinned(const QSet<quint64>& ids, bool pinned)
+{
+    if (ids.isEmpty()) {
+        return;
+    }
+    if (m_daemonClient) {
+        m_daemonClient->setPinned(ids, pinned);
+        return;
+    }
+    
+    QList<quint64> changed;
+    for (ClipboardItem& item : m_history) {
+        if (item.isPinned() != pinned && ids.contains(item.id())) {
+            item.setPinned(pinned);
+            changed.append(item.id());
+        }
+    }
+    if (changed.isEmpty()) {
+        return;
+    }
+    
+    m_historyLog.appendPinned(changed, pinned);
+    
+    // Unpinned items may be over the limit now
+    if (!pinned) {
+        trimHistory();
+    }
+    emit historyChanged();
+}
+
+quint64 ClipboardManager::mergeItems(const QSet<quint64>& ids)
+{
+    if (m_daemonClient) {
+        m_daemonClient->mergeItems(ids);
+        return 0;
+    }
+    
+    // Oldest first, the order they were copied in. Items holding a secret
+    // that is about to expire stay out, or the merge would keep it for good.
+    QStringList texts;
+    QSet<quint64> merged;
+    bool pinned = false;
+    for (auto it = m_history.crbegin(); it != m_history.crend(); ++it) {
+        if (it->type() != ClipboardItem::Image && !it->expiresAt().isValid() && ids.contains(it->id())) {
+            texts.append(it->text());
+            merged.insert(it->id());
+            pinned = pinned || it->isPinned();
+        }
+    }
+    if (merged.size() < 2) {
+        return 0;
+    }
+    
+    StallWatchdog::Scope scope("mergeItems", merged.size());
+    m_historyLog.appendRemove(removeIds(merged));
+    
+    // Not a capture: no newItemAdded(), so attached clients refetch
+    ClipboardItem item(texts.join('\n'));
+    item.setPinned(pinned);
+    const quint64 id = insertItem(item).id();
+    emit historyChanged();
+    return id;
+}
+
+int ClipboardManager::exportItems(const QSet<quint64>& ids, const QString& path) const
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return -1;
+    }
+    
+    // Oldest first, a blank line between items; images have no text to write
+    int count = 0;
+    for (auto it = m_history.crbegin(); it != m_history.crend(); ++it) {
+        if (it->type() == ClipboardItem::Image || !ids.contains(it->id())) {
+            continue;
+        }
+        if (count++ > 0) {
+            file.write("\n\n");
+        }
+        file.write(it->text().toUtf8());
+    }
+    return file.commit() ? count : -1;
+}
+
+bool ClipboardManager::exportHistory(const QString& path)
+{
+    return m_transfer->startExport(path, m_history);
+}
+
+bool ClipboardManager::importHistory(const QString& path)
+{
+    // The daemon owns the history; items would have to be pushed one by one
+    if (m_daemonClient) {
+        return false;
+    }
+    return m_transfer->startImport(path, m_history);
+}
+
+void ClipboardManager::copyToClipboard(int index)
+{
+    if (index < 0 || index >= m_history.size()) {
+        return;
+    }
+    
+    if (m_daemonClient) {
+        m_daemonClient->copyItem(m_history[index].id());
+        return;
+    }
+    
+    const ClipboardItem& item = m_history[index];
+    StallWatchdog::Scope scope("copyToClipboard",
+                               item.type() == ClipboardItem::Image ? item.imageData().size() : item.text().size() * 2);
+    recordUse(index);
+    
+    // The clipboard change comes back to us; don't count it twice
+    m_copyBackId = m_history[index].id();
+    m_history[index].copyToClipboard();
+}
+
+int ClipboardManager::indexOf(quint64 id) const
+{
+    const auto it = std::lower_bound(m_history.cbegin(), m_history.cend(), id,
+                                     [](const ClipboardItem& item, quint64 value) {
+                                         return item.id() > value;
+                                     });
+    if (it != m_history.cend() && it->id() == id) {
+        return static_cast<int>(it - m_history.cbegin());
+    }
+    return -1;
+}
+
 void ClipboardManager::setMaxHistorySize(int size)
 {
+    if (m_daemonClient) {
+        m_daemonClient->setMaxHistorySize(size);
+        return;
+    }
+    
     m_maxHistorySize = qMax(1, size);
+    m_historyLog.appendMaxSize(m_maxHistorySize);
     
     // Trim history if needed
-    while (m_history.size() > m_maxHistorySize) {
-        m_history.removeLast();
-    }
+    trimHistory();
     
     if (m_history.size() < size) {
         emit historyChanged();
     }
 }
 
-QList<ClipboardItem> ClipboardManager::search(const QString& query) const
+QList<ClipboardItem> ClipboardManager::search(const QString& query, int limit) const
 {
+    StallWatchdog::Scope scope("search", m_history.size());
     QList<ClipboardItem> results;
     
     if (query.isEmpty()) {
-        return m_history;
+        return m_history.mid(0, limit);
     }
     
     const QString lowerQuery = query.toLower();
     
     for (const auto& item : m_history) {
+        if (results.size() >= limit) {
+            return results;
+        }
         if (item.text().toLower().contains(lowerQuery) ||
             item.preview().toLower().contains(lowerQuery) ||
             item.typeString().toLower().contains(lowerQuery)) {
@@ -66,53 +485,910 @@ QList<ClipboardItem> ClipboardManager::search(const QString& query) const
         }
     }
     
+    // Everything archived is older than the history
+    HistoryArchive::Query archiveQuery;
+    archiveQuery.text = query;
+    results += m_archive->search(archiveQuery, limit - results.size());
+    
     return results;
 }
 
+QList<ClipboardManager::SearchResult> ClipboardManager::rankedSearch(const QString& query, int limit, int typeFilter) const
+{
+    StallWatchdog::Scope scope("search", m_history.size());
+    QList<SearchResult> results;
+    
+    if (limit <= 0) {
+        return results;
+    }
+    
+    const FuzzyMatcher matcher(query);
+    const int count = m_history.size();
+    
+    // Without a query the ranking is plain history order
+    if (matcher.isEmpty()) {
+        for (int i = 0; i < count && results.size() < limit; ++i) {
+            if (typeFilter == -1 || m_history[i].type() == typeFilter) {
+                results.append({i, 0, {}});
+            }
+        }
+        return results;
+    }
+    
+    // Candidates are (score, index); better means higher score, then more recent
+    using Candidate = std::pair<int, int>;
+    const auto better = [](const Candidate& a, const Candidate& b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    };
+    
+    // Bounded heap whose top is the worst of the best `limit` candidates so far
+    std::priority_queue<Candidate, std::vector<Candidate>, decltype(better)> heap(better);
+    
+    for (int i = 0; i < count; ++i) {
+        const ClipboardItem& item = m_history[i];
+        if (typeFilter != -1 && item.type() != typeFilter) {
+            continue;
+        }
+        
+        int score = matchItem(matcher, item, nullptr);
+        if (score < 0) {
+            continue;
+        }
+        score += kRecencyBonus * (count - i) / count;
+        
+        const Candidate candidate(score, i);
+        if (static_cast<int>(heap.size()) < limit) {
+            heap.push(candidate);
+        } else if (better(candidate, heap.top())) {
+            heap.pop();
+            heap.push(candidate);
+        }
+    }
+    
+    std::vector<Candidate> ranked;
+    ranked.reserve(heap.size());
+    while (!heap.empty()) {
+        ranked.push_back(heap.top());
+        heap.pop();
+    }
+    std::reverse(ranked.begin(), ranked.end());
+    
+    // Only the survivors pay for match offsets
+    results.reserve(static_cast<int>(ranked.size()));
+    for (const Candidate& candidate : ranked) {
+        SearchResult result{candidate.second, candidate.first, {}};
+        matcher.match(m_history[candidate.second].preview(), &result.positions);
+        results.append(result);
+    }
+    
+    return results;
+}
+
+QList<ClipboardManager::SearchResult> ClipboardManager::topItems(const QString& query, int limit,
+                                                                 Ranking ranking, int typeFilter) const
+{
+    HistoryQuery historyQuery;
+    historyQuery.text = query;
+    historyQuery.typeFilter = typeFilter;
+    historyQuery.limit = limit;
+    historyQuery.ranking = ranking;
+    return topItems(historyQuery);
+}
+
+QList<ClipboardManager::SearchResult> ClipboardManager::topItems(const HistoryQuery& query) const
+{
+    StallWatchdog::Scope scope("search", m_history.size());
+    QList<SearchResult> results;
+    const FuzzyMatcher matcher(query.text);
+    // Indexes come from the ranking and the time index; an entry those still
+    // hold for an item that is gone is skipped
+    const auto accept = [&](int index) {
+        if (index < 0) {
+            return;
+        }
+        const ClipboardItem& item = m_history[index];
+        if (query.typeFilter != -1 && item.type() != query.typeFilter) {
+            return;
+        }
+        
+        SearchResult result{index, 0, {}};
+        if (!matcher.isEmpty()) {
+            result.score = matchItem(matcher, item, &result.positions);
+            if (result.score < 0) {
+                return;
+            }
+        }
+        results.append(result);
+    };
+    
+    if (!query.from.isValid() && !query.to.isValid()) {
+        // Walk the history in ranking order and stop as soon as we have enough
+        const int count = query.ranking == FrecencyRanking ? static_cast<int>(m_frecencyRanking.size())
+                                                           : m_history.size();
+        for (int rank = 0; rank < count && results.size() < query.limit; ++rank) {
+            accept(query.ranking == FrecencyRanking ? indexOf(m_frecencyRanking[rank].id) : rank);
+        }
+        return results;
+    }
+    
+    // Only the items in the time range are looked at; "to" is inclusive
+    const qint64 from = query.from.isValid() ? query.from.toMSecsSinceEpoch() : LLONG_MIN;
+    const qint64 to = query.to.isValid() ? query.to.toMSecsSinceEpoch() + 1 : LLONG_MAX;
+    const std::vector<quint64> ids = m_timeIndex.range(from, to);
+    if (query.ranking == RecencyRanking) {
+        for (size_t i = 0; i < ids.size() && results.size() < query.limit; ++i) {
+            accept(indexOf(ids[i]));
+        }
+        return results;
+    }
+    
+    std::vector<RankEntry> ranked;
+    ranked.reserve(ids.size());
+    for (const quint64 id : ids) {
+        const int index = indexOf(id);
+        if (index >= 0) {
+            ranked.push_back({m_history[index].frecency(), id});
+        }
+    }
+    std::sort(ranked.begin(), ranked.end(), [](const RankEntry& a, const RankEntry& b) {
+        return rankedBefore(a.frecency, a.id, b.frecency, b.id);
+    });
+    for (size_t i = 0; i < ranked.size() && results.size() < query.limit; ++i) {
+        accept(indexOf(ranked[i].id));
+    }
+    return results;
+}
+
+QList<ClipboardItem> ClipboardManager::searchArchive(const HistoryQuery& query, int offset) const
+{
+    HistoryArchive::Query archiveQuery;
+    archiveQuery.text = query.text;
+    archiveQuery.typeFilter = query.typeFilter;
+    archiveQuery.from = query.from;
+    archiveQuery.to = query.to;
+    
+    HistoryArchive::SearchStats stats;
+    const QList<ClipboardItem> results = m_archive->search(archiveQuery, query.limit, offset, &stats);
+    qCDebug(lcPerf) << "Archive search:" << results.size() << "results," << stats.segmentsScanned << "segments scanned,"
+                    << stats.segmentsSkipped << "skipped in" << stats.nsecs / 1000 << "us";
+    return results;
+}
+
+bool ClipboardManager::archivedItem(quint64 id, ClipboardItem* item) const
+{
+    return m_archive->item(id, item);
+}
+
+void ClipboardManager::setMaxIngestRate(double perSecond)
+{
+    m_maxIngestRate = qMax(0.0, perSecond);
+    m_ingestTokens = qMin(m_ingestTokens, qMax(1.0, m_maxIngestRate));
+}
+
+ClipboardManager::ChangeStats ClipboardManager::changeStats() const
+{
+    ChangeStats stats = m_changeStats;
+    const double minutes = qMax<qint64>(1, m_changeClock.elapsed()) / 60000.0;
+    stats.rawPerMinute = stats.rawEvents / minutes;
+    stats.processedPerMinute = stats.processedEvents / minutes;
+    return stats;
+}
+
+void ClipboardManager::onClipboardDataChanged()
+{
+    // Trailing-edge debounce: each change pushes processing back, but never
+    // past the latency bound of the burst, nor before a rate-limited retry
+    ++m_changeStats.rawEvents;
+    if (m_updateTimer->isActive()) {
+        ++m_changeStats.coalescedEvents;
+    }
+    if (!m_burstStart.isValid()) {
+        m_burstStart.start();
+    }
+    
+    const qint64 latencyLeft = m_maxCoalesceLatencyMsecs - m_burstStart.elapsed();
+    const qint64 retryIn = m_rateLimitedUntil - m_changeClock.elapsed();
+    const qint64 delay = qMax(qMax<qint64>(0, qMin<qint64>(m_coalesceDelayMsecs, latencyLeft)), retryIn);
+    m_updateTimer->start(static_cast<int>(delay));
+}
+
 void ClipboardManager::onClipboardChanged()
 {
+    StallWatchdog::Scope scope("onClipboardChanged");
     const QMimeData* mimeData = m_clipboard->mimeData();
     if (!mimeData) {
         return;
     }
     
-    // Prevent processing our own clipboard changes
-    if (sender() == m_clipboard && m_updateTimer->isActive()) {
+    qint64 waitMsecs = 0;
+    if (!takeIngestToken(&waitMsecs)) {
+        ++m_changeStats.rateLimited;
+        if (m_rateLimitPolicy == KeepLatest) {
+            // The clipboard is read when the timer fires, so whatever is on
+            // it by then is what gets captured
+            m_rateLimitedUntil = m_changeClock.elapsed() + waitMsecs;
+            m_updateTimer->start(static_cast<int>(waitMsecs));
+        } else {
+            m_burstStart.invalidate();
+            m_copyBackId = 0;
+        }
         return;
     }
     
-    ClipboardItem newItem(mimeData);
+    ++m_changeStats.processedEvents;
+    if (m_burstStart.isValid()) {
+        m_changeStats.worstLatencyMsecs = qMax(m_changeStats.worstLatencyMsecs, m_burstStart.elapsed());
+        m_burstStart.invalidate();
+    }
     
-    // Skip empty or duplicate items
-    if (newItem.text().isEmpty() || isDuplicate(newItem)) {
-        return;
+    // Cheap checks on formats and raw bytes before anything is decoded
+    IngestionFilter::Payload payload;
+    const IngestionFilter::Rule rule = m_ingestionFilter.check(mimeData, &payload);
+    scope.setPayloadSize(payload.data.size());
+    bool changed = false;
+    if ((rule == IngestionFilter::Accepted || rule == IngestionFilter::RecentDuplicate) &&
+        payload.hash != 0 && payload == m_lastPayload) {
+        // The same bytes again, e.g. a script copying in a loop
+        ++m_changeStats.collapsedDuplicates;
+    } else if (rule == IngestionFilter::RecentDuplicate) {
+        // Recopying a recent item moves it to the top without rebuilding it
+        const int index = indexOf(payload.recentId);
+        if (index > 0) {
+            promoteItem(index, payload);
+            changed = true;
+        }
+    } else if (rule == IngestionFilter::Accepted) {
+        ClipboardItem newItem(mimeData, payload.format, payload.data);
+        
+        // Skip empty or duplicate items
+        if ((!newItem.text().isEmpty() || newItem.needsTextExtraction()) && !isDuplicate(newItem)) {
+            ingest(newItem, payload);
+            changed = true;
+        }
+    }
+    if (rule == IngestionFilter::Accepted || rule == IngestionFilter::RecentDuplicate) {
+        m_lastPayload = payload;
+    }
+    
+    // Only changes that reach the history use up the rate
+    if (!changed && m_maxIngestRate > 0) {
+        m_ingestTokens += 1.0;
+    }
+    
+    m_copyBackId = 0;
+}
+
+bool ClipboardManager::takeIngestToken(qint64* waitMsecs)
+{
+    if (m_maxIngestRate <= 0) {
+        return true;
+    }
+    
+    // Token bucket holding up to one second's worth of changes
+    const qint64 now = m_changeClock.elapsed();
+    m_ingestTokens = qMin(qMax(1.0, m_maxIngestRate),
+                          m_ingestTokens + (now - m_tokensRefilledAt) * m_maxIngestRate / 1000.0);
+    m_tokensRefilledAt = now;
+    if (m_ingestTokens >= 1.0) {
+        m_ingestTokens -= 1.0;
+        m_rateLimitedUntil = 0;
+        return true;
+    }
+    
+    *waitMsecs = static_cast<qint64>(std::ceil((1.0 - m_ingestTokens) * 1000.0 / m_maxIngestRate));
+    return false;
+}
+
+void ClipboardManager::ingest(const ClipboardItem& item, const IngestionFilter::Payload& payload)
+{
+    PendingCapture capture{++m_nextSequence, item, payload, m_copyBackId, false, {}, {}};
+    const QString text = item.type() == ClipboardItem::Image ? QString() : item.text();
+    
+    // The markup is kept for copy-back, so secrets in attributes, scripts
+    // and hidden inputs are looked for as well as in the visible text
+    const QString html = item.html();
+    
+    if (item.needsTextExtraction()) {
+        // Large markup: the worker extracts the visible text, then scans both
+        const quint64 sequence = capture.sequence;
+        m_ingestionPool.start([this, sequence, html]() {
+            QElapsedTimer timer;
+            timer.start();
+            const QString text = HtmlText::toPlainText(html);
+            const qint64 nsecs = qMax<qint64>(1, timer.nsecsElapsed());
+            qCDebug(lcPerf) << "Extracted" << text.size() / 1024 << "KiB of text from" << html.size() / 1024
+                            << "KiB of HTML in" << nsecs / 1000000.0 << "ms," << html.size() * 2.0 / nsecs << "GB/s";
+            const QList<SecretScanner::Finding> findings = SecretScanner::instance().scan(text);
+            const QList<SecretScanner::Finding> markupFindings = SecretScanner::instance().scanMarkup(html);
+            
+            QMetaObject::invokeMethod(this, [this, sequence, findings, markupFindings, text]() {
+                onSecretsScanned(sequence, findings, markupFindings, text);
+            }, Qt::QueuedConnection);
+        });
+    } else if (text.isEmpty() && html.isEmpty()) {
+        // Images have nothing to scan
+        capture.scanned = true;
+    } else {
+        // Even short texts are scanned on the worker, so no copy costs the GUI
+        // thread a scan. The text is implicitly shared, so the worker gets it
+        // without a copy.
+        const quint64 sequence = capture.sequence;
+        m_ingestionPool.start([this, sequence, text, html]() {
+            QElapsedTimer timer;
+            timer.start();
+            const QList<SecretScanner::Finding> findings = SecretScanner::instance().scan(text);
+            const QList<SecretScanner::Finding> markupFindings = SecretScanner::instance().scanMarkup(html);
+            const qint64 nsecs = qMax<qint64>(1, timer.nsecsElapsed());
+            qCDebug(lcPerf) << "Scanned" << (text.size() + html.size()) / 1024 << "KiB for secrets in"
+                            << nsecs / 1000000.0 << "ms," << (text.size() + html.size()) * 2.0 / nsecs << "GB/s";
+            
+            QMetaObject::invokeMethod(this, [this, sequence, findings, markupFindings]() {
+                onSecretsScanned(sequence, findings, markupFindings);
+            }, Qt::QueuedConnection);
+        });
+    }
+    
+    m_pendingCaptures.push_back(capture);
+    commitScannedCaptures();
+}
+
+void ClipboardManager::onSecretsScanned(quint64 sequence, const QList<SecretScanner::Finding>& findings,
+                                        const QList<SecretScanner::Finding>& markupFindings,
+                                        const QString& extractedText)
+{
+    // Captures queued before attaching to a daemon are gone
+    for (PendingCapture& capture : m_pendingCaptures) {
+        if (capture.sequence == sequence) {
+            if (capture.item.needsTextExtraction()) {
+                capture.item.setExtractedText(extractedText);
+            }
+            capture.findings = findings;
+            capture.markupFindings = markupFindings;
+            capture.scanned = true;
+            commitScannedCaptures();
+            return;
+        }
+    }
+}
+
+void ClipboardManager::commitScannedCaptures()
+{
+    while (!m_pendingCaptures.empty() && m_pendingCaptures.front().scanned) {
+        PendingCapture capture = m_pendingCaptures.front();
+        m_pendingCaptures.pop_front();
+        
+        // Markup extracted on the worker may have had no visible text
+        if (capture.item.text().isEmpty() ||
+            !applySecretPolicy(capture.item, capture.findings, capture.markupFindings)) {
+            continue;
+        }
+        
+        // Copy-back accounting refers to the clipboard change this came from
+        const quint64 copyBackId = m_copyBackId;
+        m_copyBackId = capture.copyBackId;
+        addItem(capture.item);
+        m_copyBackId = copyBackId;
+        m_ingestionFilter.remember(capture.payload, m_history.first().id());
+        
+        if (capture.item.expiresAt().isValid()) {
+            scheduleExpiry();
+        }
+    }
+}
+
+bool ClipboardManager::applySecretPolicy(ClipboardItem& item, const QList<SecretScanner::Finding>& findings,
+                                         const QList<SecretScanner::Finding>& markupFindings)
+{
+    SecretAction strongest = KeepSecret;
+    SecretScanner::Kind kind = SecretScanner::KindCount;
+    for (const SecretScanner::Finding& finding : findings + markupFindings) {
+        if (m_secretActions[finding.kind] > strongest) {
+            strongest = m_secretActions[finding.kind];
+            kind = finding.kind;
+        }
+    }
+    if (strongest == KeepSecret) {
+        return true;
+    }
+    if (strongest == DropSecret) {
+        ++m_changeStats.droppedSecrets;
+        qCInfo(lcPrivacy) << "Dropped a capture holding a secret:" << SecretScanner::kindName(kind);
+        return false;
+    }
+    
+    bool expires = false;
+    const QString text = maskSecrets(item.text(), findings, &expires);
+    const QString html = maskSecrets(item.html(), markupFindings, &expires);
+    
+    // Masking the text drops the markup, which a secret may be split across
+    // by tags or entities; secrets only in the markup are masked there
+    if (text != item.text()) {
+        item.replaceText(text);
+    } else if (html != item.html()) {
+        item.replaceHtml(html);
+    }
+    if (expires) {
+        item.setExpiresAt(QDateTime::currentDateTime().addMSecs(m_secretExpiryMsecs));
+    }
+    return true;
+}
+
+QString ClipboardManager::maskSecrets(const QString& text, const QList<SecretScanner::Finding>& findings,
+                                      bool* expires) const
+{
+    // Findings come in text order and never overlap
+    QString masked;
+    int position = 0;
+    for (const SecretScanner::Finding& finding : findings) {
+        const SecretAction action = m_secretActions[finding.kind];
+        if (action == ExpireSecret) {
+            *expires = true;
+        } else if (action == MaskSecret) {
+            const int prefix = finding.kind == SecretScanner::PasswordAssignment ||
+                               finding.kind == SecretScanner::HighEntropyToken ? 0 : kMaskedPrefixLength;
+            masked += QStringView(text).mid(position, finding.start + prefix - position);
+            masked += QString(kMaskLength, QChar(0x2022));
+            position = finding.start + finding.length;
+        }
+    }
+    if (position == 0) {
+        return text;
+    }
+    masked += QStringView(text).mid(position);
+    return masked;
+}
+
+void ClipboardManager::scheduleExpiry()
+{
+    QDateTime next;
+    for (const ClipboardItem& item : m_history) {
+        if (item.expiresAt().isValid() && (!next.isValid() || item.expiresAt() < next)) {
+            next = item.expiresAt();
+        }
     }
     
-    addItem(newItem);
+    if (next.isValid()) {
+        m_expiryTimer->start(qMax<qint64>(0, QDateTime::currentDateTime().msecsTo(next)));
+    } else {
+        m_expiryTimer->stop();
+    }
+}
+
+void ClipboardManager::onExpiryTimeout()
+{
+    const QDateTime now = QDateTime::currentDateTime();
+    bool removed = false;
+    for (int i = m_history.size() - 1; i >= 0; --i) {
+        if (m_history[i].expiresAt().isValid() && m_history[i].expiresAt() <= now) {
+            removeAt(i);
+            removed = true;
+        }
+    }
+    
+    scheduleExpiry();
+    if (removed) {
+        emit historyChanged();
+    }
+}
+
+void ClipboardManager::promoteItem(int index, const IngestionFilter::Payload& payload)
+{
+    // addItem finds the old copy, carries its usage over and drops it
+    ClipboardItem item = m_history[index];
+    item.setTimestamp(QDateTime::currentDateTime());
+    addItem(item);
+    m_ingestionFilter.remember(payload, m_history.first().id());
 }
 
 void ClipboardManager::addItem(const ClipboardItem& item)
 {
-    // Remove existing duplicate if found
+    const ClipboardItem newItem = insertItem(item);
+    emit newItemAdded(newItem);
+    emit historyChanged();
+}
+
+ClipboardItem ClipboardManager::insertItem(const ClipboardItem& item)
+{
+    ClipboardItem newItem(item);
+    newItem.setId(++m_nextId);
+    
+    // Remove existing duplicate if found, carrying its usage and pin over
+    int useCount = 0;
+    double frecency = 0.0;
+    bool countAsUse = true;
+    quint64 clusterId = 0;
+    quint64 oldId = 0;
     for (int i = 0; i < m_history.size(); ++i) {
         if (m_history[i] == item) {
-            m_history.removeAt(i);
+            oldId = m_history[i].id();
+            useCount = m_history[i].useCount();
+            frecency = m_history[i].frecency();
+            countAsUse = m_history[i].id() != m_copyBackId;
+            clusterId = m_history[i].clusterId();
+            newItem.setPinned(newItem.isPinned() || m_history[i].isPinned());
+            removeAt(i);
             break;
         }
     }
     
+    // Near-identical texts join the cluster of their closest match, which
+    // the history view can collapse into one row
+    if (clusterId == 0) {
+        const int nearest = indexOf(m_textIndex.findNearest(newItem.fingerprint()));
+        clusterId = nearest >= 0 ? m_history[nearest].clusterId() : newItem.id();
+    }
+    newItem.setClusterId(clusterId);
+    
+    if (countAsUse) {
+        frecency = accumulateFrecency(frecency, useCount, newItem.timestamp());
+        ++useCount;
+    }
+    newItem.setUsage(useCount, frecency);
+    
     // Add to beginning of history
-    m_history.prepend(item);
+    m_history.prepend(newItem);
+    insertRanking(newItem);
+    m_textIndex.insert(newItem.fingerprint(), newItem.id());
+    m_timeIndex.insert(newItem.timestamp().toMSecsSinceEpoch(), newItem.id());
+    
+    // Items that hold a likely secret never reach the disk. Evictions need no
+    // record; replay trims to the logged maximum size the same way.
+    if (!newItem.expiresAt().isValid()) {
+        if (oldId != 0) {
+            m_historyLog.appendMove(oldId, newItem);
+        } else {
+            m_historyLog.appendItem(newItem);
+        }
+    }
+    
+    analyzeItem(newItem);
     
     // Trim history if it exceeds max size
-    while (m_history.size() > m_maxHistorySize) {
-        m_history.removeLast();
+    trimHistory();
+    return newItem;
+}
+
+void ClipboardManager::analyzeItem(const ClipboardItem& item)
+{
+    // Decoded pixels are only held until the worker has them encoded; either
+    // way the worker hashes the thumbnail for near-duplicate detection
+    if (item.needsEncoding()) {
+        m_thumbnails->encodeImage(item.id(), item.pendingImage());
+    } else if (item.type() == ClipboardItem::Image && item.hasImage()) {
+        m_thumbnails->analyzeImage(item.id(), item.imageData());
+    } else if (item.type() == ClipboardItem::Code) {
+        m_highlights->analyze(item.id(), item.text(), item.preview());
+    }
+}
+
+void ClipboardManager::onImportStarted(qint64 itemCount)
+{
+    // Imported items are older than everything captured, so they get a block
+    // of ids just below the history and the archive. The list stays in id
+    // order, eviction takes imported items first and no id changes.
+    quint64 floor = m_history.isEmpty() ? m_nextId + 1 : m_history.last().id();
+    const quint64 archivedMinId = m_archive->minId();
+    if (archivedMinId > 0) {
+        floor = qMin(floor, archivedMinId);
+    }
+    
+    // Histories from before captured ids started high may have little room
+    const quint64 requested = static_cast<quint64>(qMax<qint64>(0, itemCount));
+    const quint64 count = qMin(requested, floor - 1);
+    if (count < requested) {
+        qWarning("Import: only %llu of %llu items fit below the history's ids", count, requested);
     }
+    m_importEndId = floor - 1;
+    m_importNextId = m_importEndId - count;
+}
+
+void ClipboardManager::onItemsImported(const QList<HistoryTransfer::Imported>& items)
+{
+    // The transfer has dropped duplicates and scanned for secrets already;
+    // the policy is applied here, as on capture. The batch is spliced in and
+    // the ranking merged once.
+    StallWatchdog::Scope scope("importItems", items.size());
+    const auto ranked = [](const RankEntry& a, const RankEntry& b) {
+        return rankedBefore(a.frecency, a.id, b.frecency, b.id);
+    };
+    const size_t rankedCount = m_frecencyRanking.size();
+    m_frecencyRanking.reserve(rankedCount + items.size());
+    
+    QList<ClipboardItem> added;         // Oldest first
+    QHash<quint64, quint64> clusters;   // Of the batch, not in the history yet
+    bool expiring = false;
+    for (const HistoryTransfer::Imported& imported : items) {
+        // Only a file holding more items than its header says runs out
+        if (m_importNextId >= m_importEndId) {
+            break;
+        }
+        ClipboardItem item(imported.item);
+        if (!applySecretPolicy(item, imported.findings, imported.markupFindings)) {
+            continue;
+        }
+        item.setId(++m_importNextId);
+        const quint64 nearestId = m_textIndex.findNearest(item.fingerprint());
+        const int nearest = indexOf(nearestId);
+        item.setClusterId(nearest >= 0 ? m_history[nearest].clusterId() : clusters.value(nearestId, item.id()));
+        clusters.insert(item.id(), item.clusterId());
+        
+        m_frecencyRanking.push_back(RankEntry{item.frecency(), item.id()});
+        m_textIndex.insert(item.fingerprint(), item.id());
+        m_timeIndex.insert(item.timestamp().toMSecsSinceEpoch(), item.id());
+        expiring = expiring || item.expiresAt().isValid();
+        added.append(item);
+    }
+    if (added.isEmpty()) {
+        return;
+    }
+    
+    // Newer than earlier batches of the import and older than the items
+    // captured, so the batch goes in as one block between them
+    const auto position = std::lower_bound(m_history.cbegin(), m_history.cend(), added.last().id(),
+                                           [](const ClipboardItem& item, quint64 value) {
+                                               return item.id() > value;
+                                           }) - m_history.cbegin();
+    m_history.insert(position, added.size(), ClipboardItem());
+    std::copy(added.crbegin(), added.crend(), m_history.begin() + position);
+    
+    const auto middle = m_frecencyRanking.begin() + rankedCount;
+    std::sort(middle, m_frecencyRanking.end(), ranked);
+    std::inplace_merge(m_frecencyRanking.begin(), middle, m_frecencyRanking.end(), ranked);
+    
+    // Only items the trim kept are logged and analyzed; replay trims the
+    // same way, so it never needs the others
+    trimHistory();
+    for (const ClipboardItem& item : std::as_const(added)) {
+        if (indexOf(item.id()) < 0) {
+            continue;
+        }
+        if (!item.expiresAt().isValid()) {
+            m_historyLog.appendItem(item);
+        }
+        analyzeItem(item);
+    }
+    if (expiring) {
+        scheduleExpiry();
+    }
+    emit historyChanged();
+}
+
+void ClipboardManager::removeAt(int index)
+{
+    removeRanking(m_history[index]);
+    m_imageHashes.remove(m_history[index].id());
+    m_textIndex.remove(m_history[index].id());
+    m_timeIndex.remove(m_history[index].timestamp().toMSecsSinceEpoch(), m_history[index].id());
+    m_ingestionFilter.forget(m_history[index].id());
+    m_thumbnails->remove(m_history[index].id());
+    m_highlights->remove(m_history[index].id());
+    m_history.removeAt(index);
+    
+    // Copying the removed newest item again must bring it back
+    if (index == 0) {
+        m_lastPayload = IngestionFilter::Payload();
+    }
+}
+
+QList<quint64> ClipboardManager::removeIds(const QSet<quint64>& ids)
+{
+    // Per-item indexes first, then each list is compacted in one pass
+    QList<quint64> removed;
+    for (const ClipboardItem& item : std::as_const(m_history)) {
+        if (ids.contains(item.id())) {
+            removed.append(item.id());
+            m_imageHashes.remove(item.id());
+            m_textIndex.remove(item.id());
+            m_ingestionFilter.forget(item.id());
+            m_thumbnails->remove(item.id());
+            m_highlights->remove(item.id());
+        }
+    }
+    if (removed.isEmpty()) {
+        return removed;
+    }
+    
+    // Copying the removed newest item again must bring it back
+    if (removed.first() == m_history.first().id()) {
+        m_lastPayload = IngestionFilter::Payload();
+    }
+    
+    m_frecencyRanking.erase(std::remove_if(m_frecencyRanking.begin(), m_frecencyRanking.end(),
+                                           [&ids](const RankEntry& entry) { return ids.contains(entry.id); }),
+                            m_frecencyRanking.end());
+    m_timeIndex.remove(ids);
+    m_history.removeIf([&ids](const ClipboardItem& item) { return ids.contains(item.id()); });
+    return removed;
+}
+
+void ClipboardManager::clearAll()
+{
+    m_history.clear();
+    m_frecencyRanking.clear();
+    m_imageHashes.clear();
+    m_textIndex.clear();
+    m_timeIndex.clear();
+    m_ingestionFilter.forgetRecent();
+    m_thumbnails->clear();
+    m_highlights->clear();
+    m_lastPayload = IngestionFilter::Payload();
+}
+
+void ClipboardManager::trimHistory()
+{
+    // Items about to expire are never logged, so they neither count toward
+    // the limit nor get evicted; HistoryLog's replay trims without them and
+    // must end up with the same items. Evicted items move to the archive,
+    // oldest first. Pinned items and the newest logged item stay, as there.
+    int logged = 0;
+    int newestLogged = -1;
+    for (int index = 0; index < m_history.size(); ++index) {
+        if (!m_history[index].expiresAt().isValid()) {
+            newestLogged = newestLogged < 0 ? index : newestLogged;
+            ++logged;
+        }
+    }
+    
+    QList<ClipboardItem> evicted;
+    for (int index = m_history.size() - 1; logged > m_maxHistorySize && index > newestLogged; --index) {
+        if (m_history[index].isPinned() || m_history[index].expiresAt().isValid()) {
+            continue;
+        }
+        evicted.append(m_history[index]);
+        removeAt(index);
+        --logged;
+    }
+    
+    if (!evicted.isEmpty() && !m_daemonClient) {
+        m_archive->archive(evicted);
+    }
+}
+
+void ClipboardManager::onDaemonReset()
+{
+    clearAll();
+    emit historyChanged();
+}
+
+void ClipboardManager::onDaemonPage(int offset, const QList<ClipboardItem>& items, bool last)
+{
+    // Pages arrive in history order, so appending keeps ids descending
+    for (const ClipboardItem& item : items) {
+        m_history.append(item);
+        insertRanking(item);
+        m_timeIndex.insert(item.timestamp().toMSecsSinceEpoch(), item.id());
+    }
+    
+    // Repaint after the first page so the newest items show right away
+    if (offset == 0 || last) {
+        emit historyChanged();
+    }
+}
+
+void ClipboardManager::onDaemonItemAdded(const ClipboardItem& item, int maxHistorySize)
+{
+    // Mirror the daemon's addItem: drop the older copy, prepend, trim
+    for (int i = 0; i < m_history.size(); ++i) {
+        if (m_history[i] == item) {
+            removeAt(i);
+            break;
+        }
+    }
+    
+    m_history.prepend(item);
+    insertRanking(item);
+    m_timeIndex.insert(item.timestamp().toMSecsSinceEpoch(), item.id());
+    m_maxHistorySize = maxHistorySize;
+    trimHistory();
     
     emit newItemAdded(item);
     emit historyChanged();
 }
 
+void ClipboardManager::onImageEncoded(quint64 id, const QByteArray& imageData)
+{
+    // The item may have been removed while it was being encoded
+    const int index = indexOf(id);
+    if (index >= 0) {
+        m_history[index].setImageData(imageData);
+        
+        // Rows and daemon clients copied the item before it had its bytes
+        if (!m_encodedTimer->isActive()) {
+            m_encodedTimer->start();
+        }
+    }
+}
+
+void ClipboardManager::onImageHashed(quint64 id, quint64 hash)
+{
+    if (indexOf(id) < 0) {
+        return;
+    }
+    
+    // Repeated screenshots of one window collapse into the newest of them.
+    // Hashes can finish out of order, so that is not necessarily this one.
+    const QList<quint64> matches = m_imageHashes.find(hash, m_nearDuplicateDistance);
+    quint64 keepId = id;
+    for (const quint64 match : matches) {
+        keepId = qMax(keepId, match);
+    }
+    
+    bool collapsed = false;
+    for (const quint64 match : matches + QList<quint64>{id}) {
+        const int index = indexOf(match);
+        if (match == keepId || index < 0) {
+            continue;
+        }
+        const ClipboardItem duplicate = m_history[index];
+        removeAt(index);
+        m_historyLog.appendRemove(match);
+        
+        // A pin on the dropped copy moves to the kept one
+        const int keepIndex = indexOf(keepId);
+        if (duplicate.isPinned() && !m_history[keepIndex].isPinned()) {
+            m_history[keepIndex].setPinned(true);
+            m_historyLog.appendPinned({keepId}, true);
+        }
+        mergeUsage(keepIndex, duplicate);
+        collapsed = true;
+    }
+    
+    if (keepId == id) {
+        m_imageHashes.insert(hash, id);
+    }
+    if (collapsed) {
+        qCDebug(lcPerf) << "Collapsed near-duplicate images into item" << keepId;
+        emit historyChanged();
+    }
+}
+
+void ClipboardManager::recordUse(int index)
+{
+    ClipboardItem& item = m_history[index];
+    
+    removeRanking(item);
+    item.setUsage(item.useCount() + 1,
+                  accumulateFrecency(item.frecency(), item.useCount(), QDateTime::currentDateTime()));
+    insertRanking(item);
+    m_historyLog.appendUsage(item);
+}
+
+void ClipboardManager::mergeUsage(int index, const ClipboardItem& other)
+{
+    ClipboardItem& item = m_history[index];
+    if (other.useCount() == 0) {
+        return;
+    }
+    
+    removeRanking(item);
+    item.setUsage(item.useCount() + other.useCount(),
+                  item.useCount() == 0 ? other.frecency() : logSum(item.frecency(), other.frecency()));
+    insertRanking(item);
+    m_historyLog.appendUsage(item);
+}
+
+void ClipboardManager::insertRanking(const ClipboardItem& item)
+{
+    const RankEntry entry{item.frecency(), item.id()};
+    const auto it = std::lower_bound(m_frecencyRanking.begin(), m_frecencyRanking.end(), entry,
+                                     [](const RankEntry& a, const RankEntry& b) {
+                                         return rankedBefore(a.frecency, a.id, b.frecency, b.id);
+                                     });
+    m_frecencyRanking.insert(it, entry);
+}
+
+void ClipboardManager::removeRanking(const ClipboardItem& item)
+{
+    const RankEntry entry{item.frecency(), item.id()};
+    const auto it = std::lower_bound(m_frecencyRanking.begin(), m_frecencyRanking.end(), entry,
+                                     [](const RankEntry& a, const RankEntry& b) {
+                                         return rankedBefore(a.frecency, a.id, b.frecency, b.id);
+                                     });
+    if (it != m_frecencyRanking.end() && it->id == item.id()) {
+        m_frecencyRanking.erase(it);
+    }
+}
+
 bool ClipboardManager::isDuplicate(const ClipboardItem& item) const
 {
     if (m_history.isEmpty()) {
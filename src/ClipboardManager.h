@@ -3,26 +3,187 @@
 
 #include <QObject>
 #include <QClipboard>
+#include <QElapsedTimer>
 #include <QTimer>
 #include <QList>
+#include <QSet>
+#include <QThreadPool>
+#include <array>
+#include <deque>
+#include <vector>
 #include "ClipboardItem.h"
+#include "HistoryLog.h"
+#include "HistoryTransfer.h"
+#include "ImageHashIndex.h"
+#include "IngestionFilter.h"
+#include "SecretScanner.h"
+#include "SimHashIndex.h"
+#include "TimestampIndex.h"
+
+class HighlightCache;
+class HistoryArchive;
+class HistoryClient;
+class ThumbnailCache;
 
 class ClipboardManager : public QObject
 {
     Q_OBJECT
     
 public:
+    static const int kDefaultSearchLimit = 500;
+    
+    enum Ranking {
+        RecencyRanking,
+        FrecencyRanking     // Copy-back count weighted by an exponential recency decay
+    };
+    
+    // What happens to a captured text in which SecretScanner finds a secret.
+    // Ordered by severity; the most severe action over all findings wins.
+    enum SecretAction {
+        KeepSecret,
+        ExpireSecret,       // Kept, then removed after secretExpiryMsecs()
+        MaskSecret,         // The secret is replaced by bullets before storing
+        DropSecret          // Never stored
+    };
+    
+    // What happens to clipboard changes over maxIngestRate()
+    enum RateLimitPolicy {
+        DropExcess,         // Changes without a token are ignored
+        KeepLatest          // Processing waits for a token, then takes the clipboard as it is by then
+    };
+    
+    // Clipboard change events as delivered versus as processed
+    struct ChangeStats
+    {
+        quint64 rawEvents = 0;          // dataChanged signals
+        quint64 processedEvents = 0;
+        quint64 coalescedEvents = 0;    // Merged into a later event by the debounce
+        quint64 collapsedDuplicates = 0;    // Same bytes as the change processed before
+        quint64 rateLimited = 0;        // Dropped, or deferred under KeepLatest
+        quint64 droppedSecrets = 0;     // Captures and imports dropped by the secret policy
+        double rawPerMinute = 0.0;
+        double processedPerMinute = 0.0;
+        qint64 worstLatencyMsecs = 0;   // First event of a burst to processing
+    };
+    
+    struct SearchResult
+    {
+        int index;              // Position in history()
+        int score;
+        QList<int> positions;   // Matched offsets into ClipboardItem::preview()
+    };
+    
+    // Filters for topItems(); an invalid from/to leaves that end of the time
+    // range open. A time range is looked up in timeIndex(), so narrow ranges
+    // are cheap however long the history is.
+    struct HistoryQuery
+    {
+        QString text;
+        int typeFilter = -1;
+        QDateTime from;
+        QDateTime to;
+        int limit = 10;
+        Ranking ranking = RecencyRanking;
+    };
+    
     explicit ClipboardManager(QObject* parent = nullptr);
+    ~ClipboardManager() override;
+    
+    // Stops capturing locally and mirrors the history of a capture daemon
+    // instead; mutations are forwarded to the daemon
+    void attachToDaemon(const QString& serverName);
+    bool isAttached() const { return m_daemonClient != nullptr; }
+    
+    // Restores the history from a write-ahead log and records every later
+    // mutation in it. Items captured before this are kept, as the newest.
+    bool openHistoryLog(const QString& path);
+    const HistoryLog& historyLog() const { return m_historyLog; }
+    
+    // Keeps items evicted from the history in on-disk segments under
+    // directory, where search() and searchArchive() still find them
+    bool openArchive(const QString& directory);
+    const HistoryArchive* archive() const { return m_archive; }
     
     // History management
     const QList<ClipboardItem>& history() const { return m_history; }
     void clearHistory();
     void removeItem(int index);
+    void copyToClipboard(int index);
+    
+    // Batch operations on sets of item ids. Each makes one pass over the
+    // history and emits historyChanged() once; unknown ids are ignored.
+    // mergeItems() replaces the non-image items among ids by one new item
+    // holding their texts, oldest first, and returns its id (0 if fewer than
+    // two were found, or when attached); items due to expire are left out.
+    // exportItems() writes their texts as UTF-8 and returns how many, or -1
+    // if path cannot be written.
+    void removeItems(const QSet<quint64>& ids);
+    void setPinned(const QSet<quint64>& ids, bool pinned);
+    quint64 mergeItems(const QSet<quint64>& ids);
+    int exportItems(const QSet<quint64>& ids, const QString& path) const;
+    
+    // Whole-history backup in HistoryTransfer's format, run in the
+    // background; transfer() reports progress and the result. Imported items
+    // not already in the history keep their timestamps and go in below the
+    // live items, so they are evicted first; the secret policy applies to
+    // them as to captures. Both return false while another transfer runs,
+    // and importHistory() when attached.
+    bool exportHistory(const QString& path);
+    bool importHistory(const QString& path);
+    HistoryTransfer* transfer() const { return m_transfer; }
+    int indexOf(quint64 id) const;
     int maxHistorySize() const { return m_maxHistorySize; }
     void setMaxHistorySize(int size);
     
-    // Search
-    QList<ClipboardItem> search(const QString& query) const;
+    // Capture times of the history items, for time ranges and day sections
+    const TimestampIndex& timeIndex() const { return m_timeIndex; }
+    
+    // Images whose perceptual hashes differ in at most this many bits are
+    // collapsed into the newest of them; -1 disables
+    int nearDuplicateDistance() const { return m_nearDuplicateDistance; }
+    void setNearDuplicateDistance(int distance) { m_nearDuplicateDistance = distance; }
+    
+    // Pre-filter applied to clipboard changes before items are built
+    IngestionFilter& ingestionFilter() { return m_ingestionFilter; }
+    const IngestionFilter& ingestionFilter() const { return m_ingestionFilter; }
+    
+    // Clipboard changes are processed once none followed for
+    // coalesceDelayMsecs(), but at most maxCoalesceLatencyMsecs() after the
+    // first change of a burst. maxIngestRate() caps processed changes per
+    // second; 0 means no cap.
+    int coalesceDelayMsecs() const { return m_coalesceDelayMsecs; }
+    void setCoalesceDelayMsecs(int msecs) { m_coalesceDelayMsecs = qMax(0, msecs); }
+    int maxCoalesceLatencyMsecs() const { return m_maxCoalesceLatencyMsecs; }
+    void setMaxCoalesceLatencyMsecs(int msecs) { m_maxCoalesceLatencyMsecs = qMax(0, msecs); }
+    double maxIngestRate() const { return m_maxIngestRate; }
+    void setMaxIngestRate(double perSecond);
+    RateLimitPolicy rateLimitPolicy() const { return m_rateLimitPolicy; }
+    void setRateLimitPolicy(RateLimitPolicy policy) { m_rateLimitPolicy = policy; }
+    ChangeStats changeStats() const;
+    
+    // Secret handling on the capture path
+    SecretAction secretAction(SecretScanner::Kind kind) const { return m_secretActions[kind]; }
+    void setSecretAction(SecretScanner::Kind kind, SecretAction action) { m_secretActions[kind] = action; }
+    int secretExpiryMsecs() const { return m_secretExpiryMsecs; }
+    void setSecretExpiryMsecs(int msecs) { m_secretExpiryMsecs = qMax(0, msecs); }
+    
+    // Thumbnails of image items, keyed by item id
+    ThumbnailCache* thumbnailCache() const { return m_thumbnails; }
+    
+    // Syntax highlighting of code items, keyed by item id
+    HighlightCache* highlightCache() const { return m_highlights; }
+    
+    // Search. search() returns the matching history items, then archived
+    // ones until limit items are found.
+    QList<ClipboardItem> search(const QString& query, int limit = kDefaultSearchLimit) const;
+    QList<SearchResult> rankedSearch(const QString& query, int limit, int typeFilter = -1) const;
+    QList<SearchResult> topItems(const QString& query, int limit, Ranking ranking,
+                                 int typeFilter = -1) const;
+    QList<SearchResult> topItems(const HistoryQuery& query) const;
+    
+    // Archived items only, newest first; text is matched as a substring
+    QList<ClipboardItem> searchArchive(const HistoryQuery& query, int offset = 0) const;
+    bool archivedItem(quint64 id, ClipboardItem* item) const;
     
     // Statistics
     int itemCount() const { return m_history.size(); }
@@ -32,16 +193,101 @@ signals:
     void newItemAdded(const ClipboardItem& item);
     
 private slots:
+    void onClipboardDataChanged();
     void onClipboardChanged();
+    void onDaemonReset();
+    void onDaemonPage(int offset, const QList<ClipboardItem>& items, bool last);
+    void onDaemonItemAdded(const ClipboardItem& item, int maxHistorySize);
+    void onImageEncoded(quint64 id, const QByteArray& imageData);
+    void onImageHashed(quint64 id, quint64 hash);
+    void onImportStarted(qint64 itemCount);
+    void onItemsImported(const QList<HistoryTransfer::Imported>& items);
+    void onExpiryTimeout();
     
 private:
+    struct RankEntry
+    {
+        double frecency;
+        quint64 id;
+    };
+    
+    // A capture waiting for its secret scan. Captures are committed in
+    // arrival order, so a small one queued behind a large one waits for it.
+    struct PendingCapture
+    {
+        quint64 sequence;
+        ClipboardItem item;
+        IngestionFilter::Payload payload;
+        quint64 copyBackId;
+        bool scanned;
+        QList<SecretScanner::Finding> findings;
+        QList<SecretScanner::Finding> markupFindings;   // In an Html item's markup
+    };
+    
     QClipboard* m_clipboard;
-    QList<ClipboardItem> m_history;
+    QList<ClipboardItem> m_history;     // Newest first, so ids are strictly descending
     QTimer* m_updateTimer;
     int m_maxHistorySize;
     QString m_lastClipboardText;
+    quint64 m_nextId;
+    quint64 m_importNextId;     // Ids reserved for an import run up to m_importEndId
+    quint64 m_importEndId;
+    quint64 m_copyBackId;
+    std::vector<RankEntry> m_frecencyRanking;   // Best first
+    HistoryClient* m_daemonClient;
+    QTimer* m_reconnectTimer;
+    int m_reconnectDelayMsecs;
+    ThumbnailCache* m_thumbnails;
+    HighlightCache* m_highlights;
+    HistoryTransfer* m_transfer;
+    ImageHashIndex m_imageHashes;
+    SimHashIndex m_textIndex;
+    TimestampIndex m_timeIndex;
+    IngestionFilter m_ingestionFilter;
+    int m_nearDuplicateDistance;
+    QThreadPool m_ingestionPool;
+    std::deque<PendingCapture> m_pendingCaptures;
+    quint64 m_nextSequence;
+    std::array<SecretAction, SecretScanner::KindCount> m_secretActions;
+    int m_secretExpiryMsecs;
+    QTimer* m_expiryTimer;
+    QTimer* m_encodedTimer;     // Coalesces refreshes after images are encoded
+    HistoryLog m_historyLog;
+    HistoryArchive* m_archive;
+    int m_coalesceDelayMsecs;
+    int m_maxCoalesceLatencyMsecs;
+    double m_maxIngestRate;
+    RateLimitPolicy m_rateLimitPolicy;
+    double m_ingestTokens;
+    qint64 m_tokensRefilledAt;
+    qint64 m_rateLimitedUntil;
+    IngestionFilter::Payload m_lastPayload;     // Last accepted payload, to skip re-announcements
+    QElapsedTimer m_changeClock;    // Since construction; the time base of the above
+    QElapsedTimer m_burstStart;     // Invalid while no change is waiting
+    ChangeStats m_changeStats;
     
+    bool takeIngestToken(qint64* waitMsecs);
+    void ingest(const ClipboardItem& item, const IngestionFilter::Payload& payload);
+    void onSecretsScanned(quint64 sequence, const QList<SecretScanner::Finding>& findings,
+                          const QList<SecretScanner::Finding>& markupFindings,
+                          const QString& extractedText = QString());
+    void commitScannedCaptures();
+    bool applySecretPolicy(ClipboardItem& item, const QList<SecretScanner::Finding>& findings,
+                           const QList<SecretScanner::Finding>& markupFindings);
+    QString maskSecrets(const QString& text, const QList<SecretScanner::Finding>& findings, bool* expires) const;
+    void scheduleExpiry();
     void addItem(const ClipboardItem& item);
+    ClipboardItem insertItem(const ClipboardItem& item);
+    void analyzeItem(const ClipboardItem& item);
+    void promoteItem(int index, const IngestionFilter::Payload& payload);
+    void removeAt(int index);
+    QList<quint64> removeIds(const QSet<quint64>& ids);
+    void clearAll();
+    void trimHistory();
+    void recordUse(int index);
+    void mergeUsage(int index, const ClipboardItem& other);
+    void insertRanking(const ClipboardItem& item);
+    void removeRanking(const ClipboardItem& item);
     bool isDuplicate(const ClipboardItem& item) const;
 };
 
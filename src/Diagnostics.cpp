@@ -0,0 +1,186 @@
+#include "Diagnostics.h"
+#include <QAbstractEventDispatcher>
+#include <QAbstractItemView>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QScrollBar>
+#include <QFile>
+#include <QTimer>
+#include <algorithm>
+
+#if defined(Q_OS_LINUX)
+#include <unistd.h>
+#elif defined(Q_OS_MACOS)
+#include <mach/mach.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+Q_LOGGING_CATEGORY(lcPerf, "clipboard.perf", QtWarningMsg)
+Q_LOGGING_CATEGORY(lcPrivacy, "clipboard.privacy", QtWarningMsg)
+
+namespace {
+// Started during static initialization, before main()
+struct StaticStartTimer
+{
+    QElapsedTimer timer;
+    StaticStartTimer() { timer.start(); }
+};
+StaticStartTimer g_staticStart;
+}
+
+namespace Diagnostics {
+
+qint64 msecsSinceProcessStart()
+{
+#if defined(Q_OS_LINUX)
+    // Field 22 of /proc/self/stat is the start time in clock ticks since boot
+    QFile statFile(QStringLiteral("/proc/self/stat"));
+    QFile uptimeFile(QStringLiteral("/proc/uptime"));
+    if (statFile.open(QIODevice::ReadOnly) && uptimeFile.open(QIODevice::ReadOnly)) {
+        const QByteArray stat = statFile.readAll();
+        const int commEnd = stat.lastIndexOf(')');
+        const QList<QByteArray> fields = stat.mid(commEnd + 2).split(' ');
+        const double uptimeSecs = uptimeFile.readAll().split(' ').value(0).toDouble();
+        const long ticksPerSec = sysconf(_SC_CLK_TCK);
+        
+        // Fields after the command start at field 3
+        if (commEnd > 0 && fields.size() > 19 && ticksPerSec > 0) {
+            const double startSecs = fields[19].toDouble() / ticksPerSec;
+            return qRound64((uptimeSecs - startSecs) * 1000);
+        }
+    }
+#elif defined(Q_OS_MACOS)
+    int mib[4] = {CTL_KERN, KERN_PROC, KERN_PROC_PID, getpid()};
+    struct kinfo_proc info;
+    size_t size = sizeof(info);
+    if (sysctl(mib, 4, &info, &size, nullptr, 0) == 0) {
+        struct timeval now;
+        gettimeofday(&now, nullptr);
+        const struct timeval start = info.kp_proc.p_starttime;
+        return (now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000;
+    }
+#endif
+    return g_staticStart.timer.elapsed();
+}
+
+qint64 residentSetBytes()
+{
+#if defined(Q_OS_LINUX)
+    // Second field of /proc/self/statm is the resident set in pages
+    QFile statmFile(QStringLiteral("/proc/self/statm"));
+    if (statmFile.open(QIODevice::ReadOnly)) {
+        const QList<QByteArray> fields = statmFile.readAll().split(' ');
+        if (fields.size() > 1) {
+            return fields[1].toLongLong() * sysconf(_SC_PAGESIZE);
+        }
+    }
+#elif defined(Q_OS_MACOS)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                  reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS) {
+        return static_cast<qint64>(info.resident_size);
+    }
+#endif
+    return -1;
+}
+
+PaintStats measureScrollPaint(QAbstractItemView* view)
+{
+    PaintStats stats{0, 0.0, 0.0};
+    QScrollBar* scrollBar = view->verticalScrollBar();
+    const int savedValue = scrollBar->value();
+    const int step = qMax(1, scrollBar->pageStep());
+    
+    QElapsedTimer timer;
+    for (int value = scrollBar->minimum(); ; value += step) {
+        scrollBar->setValue(qMin(value, scrollBar->maximum()));
+        
+        timer.start();
+        view->viewport()->repaint();
+        const double msecs = timer.nsecsElapsed() / 1e6;
+        
+        ++stats.frames;
+        stats.totalMsecs += msecs;
+        stats.worstMsecs = qMax(stats.worstMsecs, msecs);
+        
+        if (value >= scrollBar->maximum()) {
+            break;
+        }
+    }
+    
+    scrollBar->setValue(savedValue);
+    
+    qCDebug(lcPerf) << "Scroll paint:" << stats.frames << "frames,"
+                    << stats.totalMsecs << "ms total," << stats.worstMsecs << "ms worst";
+    return stats;
+}
+
+ActivityMonitor* ActivityMonitor::s_instance = nullptr;
+
+ActivityMonitor* ActivityMonitor::start()
+{
+    if (!s_instance) {
+        s_instance = new ActivityMonitor(QCoreApplication::instance());
+    }
+    return s_instance;
+}
+
+ActivityMonitor::ActivityMonitor(QObject* parent)
+    : QObject(parent)
+{
+    m_started.start();
+    
+    // Every event of the main thread passes the application's filters
+    QCoreApplication::instance()->installEventFilter(this);
+    connect(QAbstractEventDispatcher::instance(), &QAbstractEventDispatcher::awake, this, [this]() {
+        ++m_stats.wakeups;
+    });
+}
+
+bool ActivityMonitor::eventFilter(QObject* watched, QEvent* event)
+{
+    if (event->type() == QEvent::Timer) {
+        ++m_stats.timerFires;
+        
+        // A QTimer says little; its owner says whose timer it is
+        const QObject* owner = qobject_cast<QTimer*>(watched) && watched->parent() ? watched->parent() : watched;
+        ++m_stats.timersByOwner[QString::fromLatin1(owner->metaObject()->className())];
+    } else if (event->type() == QEvent::Paint) {
+        ++m_stats.repaints;
+    }
+    return QObject::eventFilter(watched, event);
+}
+
+ActivityStats ActivityMonitor::stats() const
+{
+    ActivityStats stats = m_stats;
+    stats.minutes = m_started.elapsed() / 60000.0;
+    return stats;
+}
+
+QString ActivityMonitor::summary() const
+{
+    const ActivityStats current = stats();
+    const double minutes = qMax(current.minutes, 1.0 / 60000);
+    QString text = QString("%1 wakeups/min, %2 timer fires/min, %3 repaints/min over %4 min")
+                       .arg(current.wakeups / minutes, 0, 'f', 1)
+                       .arg(current.timerFires / minutes, 0, 'f', 1)
+                       .arg(current.repaints / minutes, 0, 'f', 1)
+                       .arg(current.minutes, 0, 'f', 1);
+    
+    // The busiest timer owners first
+    QList<QPair<qint64, QString>> owners;
+    for (auto it = current.timersByOwner.cbegin(); it != current.timersByOwner.cend(); ++it) {
+        owners.append({it.value(), it.key()});
+    }
+    std::sort(owners.begin(), owners.end(), std::greater<QPair<qint64, QString>>());
+    for (int i = 0; i < owners.size() && i < 5; ++i) {
+        text += QString(i == 0 ? "; timers: %1 %2" : ", %1 %2").arg(owners[i].second).arg(owners[i].first);
+    }
+    return text;
+}
+
+}
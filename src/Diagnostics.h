@@ -0,0 +1,78 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QLoggingCategory>
+#include <QObject>
+
+class QAbstractItemView;
+
+// Performance measurements are logged under "clipboard.perf"; enable them with
+// QT_LOGGING_RULES="clipboard.perf.debug=true"
+Q_DECLARE_LOGGING_CATEGORY(lcPerf)
+
+// What the capture path did with sensitive content, under "clipboard.privacy".
+// Messages name the kind of secret, never its text.
+Q_DECLARE_LOGGING_CATEGORY(lcPrivacy)
+
+namespace Diagnostics {
+
+// Budget for anything that has to happen between two frames at 60 Hz
+const qint64 kFrameBudgetMsecs = 16;
+
+struct PaintStats
+{
+    int frames;
+    double totalMsecs;
+    double worstMsecs;
+};
+
+// Milliseconds since the process was started, or since static initialization
+// on platforms where the process start time is not available
+qint64 msecsSinceProcessStart();
+
+// Current resident set size in bytes, or -1 if unknown on this platform
+qint64 residentSetBytes();
+
+// Scrolls the view from top to bottom one page at a time, repainting the
+// viewport synchronously at each step, then restores the scroll position.
+PaintStats measureScrollPaint(QAbstractItemView* view);
+
+struct ActivityStats
+{
+    qint64 wakeups = 0;         // Main event loop returned from waiting
+    qint64 timerFires = 0;
+    qint64 repaints = 0;        // Paint events, one per widget painted
+    double minutes = 0.0;
+    QHash<QString, qint64> timersByOwner;   // Class of the timer's owner -> fires
+};
+
+// Counts what wakes the main thread, to check that an idle process stays
+// asleep: event loop wakeups, timer events and paint events. Off unless
+// started; counting itself adds no timers.
+class ActivityMonitor : public QObject
+{
+    Q_OBJECT
+    
+public:
+    static ActivityMonitor* start();
+    static ActivityMonitor* instance() { return s_instance; }   // Null unless started
+    
+    ActivityStats stats() const;
+    QString summary() const;
+    
+protected:
+    bool eventFilter(QObject* watched, QEvent* event) override;
+    
+private:
+    static ActivityMonitor* s_instance;
+    QElapsedTimer m_started;
+    ActivityStats m_stats;
+    
+    explicit ActivityMonitor(QObject* parent);
+};
+
+}
+
+#endif // DIAGNOSTICS_H
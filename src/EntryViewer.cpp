@@ -0,0 +1,285 @@
+#include "EntryViewer.h"
+#include "Diagnostics.h"
+#include <QElapsedTimer>
+#include <QFontDatabase>
+#include <QPainter>
+#include <QScrollBar>
+#include <algorithm>
+#include <climits>
+
+namespace {
+// Indexed on the GUI thread, enough for the first screen
+const qint64 kFirstPageLength = 64 * 1024;
+
+// Each batch the worker hands over; a few ms of scanning
+const qint64 kIndexBatchLength = 8 * 1024 * 1024;
+
+// Line starts in text[from, to) into starts, plus the longest line seen,
+// where a line runs from its start to the next one
+void indexLines(QStringView text, qint64 from, qint64 to, qint64 previousStart,
+                std::vector<qint64>* starts, qint64* longestLine)
+{
+    qint64 position = from;
+    while (position < to) {
+        const qsizetype newline = text.indexOf(u'\n', position);
+        if (newline < 0 || newline >= to) {
+            break;
+        }
+        position = newline + 1;
+        *longestLine = qMax(*longestLine, position - previousStart);
+        previousStart = position;
+        if (position < text.size()) {
+            starts->push_back(position);
+        }
+    }
+}
+}
+
+EntryViewer::EntryViewer(QWidget* parent)
+    : QAbstractScrollArea(parent)
+    , m_longestLine(0)
+    , m_indexing(false)
+    , m_matchStart(-1)
+    , m_matchLength(0)
+    , m_generation(0)
+{
+    setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    
+    // Indexing and finding run one after the other, so a find sees every line
+    m_pool.setMaxThreadCount(1);
+}
+
+EntryViewer::~EntryViewer()
+{
+    ++m_generation;
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+void EntryViewer::setText(const QString& text)
+{
+    const quint64 generation = ++m_generation;
+    m_pool.clear();
+    
+    m_text = text;
+    m_highlight.reset();
+    m_lineStarts.assign(1, 0);
+    m_longestLine = 0;
+    m_matchStart = -1;
+    m_matchLength = 0;
+    verticalScrollBar()->setValue(0);
+    horizontalScrollBar()->setValue(0);
+    
+    // The first page right away, the rest on the worker
+    const qint64 firstPageEnd = qMin<qint64>(m_text.size(), kFirstPageLength);
+    indexLines(m_text, 0, firstPageEnd, 0, &m_lineStarts, &m_longestLine);
+    m_indexing = firstPageEnd < m_text.size();
+    if (!m_indexing) {
+        m_longestLine = qMax(m_longestLine, m_text.size() - m_lineStarts.back());
+    } else {
+        const QString shared = m_text;
+        const qint64 lastStart = m_lineStarts.back();
+        m_pool.start([this, generation, shared, firstPageEnd, lastStart]() {
+            QElapsedTimer timer;
+            timer.start();
+            qint64 previousStart = lastStart;
+            for (qint64 from = firstPageEnd; from < shared.size(); from += kIndexBatchLength) {
+                if (m_generation.load() != generation) {
+                    return;
+                }
+                
+                const qint64 to = qMin<qint64>(shared.size(), from + kIndexBatchLength);
+                std::vector<qint64> starts;
+                qint64 longestLine = 0;
+                indexLines(shared, from, to, previousStart, &starts, &longestLine);
+                if (!starts.empty()) {
+                    previousStart = starts.back();
+                }
+                const bool finished = to == shared.size();
+                if (finished) {
+                    longestLine = qMax(longestLine, to - previousStart);
+                }
+                QMetaObject::invokeMethod(this, [this, generation, starts, longestLine, finished]() {
+                    onLinesIndexed(generation, starts, longestLine, finished);
+                }, Qt::QueuedConnection);
+            }
+            qCDebug(lcPerf) << "Indexed lines of" << shared.size() / 1024 << "KiB in" << timer.elapsed() << "ms";
+        });
+    }
+    
+    updateScrollBars();
+    viewport()->update();
+    emit indexingProgress(lineCount(), !m_indexing);
+}
+
+void EntryViewer::onLinesIndexed(quint64 generation, const std::vector<qint64>& starts, qint64 longestLine,
+                                 bool finished)
+{
+    if (generation != m_generation.load()) {
+        return;
+    }
+    
+    m_lineStarts.insert(m_lineStarts.end(), starts.begin(), starts.end());
+    m_longestLine = qMax(m_longestLine, longestLine);
+    m_indexing = !finished;
+    updateScrollBars();
+    viewport()->update();
+    emit indexingProgress(lineCount(), finished);
+}
+
+void EntryViewer::goToLine(qint64 line)
+{
+    const qint64 index = qBound<qint64>(0, line - 1, lineCount() - 1);
+    verticalScrollBar()->setValue(static_cast<int>(qMin<qint64>(index, INT_MAX)));
+}
+
+void EntryViewer::findNext(const QString& needle)
+{
+    if (needle.isEmpty() || m_text.isEmpty()) {
+        emit findFinished(false);
+        return;
+    }
+    
+    const qint64 from = m_matchStart >= 0 ? m_matchStart + 1
+                                          : m_lineStarts[qMin<qint64>(verticalScrollBar()->value(), lineCount() - 1)];
+    const quint64 generation = m_generation.load();
+    const QString shared = m_text;
+    m_pool.start([this, generation, shared, needle, from]() {
+        const QStringView text(shared);
+        qsizetype position = text.indexOf(needle, from, Qt::CaseInsensitive);
+        if (position < 0) {
+            // Wrapping around: from the top to where this search started
+            position = text.left(qMin<qint64>(shared.size(), from + needle.size() - 1))
+                           .indexOf(needle, 0, Qt::CaseInsensitive);
+        }
+        QMetaObject::invokeMethod(this, [this, generation, position, needle]() {
+            onFound(generation, position, needle.size());
+        }, Qt::QueuedConnection);
+    });
+}
+
+void EntryViewer::onFound(quint64 generation, qint64 position, qint64 length)
+{
+    if (generation != m_generation.load()) {
+        return;
+    }
+    if (position < 0) {
+        emit findFinished(false);
+        return;
+    }
+    
+    m_matchStart = position;
+    m_matchLength = length;
+    
+    // The match a few lines from the top, and its start in view
+    const qint64 line = lineAt(position);
+    verticalScrollBar()->setValue(static_cast<int>(qMin<qint64>(qMax<qint64>(0, line - 3), INT_MAX)));
+    const qint64 column = position - m_lineStarts[line];
+    const int visibleColumns = viewport()->width() / qMax(1, fontMetrics().horizontalAdvance(QLatin1Char('M')));
+    if (column < horizontalScrollBar()->value() || column + length > horizontalScrollBar()->value() + visibleColumns) {
+        horizontalScrollBar()->setValue(static_cast<int>(qMin<qint64>(qMax<qint64>(0, column - 8), INT_MAX)));
+    }
+    viewport()->update();
+    emit findFinished(true);
+}
+
+qint64 EntryViewer::lineAt(qint64 position) const
+{
+    const auto it = std::upper_bound(m_lineStarts.cbegin(), m_lineStarts.cend(), position);
+    return qMax<qint64>(0, (it - m_lineStarts.cbegin()) - 1);
+}
+
+void EntryViewer::setHighlight(const QSharedPointer<const SyntaxHighlighter::Highlight>& highlight)
+{
+    m_highlight = highlight;
+    viewport()->update();
+}
+
+void EntryViewer::paintEvent(QPaintEvent* event)
+{
+    Q_UNUSED(event);
+    QPainter painter(viewport());
+    painter.setFont(font());
+    
+    const QFontMetrics metrics = fontMetrics();
+    const int lineHeight = metrics.height();
+    const int charWidth = qMax(1, metrics.horizontalAdvance(QLatin1Char('M')));
+    const qint64 firstLine = verticalScrollBar()->value();
+    const qint64 column = horizontalScrollBar()->value();
+    const int columns = viewport()->width() / charWidth + 2;
+    const QStringView text(m_text);
+    
+    for (int row = 0; row * lineHeight < viewport()->height(); ++row) {
+        const qint64 line = firstLine + row;
+        if (line >= lineCount()) {
+            break;
+        }
+        
+        // Only the visible columns, cut at the end of the line
+        const qint64 lineStart = m_lineStarts[line];
+        const qint64 from = qMin<qint64>(m_text.size(), lineStart + column);
+        QStringView segment = text.mid(from, columns);
+        const qsizetype newline = segment.indexOf(u'\n');
+        if (newline >= 0) {
+            segment.truncate(newline);
+        }
+        if (segment.endsWith(u'\r')) {
+            segment.chop(1);
+        }
+        
+        const int y = row * lineHeight;
+        if (m_matchStart >= 0 && m_matchStart + m_matchLength > from && m_matchStart < from + segment.size()) {
+            const qint64 start = qMax<qint64>(m_matchStart, from) - from;
+            const qint64 end = qMin<qint64>(m_matchStart + m_matchLength, from + segment.size()) - from;
+            painter.fillRect(QRect(int(start) * charWidth, y, int(end - start) * charWidth, lineHeight),
+                             QColor(255, 214, 10, 160));
+        }
+        
+        const QColor textColor = palette().color(QPalette::Text);
+        if (!m_highlight || m_highlight->spans.empty()) {
+            painter.setPen(textColor);
+            painter.drawText(0, y + metrics.ascent(), segment.toString());
+            continue;
+        }
+        
+        // Alternating plain and colored runs, from the first span that
+        // reaches into the segment
+        const std::vector<SyntaxHighlighter::Span>& spans = m_highlight->spans;
+        auto span = std::upper_bound(spans.begin(), spans.end(), from,
+                                     [](qint64 position, const SyntaxHighlighter::Span& s) { return position < s.start; });
+        if (span != spans.begin() && (span - 1)->start + (span - 1)->length > from) {
+            --span;
+        }
+        qint64 start = 0;
+        while (start < segment.size()) {
+            const qint64 spanStart = span != spans.end() ? qint64(span->start) - from : segment.size();
+            const bool colored = spanStart <= start;
+            const qint64 end = colored ? qMin<qint64>(spanStart + span->length, segment.size())
+                                       : qMin<qint64>(spanStart, segment.size());
+            painter.setPen(colored ? SyntaxHighlighter::color(span->kind) : textColor);
+            painter.drawText(int(start) * charWidth, y + metrics.ascent(), segment.mid(start, end - start).toString());
+            if (colored) {
+                ++span;
+            }
+            start = end;
+        }
+    }
+}
+
+void EntryViewer::resizeEvent(QResizeEvent* event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    updateScrollBars();
+}
+
+void EntryViewer::updateScrollBars()
+{
+    const QFontMetrics metrics = fontMetrics();
+    const int visibleLines = qMax(1, viewport()->height() / metrics.height());
+    const int visibleColumns = qMax(1, viewport()->width() / qMax(1, metrics.horizontalAdvance(QLatin1Char('M'))));
+    
+    verticalScrollBar()->setRange(0, static_cast<int>(qMin<qint64>(qMax<qint64>(0, lineCount() - visibleLines), INT_MAX)));
+    verticalScrollBar()->setPageStep(visibleLines);
+    horizontalScrollBar()->setRange(0, static_cast<int>(qMin<qint64>(qMax<qint64>(0, m_longestLine - visibleColumns), INT_MAX)));
+    horizontalScrollBar()->setPageStep(visibleColumns);
+}
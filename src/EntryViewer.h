@@ -0,0 +1,70 @@
+#ifndef ENTRYVIEWER_H
+#define ENTRYVIEWER_H
+
+#include "SyntaxHighlighter.h"
+#include <QAbstractScrollArea>
+#include <QSharedPointer>
+#include <QString>
+#include <QThreadPool>
+#include <atomic>
+#include <vector>
+
+// Shows the full text of one history entry, however large, a screen at a
+// time. The text is shared with the item, never copied or laid out as a
+// whole: line starts are indexed on a worker and arrive in batches, the
+// first page inline, so the first screen shows at once and the scroll range
+// grows while the rest is indexed. Only the visible columns of the visible
+// lines are ever painted.
+class EntryViewer : public QAbstractScrollArea
+{
+    Q_OBJECT
+    
+public:
+    explicit EntryViewer(QWidget* parent = nullptr);
+    ~EntryViewer() override;
+    
+    void setText(const QString& text);
+    void clear() { setText(QString()); }
+    
+    // Colors the text with spans highlighted elsewhere; setText() drops them
+    void setHighlight(const QSharedPointer<const SyntaxHighlighter::Highlight>& highlight);
+    
+    // Lines indexed so far; all of them once indexing is done
+    qint64 lineCount() const { return static_cast<qint64>(m_lineStarts.size()); }
+    bool isIndexing() const { return m_indexing; }
+    
+public slots:
+    // Lines count from 1; lines not indexed yet go to the last indexed one
+    void goToLine(qint64 line);
+    
+    // Searches case-insensitively from after the current match, or the top
+    // line, wrapping around at the end
+    void findNext(const QString& needle);
+    
+signals:
+    void indexingProgress(qint64 lines, bool finished);
+    void findFinished(bool found);
+    
+protected:
+    void paintEvent(QPaintEvent* event) override;
+    void resizeEvent(QResizeEvent* event) override;
+    
+private:
+    QString m_text;
+    QSharedPointer<const SyntaxHighlighter::Highlight> m_highlight;
+    std::vector<qint64> m_lineStarts;   // Text offset of each indexed line
+    qint64 m_longestLine;
+    bool m_indexing;
+    qint64 m_matchStart;                // -1 if there is no match
+    qint64 m_matchLength;
+    QThreadPool m_pool;
+    std::atomic<quint64> m_generation;  // Bumped per text; workers for an older one stop
+    
+    void onLinesIndexed(quint64 generation, const std::vector<qint64>& starts, qint64 longestLine,
+                        bool finished);
+    void onFound(quint64 generation, qint64 position, qint64 length);
+    qint64 lineAt(qint64 position) const;
+    void updateScrollBars();
+};
+
+#endif // ENTRYVIEWER_H
@@ -0,0 +1,173 @@
+#include "FuzzyMatcher.h"
+
+namespace {
+// Scoring constants follow fzf's v1 algorithm
+const int kScoreMatch = 16;
+const int kScoreGapStart = -3;
+const int kScoreGapExtension = -1;
+const int kBonusBoundary = kScoreMatch / 2;
+const int kBonusBoundaryWhite = kBonusBoundary + 2;
+const int kBonusNonWord = kScoreMatch / 2;
+const int kBonusCamel123 = kBonusBoundary + kScoreGapExtension;
+const int kBonusConsecutive = -(kScoreGapStart + kScoreGapExtension);
+const int kBonusFirstCharMultiplier = 2;
+}
+
+FuzzyMatcher::FuzzyMatcher(const QString& pattern)
+    : m_pattern(pattern.trimmed())
+    , m_caseSensitive(false)
+{
+    // Smart case: only match case-sensitively if the user typed an uppercase letter
+    for (const QChar c : m_pattern) {
+        if (c.isUpper()) {
+            m_caseSensitive = true;
+            break;
+        }
+    }
+
+    if (!m_caseSensitive) {
+        m_pattern = m_pattern.toLower();
+    }
+}
+
+int FuzzyMatcher::match(const QString& text, QList<int>* positions) const
+{
+    const int patternLength = m_pattern.size();
+    const int textLength = text.size();
+
+    if (patternLength == 0) {
+        return 0;
+    }
+    if (patternLength > textLength) {
+        return -1;
+    }
+
+    // Forward scan: find the first position where the whole pattern has matched
+    int patternIndex = 0;
+    int start = -1;
+    int end = -1;
+    for (int i = 0; i < textLength; ++i) {
+        if (fold(text[i]) == m_pattern[patternIndex]) {
+            if (start < 0) {
+                start = i;
+            }
+            if (++patternIndex == patternLength) {
+                end = i + 1;
+                break;
+            }
+        }
+    }
+
+    if (end < 0) {
+        return -1;
+    }
+
+    // Backward scan: tighten the start of the match window
+    patternIndex = patternLength - 1;
+    for (int i = end - 1; i >= start; --i) {
+        if (fold(text[i]) == m_pattern[patternIndex]) {
+            if (--patternIndex < 0) {
+                start = i;
+                break;
+            }
+        }
+    }
+
+    return calculateScore(text, start, end, positions);
+}
+
+QChar FuzzyMatcher::fold(QChar c) const
+{
+    return m_caseSensitive ? c : c.toLower();
+}
+
+FuzzyMatcher::CharClass FuzzyMatcher::charClass(QChar c)
+{
+    if (c.isLower()) {
+        return Lower;
+    } else if (c.isUpper()) {
+        return Upper;
+    } else if (c.isDigit()) {
+        return Number;
+    } else if (c.isSpace()) {
+        return White;
+    } else if (c.isLetter()) {
+        return Lower;
+    }
+    return NonWord;
+}
+
+int FuzzyMatcher::bonusFor(CharClass prevClass, CharClass currClass)
+{
+    const bool currIsWord = currClass != White && currClass != NonWord;
+
+    if (prevClass == White && currIsWord) {
+        return kBonusBoundaryWhite;
+    }
+    if (prevClass == NonWord && currIsWord) {
+        return kBonusBoundary;
+    }
+    if ((prevClass == Lower && currClass == Upper) ||
+        (prevClass != Number && currClass == Number)) {
+        return kBonusCamel123;
+    }
+    if (currClass == NonWord) {
+        return kBonusNonWord;
+    }
+    if (currClass == White) {
+        return kBonusBoundaryWhite;
+    }
+    return 0;
+}
+
+int FuzzyMatcher::calculateScore(const QString& text, int start, int end, QList<int>* positions) const
+{
+    int patternIndex = 0;
+    int score = 0;
+    int consecutive = 0;
+    int firstBonus = 0;
+    bool inGap = false;
+    CharClass prevClass = start > 0 ? charClass(text[start - 1]) : White;
+
+    if (positions) {
+        positions->clear();
+        positions->reserve(m_pattern.size());
+    }
+
+    for (int i = start; i < end; ++i) {
+        const QChar c = text[i];
+        const CharClass currClass = charClass(c);
+
+        if (patternIndex < m_pattern.size() && fold(c) == m_pattern[patternIndex]) {
+            if (positions) {
+                positions->append(i);
+            }
+
+            score += kScoreMatch;
+            int bonus = bonusFor(prevClass, currClass);
+            if (consecutive == 0) {
+                firstBonus = bonus;
+            } else {
+                // A run inherits the bonus of its first character
+                if (bonus >= kBonusBoundary && bonus > firstBonus) {
+                    firstBonus = bonus;
+                }
+                bonus = qMax(qMax(bonus, firstBonus), kBonusConsecutive);
+            }
+
+            score += patternIndex == 0 ? bonus * kBonusFirstCharMultiplier : bonus;
+            inGap = false;
+            ++consecutive;
+            ++patternIndex;
+        } else {
+            score += inGap ? kScoreGapExtension : kScoreGapStart;
+            inGap = true;
+            consecutive = 0;
+            firstBonus = 0;
+        }
+
+        prevClass = currClass;
+    }
+
+    return qMax(0, score);
+}
@@ -0,0 +1,41 @@
+#ifndef FUZZYMATCHER_H
+#define FUZZYMATCHER_H
+
+#include <QString>
+#include <QList>
+
+// fzf-style subsequence matcher. A pattern matches when all of its characters
+// appear in order in the text; the score rewards contiguous runs and matches
+// that start on word boundaries, and penalizes gaps between matched chars.
+// Matching is case-insensitive unless the pattern contains an uppercase letter.
+class FuzzyMatcher
+{
+public:
+    explicit FuzzyMatcher(const QString& pattern);
+
+    bool isEmpty() const { return m_pattern.isEmpty(); }
+    QString pattern() const { return m_pattern; }
+
+    // Returns the match score, or -1 if the pattern does not match the text.
+    // When positions is non-null it receives the offsets of the matched chars.
+    int match(const QString& text, QList<int>* positions = nullptr) const;
+
+private:
+    enum CharClass {
+        White,
+        NonWord,
+        Lower,
+        Upper,
+        Number
+    };
+
+    QString m_pattern;
+    bool m_caseSensitive;
+
+    QChar fold(QChar c) const;
+    static CharClass charClass(QChar c);
+    static int bonusFor(CharClass prevClass, CharClass currClass);
+    int calculateScore(const QString& text, int start, int end, QList<int>* positions) const;
+};
+
+#endif // FUZZYMATCHER_H
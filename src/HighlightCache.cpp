@@ -0,0 +1,121 @@
+#include "HighlightCache.h"
+#include "Diagnostics.h"
+#include <QElapsedTimer>
+
+namespace {
+// A million preview tokens, far more than a full history's rows
+const int kMaxPreviewBytes = 8 * 1024 * 1024;
+
+// Holds the largest highlight, kMaxHighlightLength characters, a few times over
+const int kMaxFullBytes = 32 * 1024 * 1024;
+
+// Tokenizing is fast; one thread keeps captures from competing with the list
+const int kMaxWorkerThreads = 1;
+}
+
+HighlightCache::HighlightCache(QObject* parent)
+    : QObject(parent)
+    , m_previews(kMaxPreviewBytes)
+    , m_full(kMaxFullBytes)
+    , m_nextTicket(0)
+{
+    m_pool.setMaxThreadCount(kMaxWorkerThreads);
+}
+
+HighlightCache::~HighlightCache()
+{
+    // Workers post their results back to this object
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+HighlightCache::HighlightPtr HighlightCache::highlight(quint64 id, const QString& text, const QString& preview)
+{
+    if (const HighlightPtr* highlight = m_full.object(id)) {
+        return *highlight;
+    }
+    
+    // Work already queued for the row computes the full spans anyway
+    const auto pending = m_pending.find(id);
+    if (pending != m_pending.end()) {
+        pending->full = true;
+    } else if (!text.isEmpty()) {
+        start(id, text, preview, true);
+    }
+    return HighlightPtr();
+}
+
+HighlightCache::HighlightPtr HighlightCache::previewHighlight(quint64 id, const QString& text, const QString& preview)
+{
+    if (const HighlightPtr* highlight = m_previews.object(id)) {
+        return *highlight;
+    }
+    if (const HighlightPtr* highlight = m_full.object(id)) {
+        return *highlight;
+    }
+    if (!m_pending.contains(id) && !text.isEmpty()) {
+        start(id, text, preview, false);
+    }
+    return HighlightPtr();
+}
+
+void HighlightCache::analyze(quint64 id, const QString& text, const QString& preview)
+{
+    if (!m_pending.contains(id) && !m_previews.contains(id)) {
+        start(id, text, preview, false);
+    }
+}
+
+void HighlightCache::start(quint64 id, const QString& text, const QString& preview, bool full)
+{
+    // Both strings are implicitly shared, so the worker gets them without a copy
+    const quint64 ticket = ++m_nextTicket;
+    m_pending.insert(id, Pending{ticket, full});
+    m_pool.start([this, id, ticket, text, preview]() {
+        QElapsedTimer timer;
+        timer.start();
+        
+        const HighlightPtr highlight(new SyntaxHighlighter::Highlight(SyntaxHighlighter::highlight(text, preview)));
+        qCDebug(lcPerf) << "Highlighted" << text.size() << "characters as"
+                        << SyntaxHighlighter::languageName(highlight->language) << "in" << timer.elapsed() << "ms";
+        
+        QMetaObject::invokeMethod(this, [this, id, ticket, highlight]() {
+            insert(id, ticket, highlight);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void HighlightCache::remove(quint64 id)
+{
+    m_previews.remove(id);
+    m_full.remove(id);
+    m_pending.remove(id);
+}
+
+void HighlightCache::clear()
+{
+    m_previews.clear();
+    m_full.clear();
+    m_pending.clear();
+}
+
+void HighlightCache::insert(quint64 id, quint64 ticket, const HighlightPtr& highlight)
+{
+    // Removed, or asked for again since; the newer result follows
+    const auto pending = m_pending.constFind(id);
+    if (pending == m_pending.cend() || pending->ticket != ticket) {
+        return;
+    }
+    const bool full = pending->full;
+    m_pending.erase(pending);
+    
+    // Plain text costs nothing to keep and must not be highlighted again
+    SyntaxHighlighter::Highlight* preview = new SyntaxHighlighter::Highlight;
+    preview->language = highlight->language;
+    preview->previewSpans = highlight->previewSpans;
+    m_previews.insert(id, new HighlightPtr(preview), static_cast<int>(qMax<qint64>(1, preview->sizeInBytes())));
+    if (full) {
+        m_full.insert(id, new HighlightPtr(highlight), static_cast<int>(qMax<qint64>(1, highlight->sizeInBytes())));
+    }
+    emit highlightReady(id);
+}
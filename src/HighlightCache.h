@@ -0,0 +1,61 @@
+#ifndef HIGHLIGHTCACHE_H
+#define HIGHLIGHTCACHE_H
+
+#include "SyntaxHighlighter.h"
+#include <QObject>
+#include <QCache>
+#include <QHash>
+#include <QSharedPointer>
+#include <QThreadPool>
+
+// Code items are highlighted off the GUI thread, once per item; views only
+// paint the finished spans. List rows need only the preview spans, which are
+// kept in their own LRU bounded by span bytes, so a large entry opened in the
+// viewer never pushes the visible rows out and back in. Full spans live in a
+// second, small LRU for the viewer.
+class HighlightCache : public QObject
+{
+    Q_OBJECT
+    
+public:
+    typedef QSharedPointer<const SyntaxHighlighter::Highlight> HighlightPtr;
+    
+    explicit HighlightCache(QObject* parent = nullptr);
+    ~HighlightCache() override;
+    
+    // Returns the cached highlight with spans over the whole text, or null
+    // after queueing the work on text; highlightReady() follows once it is
+    // available
+    HighlightPtr highlight(quint64 id, const QString& text, const QString& preview);
+    
+    // Same for list rows; only previewSpans is filled in
+    HighlightPtr previewHighlight(quint64 id, const QString& text, const QString& preview);
+    
+    // Highlights a newly captured code item's preview ahead of its first paint
+    void analyze(quint64 id, const QString& text, const QString& preview);
+    
+    // Drops the item's spans; work still running for it is discarded
+    void remove(quint64 id);
+    void clear();
+    
+signals:
+    void highlightReady(quint64 id);
+    
+private:
+    struct Pending
+    {
+        quint64 ticket;     // Tells a result from one queued before a remove()
+        bool full;          // The viewer asked; keep the full spans too
+    };
+    
+    QThreadPool m_pool;
+    QCache<quint64, HighlightPtr> m_previews;   // Cost is span bytes
+    QCache<quint64, HighlightPtr> m_full;
+    QHash<quint64, Pending> m_pending;
+    quint64 m_nextTicket;
+    
+    void start(quint64 id, const QString& text, const QString& preview, bool full);
+    void insert(quint64 id, quint64 ticket, const HighlightPtr& highlight);
+};
+
+#endif // HIGHLIGHTCACHE_H
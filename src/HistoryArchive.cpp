@@ -0,0 +1,508 @@
+#include "HistoryArchive.h"
+#include "Diagnostics.h"
+#include <QDataStream>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSaveFile>
+#include <QSet>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+namespace {
+const quint32 kSegmentMagic = 0x43425347;  // "CBSG"
+const quint32 kSegmentVersion = 2;
+const quint32 kFirstSegmentVersion = 1;     // Its items may lack the markup and pin
+const int kStreamVersion = QDataStream::Qt_6_0;
+
+// Images make items large; seal early rather than hold hundreds of MB
+const qint64 kMaxPendingBytes = 64 * 1024 * 1024;
+
+// About 1% false positives
+const int kBloomBitsPerTrigram = 10;
+const int kBloomHashes = 7;
+const quint32 kMinBloomBits = 1024;
+
+const QString kSegmentPattern = QStringLiteral("segment-*.seg");
+
+qint64 alignTo8(qint64 offset)
+{
+    return (offset + 7) & ~qint64(7);
+}
+
+// Case folding per UTF-16 unit, the same for indexing and querying;
+// surrogates are left alone
+ushort foldUnit(ushort unit)
+{
+    return QChar::isSurrogate(unit) ? unit : static_cast<ushort>(QChar::toCaseFolded(unit));
+}
+
+quint64 trigramHash(ushort a, ushort b, ushort c)
+{
+    // splitmix64 over the three units
+    quint64 x = (quint64(a) << 32) | (quint64(b) << 16) | c;
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Double hashing: probe i is h1 + i * h2
+quint32 bloomProbe(quint64 hash, int i, quint32 bits)
+{
+    const quint32 h1 = static_cast<quint32>(hash);
+    const quint32 h2 = static_cast<quint32>(hash >> 32) | 1;
+    return (h1 + static_cast<quint32>(i) * h2) & (bits - 1);
+}
+
+qint64 itemBytes(const ClipboardItem& item)
+{
+    return (item.text().size() + item.html().size()) * 2 + item.imageData().size();
+}
+
+QString segmentName(quint64 minId)
+{
+    // Fixed width, so name order is id order
+    return QStringLiteral("segment-%1.seg").arg(minId, 16, 16, QLatin1Char('0'));
+}
+}
+
+HistoryArchive::HistoryArchive(QObject* parent)
+    : QObject(parent)
+    , m_pendingBytes(0)
+{
+    // One writer keeps segments sealed in order
+    m_pool.setMaxThreadCount(1);
+}
+
+HistoryArchive::~HistoryArchive()
+{
+    flush();
+}
+
+bool HistoryArchive::open(const QString& directory)
+{
+    QDir dir(directory);
+    if (!dir.mkpath(QStringLiteral("."))) {
+        return false;
+    }
+    m_directory = dir.absolutePath();
+    
+    const QStringList names = dir.entryList({kSegmentPattern}, QDir::Files, QDir::Name | QDir::Reversed);
+    for (const QString& name : names) {
+        Segment segment;
+        if (mapSegment(dir.filePath(name), &segment)) {
+            m_segments.push_back(std::move(segment));
+        } else {
+            qWarning("History archive: skipping unreadable segment %s", qPrintable(name));
+        }
+    }
+    
+    qCDebug(lcPerf) << "Mapped" << m_segments.size() << "archive segments," << itemCount() << "items";
+    return true;
+}
+
+bool HistoryArchive::mapSegment(const QString& path, Segment* segment) const
+{
+    segment->file.reset(new QFile(path));
+    if (!segment->file->open(QIODevice::ReadOnly) || segment->file->size() < qint64(sizeof(SegmentHeader))) {
+        return false;
+    }
+    segment->size = segment->file->size();
+    segment->data = segment->file->map(0, segment->size);
+    if (!segment->data) {
+        return false;
+    }
+    
+    // Every offset is checked once here, so searches can trust them
+    segment->header = reinterpret_cast<const SegmentHeader*>(segment->data);
+    const SegmentHeader& header = *segment->header;
+    const qint64 indexEnd = qint64(header.indexOffset) + qint64(header.count) * qint64(sizeof(IndexEntry));
+    if (header.magic != kSegmentMagic || header.version < kFirstSegmentVersion || header.version > kSegmentVersion ||
+        header.bloomBits == 0 || (header.bloomBits & (header.bloomBits - 1)) != 0 ||
+        qint64(header.bloomOffset) + header.bloomBits / 8 > segment->size ||
+        header.indexOffset % 8 != 0 || indexEnd > segment->size) {
+        return false;
+    }
+    segment->index = reinterpret_cast<const IndexEntry*>(segment->data + header.indexOffset);
+    for (quint32 i = 0; i < header.count; ++i) {
+        const IndexEntry& entry = segment->index[i];
+        if (entry.textOffset % 2 != 0 ||
+            qint64(entry.textOffset) + qint64(entry.textLength) * 2 > segment->size ||
+            qint64(entry.blobOffset) + qint64(entry.blobLength) > segment->size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void HistoryArchive::archive(const QList<ClipboardItem>& items)
+{
+    if (!isOpen()) {
+        return;
+    }
+    
+    for (const ClipboardItem& item : items) {
+        addPending(item);
+        if (m_pending.size() >= kSegmentItems || m_pendingBytes >= kMaxPendingBytes) {
+            seal();
+        }
+    }
+}
+
+void HistoryArchive::seal()
+{
+    if (m_pending.isEmpty()) {
+        return;
+    }
+    
+    const QList<ClipboardItem> batch = m_pending;
+    const QString path = QDir(m_directory).filePath(segmentName(batch.last().id()));
+    m_sealing.prepend(batch);
+    m_pending.clear();
+    m_pendingBytes = 0;
+    
+    m_pool.start([this, batch, path]() {
+        QElapsedTimer timer;
+        timer.start();
+        
+        const QByteArray data = buildSegment(batch);
+        QSaveFile file(path);
+        const bool written = file.open(QIODevice::WriteOnly) && file.write(data) == data.size() && file.commit();
+        qCDebug(lcPerf) << "Sealed" << batch.size() << "items into an archive segment of" << data.size() / 1024
+                        << "KiB in" << timer.elapsed() << "ms";
+        
+        QMetaObject::invokeMethod(this, [this, path, written]() {
+            onSealed(path, written);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void HistoryArchive::onSealed(const QString& path, bool written)
+{
+    // Batches are sealed in order, so this is the oldest one in flight;
+    // none means the archive was cleared meanwhile
+    if (m_sealing.isEmpty()) {
+        QFile::remove(path);
+        return;
+    }
+    const QList<ClipboardItem> batch = m_sealing.takeLast();
+    
+    Segment segment;
+    if (written && mapSegment(path, &segment)) {
+        m_segments.insert(m_segments.begin(), std::move(segment));
+        return;
+    }
+    
+    // Retried with the next seal
+    qWarning("History archive: could not write %s", qPrintable(path));
+    for (const ClipboardItem& item : batch) {
+        addPending(item);
+    }
+}
+
+void HistoryArchive::addPending(const ClipboardItem& item)
+{
+    // Segments are built newest first by id. Evicted items mostly arrive in
+    // that order, but imported ones are numbered below everything archived.
+    const auto position = std::lower_bound(m_pending.begin(), m_pending.end(), item.id(),
+                                           [](const ClipboardItem& pending, quint64 id) {
+                                               return pending.id() > id;
+                                           });
+    m_pending.insert(position, item);
+    m_pendingBytes += itemBytes(item);
+}
+
+void HistoryArchive::flush()
+{
+    seal();
+    m_pool.waitForDone();
+}
+
+void HistoryArchive::clear()
+{
+    m_pool.waitForDone();
+    m_pending.clear();
+    m_sealing.clear();
+    m_pendingBytes = 0;
+    
+    for (Segment& segment : m_segments) {
+        segment.file->close();
+        segment.file->remove();
+    }
+    m_segments.clear();
+}
+
+qint64 HistoryArchive::itemCount() const
+{
+    qint64 count = m_pending.size();
+    for (const QList<ClipboardItem>& batch : m_sealing) {
+        count += batch.size();
+    }
+    for (const Segment& segment : m_segments) {
+        count += segment.header->count;
+    }
+    return count;
+}
+
+quint64 HistoryArchive::maxId() const
+{
+    quint64 id = m_pending.isEmpty() ? 0 : m_pending.first().id();
+    for (const QList<ClipboardItem>& batch : m_sealing) {
+        id = qMax(id, batch.first().id());
+    }
+    for (const Segment& segment : m_segments) {
+        id = qMax(id, segment.header->maxId);
+    }
+    return id;
+}
+
+quint64 HistoryArchive::minId() const
+{
+    quint64 id = m_pending.isEmpty() ? 0 : m_pending.last().id();
+    const auto lower = [&id](quint64 other) {
+        id = id == 0 ? other : qMin(id, other);
+    };
+    for (const QList<ClipboardItem>& batch : m_sealing) {
+        lower(batch.last().id());
+    }
+    for (const Segment& segment : m_segments) {
+        lower(segment.header->minId);
+    }
+    return id;
+}
+
+QList<ClipboardItem> HistoryArchive::search(const Query& query, int limit, int offset, SearchStats* stats) const
+{
+    QElapsedTimer timer;
+    timer.start();
+    
+    QList<ClipboardItem> results;
+    SearchStats localStats;
+    int skip = offset;
+    const auto take = [&](const ClipboardItem& item) {
+        if (skip > 0) {
+            --skip;
+        } else {
+            results.append(item);
+        }
+        return results.size() >= limit;
+    };
+    
+    const qint64 fromMsecs = query.from.isValid() ? query.from.toMSecsSinceEpoch() : LLONG_MIN;
+    const qint64 toMsecs = query.to.isValid() ? query.to.toMSecsSinceEpoch() : LLONG_MAX;
+    
+    // Items not sealed yet are newer than every segment
+    bool done = limit <= 0;
+    for (const ClipboardItem& item : m_pending) {
+        if (done) {
+            break;
+        }
+        done = matches(item, query) && take(item);
+    }
+    for (const QList<ClipboardItem>& batch : m_sealing) {
+        for (const ClipboardItem& item : batch) {
+            if (done) {
+                break;
+            }
+            done = matches(item, query) && take(item);
+        }
+    }
+    
+    for (const Segment& segment : m_segments) {
+        if (done) {
+            break;
+        }
+        const SegmentHeader& header = *segment.header;
+        if (header.maxTimestamp < fromMsecs || header.minTimestamp > toMsecs ||
+            (query.typeFilter != -1 && !(header.typeMask & (1u << query.typeFilter))) ||
+            !mayContain(segment, query.text)) {
+            ++localStats.segmentsSkipped;
+            continue;
+        }
+        ++localStats.segmentsScanned;
+        
+        // Texts are matched in place in the mapping; only hits are decoded
+        for (quint32 i = 0; i < header.count && !done; ++i) {
+            const IndexEntry& entry = segment.index[i];
+            if (entry.timestamp < fromMsecs || entry.timestamp > toMsecs ||
+                (query.typeFilter != -1 && entry.type != query.typeFilter)) {
+                continue;
+            }
+            const QStringView text(reinterpret_cast<const QChar*>(segment.data + entry.textOffset),
+                                   entry.textLength);
+            if (query.text.isEmpty() || text.contains(query.text, Qt::CaseInsensitive)) {
+                done = take(decode(segment, entry));
+            }
+        }
+    }
+    
+    localStats.nsecs = timer.nsecsElapsed();
+    if (stats) {
+        *stats = localStats;
+    }
+    return results;
+}
+
+bool HistoryArchive::item(quint64 id, ClipboardItem* item) const
+{
+    for (const ClipboardItem& candidate : m_pending) {
+        if (candidate.id() == id) {
+            *item = candidate;
+            return true;
+        }
+    }
+    for (const QList<ClipboardItem>& batch : m_sealing) {
+        for (const ClipboardItem& candidate : batch) {
+            if (candidate.id() == id) {
+                *item = candidate;
+                return true;
+            }
+        }
+    }
+    
+    for (const Segment& segment : m_segments) {
+        const SegmentHeader& header = *segment.header;
+        if (id < header.minId || id > header.maxId) {
+            continue;
+        }
+        // The index is in descending id order
+        const IndexEntry* end = segment.index + header.count;
+        const IndexEntry* it = std::lower_bound(segment.index, end, id,
+                                                [](const IndexEntry& entry, quint64 value) {
+                                                    return entry.id > value;
+                                                });
+        if (it != end && it->id == id) {
+            *item = decode(segment, *it);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HistoryArchive::mayContain(const Segment& segment, const QString& text)
+{
+    // Shorter queries have no trigram, and surrogates fold differently in
+    // QString's case-insensitive matching; scan those
+    if (text.size() < 3) {
+        return true;
+    }
+    for (const QChar c : text) {
+        if (c.isSurrogate()) {
+            return true;
+        }
+    }
+    
+    const SegmentHeader& header = *segment.header;
+    const uchar* bloom = segment.data + header.bloomOffset;
+    for (int i = 0; i + 2 < text.size(); ++i) {
+        const quint64 hash = trigramHash(foldUnit(text[i].unicode()), foldUnit(text[i + 1].unicode()),
+                                         foldUnit(text[i + 2].unicode()));
+        for (int probe = 0; probe < int(header.bloomHashes); ++probe) {
+            const quint32 bit = bloomProbe(hash, probe, header.bloomBits);
+            if (!(bloom[bit / 8] & (1u << (bit % 8)))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool HistoryArchive::matches(const ClipboardItem& item, const Query& query)
+{
+    if (query.typeFilter != -1 && item.type() != query.typeFilter) {
+        return false;
+    }
+    if ((query.from.isValid() && item.timestamp() < query.from) ||
+        (query.to.isValid() && item.timestamp() > query.to)) {
+        return false;
+    }
+    return query.text.isEmpty() || item.text().contains(query.text, Qt::CaseInsensitive);
+}
+
+ClipboardItem HistoryArchive::decode(const Segment& segment, const IndexEntry& entry)
+{
+    const QByteArray blob = QByteArray::fromRawData(reinterpret_cast<const char*>(segment.data + entry.blobOffset),
+                                                    entry.blobLength);
+    QDataStream in(blob);
+    in.setVersion(kStreamVersion);
+    ClipboardItem item;
+    if (segment.header->version < kSegmentVersion) {
+        ClipboardItem::readLegacy(in, item);   // Each blob holds just the item
+    } else {
+        in >> item;     // Copies out of the mapping
+    }
+    return item;
+}
+
+QByteArray HistoryArchive::buildSegment(const QList<ClipboardItem>& items)
+{
+    SegmentHeader header{};
+    header.magic = kSegmentMagic;
+    header.version = kSegmentVersion;
+    header.count = items.size();
+    header.minId = items.last().id();
+    header.maxId = items.first().id();
+    header.minTimestamp = LLONG_MAX;
+    header.maxTimestamp = LLONG_MIN;
+    header.bloomHashes = kBloomHashes;
+    
+    // Distinct trigrams first, to size the filter
+    QSet<quint64> trigrams;
+    for (const ClipboardItem& item : items) {
+        const QString text = item.text();
+        for (int i = 0; i + 2 < text.size(); ++i) {
+            trigrams.insert(trigramHash(foldUnit(text[i].unicode()), foldUnit(text[i + 1].unicode()),
+                                        foldUnit(text[i + 2].unicode())));
+        }
+    }
+    header.bloomBits = kMinBloomBits;
+    while (header.bloomBits < quint32(trigrams.size()) * kBloomBitsPerTrigram && header.bloomBits < (1u << 31)) {
+        header.bloomBits *= 2;
+    }
+    header.bloomOffset = alignTo8(sizeof(SegmentHeader));
+    header.indexOffset = alignTo8(header.bloomOffset + header.bloomBits / 8);
+    
+    QByteArray data(header.indexOffset + qint64(items.size()) * sizeof(IndexEntry), '\0');
+    uchar* bloom = reinterpret_cast<uchar*>(data.data() + header.bloomOffset);
+    for (const quint64 hash : trigrams) {
+        for (int probe = 0; probe < kBloomHashes; ++probe) {
+            const quint32 bit = bloomProbe(hash, probe, header.bloomBits);
+            bloom[bit / 8] |= 1u << (bit % 8);
+        }
+    }
+    
+    std::vector<IndexEntry> index;
+    index.reserve(items.size());
+    for (const ClipboardItem& item : items) {
+        IndexEntry entry{};
+        entry.id = item.id();
+        entry.timestamp = item.timestamp().toMSecsSinceEpoch();
+        entry.type = item.type();
+        
+        const QString text = item.text();
+        data.resize(alignTo8(data.size()));
+        entry.textOffset = data.size();
+        entry.textLength = text.size();
+        data.append(reinterpret_cast<const char*>(text.constData()), text.size() * 2);
+        
+        QByteArray blob;
+        QDataStream out(&blob, QIODevice::WriteOnly);
+        out.setVersion(kStreamVersion);
+        out << item;
+        data.resize(alignTo8(data.size()));
+        entry.blobOffset = data.size();
+        entry.blobLength = blob.size();
+        data.append(blob);
+        
+        header.minTimestamp = qMin(header.minTimestamp, entry.timestamp);
+        header.maxTimestamp = qMax(header.maxTimestamp, entry.timestamp);
+        header.typeMask |= 1u << entry.type;
+        index.push_back(entry);
+    }
+    
+    std::memcpy(data.data(), &header, sizeof(header));
+    std::memcpy(data.data() + header.indexOffset, index.data(), index.size() * sizeof(IndexEntry));
+    return data;
+}
@@ -0,0 +1,134 @@
+#ifndef HISTORYARCHIVE_H
+#define HISTORYARCHIVE_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QList>
+#include <QString>
+#include <QThreadPool>
+#include <memory>
+#include <vector>
+#include "ClipboardItem.h"
+
+class QFile;
+
+// Cold tier of the history. Items evicted from ClipboardManager's in-memory
+// history are collected and sealed into immutable segment files of up to
+// kSegmentItems items, written on a worker. Segments are memory-mapped and
+// never decoded as a whole: each carries its id, time and type ranges and a
+// bloom filter of the case-folded character trigrams of its texts, so a search
+// skips every segment that cannot match and only deserializes the hits.
+//
+// A segment is a SegmentHeader, the bloom filter, one IndexEntry per item
+// (newest first), then each item's text as raw UTF-16 and its serialized
+// ClipboardItem. Segments are a local cache in host byte order, not an
+// exchange format. Items still waiting to be sealed are lost on a crash.
+// Version 1 segments are still read; their items may lack the markup and
+// pin fields.
+class HistoryArchive : public QObject
+{
+    Q_OBJECT
+    
+public:
+    static const int kSegmentItems = 4096;
+    
+    struct Query
+    {
+        QString text;           // Case-insensitive substring; empty matches all
+        int typeFilter = -1;
+        QDateTime from;         // Invalid for an open end
+        QDateTime to;
+    };
+    
+    struct SearchStats
+    {
+        int segmentsScanned = 0;
+        int segmentsSkipped = 0;
+        qint64 nsecs = 0;
+    };
+    
+    explicit HistoryArchive(QObject* parent = nullptr);
+    ~HistoryArchive() override;
+    
+    // Maps the segments already in directory; new ones are written there
+    bool open(const QString& directory);
+    bool isOpen() const { return !m_directory.isEmpty(); }
+    
+    // Takes items evicted from the hot history, oldest first
+    void archive(const QList<ClipboardItem>& items);
+    
+    // Newest first, at most limit matches, skipping the first offset
+    QList<ClipboardItem> search(const Query& query, int limit, int offset = 0, SearchStats* stats = nullptr) const;
+    bool item(quint64 id, ClipboardItem* item) const;
+    
+    int segmentCount() const { return static_cast<int>(m_segments.size()); }
+    qint64 itemCount() const;
+    
+    // Highest id archived, 0 if none; new items must be numbered above it
+    quint64 maxId() const;
+    
+    // Lowest id archived, 0 if none; imported items are numbered below it
+    quint64 minId() const;
+    
+    // Seals what is pending and waits for it, e.g. before exit
+    void flush();
+    
+    // Deletes every segment and pending item
+    void clear();
+    
+private:
+    struct SegmentHeader
+    {
+        quint32 magic;
+        quint32 version;
+        quint32 count;
+        quint32 typeMask;       // Bit per ClipboardItem::ItemType present
+        quint64 minId;
+        quint64 maxId;
+        qint64 minTimestamp;    // Epoch ms
+        qint64 maxTimestamp;
+        quint64 bloomOffset;
+        quint32 bloomBits;      // Power of two
+        quint32 bloomHashes;
+        quint64 indexOffset;
+    };
+    
+    struct IndexEntry
+    {
+        quint64 id;
+        qint64 timestamp;
+        quint64 textOffset;     // UTF-16, 2-byte aligned
+        quint64 blobOffset;     // Serialized ClipboardItem
+        quint32 textLength;     // In UTF-16 units
+        quint32 blobLength;
+        qint32 type;
+        quint32 reserved;
+    };
+    
+    struct Segment
+    {
+        std::unique_ptr<QFile> file;
+        const uchar* data = nullptr;
+        qint64 size = 0;
+        const SegmentHeader* header = nullptr;
+        const IndexEntry* index = nullptr;
+    };
+    
+    QString m_directory;
+    std::vector<Segment> m_segments;    // Newest first
+    QList<ClipboardItem> m_pending;     // Highest id first, not sealed yet
+    QList<QList<ClipboardItem>> m_sealing;  // Handed to the worker, newest batch first
+    qint64 m_pendingBytes;
+    QThreadPool m_pool;
+    
+    void addPending(const ClipboardItem& item);
+    void seal();
+    void onSealed(const QString& path, bool written);
+    bool mapSegment(const QString& path, Segment* segment) const;
+    static QByteArray buildSegment(const QList<ClipboardItem>& items);
+    static ClipboardItem decode(const Segment& segment, const IndexEntry& entry);
+    static bool mayContain(const Segment& segment, const QString& text);
+    static bool matches(const ClipboardItem& item, const Query& query);
+};
+
+#endif // HISTORYARCHIVE_H
@@ -0,0 +1,199 @@
+#include "HistoryClient.h"
+#include "IpcProtocol.h"
+#include <QLocalSocket>
+
+namespace {
+const int kPageSize = 200;
+}
+
+HistoryClient::HistoryClient(const QString& serverName, QObject* parent)
+    : QObject(parent)
+    , m_socket(new QLocalSocket(this))
+    , m_serverName(serverName)
+    , m_expectedOffset(-1)
+{
+    connect(m_socket, &QLocalSocket::connected, this, &HistoryClient::onConnected);
+    connect(m_socket, &QLocalSocket::readyRead, this, &HistoryClient::onReadyRead);
+    connect(m_socket, &QLocalSocket::disconnected, this, &HistoryClient::disconnected);
+    connect(m_socket, &QLocalSocket::errorOccurred, this, [this]() {
+        if (m_socket->state() == QLocalSocket::UnconnectedState) {
+            emit disconnected();
+        }
+    });
+}
+
+void HistoryClient::connectToDaemon()
+{
+    m_reader = IpcProtocol::FrameReader();
+    m_expectedOffset = -1;
+    m_socket->connectToServer(m_serverName);
+}
+
+bool HistoryClient::isConnected() const
+{
+    return m_socket->state() == QLocalSocket::ConnectedState;
+}
+
+void HistoryClient::removeItem(quint64 id)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::RemoveItem) << id;
+    send(payload);
+}
+
+void HistoryClient::removeItems(const QSet<quint64>& ids)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::RemoveItems) << ids.values();
+    send(payload);
+}
+
+void HistoryClient::setPinned(const QSet<quint64>& ids, bool pinned)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::SetPinned) << pinned << ids.values();
+    send(payload);
+}
+
+void HistoryClient::mergeItems(const QSet<quint64>& ids)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::MergeItems) << ids.values();
+    send(payload);
+}
+
+void HistoryClient::clearHistory()
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::ClearHistory);
+    send(payload);
+}
+
+void HistoryClient::copyItem(quint64 id)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::CopyItem) << id;
+    send(payload);
+}
+
+void HistoryClient::setMaxHistorySize(int size)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::SetMaxHistorySize) << static_cast<qint32>(size);
+    send(payload);
+}
+
+void HistoryClient::onConnected()
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::Hello) << IpcProtocol::kVersion;
+    send(payload);
+    
+    emit connected();
+}
+
+void HistoryClient::onReadyRead()
+{
+    QList<QByteArray> frames;
+    if (!IpcProtocol::readFrames(m_socket, m_reader, frames)) {
+        m_socket->abort();
+        return;
+    }
+    
+    for (const QByteArray& frame : frames) {
+        handleFrame(frame);
+    }
+}
+
+void HistoryClient::send(const QByteArray& payload)
+{
+    if (isConnected()) {
+        IpcProtocol::writeFrame(m_socket, payload);
+    }
+}
+
+void HistoryClient::requestPage(int offset)
+{
+    m_expectedOffset = offset;
+    
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::RequestPage)
+        << static_cast<qint32>(offset) << static_cast<qint32>(kPageSize);
+    send(payload);
+}
+
+void HistoryClient::restartFetch()
+{
+    emit historyReset();
+    requestPage(0);
+}
+
+void HistoryClient::handleFrame(const QByteArray& frame)
+{
+    QDataStream in(frame);
+    in.setVersion(IpcProtocol::kStreamVersion);
+    
+    quint8 type = 0;
+    in >> type;
+    
+    switch (type) {
+        case IpcProtocol::Welcome: {
+            quint32 version = 0;
+            in >> version;
+            if (version != IpcProtocol::kVersion) {
+                m_socket->abort();
+                return;
+            }
+            restartFetch();
+            break;
+        }
+        case IpcProtocol::HistoryPage: {
+            qint32 offset = 0;
+            qint32 total = 0;
+            QList<ClipboardItem> items;
+            in >> offset >> total >> items;
+            
+            // Answers to requests made before a reset are stale
+            if (offset != m_expectedOffset) {
+                return;
+            }
+            
+            const int next = offset + items.size();
+            const bool last = items.isEmpty() || next >= total;
+            m_expectedOffset = last ? -1 : next;
+            emit pageReceived(offset, items, last);
+            
+            if (!last) {
+                requestPage(next);
+            }
+            break;
+        }
+        case IpcProtocol::ItemAdded: {
+            ClipboardItem item;
+            qint32 maxHistorySize = 0;
+            in >> item >> maxHistorySize;
+            
+            // An add shifts the offsets of a fetch in progress, start over
+            if (m_expectedOffset >= 0) {
+                restartFetch();
+                return;
+            }
+            emit itemAdded(item, maxHistorySize);
+            break;
+        }
+        case IpcProtocol::HistoryReset:
+            restartFetch();
+            break;
+        default:
+            break;
+    }
+}
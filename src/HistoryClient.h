@@ -0,0 +1,58 @@
+#ifndef HISTORYCLIENT_H
+#define HISTORYCLIENT_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QList>
+#include <QSet>
+#include "ClipboardItem.h"
+#include "IpcProtocol.h"
+
+class QLocalSocket;
+
+// Client side of the IPC protocol: fetches the daemon's history in pages and
+// reports pushed changes. Commands are forwarded to the daemon, which answers
+// with the resulting change.
+class HistoryClient : public QObject
+{
+    Q_OBJECT
+    
+public:
+    explicit HistoryClient(const QString& serverName, QObject* parent = nullptr);
+    
+    void connectToDaemon();
+    bool isConnected() const;
+    
+    void removeItem(quint64 id);
+    void removeItems(const QSet<quint64>& ids);
+    void setPinned(const QSet<quint64>& ids, bool pinned);
+    void mergeItems(const QSet<quint64>& ids);
+    void clearHistory();
+    void copyItem(quint64 id);
+    void setMaxHistorySize(int size);
+    
+signals:
+    // The mirrored history must be discarded; pages starting at 0 follow
+    void historyReset();
+    void pageReceived(int offset, const QList<ClipboardItem>& items, bool last);
+    void itemAdded(const ClipboardItem& item, int maxHistorySize);
+    void connected();
+    void disconnected();
+    
+private slots:
+    void onConnected();
+    void onReadyRead();
+    
+private:
+    QLocalSocket* m_socket;
+    QString m_serverName;
+    IpcProtocol::FrameReader m_reader;
+    int m_expectedOffset;   // Next page offset while fetching, -1 when in sync
+    
+    void send(const QByteArray& payload);
+    void requestPage(int offset);
+    void restartFetch();
+    void handleFrame(const QByteArray& frame);
+};
+
+#endif // HISTORYCLIENT_H
@@ -0,0 +1,858 @@
+#include "HistoryLog.h"
+#include "Diagnostics.h"
+#include <QDataStream>
+#include <QDeadlineTimer>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QThread>
+#include <QtEndian>
+#include <array>
+#include <functional>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+const quint32 kMagic = 0x43424c47;     // "CBLG"
+const quint32 kVersion = 3;
+const quint32 kFirstVersion = 1;    // Readable; rewritten on open
+const quint32 kFullItemVersion = 3; // Items before it may lack the markup and pin
+const int kHeaderSize = 8;
+const int kRecordHeaderSize = 8;
+const int kStreamVersion = QDataStream::Qt_6_0;
+
+// Anything larger is a corrupt length field, not a record
+const quint32 kMaxRecordSize = 1024 * 1024 * 1024;
+
+// A copy burst is one batch; an idle clipboard costs one fsync per copy at
+// most, a second after it
+const qint64 kGroupCommitBytes = 256 * 1024;
+const qint64 kGroupCommitMsecs = 1000;
+
+// Size of a record besides its item payload
+const qint64 kRecordOverhead = 64;
+
+// Compaction starts once this much of a file of at least this size is dead,
+// and copies one step's worth of records per pause
+const double kCompactionDeadRatio = 0.5;
+const qint64 kMinCompactionBytes = 1024 * 1024;
+const qint64 kCompactionStepBytes = 256 * 1024;
+const qint64 kCompactionPauseMsecs = 20;
+
+quint32 crc32(const char* data, qint64 size)
+{
+    static const std::array<quint32, 256> table = []() {
+        std::array<quint32, 256> entries{};
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+            }
+            entries[i] = crc;
+        }
+        return entries;
+    }();
+    
+    quint32 crc = 0xffffffff;
+    for (qint64 i = 0; i < size; ++i) {
+        crc = table[(crc ^ static_cast<quint8>(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffff;
+}
+
+bool syncToDisk(QFile& file)
+{
+    if (!file.flush()) {
+        return false;
+    }
+#ifdef Q_OS_WIN
+    return _commit(file.handle()) == 0;
+#else
+    return ::fsync(file.handle()) == 0;
+#endif
+}
+
+qint64 itemBytes(const ClipboardItem& item)
+{
+    return (item.text().size() + item.html().size()) * 2 + item.imageData().size() + kRecordOverhead;
+}
+
+QByteArray fileHeader()
+{
+    QByteArray header(kHeaderSize, Qt::Uninitialized);
+    qToBigEndian(kMagic, header.data());
+    qToBigEndian(kVersion, header.data() + 4);
+    return header;
+}
+}
+
+HistoryLog::HistoryLog()
+    : m_writer(nullptr)
+    , m_queuedBytes(0)
+    , m_flushRequested(false)
+    , m_writing(false)
+    , m_stopping(false)
+    , m_liveMaxSize(-1)
+    , m_liveBytes(0)
+    , m_fileSize(0)
+    , m_compactionBackoffSize(0)
+    , m_failed(false)
+{
+}
+
+HistoryLog::~HistoryLog()
+{
+    if (!m_writer) {
+        return;
+    }
+    
+    // The writer commits whatever is still queued before it exits
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_wakeup.wakeAll();
+    }
+    m_writer->wait();
+    delete m_writer;
+}
+
+bool HistoryLog::open(const QString& path, Recovered* recovered)
+{
+    if (m_writer) {
+        m_errorString = QStringLiteral("already open");
+        return false;
+    }
+    
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadWrite)) {
+        m_errorString = m_file.errorString();
+        return false;
+    }
+    if (!recover(recovered)) {
+        m_file.close();
+        return false;
+    }
+    
+    m_openedAt.start();
+    publishSpaceStats();
+    m_writer = QThread::create([this]() { writerLoop(); });
+    m_writer->start(QThread::LowPriority);
+    return true;
+}
+
+bool HistoryLog::recover(Recovered* recovered)
+{
+    // A new file only gets its header
+    if (m_file.size() < kHeaderSize) {
+        if (!m_file.resize(0) || m_file.write(fileHeader()) != kHeaderSize || !syncToDisk(m_file)) {
+            m_errorString = m_file.errorString();
+            return false;
+        }
+        m_fileSize = kHeaderSize;
+        return true;
+    }
+    
+    const QByteArray header = m_file.read(kHeaderSize);
+    const quint32 version = qFromBigEndian<quint32>(header.constData() + 4);
+    if (header.left(4) != fileHeader().left(4) || version < kFirstVersion || version > kVersion) {
+        m_errorString = QStringLiteral("not a history log, or written by a newer version");
+        return false;
+    }
+    
+    // Ids follow history order, imported items numbered below the rest, so a
+    // map ordered by descending id is history order
+    std::map<quint64, ClipboardItem, std::greater<quint64>> items;
+    int maxSize = -1;
+    const auto trim = [&]() {
+        // The oldest unpinned item goes first; the newest always stays
+        auto it = items.end();
+        while (maxSize > 0 && static_cast<int>(items.size()) > maxSize && --it != items.begin()) {
+            if (!it->second.isPinned()) {
+                it = items.erase(it);
+            }
+        }
+    };
+    
+    qint64 validEnd = kHeaderSize;
+    while (true) {
+        const QByteArray recordHeader = m_file.read(kRecordHeaderSize);
+        if (recordHeader.size() < kRecordHeaderSize) {
+            break;
+        }
+        const quint32 length = qFromBigEndian<quint32>(recordHeader.constData());
+        const quint32 checksum = qFromBigEndian<quint32>(recordHeader.constData() + 4);
+        if (length == 0 || length > kMaxRecordSize) {
+            break;
+        }
+        const QByteArray payload = m_file.read(length);
+        Record record;
+        if (payload.size() < static_cast<int>(length) || crc32(payload.constData(), length) != checksum ||
+            !deserialize(payload, version, &record)) {
+            break;
+        }
+        
+        switch (record.op) {
+            case AddItem:
+                items[record.id] = record.item;
+                trim();
+                break;
+            case MoveToFront: {
+                // Moves of items that were never logged (expiring ones) are skipped
+                const auto it = items.find(record.id);
+                if (it != items.end()) {
+                    ClipboardItem item = it->second;
+                    items.erase(it);
+                    item.setId(record.item.id());
+                    item.setTimestamp(record.item.timestamp());
+                    item.setUsage(record.item.useCount(), record.item.frecency());
+                    items[item.id()] = item;
+                    trim();
+                }
+                break;
+            }
+            case RemoveItem:
+                items.erase(record.id);
+                break;
+            case ClearHistory:
+                items.clear();
+                break;
+            case SetMaxSize:
+                maxSize = record.value;
+                trim();
+                break;
+            case SetUsage: {
+                const auto it = items.find(record.id);
+                if (it != items.end()) {
+                    it->second.setUsage(record.item.useCount(), record.item.frecency());
+                }
+                break;
+            }
+            case RemoveItems:
+                for (const quint64 id : record.ids) {
+                    items.erase(id);
+                }
+                break;
+            case SetPinned:
+                for (const quint64 id : record.ids) {
+                    const auto it = items.find(id);
+                    if (it != items.end()) {
+                        it->second.setPinned(record.value != 0);
+                    }
+                }
+                trim();
+                break;
+        }
+        
+        track(record, validEnd, kRecordHeaderSize + length);
+        validEnd += kRecordHeaderSize + length;
+        ++recovered->records;
+    }
+    
+    recovered->truncatedBytes = m_file.size() - validEnd;
+    if (recovered->truncatedBytes > 0) {
+        qWarning("History log: dropping %lld bytes of torn or corrupt records at offset %lld",
+                 static_cast<long long>(recovered->truncatedBytes), static_cast<long long>(validEnd));
+        if (!m_file.resize(validEnd) || !syncToDisk(m_file)) {
+            m_errorString = m_file.errorString();
+            return false;
+        }
+    }
+    m_file.seek(validEnd);
+    m_fileSize = validEnd;
+    
+    recovered->maxHistorySize = maxSize;
+    for (const auto& entry : items) {
+        recovered->items.append(entry.second);
+    }
+    
+    // Items in older files may lack fields, and compaction copies records as
+    // they are, so the file is rewritten in the current layout right away
+    return version == kVersion || upgrade(recovered);
+}
+
+bool HistoryLog::upgrade(Recovered* recovered)
+{
+    QByteArray data = fileHeader();
+    for (auto it = recovered->items.crbegin(); it != recovered->items.crend(); ++it) {
+        data.append(frame(serialize(Record{AddItem, it->id(), 0, *it})));
+    }
+    if (recovered->maxHistorySize > 0) {
+        data.append(frame(serialize(Record{SetMaxSize, 0, recovered->maxHistorySize, ClipboardItem()})));
+    }
+    
+    QSaveFile file(m_file.fileName());
+    m_file.close();
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+        m_errorString = file.errorString();
+        return false;
+    }
+    if (!m_file.open(QIODevice::ReadWrite)) {
+        m_errorString = m_file.errorString();
+        return false;
+    }
+    qCDebug(lcPerf) << "Upgraded history log to version" << kVersion << "with" << recovered->items.size() << "items";
+    
+    // Replayed again, so offsets are tracked in the new file
+    const qint64 truncatedBytes = recovered->truncatedBytes;
+    m_live.clear();
+    m_liveMaxSize = -1;
+    m_liveBytes = 0;
+    *recovered = Recovered();
+    if (!recover(recovered)) {
+        return false;
+    }
+    recovered->truncatedBytes = truncatedBytes;
+    return true;
+}
+
+void HistoryLog::appendItem(const ClipboardItem& item)
+{
+    append(Record{AddItem, item.id(), 0, item}, itemBytes(item));
+}
+
+void HistoryLog::appendMove(quint64 oldId, const ClipboardItem& item)
+{
+    append(Record{MoveToFront, oldId, 0, item}, kRecordOverhead);
+}
+
+void HistoryLog::appendRemove(quint64 id)
+{
+    append(Record{RemoveItem, id, 0, ClipboardItem()}, kRecordOverhead);
+}
+
+void HistoryLog::appendRemove(const QList<quint64>& ids)
+{
+    append(Record{RemoveItems, 0, 0, ClipboardItem(), ids}, kRecordOverhead + ids.size() * 8);
+}
+
+void HistoryLog::appendPinned(const QList<quint64>& ids, bool pinned)
+{
+    append(Record{SetPinned, 0, pinned ? 1 : 0, ClipboardItem(), ids}, kRecordOverhead + ids.size() * 8);
+}
+
+void HistoryLog::appendClear()
+{
+    append(Record{ClearHistory, 0, 0, ClipboardItem()}, kRecordOverhead);
+}
+
+void HistoryLog::appendMaxSize(int size)
+{
+    append(Record{SetMaxSize, 0, size, ClipboardItem()}, kRecordOverhead);
+}
+
+void HistoryLog::appendUsage(const ClipboardItem& item)
+{
+    append(Record{SetUsage, item.id(), 0, item}, kRecordOverhead);
+}
+
+void HistoryLog::append(Record record, qint64 estimatedBytes)
+{
+    if (!m_writer) {
+        return;
+    }
+    
+    QElapsedTimer timer;
+    timer.start();
+    
+    QMutexLocker locker(&m_mutex);
+    if (m_queue.empty()) {
+        m_batchAge.start();
+    }
+    m_queue.push_back(std::move(record));
+    m_queuedBytes += estimatedBytes;
+    m_wakeup.wakeOne();
+    
+    m_stats.worstAppendUsecs = qMax(m_stats.worstAppendUsecs, timer.nsecsElapsed() / 1000.0);
+}
+
+void HistoryLog::flush()
+{
+    if (!m_writer) {
+        return;
+    }
+    
+    QMutexLocker locker(&m_mutex);
+    m_flushRequested = true;
+    m_wakeup.wakeAll();
+    while (!m_queue.empty() || m_writing) {
+        m_committed.wait(&m_mutex);
+    }
+}
+
+HistoryLog::Stats HistoryLog::stats() const
+{
+    QMutexLocker locker(&m_mutex);
+    Stats stats = m_stats;
+    const qint64 minutes = m_openedAt.isValid() ? m_openedAt.elapsed() : 0;
+    stats.fsyncsPerMinute = minutes > 0 ? stats.commits * 60000.0 / minutes : 0.0;
+    return stats;
+}
+
+void HistoryLog::writerLoop()
+{
+    maybeStartCompaction();
+    
+    QMutexLocker locker(&m_mutex);
+    while (true) {
+        while (m_queue.empty() && !m_stopping) {
+            if (!m_compaction.output) {
+                m_wakeup.wait(&m_mutex);
+                continue;
+            }
+            
+            // Compaction only runs while there is nothing to commit, and
+            // pauses between steps so it doesn't saturate the disk
+            locker.unlock();
+            compactStep();
+            locker.relock();
+            if (m_compaction.output && m_queue.empty() && !m_stopping) {
+                m_wakeup.wait(&m_mutex, QDeadlineTimer(kCompactionPauseMsecs));
+            }
+        }
+        if (m_queue.empty()) {
+            break;
+        }
+        
+        // Let the batch grow until it is big or old enough
+        while (!m_stopping && !m_flushRequested && m_queuedBytes < kGroupCommitBytes) {
+            const qint64 remaining = kGroupCommitMsecs - m_batchAge.elapsed();
+            if (remaining <= 0) {
+                break;
+            }
+            m_wakeup.wait(&m_mutex, QDeadlineTimer(remaining));
+        }
+        
+        std::vector<Record> batch;
+        batch.swap(m_queue);
+        const QElapsedTimer batchAge = m_batchAge;
+        m_queuedBytes = 0;
+        m_flushRequested = false;
+        m_writing = true;
+        locker.unlock();
+        
+        writeBatch(batch);
+        maybeStartCompaction();
+        
+        locker.relock();
+        m_writing = false;
+        m_stats.worstCommitMsecs = qMax(m_stats.worstCommitMsecs, batchAge.elapsed());
+        m_committed.wakeAll();
+    }
+    locker.unlock();
+    
+    // The old file is complete on its own; an unfinished compaction is dropped
+    if (m_compaction.output) {
+        abortCompaction(QStringLiteral("shutting down"));
+    }
+}
+
+void HistoryLog::writeBatch(const std::vector<Record>& batch)
+{
+    if (m_failed) {
+        return;
+    }
+    
+    QElapsedTimer timer;
+    timer.start();
+    
+    QByteArray data;
+    std::vector<qint64> lengths;
+    lengths.reserve(batch.size());
+    for (const Record& record : batch) {
+        const QByteArray framed = frame(serialize(record));
+        lengths.push_back(framed.size());
+        data.append(framed);
+    }
+    
+    if (m_file.write(data) != data.size() || !syncToDisk(m_file)) {
+        // Recovery stops at a torn record, which would hide every later one.
+        // The batch is cut off again, so the next one follows the last good
+        // record; if even that fails, nothing more is appended.
+        qWarning("History log: write failed, dropping %d records: %s", static_cast<int>(batch.size()),
+                 qPrintable(m_file.errorString()));
+        m_file.close();
+        if (!m_file.open(QIODevice::ReadWrite) || !m_file.resize(m_fileSize) || !m_file.seek(m_fileSize)) {
+            qWarning("History log: cannot cut off the failed write, no longer appending: %s",
+                     qPrintable(m_file.errorString()));
+            m_failed = true;
+        }
+        return;
+    }
+    
+    // Only what is on disk is tracked, so offsets stay those of the file
+    for (size_t i = 0; i < batch.size(); ++i) {
+        track(batch[i], m_fileSize, lengths[i]);
+        m_fileSize += lengths[i];
+    }
+    
+    QMutexLocker locker(&m_mutex);
+    m_stats.records += static_cast<qint64>(batch.size());
+    m_stats.bytesWritten += data.size();
+    ++m_stats.commits;
+    m_stats.fileBytes = m_fileSize;
+    m_stats.deadSpaceRatio = deadSpaceRatio();
+    qCDebug(lcPerf) << "Committed" << batch.size() << "history records," << data.size() / 1024 << "KiB in"
+                    << timer.elapsed() << "ms;" << m_stats.commits << "fsyncs so far";
+}
+
+void HistoryLog::track(const Record& record, qint64 offset, qint64 length)
+{
+    switch (record.op) {
+        case AddItem:
+            m_live[record.id] = LiveEntry{offset, length, record.id, false, QDateTime(), 0, 0.0,
+                                          record.item.isPinned(), record.item.isPinned()};
+            m_liveBytes += length;
+            break;
+        case MoveToFront: {
+            const auto it = m_live.find(record.id);
+            if (it == m_live.end()) {
+                return;
+            }
+            LiveEntry entry = it->second;
+            m_live.erase(it);
+            entry.changed = true;
+            entry.timestamp = record.item.timestamp();
+            entry.useCount = record.item.useCount();
+            entry.frecency = record.item.frecency();
+            m_live[record.item.id()] = entry;
+            break;
+        }
+        case RemoveItem: {
+            const auto it = m_live.find(record.id);
+            if (it != m_live.end()) {
+                m_liveBytes -= it->second.length;
+                m_live.erase(it);
+            }
+            return;
+        }
+        case ClearHistory:
+            m_live.clear();
+            m_liveBytes = 0;
+            return;
+        case SetMaxSize:
+            m_liveMaxSize = record.value;
+            break;
+        case SetUsage: {
+            const auto it = m_live.find(record.id);
+            if (it != m_live.end()) {
+                it->second.changed = true;
+                it->second.useCount = record.item.useCount();
+                it->second.frecency = record.item.frecency();
+            }
+            return;
+        }
+        case RemoveItems:
+            for (const quint64 id : record.ids) {
+                const auto it = m_live.find(id);
+                if (it != m_live.end()) {
+                    m_liveBytes -= it->second.length;
+                    m_live.erase(it);
+                }
+            }
+            return;
+        case SetPinned:
+            for (const quint64 id : record.ids) {
+                const auto it = m_live.find(id);
+                if (it != m_live.end()) {
+                    it->second.pinned = record.value != 0;
+                }
+            }
+            break;
+    }
+    
+    // Evictions are not logged; mirror replay's trimming
+    auto it = m_live.end();
+    while (m_liveMaxSize > 0 && static_cast<int>(m_live.size()) > m_liveMaxSize && --it != m_live.begin()) {
+        if (!it->second.pinned) {
+            m_liveBytes -= it->second.length;
+            it = m_live.erase(it);
+        }
+    }
+}
+
+double HistoryLog::deadSpaceRatio() const
+{
+    const qint64 recordBytes = m_fileSize - kHeaderSize;
+    return recordBytes > 0 ? 1.0 - static_cast<double>(m_liveBytes) / recordBytes : 0.0;
+}
+
+void HistoryLog::maybeStartCompaction()
+{
+    if (m_failed || m_compaction.output || m_fileSize < qMax(kMinCompactionBytes, m_compactionBackoffSize) ||
+        deadSpaceRatio() < kCompactionDeadRatio) {
+        return;
+    }
+    
+    m_compaction.output.reset(new QSaveFile(m_file.fileName()));
+    m_compaction.source.setFileName(m_file.fileName());
+    if (!m_compaction.output->open(QIODevice::WriteOnly) || !m_compaction.source.open(QIODevice::ReadOnly) ||
+        m_compaction.output->write(fileHeader()) != kHeaderSize) {
+        abortCompaction(m_compaction.output->errorString());
+        return;
+    }
+    
+    // The live set as of the last committed record; what is committed
+    // after it is copied over verbatim at the end
+    m_compaction.entries.assign(m_live.rbegin(), m_live.rend());
+    m_compaction.next = 0;
+    m_compaction.outputSize = kHeaderSize;
+    m_compaction.tailStart = m_fileSize;
+    m_compaction.maxSize = m_liveMaxSize;
+    m_compaction.newOffsets.clear();
+    m_compaction.started.start();
+    
+    qCDebug(lcPerf) << "Compacting history log:" << m_fileSize / 1024 << "KiB," << deadSpaceRatio() * 100
+                    << "% dead," << m_compaction.entries.size() << "live items";
+}
+
+void HistoryLog::compactStep()
+{
+    QElapsedTimer timer;
+    timer.start();
+    
+    QByteArray data;
+    QList<quint64> pinned;
+    QList<quint64> unpinned;
+    while (m_compaction.next < m_compaction.entries.size() && data.size() < kCompactionStepBytes) {
+        const quint64 id = m_compaction.entries[m_compaction.next].first;
+        const LiveEntry& entry = m_compaction.entries[m_compaction.next].second;
+        ++m_compaction.next;
+        
+        // The AddItem record is copied as is, checksum included
+        if (!m_compaction.source.seek(entry.offset)) {
+            abortCompaction(m_compaction.source.errorString());
+            return;
+        }
+        const QByteArray record = m_compaction.source.read(entry.length);
+        if (record.size() != entry.length) {
+            abortCompaction(QStringLiteral("short read"));
+            return;
+        }
+        m_compaction.newOffsets[entry.offset] = m_compaction.outputSize + data.size();
+        data.append(record);
+        
+        if (entry.changed) {
+            ClipboardItem state;
+            state.setId(id);
+            state.setTimestamp(entry.timestamp);
+            state.setUsage(entry.useCount, entry.frecency);
+            data.append(frame(serialize(entry.addedId != id ? Record{MoveToFront, entry.addedId, 0, state}
+                                                            : Record{SetUsage, id, 0, state})));
+        }
+        if (entry.pinned != entry.addedPinned) {
+            (entry.pinned ? pinned : unpinned).append(id);
+        }
+    }
+    
+    // The copied AddItem records hold the pin flag as it was when each item
+    // was added; one record per step sets those that changed since
+    if (!pinned.isEmpty()) {
+        data.append(frame(serialize(Record{SetPinned, 0, 1, ClipboardItem(), pinned})));
+    }
+    if (!unpinned.isEmpty()) {
+        data.append(frame(serialize(Record{SetPinned, 0, 0, ClipboardItem(), unpinned})));
+    }
+    
+    if (m_compaction.output->write(data) != data.size()) {
+        abortCompaction(m_compaction.output->errorString());
+        return;
+    }
+    m_compaction.outputSize += data.size();
+    
+    const bool finished = m_compaction.next == m_compaction.entries.size() && finishCompaction();
+    
+    QMutexLocker locker(&m_mutex);
+    m_stats.bytesRewritten += data.size();
+    m_stats.worstCompactionPauseMsecs = qMax(m_stats.worstCompactionPauseMsecs, timer.elapsed());
+    if (finished) {
+        ++m_stats.compactions;
+        m_stats.lastCompactionMsecs = m_compaction.started.elapsed();
+        m_stats.fileBytes = m_fileSize;
+        m_stats.deadSpaceRatio = deadSpaceRatio();
+    }
+}
+
+bool HistoryLog::finishCompaction()
+{
+    // Replay trims only once the maximum size is known, so none of the
+    // copied items can be evicted before its move record is seen
+    QByteArray data;
+    if (m_compaction.maxSize > 0) {
+        data = frame(serialize(Record{SetMaxSize, 0, m_compaction.maxSize, ClipboardItem()}));
+    }
+    const qint64 newTailStart = m_compaction.outputSize + data.size();
+    
+    // Then everything committed since the live set was taken
+    const qint64 tailLength = m_fileSize - m_compaction.tailStart;
+    if (!m_compaction.source.seek(m_compaction.tailStart)) {
+        abortCompaction(m_compaction.source.errorString());
+        return false;
+    }
+    const QByteArray tail = m_compaction.source.read(tailLength);
+    data.append(tail);
+    if (tail.size() != tailLength || m_compaction.output->write(data) != data.size()) {
+        abortCompaction(QStringLiteral("could not copy the records committed meanwhile"));
+        return false;
+    }
+    m_compaction.outputSize += data.size();
+    
+    // QSaveFile syncs the new file and renames it over the old one, so the
+    // log is either file, never something in between
+    m_compaction.source.close();
+    m_file.close();
+    const bool committed = m_compaction.output->commit();
+    const QString error = m_compaction.output->errorString();
+    m_compaction.output.reset();
+    if (!m_file.open(QIODevice::ReadWrite) || !m_file.seek(m_file.size())) {
+        qWarning("History log: cannot reopen %s: %s", qPrintable(m_file.fileName()), qPrintable(m_file.errorString()));
+    }
+    if (!committed) {
+        qWarning("History log: compaction failed: %s", qPrintable(error));
+        m_compaction.entries.clear();
+        m_compaction.newOffsets.clear();
+        m_compactionBackoffSize = m_fileSize * 2;
+        return false;
+    }
+    
+    // Every live item was either copied or added after tailStart
+    for (auto& live : m_live) {
+        LiveEntry& entry = live.second;
+        entry.offset = entry.offset >= m_compaction.tailStart
+                           ? entry.offset - m_compaction.tailStart + newTailStart
+                           : m_compaction.newOffsets[entry.offset];
+    }
+    
+    qCDebug(lcPerf) << "Compacted history log from" << m_fileSize / 1024 << "KiB to"
+                    << m_compaction.outputSize / 1024 << "KiB in" << m_compaction.started.elapsed() << "ms";
+    m_fileSize = m_compaction.outputSize;
+    m_compactionBackoffSize = 0;
+    m_compaction.entries.clear();
+    m_compaction.newOffsets.clear();
+    return true;
+}
+
+void HistoryLog::abortCompaction(const QString& reason)
+{
+    qWarning("History log: compaction abandoned: %s", qPrintable(reason));
+    m_compaction.output.reset();   // Discards the unfinished file
+    m_compaction.source.close();
+    m_compaction.entries.clear();
+    m_compaction.newOffsets.clear();
+    m_compactionBackoffSize = m_fileSize * 2;
+}
+
+void HistoryLog::publishSpaceStats()
+{
+    QMutexLocker locker(&m_mutex);
+    m_stats.fileBytes = m_fileSize;
+    m_stats.deadSpaceRatio = deadSpaceRatio();
+}
+
+QByteArray HistoryLog::frame(const QByteArray& payload)
+{
+    QByteArray framed(kRecordHeaderSize, Qt::Uninitialized);
+    qToBigEndian(static_cast<quint32>(payload.size()), framed.data());
+    qToBigEndian(crc32(payload.constData(), payload.size()), framed.data() + 4);
+    framed.append(payload);
+    return framed;
+}
+
+QByteArray HistoryLog::serialize(const Record& record)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(kStreamVersion);
+    out << static_cast<quint8>(record.op);
+    
+    switch (record.op) {
+        case AddItem:
+            // Images still waiting for their background encode are encoded here
+            out << record.item;
+            break;
+        case MoveToFront:
+            out << record.id << record.item.id() << record.item.timestamp()
+                << static_cast<qint32>(record.item.useCount()) << record.item.frecency();
+            break;
+        case RemoveItem:
+            out << record.id;
+            break;
+        case ClearHistory:
+            break;
+        case SetMaxSize:
+            out << record.value;
+            break;
+        case SetUsage:
+            out << record.id << static_cast<qint32>(record.item.useCount()) << record.item.frecency();
+            break;
+        case RemoveItems:
+            out << record.ids;
+            break;
+        case SetPinned:
+            out << record.value << record.ids;
+            break;
+    }
+    return payload;
+}
+
+bool HistoryLog::deserialize(const QByteArray& payload, quint32 version, Record* record)
+{
+    QDataStream in(payload);
+    in.setVersion(kStreamVersion);
+    quint8 op = 0;
+    in >> op;
+    
+    record->op = static_cast<Op>(op);
+    record->id = 0;
+    record->value = 0;
+    switch (record->op) {
+        case AddItem:
+            if (version < kFullItemVersion) {
+                ClipboardItem::readLegacy(in, record->item);
+            } else {
+                in >> record->item;
+            }
+            record->id = record->item.id();
+            break;
+        case MoveToFront: {
+            quint64 newId = 0;
+            QDateTime timestamp;
+            qint32 useCount = 0;
+            double frecency = 0.0;
+            in >> record->id >> newId >> timestamp >> useCount >> frecency;
+            record->item.setId(newId);
+            record->item.setTimestamp(timestamp);
+            record->item.setUsage(useCount, frecency);
+            break;
+        }
+        case RemoveItem:
+            in >> record->id;
+            break;
+        case ClearHistory:
+            break;
+        case SetMaxSize:
+            in >> record->value;
+            break;
+        case SetUsage: {
+            qint32 useCount = 0;
+            double frecency = 0.0;
+            in >> record->id >> useCount >> frecency;
+            record->item.setUsage(useCount, frecency);
+            break;
+        }
+        case RemoveItems:
+            in >> record->ids;
+            break;
+        case SetPinned:
+            in >> record->value >> record->ids;
+            break;
+        default:
+            // The version in the header covers the ops; this is corruption
+            return false;
+    }
+    return in.status() == QDataStream::Ok;
+}
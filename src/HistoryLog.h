@@ -0,0 +1,189 @@
+#ifndef HISTORYLOG_H
+#define HISTORYLOG_H
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+#include <map>
+#include <memory>
+#include <vector>
+#include "ClipboardItem.h"
+
+class QSaveFile;
+class QThread;
+
+// Write-ahead log of history mutations, so the history survives restarts and
+// crashes. Appending only queues the mutation; a background writer commits
+// queued records in batches with one fsync per batch, once the batch holds
+// kGroupCommitBytes or its oldest record is kGroupCommitMsecs old. A crash
+// loses at most the batch that was not committed yet.
+//
+// The file is a header (quint32 magic, quint32 version) followed by records:
+// quint32 payload length, quint32 CRC-32 of the payload, then the payload, a
+// QDataStream holding a quint8 Op and its fields. Recovery replays records up
+// to the first one that is cut short or fails its checksum and truncates the
+// file there, so a torn last write is dropped rather than fatal. A batch
+// whose write fails is cut off right away, so later batches are not lost
+// behind it.
+//
+// Version 2 added the batch ops RemoveItems and SetPinned. Version 3 items
+// always carry the markup and pin fields; older files may hold items
+// without them, so they are replayed and rewritten whole on open. Replay
+// evicts the oldest unpinned items, like ClipboardManager does.
+//
+// Removed, evicted and moved items leave dead records behind. Once most of
+// the file is dead, the writer compacts it while it has nothing to commit:
+// a few hundred KiB at a time, it copies the AddItem record of every live
+// item into a new file, with a record for any later move or usage change.
+// It then appends the records committed since it started and renames the
+// new file over the old one. Appends are never blocked; commits wait for
+// at most one step.
+class HistoryLog
+{
+public:
+    enum Op : quint8 {
+        AddItem = 1,    // ClipboardItem
+        MoveToFront,    // quint64 oldId, quint64 newId, QDateTime timestamp, qint32 useCount, double frecency
+        RemoveItem,     // quint64 id
+        ClearHistory,
+        SetMaxSize,     // qint32 size
+        SetUsage,       // quint64 id, qint32 useCount, double frecency
+        RemoveItems,    // QList<quint64> ids
+        SetPinned       // qint32 pinned, QList<quint64> ids
+    };
+    
+    // History as of the last committed record, newest first
+    struct Recovered
+    {
+        QList<ClipboardItem> items;
+        int maxHistorySize = -1;    // -1 if never recorded
+        int records = 0;
+        qint64 truncatedBytes = 0;  // Torn or corrupt tail that was cut off
+    };
+    
+    struct Stats
+    {
+        qint64 records = 0;
+        qint64 commits = 0;             // One fsync each
+        qint64 bytesWritten = 0;
+        double fsyncsPerMinute = 0.0;
+        double worstAppendUsecs = 0.0;  // Time the capture path spends queueing
+        qint64 worstCommitMsecs = 0;    // Oldest record in a batch to fsync done
+        
+        qint64 fileBytes = 0;
+        double deadSpaceRatio = 0.0;    // Share of the file no live item needs
+        qint64 compactions = 0;
+        qint64 bytesRewritten = 0;
+        qint64 worstCompactionPauseMsecs = 0;   // Longest step or swap, during which nothing commits
+        qint64 lastCompactionMsecs = 0;         // Start to swap, throttling included
+    };
+    
+    HistoryLog();
+    ~HistoryLog();
+    
+    // Recovers the history from path, creating the file if needed, and starts
+    // the writer. Appends before a successful open are ignored.
+    bool open(const QString& path, Recovered* recovered);
+    bool isOpen() const { return m_writer != nullptr; }
+    QString errorString() const { return m_errorString; }
+    
+    void appendItem(const ClipboardItem& item);
+    void appendMove(quint64 oldId, const ClipboardItem& item);
+    void appendRemove(quint64 id);
+    void appendRemove(const QList<quint64>& ids);
+    void appendPinned(const QList<quint64>& ids, bool pinned);
+    void appendClear();
+    void appendMaxSize(int size);
+    void appendUsage(const ClipboardItem& item);
+    
+    // Commits everything queued so far and waits for the fsync
+    void flush();
+    
+    Stats stats() const;
+    
+private:
+    struct Record
+    {
+        Op op;
+        quint64 id;
+        qint32 value;
+        ClipboardItem item;     // Serialized by the writer, off the capture path
+        QList<quint64> ids;     // Batch ops only
+    };
+    
+    // Where a live item's AddItem record is, and its state if later records
+    // changed it
+    struct LiveEntry
+    {
+        qint64 offset;
+        qint64 length;
+        quint64 addedId;        // Id in the AddItem record; the item's id differs after a move
+        bool changed;
+        QDateTime timestamp;
+        qint32 useCount;
+        double frecency;
+        bool pinned;
+        bool addedPinned;       // Pin flag in the AddItem record
+    };
+    
+    // A compaction in progress; only the writer touches it
+    struct Compaction
+    {
+        std::unique_ptr<QSaveFile> output;
+        QFile source;
+        std::vector<std::pair<quint64, LiveEntry>> entries;     // Live items at the start, oldest first
+        size_t next = 0;
+        qint64 outputSize = 0;
+        qint64 tailStart = 0;   // Records from here on were committed during compaction
+        int maxSize = -1;
+        std::map<qint64, qint64> newOffsets;    // Old AddItem offset -> offset in the output
+        QElapsedTimer started;
+    };
+    
+    QFile m_file;
+    QString m_errorString;
+    QThread* m_writer;
+    
+    // Shared with the writer
+    mutable QMutex m_mutex;
+    QWaitCondition m_wakeup;
+    QWaitCondition m_committed;
+    std::vector<Record> m_queue;
+    qint64 m_queuedBytes;
+    QElapsedTimer m_batchAge;
+    bool m_flushRequested;
+    bool m_writing;
+    bool m_stopping;
+    Stats m_stats;
+    QElapsedTimer m_openedAt;
+    
+    // Owned by the writer once it runs
+    std::map<quint64, LiveEntry, std::greater<quint64>> m_live;     // History order
+    int m_liveMaxSize;
+    qint64 m_liveBytes;
+    qint64 m_fileSize;
+    qint64 m_compactionBackoffSize;
+    bool m_failed;      // A failed write could not be cut off
+    Compaction m_compaction;
+    
+    void append(Record record, qint64 estimatedBytes);
+    void writerLoop();
+    void writeBatch(const std::vector<Record>& batch);
+    bool recover(Recovered* recovered);
+    bool upgrade(Recovered* recovered);
+    void track(const Record& record, qint64 offset, qint64 length);
+    double deadSpaceRatio() const;
+    void maybeStartCompaction();
+    void compactStep();
+    bool finishCompaction();
+    void abortCompaction(const QString& reason);
+    void publishSpaceStats();
+    static QByteArray serialize(const Record& record);
+    static bool deserialize(const QByteArray& payload, quint32 version, Record* record);
+    static QByteArray frame(const QByteArray& payload);
+};
+
+#endif // HISTORYLOG_H
@@ -0,0 +1,481 @@
+#include "HistoryServer.h"
+#include "IpcProtocol.h"
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QClipboard>
+#include <QGuiApplication>
+#include <QImage>
+#include <QMimeData>
+
+namespace {
+const int kMaxPageSize = 500;
+
+// Pages are cut at this size too, so a run of large items doesn't make a
+// huge message; an item larger than this goes in a page of its own
+const qint64 kMaxPageBytes = 8 * 1024 * 1024;
+const int kMaxQueryResults = 10000;
+
+// Chunks queued in a client socket before waiting for bytesWritten
+const qint64 kMaxQueuedBytes = 4 * IpcProtocol::kChunkSize;
+
+// UTF-16 code units per chunk; one unit never takes more than 3 UTF-8 bytes
+const qsizetype kTextChunkLength = IpcProtocol::kChunkSize / 3;
+
+const qsizetype kMaxPushSize = 512 * 1024 * 1024;
+
+qint64 utf8Length(const QString& text)
+{
+    qint64 length = 0;
+    for (const QChar c : text) {
+        const ushort unit = c.unicode();
+        if (unit < 0x80) {
+            length += 1;
+        } else if (unit < 0x800) {
+            length += 2;
+        } else if (c.isSurrogate()) {
+            length += 2;    // A pair encodes to 4 bytes
+        } else {
+            length += 3;
+        }
+    }
+    return length;
+}
+
+QDateTime fromMsecs(qint64 msecs)
+{
+    return msecs == IpcProtocol::kUnboundedTime ? QDateTime() : QDateTime::fromMSecsSinceEpoch(msecs);
+}
+}
+
+HistoryServer::HistoryServer(ClipboardManager* manager, QObject* parent)
+    : QObject(parent)
+    , m_server(new QLocalServer(this))
+    , m_manager(manager)
+    , m_itemJustAdded(false)
+    , m_nameInUse(false)
+{
+    m_server->setSocketOptions(QLocalServer::UserAccessOption);
+    connect(m_server, &QLocalServer::newConnection, this, &HistoryServer::onNewConnection);
+    
+    connect(m_manager, &ClipboardManager::newItemAdded, this, &HistoryServer::onItemAdded);
+    connect(m_manager, &ClipboardManager::historyChanged, this, &HistoryServer::onHistoryChanged);
+}
+
+bool HistoryServer::listen(const QString& name)
+{
+    // Don't take the name over from a running instance
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    m_nameInUse = probe.waitForConnected(100);
+    if (m_nameInUse) {
+        probe.disconnectFromServer();
+        return false;
+    }
+    
+    // Clean up a socket left behind by an instance that didn't exit cleanly
+    QLocalServer::removeServer(name);
+    return m_server->listen(name);
+}
+
+QString HistoryServer::errorString() const
+{
+    if (m_nameInUse) {
+        return QStringLiteral("another instance is already running");
+    }
+    return m_server->errorString();
+}
+
+void HistoryServer::onNewConnection()
+{
+    while (QLocalSocket* client = m_server->nextPendingConnection()) {
+        m_readers.insert(client, IpcProtocol::FrameReader());
+        connect(client, &QLocalSocket::readyRead, this, &HistoryServer::onClientReadyRead);
+        connect(client, &QLocalSocket::disconnected, this, &HistoryServer::onClientDisconnected);
+        connect(client, &QLocalSocket::bytesWritten, this, &HistoryServer::onClientBytesWritten);
+    }
+}
+
+void HistoryServer::onClientReadyRead()
+{
+    QLocalSocket* client = qobject_cast<QLocalSocket*>(sender());
+    if (!client || !m_readers.contains(client)) {
+        return;
+    }
+    
+    QList<QByteArray> frames;
+    if (!IpcProtocol::readFrames(client, m_readers[client], frames)) {
+        client->disconnectFromServer();
+        return;
+    }
+    
+    for (const QByteArray& frame : frames) {
+        handleFrame(client, frame);
+    }
+}
+
+void HistoryServer::onClientDisconnected()
+{
+    QLocalSocket* client = qobject_cast<QLocalSocket*>(sender());
+    m_readers.remove(client);
+    m_outgoing.remove(client);
+    m_incoming.remove(client);
+    if (client) {
+        client->deleteLater();
+    }
+}
+
+void HistoryServer::onClientBytesWritten()
+{
+    QLocalSocket* client = qobject_cast<QLocalSocket*>(sender());
+    if (client) {
+        pumpTransfer(client);
+    }
+}
+
+void HistoryServer::onItemAdded(const ClipboardItem& item)
+{
+    // Clients apply the same dedup and trimming, so an add is pushed as-is
+    // rather than as a full reset
+    m_itemJustAdded = true;
+    
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::ItemAdded)
+        << item << static_cast<qint32>(m_manager->maxHistorySize());
+    broadcast(payload);
+}
+
+void HistoryServer::onHistoryChanged()
+{
+    // historyChanged follows every newItemAdded; that change was already pushed
+    if (m_itemJustAdded) {
+        m_itemJustAdded = false;
+        return;
+    }
+    
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::HistoryReset)
+        << static_cast<qint32>(m_manager->itemCount());
+    broadcast(payload);
+}
+
+void HistoryServer::handleFrame(QLocalSocket* client, const QByteArray& frame)
+{
+    QDataStream in(frame);
+    in.setVersion(IpcProtocol::kStreamVersion);
+    
+    quint8 type = 0;
+    in >> type;
+    
+    switch (type) {
+        case IpcProtocol::Hello: {
+            quint32 version = 0;
+            in >> version;
+            if (version != IpcProtocol::kVersion) {
+                client->disconnectFromServer();
+                return;
+            }
+            
+            QByteArray payload;
+            QDataStream out(&payload, QIODevice::WriteOnly);
+            IpcProtocol::beginMessage(out, IpcProtocol::Welcome)
+                << IpcProtocol::kVersion
+                << static_cast<qint32>(m_manager->itemCount())
+                << static_cast<qint32>(m_manager->maxHistorySize());
+            IpcProtocol::writeFrame(client, payload);
+            break;
+        }
+        case IpcProtocol::RequestPage: {
+            qint32 offset = 0;
+            qint32 count = 0;
+            in >> offset >> count;
+            sendPage(client, offset, count);
+            break;
+        }
+        case IpcProtocol::RemoveItem: {
+            quint64 id = 0;
+            in >> id;
+            m_manager->removeItem(m_manager->indexOf(id));
+            break;
+        }
+        case IpcProtocol::RemoveItems: {
+            QList<quint64> ids;
+            in >> ids;
+            m_manager->removeItems(QSet<quint64>(ids.cbegin(), ids.cend()));
+            break;
+        }
+        case IpcProtocol::SetPinned: {
+            bool pinned = false;
+            QList<quint64> ids;
+            in >> pinned >> ids;
+            m_manager->setPinned(QSet<quint64>(ids.cbegin(), ids.cend()), pinned);
+            break;
+        }
+        case IpcProtocol::MergeItems: {
+            QList<quint64> ids;
+            in >> ids;
+            m_manager->mergeItems(QSet<quint64>(ids.cbegin(), ids.cend()));
+            break;
+        }
+        case IpcProtocol::ClearHistory:
+            m_manager->clearHistory();
+            break;
+        case IpcProtocol::CopyItem: {
+            quint64 id = 0;
+            in >> id;
+            m_manager->copyToClipboard(m_manager->indexOf(id));
+            break;
+        }
+        case IpcProtocol::SetMaxHistorySize: {
+            qint32 size = 0;
+            in >> size;
+            m_manager->setMaxHistorySize(size);
+            break;
+        }
+        case IpcProtocol::Query: {
+            ClipboardManager::HistoryQuery query;
+            qint32 typeFilter = -1;
+            qint64 from = IpcProtocol::kUnboundedTime;
+            qint64 to = IpcProtocol::kUnboundedTime;
+            qint32 limit = 0;
+            in >> query.text >> typeFilter >> from >> to >> limit;
+            
+            query.typeFilter = typeFilter;
+            query.from = fromMsecs(from);
+            query.to = fromMsecs(to);
+            query.limit = qBound(0, limit, kMaxQueryResults);
+            sendQueryResults(client, query);
+            break;
+        }
+        case IpcProtocol::Fetch: {
+            quint64 id = 0;
+            in >> id;
+            startFetch(client, id);
+            break;
+        }
+        case IpcProtocol::Push: {
+            IncomingTransfer transfer;
+            in >> transfer.mimeType;
+            m_incoming.insert(client, transfer);
+            break;
+        }
+        case IpcProtocol::PayloadChunk: {
+            auto it = m_incoming.find(client);
+            if (it == m_incoming.end()) {
+                return;
+            }
+            
+            QByteArray data;
+            in >> data;
+            if (it->data.size() + data.size() > kMaxPushSize) {
+                m_incoming.erase(it);
+                sendError(client, QStringLiteral("Pushed payload is too large"));
+                return;
+            }
+            it->data.append(data);
+            break;
+        }
+        case IpcProtocol::PayloadEnd:
+            finishPush(client);
+            break;
+        default:
+            client->disconnectFromServer();
+            break;
+    }
+}
+
+void HistoryServer::sendPage(QLocalSocket* client, int offset, int count)
+{
+    const QList<ClipboardItem>& history = m_manager->history();
+    offset = qBound(0, offset, history.size());
+    count = qBound(0, count, qMin(kMaxPageSize, history.size() - offset));
+    
+    qint64 bytes = 0;
+    for (int i = 0; i < count; ++i) {
+        const ClipboardItem& item = history[offset + i];
+        bytes += (item.text().size() + item.html().size() + item.preview().size()) * 2 + item.imageData().size();
+        if (i > 0 && bytes > kMaxPageBytes) {
+            count = i;
+            break;
+        }
+    }
+    
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::HistoryPage)
+        << static_cast<qint32>(offset)
+        << static_cast<qint32>(history.size())
+        << history.mid(offset, count);
+    IpcProtocol::writeFrame(client, payload);
+}
+
+void HistoryServer::sendQueryResults(QLocalSocket* client, const ClipboardManager::HistoryQuery& query)
+{
+    const QList<ClipboardItem>& history = m_manager->history();
+    const QList<ClipboardManager::SearchResult> results = m_manager->topItems(query);
+    
+    // One frame per result, so clients can print them as they arrive
+    for (const ClipboardManager::SearchResult& result : results) {
+        sendQueryResult(client, history[result.index]);
+    }
+    
+    // Archived items are older than the whole history, so they come last
+    // in either ranking
+    ClipboardManager::HistoryQuery archiveQuery = query;
+    archiveQuery.limit = query.limit - results.size();
+    const QList<ClipboardItem> archived = archiveQuery.limit > 0 ? m_manager->searchArchive(archiveQuery)
+                                                                 : QList<ClipboardItem>();
+    for (const ClipboardItem& item : archived) {
+        sendQueryResult(client, item);
+    }
+    
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::QueryEnd) << static_cast<qint32>(results.size() + archived.size());
+    IpcProtocol::writeFrame(client, payload);
+}
+
+void HistoryServer::sendQueryResult(QLocalSocket* client, const ClipboardItem& item)
+{
+    const qint64 size = item.type() == ClipboardItem::Image ? -1 : utf8Length(item.text());
+    
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::QueryResult)
+        << item.id() << static_cast<qint32>(item.type())
+        << item.timestamp().toMSecsSinceEpoch() << size << item.preview();
+    IpcProtocol::writeFrame(client, payload);
+}
+
+void HistoryServer::startFetch(QLocalSocket* client, quint64 id)
+{
+    // Evicted items are looked up in the archive; that copy holds the only
+    // reference to its data once the transfer has it
+    const int index = m_manager->indexOf(id);
+    ClipboardItem archived;
+    if (index < 0 && !m_manager->archivedItem(id, &archived)) {
+        sendError(client, QStringLiteral("No item with id %1").arg(id));
+        return;
+    }
+    if (m_outgoing.contains(client)) {
+        sendError(client, QStringLiteral("A fetch is already in progress"));
+        return;
+    }
+    
+    const ClipboardItem& item = index >= 0 ? m_manager->history()[index] : archived;
+    OutgoingTransfer transfer;
+    QString mimeType;
+    qint64 size = 0;
+    
+    if (item.type() == ClipboardItem::Image) {
+        // Already encoded, this shares the item's bytes
+        transfer.bytes = item.encodedImage();
+        transfer.isText = false;
+        mimeType = QStringLiteral("image/png");
+        size = transfer.bytes.size();
+    } else {
+        // Shares the item's string data, nothing is copied up front. HTML
+        // goes out as copied, unless masking a secret dropped the markup.
+        const bool html = !item.html().isEmpty();
+        transfer.text = html ? item.html() : item.text();
+        mimeType = html ? QStringLiteral("text/html") : QStringLiteral("text/plain;charset=utf-8");
+        size = utf8Length(transfer.text);
+    }
+    
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::PayloadBegin) << id << mimeType << size;
+    IpcProtocol::writeFrame(client, payload);
+    
+    m_outgoing.insert(client, transfer);
+    pumpTransfer(client);
+}
+
+void HistoryServer::pumpTransfer(QLocalSocket* client)
+{
+    auto it = m_outgoing.find(client);
+    if (it == m_outgoing.end()) {
+        return;
+    }
+    
+    OutgoingTransfer& transfer = it.value();
+    const qsizetype total = transfer.isText ? transfer.text.size() : transfer.bytes.size();
+    
+    // Keep only a few chunks queued; bytesWritten brings us back for more
+    while (transfer.position < total && client->bytesToWrite() < kMaxQueuedBytes) {
+        QByteArray chunk;
+        if (transfer.isText) {
+            qsizetype length = qMin(kTextChunkLength, total - transfer.position);
+            
+            // Never split a surrogate pair across chunks
+            if (transfer.position + length < total &&
+                transfer.text.at(transfer.position + length - 1).isHighSurrogate()) {
+                --length;
+            }
+            chunk = QStringView(transfer.text).mid(transfer.position, length).toUtf8();
+            transfer.position += length;
+        } else {
+            chunk = transfer.bytes.mid(transfer.position, IpcProtocol::kChunkSize);
+            transfer.position += chunk.size();
+        }
+        
+        QByteArray payload;
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        IpcProtocol::beginMessage(out, IpcProtocol::PayloadChunk) << chunk;
+        IpcProtocol::writeFrame(client, payload);
+    }
+    
+    if (transfer.position >= total) {
+        m_outgoing.erase(it);
+        
+        QByteArray payload;
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        IpcProtocol::beginMessage(out, IpcProtocol::PayloadEnd);
+        IpcProtocol::writeFrame(client, payload);
+    }
+}
+
+void HistoryServer::finishPush(QLocalSocket* client)
+{
+    auto it = m_incoming.find(client);
+    if (it == m_incoming.end()) {
+        return;
+    }
+    
+    const IncomingTransfer transfer = it.value();
+    m_incoming.erase(it);
+    
+    // The clipboard change is captured like any other copy
+    QMimeData* mimeData = new QMimeData();
+    if (transfer.mimeType.startsWith(QLatin1String("image/"))) {
+        QImage image;
+        if (!image.loadFromData(transfer.data)) {
+            delete mimeData;
+            sendError(client, QStringLiteral("Pushed image could not be decoded"));
+            return;
+        }
+        mimeData->setImageData(image);
+    } else if (transfer.mimeType.startsWith(QLatin1String("text/html"))) {
+        mimeData->setHtml(QString::fromUtf8(transfer.data));
+    } else {
+        mimeData->setText(QString::fromUtf8(transfer.data));
+    }
+    
+    QGuiApplication::clipboard()->setMimeData(mimeData);
+}
+
+void HistoryServer::sendError(QLocalSocket* client, const QString& message)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::Error) << message;
+    IpcProtocol::writeFrame(client, payload);
+}
+
+void HistoryServer::broadcast(const QByteArray& payload)
+{
+    for (auto it = m_readers.constBegin(); it != m_readers.constEnd(); ++it) {
+        IpcProtocol::writeFrame(it.key(), payload);
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef HISTORYSERVER_H
+#define HISTORYSERVER_H
+
+#include <QObject>
+#include <QHash>
+#include <QByteArray>
+#include "ClipboardManager.h"
+#include "IpcProtocol.h"
+
+class QLocalServer;
+class QLocalSocket;
+
+// Server side of the IPC protocol: serves history pages, queries and item
+// payloads from a ClipboardManager, applies client commands and pushes
+// changes to every attached client.
+class HistoryServer : public QObject
+{
+    Q_OBJECT
+    
+public:
+    explicit HistoryServer(ClipboardManager* manager, QObject* parent = nullptr);
+    
+    // Fails if another instance is already serving this name
+    bool listen(const QString& name);
+    QString errorString() const;
+    int clientCount() const { return m_readers.size(); }
+    
+private slots:
+    void onNewConnection();
+    void onClientReadyRead();
+    void onClientDisconnected();
+    void onClientBytesWritten();
+    void onItemAdded(const ClipboardItem& item);
+    void onHistoryChanged();
+    
+private:
+    // An item payload being streamed to a client. Text is converted to UTF-8
+    // one chunk at a time, so only the chunks queued in the socket are copied.
+    struct OutgoingTransfer
+    {
+        QString text;
+        QByteArray bytes;
+        bool isText = true;
+        qsizetype position = 0;
+    };
+    
+    // A payload pushed by a client for the clipboard
+    struct IncomingTransfer
+    {
+        QString mimeType;
+        QByteArray data;
+    };
+    
+    QLocalServer* m_server;
+    ClipboardManager* m_manager;
+    QHash<QLocalSocket*, IpcProtocol::FrameReader> m_readers;
+    QHash<QLocalSocket*, OutgoingTransfer> m_outgoing;
+    QHash<QLocalSocket*, IncomingTransfer> m_incoming;
+    bool m_itemJustAdded;
+    bool m_nameInUse;
+    
+    void handleFrame(QLocalSocket* client, const QByteArray& frame);
+    void sendPage(QLocalSocket* client, int offset, int count);
+    void sendQueryResults(QLocalSocket* client, const ClipboardManager::HistoryQuery& query);
+    void sendQueryResult(QLocalSocket* client, const ClipboardItem& item);
+    void startFetch(QLocalSocket* client, quint64 id);
+    void pumpTransfer(QLocalSocket* client);
+    void finishPush(QLocalSocket* client);
+    void sendError(QLocalSocket* client, const QString& message);
+    void broadcast(const QByteArray& payload);
+};
+
+#endif // HISTORYSERVER_H
@@ -0,0 +1,424 @@
+#include "HistoryTransfer.h"
+#include "Diagnostics.h"
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+#include <QSet>
+#include <QtEndian>
+#include <algorithm>
+
+namespace {
+const quint32 kMagic = 0x43424558;     // "CBEX"
+const quint32 kVersion = 1;
+const int kHeaderSize = 16;
+const int kRecordHeaderSize = 6;
+const int kStreamVersion = QDataStream::Qt_6_0;
+
+// Anything larger is a corrupt length field; compressed chunks may grow a little
+const quint32 kMaxRecordSize = 2 * HistoryTransfer::kChunkSize;
+
+// Fast levels already halve typical text; images are left alone
+const int kCompressionLevel = 3;
+const int kMinCompressBytes = 512;
+
+// Imported items are handed over in batches of this many, or fewer if large
+const int kBatchItems = 512;
+const qint64 kBatchBytes = 16 * 1024 * 1024;
+
+// At most this often, so a fast transfer does not flood the GUI thread
+const qint64 kProgressIntervalMsecs = 100;
+
+QByteArray content(const ClipboardItem& item, HistoryTransfer::Kind* kind)
+{
+    if (item.type() == ClipboardItem::Image) {
+        *kind = HistoryTransfer::ItemImage;
+        return item.encodedImage();
+    }
+    if (!item.html().isEmpty()) {
+        *kind = HistoryTransfer::ItemHtml;
+        return item.html().toUtf8();
+    }
+    *kind = HistoryTransfer::ItemText;
+    return item.text().toUtf8();
+}
+
+quint64 hashContent(qint32 type, const QByteArray& bytes)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QByteArray(1, static_cast<char>(type)));
+    hash.addData(bytes);
+    return qFromBigEndian<quint64>(hash.result().constData());
+}
+
+// Rebuilt the way capture builds items: HTML from its markup, with the
+// visible text extracted from it and typing it; other texts are typed as
+// exported
+ClipboardItem buildItem(qint32 type, quint8 contentKind, const QByteArray& bytes)
+{
+    if (type == ClipboardItem::Image) {
+        return ClipboardItem::fromImageData(bytes);
+    }
+    if (contentKind == HistoryTransfer::ItemHtml) {
+        return ClipboardItem(QString::fromUtf8(bytes), ClipboardItem::Html);
+    }
+    
+    // Html items whose markup was dropped, e.g. with a secret masked, are
+    // only their text
+    ClipboardItem item(QString(), static_cast<ClipboardItem::ItemType>(type));
+    item.replaceText(QString::fromUtf8(bytes));
+    return item;
+}
+
+bool writeRecord(QIODevice* device, HistoryTransfer::Kind kind, const QByteArray& body, bool compress)
+{
+    QByteArray packed = body;
+    quint8 flags = 0;
+    if (compress && body.size() >= kMinCompressBytes) {
+        const QByteArray compressed = qCompress(body, kCompressionLevel);
+        if (compressed.size() < body.size()) {
+            packed = compressed;
+            flags |= HistoryTransfer::kCompressed;
+        }
+    }
+    
+    char header[kRecordHeaderSize];
+    qToBigEndian(static_cast<quint32>(packed.size()), header);
+    header[4] = static_cast<char>(kind);
+    header[5] = static_cast<char>(flags);
+    return device->write(header, kRecordHeaderSize) == kRecordHeaderSize &&
+           device->write(packed) == packed.size();
+}
+}
+
+HistoryTransfer::HistoryTransfer(QObject* parent)
+    : QObject(parent)
+    , m_batchSlots(kMaxPendingBatches)
+    , m_cancelled(false)
+    , m_busy(false)
+{
+    qRegisterMetaType<HistoryTransfer::Result>();
+    m_pool.setMaxThreadCount(1);
+}
+
+HistoryTransfer::~HistoryTransfer()
+{
+    // Workers post their results back to this object
+    m_cancelled = true;
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+bool HistoryTransfer::startExport(const QString& path, const QList<ClipboardItem>& items)
+{
+    if (m_busy) {
+        return false;
+    }
+    m_busy = true;
+    m_cancelled = false;
+    m_lastProgress.invalidate();
+    
+    // The list is implicitly shared; items captured meanwhile are not in it
+    m_pool.start([this, path, items]() {
+        finish(exportItems(path, items));
+    });
+    return true;
+}
+
+bool HistoryTransfer::startImport(const QString& path, const QList<ClipboardItem>& existing)
+{
+    if (m_busy) {
+        return false;
+    }
+    m_busy = true;
+    m_cancelled = false;
+    m_lastProgress.invalidate();
+    
+    m_pool.start([this, path, existing]() {
+        finish(importItems(path, existing));
+    });
+    return true;
+}
+
+quint64 HistoryTransfer::contentHash(const ClipboardItem& item)
+{
+    Kind kind;
+    return hashContent(item.type(), content(item, &kind));
+}
+
+HistoryTransfer::Result HistoryTransfer::exportItems(const QString& path, const QList<ClipboardItem>& items)
+{
+    QElapsedTimer timer;
+    timer.start();
+    Result result;
+    
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        result.error = file.errorString();
+        return result;
+    }
+    // The count lets an import reserve ids for the items up front
+    const qint64 count = std::count_if(items.cbegin(), items.cend(), [](const ClipboardItem& item) {
+        return !item.expiresAt().isValid();
+    });
+    char header[kHeaderSize];
+    qToBigEndian(kMagic, header);
+    qToBigEndian(kVersion, header + 4);
+    qToBigEndian(count, header + 8);
+    bool ok = file.write(header, kHeaderSize) == kHeaderSize;
+    
+    // Oldest first, so an import brings them back in capture order
+    qint64 done = 0;
+    for (auto it = items.crbegin(); ok && it != items.crend(); ++it, ++done) {
+        if (m_cancelled) {
+            file.cancelWriting();
+            result.error = QStringLiteral("cancelled");
+            return result;
+        }
+        reportProgress(done, items.size());
+        if (it->expiresAt().isValid()) {
+            continue;
+        }
+        
+        Kind kind;
+        const QByteArray bytes = content(*it, &kind);
+        
+        QByteArray begin;
+        QDataStream out(&begin, QIODevice::WriteOnly);
+        out.setVersion(kStreamVersion);
+        out << hashContent(it->type(), bytes) << static_cast<qint32>(it->type())
+            << it->timestamp().toMSecsSinceEpoch() << static_cast<qint32>(it->useCount()) << it->frecency()
+            << it->isPinned();
+        ok = writeRecord(&file, ItemBegin, begin, false);
+        
+        // Chunks share the item's bytes; mid() does not copy them
+        for (qsizetype offset = 0; ok && offset < bytes.size(); offset += kChunkSize) {
+            ok = writeRecord(&file, kind, bytes.mid(offset, kChunkSize), kind != ItemImage);
+        }
+        ok = ok && writeRecord(&file, ItemEnd, QByteArray(), false);
+        ++result.items;
+    }
+    
+    QByteArray end;
+    QDataStream out(&end, QIODevice::WriteOnly);
+    out.setVersion(kStreamVersion);
+    out << result.items;
+    ok = ok && writeRecord(&file, End, end, false);
+    result.bytes = file.size();
+    
+    if (!ok || !file.commit()) {
+        result.error = file.errorString();
+        return result;
+    }
+    reportProgress(items.size(), items.size());
+    result.ok = true;
+    result.msecs = timer.elapsed();
+    qCDebug(lcPerf) << "Exported" << result.items << "items," << result.bytes / 1024 << "KiB in"
+                    << result.msecs << "ms";
+    return result;
+}
+
+HistoryTransfer::Result HistoryTransfer::importItems(const QString& path, const QList<ClipboardItem>& existing)
+{
+    QElapsedTimer timer;
+    timer.start();
+    Result result;
+    
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        result.error = file.errorString();
+        return result;
+    }
+    const QByteArray header = file.read(kHeaderSize);
+    if (header.size() != kHeaderSize || qFromBigEndian<quint32>(header.constData()) != kMagic) {
+        result.error = QStringLiteral("not a clipboard history export");
+        return result;
+    }
+    if (qFromBigEndian<quint32>(header.constData() + 4) > kVersion) {
+        result.error = QStringLiteral("written by a newer version");
+        return result;
+    }
+    result.bytes = file.size();
+    const qint64 itemCount = qFromBigEndian<qint64>(header.constData() + 8);
+    QMetaObject::invokeMethod(this, [this, itemCount]() {
+        emit importStarted(itemCount);
+    }, Qt::QueuedConnection);
+    
+    // Hashing the history here keeps it off the GUI thread
+    QSet<quint64> seen;
+    seen.reserve(existing.size());
+    for (const ClipboardItem& item : existing) {
+        seen.insert(contentHash(item));
+    }
+    
+    QList<Imported> batch;
+    qint64 batchBytes = 0;
+    bool inItem = false;
+    bool skipping = false;
+    bool ended = false;
+    quint64 hash = 0;
+    qint32 type = ClipboardItem::Text;
+    qint64 timestamp = 0;
+    qint32 useCount = 0;
+    double frecency = 0.0;
+    bool pinned = false;
+    quint8 contentKind = ItemText;
+    QByteArray bytes;
+    
+    while (!ended) {
+        if (m_cancelled) {
+            result.error = QStringLiteral("cancelled");
+            return result;
+        }
+        reportProgress(file.pos(), result.bytes);
+        
+        const QByteArray recordHeader = file.read(kRecordHeaderSize);
+        if (recordHeader.size() != kRecordHeaderSize) {
+            result.error = QStringLiteral("file is cut short");
+            return result;
+        }
+        const quint32 length = qFromBigEndian<quint32>(recordHeader.constData());
+        const quint8 kind = static_cast<quint8>(recordHeader[4]);
+        const quint8 flags = static_cast<quint8>(recordHeader[5]);
+        if (length > kMaxRecordSize) {
+            result.error = QStringLiteral("corrupt record at offset %1").arg(file.pos() - kRecordHeaderSize);
+            return result;
+        }
+        
+        // A duplicate's content is skipped over, never read or decompressed
+        const bool isContent = kind == ItemText || kind == ItemHtml || kind == ItemImage;
+        if (isContent && skipping) {
+            if (file.skip(length) != length) {
+                result.error = QStringLiteral("file is cut short");
+                return result;
+            }
+            continue;
+        }
+        QByteArray body = file.read(length);
+        if (body.size() != static_cast<qsizetype>(length)) {
+            result.error = QStringLiteral("file is cut short");
+            return result;
+        }
+        if (flags & kCompressed) {
+            body = qUncompress(body);
+            if (body.isEmpty()) {
+                result.error = QStringLiteral("corrupt record at offset %1").arg(file.pos() - length);
+                return result;
+            }
+        }
+        
+        QDataStream in(body);
+        in.setVersion(kStreamVersion);
+        switch (kind) {
+            case ItemBegin:
+                in >> hash >> type >> timestamp >> useCount >> frecency >> pinned;
+                if (in.status() != QDataStream::Ok || inItem || type < ClipboardItem::Text ||
+                    type > ClipboardItem::Code) {
+                    result.error = QStringLiteral("corrupt item at offset %1").arg(file.pos() - length);
+                    return result;
+                }
+                inItem = true;
+                skipping = seen.contains(hash);
+                contentKind = type == ClipboardItem::Image ? ItemImage : ItemText;
+                bytes.clear();
+                break;
+            case ItemText:
+            case ItemHtml:
+            case ItemImage:
+                contentKind = kind;
+                bytes.append(body);
+                break;
+            case ItemEnd: {
+                if (!inItem) {
+                    result.error = QStringLiteral("corrupt item at offset %1").arg(file.pos() - length);
+                    return result;
+                }
+                inItem = false;
+                if (skipping) {
+                    ++result.duplicates;
+                    break;
+                }
+                if (hashContent(type, bytes) != hash) {
+                    result.error = QStringLiteral("item content does not match its hash at offset %1")
+                                       .arg(file.pos() - length);
+                    return result;
+                }
+                seen.insert(hash);
+                
+                Imported imported{buildItem(type, contentKind, bytes), {}, {}};
+                imported.item.setTimestamp(QDateTime::fromMSecsSinceEpoch(timestamp));
+                imported.item.setUsage(useCount, frecency);
+                imported.item.setPinned(pinned);
+                if (type != ClipboardItem::Image) {
+                    imported.findings = SecretScanner::instance().scan(imported.item.text());
+                    imported.markupFindings = SecretScanner::instance().scanMarkup(imported.item.html());
+                }
+                batch.append(imported);
+                batchBytes += bytes.size();
+                ++result.items;
+                
+                if (batch.size() >= kBatchItems || batchBytes >= kBatchBytes) {
+                    if (!postBatch(batch)) {
+                        result.error = QStringLiteral("cancelled");
+                        return result;
+                    }
+                    batch.clear();
+                    batchBytes = 0;
+                }
+                bytes.clear();
+                break;
+            }
+            case End:
+                ended = true;
+                break;
+            default:
+                // Added by a later version; the length lets us step over it
+                break;
+        }
+    }
+    
+    if (!batch.isEmpty() && !postBatch(batch)) {
+        result.error = QStringLiteral("cancelled");
+        return result;
+    }
+    reportProgress(result.bytes, result.bytes);
+    result.ok = true;
+    result.msecs = timer.elapsed();
+    qCDebug(lcPerf) << "Imported" << result.items << "items," << result.duplicates << "duplicates skipped, in"
+                    << result.msecs << "ms";
+    return result;
+}
+
+bool HistoryTransfer::postBatch(const QList<Imported>& batch)
+{
+    // Waits while the receiver is behind, so batches never pile up in memory
+    while (!m_batchSlots.tryAcquire(1, 50)) {
+        if (m_cancelled) {
+            return false;
+        }
+    }
+    QMetaObject::invokeMethod(this, [this, batch]() {
+        emit itemsImported(batch);
+        m_batchSlots.release();
+    }, Qt::QueuedConnection);
+    return true;
+}
+
+void HistoryTransfer::reportProgress(qint64 done, qint64 total)
+{
+    if (done < total && m_lastProgress.isValid() && m_lastProgress.elapsed() < kProgressIntervalMsecs) {
+        return;
+    }
+    m_lastProgress.start();
+    QMetaObject::invokeMethod(this, [this, done, total]() {
+        emit progress(done, total);
+    }, Qt::QueuedConnection);
+}
+
+void HistoryTransfer::finish(const Result& result)
+{
+    QMetaObject::invokeMethod(this, [this, result]() {
+        m_busy = false;
+        emit finished(result);
+    }, Qt::QueuedConnection);
+}
@@ -0,0 +1,112 @@
+#ifndef HISTORYTRANSFER_H
+#define HISTORYTRANSFER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QList>
+#include <QSemaphore>
+#include <QString>
+#include <QThreadPool>
+#include <atomic>
+#include "ClipboardItem.h"
+#include "SecretScanner.h"
+
+// Export and import of the history, for backup and migration. Both run on
+// a worker one item at a time, so memory use is bounded by the largest
+// item, not the history; progress is reported as they go.
+//
+// The file is a header (quint32 magic, quint32 version, qint64 number of
+// items) followed by records: quint32 body length, quint8 Kind, quint8 flags, then the body.
+// All integers are big-endian. Flag kCompressed marks a body packed with
+// qCompress(). An item is an ItemBegin record, its content as ItemText,
+// ItemHtml or ItemImage chunks of at most kChunkSize bytes before
+// compression, then ItemEnd; an End record closes the file, so a cut-off
+// file is told apart from a complete one. Texts are UTF-8 and compressed
+// when that pays; images keep their original encoding and are never
+// recompressed. Readers skip record kinds they do not know.
+//
+// Items are written oldest first. Each carries a content hash, so an
+// import skips items already in the history, or earlier in the file,
+// without decoding their content. Imported items are rebuilt as on
+// capture, HTML from its markup, and scanned for secrets on the worker.
+class HistoryTransfer : public QObject
+{
+    Q_OBJECT
+    
+public:
+    enum Kind : quint8 {
+        ItemBegin = 1,  // quint64 contentHash, qint32 type, qint64 timestampMsecs, qint32 useCount, double frecency, bool pinned
+        ItemText,       // Chunk of the UTF-8 text
+        ItemHtml,       // Chunk of the UTF-8 markup of an item copied as HTML
+        ItemImage,      // Chunk of the encoded image as copied
+        ItemEnd,
+        End             // qint64 itemCount
+    };
+    
+    static const quint8 kCompressed = 0x01;
+    static const int kChunkSize = 1024 * 1024;
+    
+    // An imported item and what SecretScanner found in its text and markup,
+    // for the receiver to apply its secret policy to, as on capture
+    struct Imported
+    {
+        ClipboardItem item;
+        QList<SecretScanner::Finding> findings;
+        QList<SecretScanner::Finding> markupFindings;
+    };
+    
+    struct Result
+    {
+        bool ok = false;
+        QString error;
+        qint64 items = 0;       // Written, or imported
+        qint64 duplicates = 0;  // Skipped by an import
+        qint64 bytes = 0;       // File size
+        qint64 msecs = 0;
+    };
+    
+    explicit HistoryTransfer(QObject* parent = nullptr);
+    ~HistoryTransfer() override;
+    
+    // One transfer at a time; starting another while busy fails
+    bool isBusy() const { return m_busy; }
+    void cancel() { m_cancelled = true; }
+    
+    // Writes items, given newest first as in the history, to path. Items
+    // that are about to expire are left out.
+    bool startExport(const QString& path, const QList<ClipboardItem>& items);
+    
+    // Reads path and hands the items not in existing over through
+    // itemsImported(), oldest first, in batches. importStarted() comes
+    // first, with how many items the file holds at most. The worker stays at
+    // most kMaxPendingBatches ahead of the receiver.
+    bool startImport(const QString& path, const QList<ClipboardItem>& existing);
+    
+    // Hash of what ClipboardItem::operator==() compares, stable across runs
+    static quint64 contentHash(const ClipboardItem& item);
+    
+signals:
+    void progress(qint64 done, qint64 total);   // Items when exporting, bytes when importing
+    void importStarted(qint64 itemCount);
+    void itemsImported(const QList<HistoryTransfer::Imported>& items);
+    void finished(const HistoryTransfer::Result& result);
+    
+private:
+    static const int kMaxPendingBatches = 2;
+    
+    QThreadPool m_pool;
+    QSemaphore m_batchSlots;
+    QElapsedTimer m_lastProgress;   // Worker only
+    std::atomic<bool> m_cancelled;
+    bool m_busy;
+    
+    Result exportItems(const QString& path, const QList<ClipboardItem>& items);
+    Result importItems(const QString& path, const QList<ClipboardItem>& existing);
+    bool postBatch(const QList<Imported>& batch);
+    void reportProgress(qint64 done, qint64 total);
+    void finish(const Result& result);
+};
+
+Q_DECLARE_METATYPE(HistoryTransfer::Result)
+
+#endif // HISTORYTRANSFER_H
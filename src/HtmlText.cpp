@@ -0,0 +1,431 @@
+#include "HtmlText.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+enum TagKind : quint8 {
+    InlineTag,
+    BlockTag,       // Starts on a new line
+    PreTag,
+    HiddenTag,      // Contents are never shown
+    LineBreakTag,
+    CellTag
+};
+
+// Longest tag name that matters ("blockquote"); names are zero-padded to a
+// fixed size, so comparing two is a fixed-size memcmp
+const int kTagNameSize = 12;
+
+struct TagEntry
+{
+    char name[kTagNameSize];
+    TagKind kind;
+};
+
+// Sorted by name, for binary search
+const TagEntry kTags[] = {
+    {"address", BlockTag}, {"article", BlockTag}, {"aside", BlockTag}, {"blockquote", BlockTag},
+    {"br", LineBreakTag}, {"dd", BlockTag}, {"div", BlockTag}, {"dl", BlockTag}, {"dt", BlockTag},
+    {"fieldset", BlockTag}, {"figcaption", BlockTag}, {"figure", BlockTag}, {"footer", BlockTag},
+    {"form", BlockTag}, {"h1", BlockTag}, {"h2", BlockTag}, {"h3", BlockTag}, {"h4", BlockTag},
+    {"h5", BlockTag}, {"h6", BlockTag}, {"header", BlockTag}, {"hr", BlockTag}, {"li", BlockTag},
+    {"main", BlockTag}, {"nav", BlockTag}, {"noscript", HiddenTag}, {"ol", BlockTag}, {"p", BlockTag},
+    {"pre", PreTag}, {"script", HiddenTag}, {"section", BlockTag}, {"style", HiddenTag},
+    {"table", BlockTag}, {"td", CellTag}, {"template", HiddenTag}, {"th", CellTag},
+    {"title", HiddenTag}, {"tr", BlockTag}, {"ul", BlockTag}
+};
+
+TagKind tagKind(const char (&name)[kTagNameSize])
+{
+    const TagEntry* entry = std::lower_bound(std::begin(kTags), std::end(kTags), name,
+                                             [](const TagEntry& tag, const char* value) {
+                                                 return std::memcmp(tag.name, value, kTagNameSize) < 0;
+                                             });
+    return entry != std::end(kTags) && std::memcmp(entry->name, name, kTagNameSize) == 0 ? entry->kind : InlineTag;
+}
+
+struct Entity
+{
+    const char* name;
+    char16_t value;
+};
+
+// The named entities seen in practice; anything else is kept as written
+const Entity kEntities[] = {
+    {"amp", u'&'}, {"lt", u'<'}, {"gt", u'>'}, {"quot", u'"'}, {"apos", u'\''}, {"nbsp", u' '},
+    {"ensp", u' '}, {"emsp", u' '}, {"thinsp", u' '}, {"shy", 0}, {"zwj", 0}, {"zwnj", 0},
+    {"copy", u'©'}, {"reg", u'®'}, {"trade", u'™'}, {"deg", u'°'},
+    {"times", u'×'}, {"divide", u'÷'}, {"plusmn", u'±'}, {"micro", u'µ'},
+    {"para", u'¶'}, {"sect", u'§'}, {"middot", u'·'}, {"bull", u'•'},
+    {"hellip", u'…'}, {"ndash", u'–'}, {"mdash", u'—'}, {"lsquo", u'‘'},
+    {"rsquo", u'’'}, {"sbquo", u'‚'}, {"ldquo", u'“'}, {"rdquo", u'”'},
+    {"bdquo", u'„'}, {"laquo", u'«'}, {"raquo", u'»'}, {"euro", u'€'},
+    {"pound", u'£'}, {"yen", u'¥'}, {"cent", u'¢'}, {"larr", u'←'},
+    {"rarr", u'→'}, {"uarr", u'↑'}, {"darr", u'↓'}, {"check", u'✓'}
+};
+const int kMaxEntityName = 6;
+
+// Four UTF-16 units in a quint64, for the text loop
+const quint64 kLaneOnes = 0x0001000100010001ULL;
+const quint64 kLaneHighBits = 0x8000800080008000ULL;
+const quint64 kLaneLowBits = 0x7fff7fff7fff7fffULL;
+
+// The high bit of each lane that is zero; exact, no borrows between lanes
+quint64 zeroLanes(quint64 units)
+{
+    return ~(((units & kLaneLowBits) + kLaneLowBits) | units) & kLaneHighBits;
+}
+
+// The high bit of each lane below 0x20, i.e. control characters and all
+// whitespace but the space
+quint64 controlLanes(quint64 units)
+{
+    return ~((units | kLaneHighBits) - kLaneOnes * 0x20) & ~units & kLaneHighBits;
+}
+
+bool isSpace(char16_t c)
+{
+    return c == u' ' || c == u'\n' || c == u'\t' || c == u'\r' || c == u'\f';
+}
+
+bool isAsciiAlnum(char16_t c)
+{
+    return (c >= u'a' && c <= u'z') || (c >= u'A' && c <= u'Z') || (c >= u'0' && c <= u'9');
+}
+
+bool isAsciiAlpha(char16_t c)
+{
+    return (c >= u'a' && c <= u'z') || (c >= u'A' && c <= u'Z');
+}
+
+// Case-insensitive match of an ASCII lowercase name at p
+bool startsWithName(const char16_t* p, const char16_t* end, const char* name)
+{
+    for (; *name; ++name, ++p) {
+        if (p == end || (*p | 0x20) != *name) {
+            return false;
+        }
+    }
+    return true;
+}
+
+class Extractor
+{
+public:
+    Extractor(QStringView html, QChar* out)
+        : m_p(reinterpret_cast<const char16_t*>(html.data()))
+        , m_end(m_p + html.size())
+        , m_begin(out)
+        , m_out(out)
+        , m_pendingSpace(false)
+        , m_preDepth(0)
+    {
+    }
+    
+    qsizetype run()
+    {
+        while (m_p < m_end) {
+            const char16_t c = *m_p;
+            if (c == u'<') {
+                markup();
+            } else if (c == u'&') {
+                entity();
+            } else if (isSpace(c)) {
+                ++m_p;
+                if (m_preDepth > 0) {
+                    if (c != u'\r') {
+                        put(c);
+                    }
+                } else {
+                    m_pendingSpace = true;
+                }
+            } else {
+                text();
+            }
+        }
+        
+        while (m_out > m_begin && isSpace(m_out[-1].unicode())) {
+            --m_out;
+        }
+        return m_out - m_begin;
+    }
+    
+private:
+    const char16_t* m_p;
+    const char16_t* const m_end;
+    QChar* const m_begin;
+    QChar* m_out;
+    bool m_pendingSpace;        // Whitespace was skipped since the last character written
+    int m_preDepth;
+    
+    // Writes a visible character, after the space collapsed before it
+    void put(char16_t c)
+    {
+        if (m_pendingSpace) {
+            m_pendingSpace = false;
+            if (m_out > m_begin && m_out[-1] != u'\n' && m_out[-1] != u' ') {
+                *m_out++ = u' ';
+            }
+        }
+        *m_out++ = QChar(c);
+    }
+    
+    void lineBreak()
+    {
+        m_pendingSpace = false;
+        while (m_out > m_begin && (m_out[-1] == u' ' || m_out[-1] == u'\t')) {
+            --m_out;
+        }
+        if (m_out > m_begin && m_out[-1] != u'\n') {
+            *m_out++ = u'\n';
+        }
+    }
+    
+    // The hot loop: a run of ordinary characters, and single spaces
+    // between them, which need no collapsing
+    void text()
+    {
+        put(*m_p++);
+        while (m_p < m_end) {
+            // Four units at a time while there is no '<', '&', whitespace
+            // other than the space, or space following a space
+            while (m_end - m_p >= 4) {
+                quint64 units;
+                std::memcpy(&units, m_p, sizeof(units));
+                const quint64 spaces = zeroLanes(units ^ (kLaneOnes * u' '));
+                const quint64 spaceBefore = (spaces << 16) | (m_out[-1] == u' ' ? 0x8000 : 0);
+                if (zeroLanes(units ^ (kLaneOnes * u'<')) | zeroLanes(units ^ (kLaneOnes * u'&')) |
+                    controlLanes(units) | (spaces & spaceBefore)) {
+                    break;
+                }
+                std::memcpy(m_out, m_p, sizeof(units));
+                m_p += 4;
+                m_out += 4;
+            }
+            if (m_p == m_end) {
+                return;
+            }
+            
+            const char16_t c = *m_p;
+            if (c == u'<' || c == u'&') {
+                return;
+            }
+            if (isSpace(c)) {
+                if (c != u' ' || m_preDepth > 0 || m_end - m_p < 2 || m_p[1] <= u' ' || m_p[1] == u'<' ||
+                    m_p[1] == u'&') {
+                    return;
+                }
+            }
+            *m_out++ = QChar(c);
+            ++m_p;
+        }
+    }
+    
+    // Advances past the next occurrence of token, or to the end
+    void skipPast(QStringView token)
+    {
+        const QStringView rest(m_p, m_end - m_p);
+        const qsizetype index = rest.indexOf(token);
+        m_p = index < 0 ? m_end : m_p + index + token.size();
+    }
+    
+    // Advances past the '>' ending a tag, honouring quoted attribute values
+    void skipTag()
+    {
+        char16_t quote = 0;
+        while (m_p < m_end) {
+            // Attribute values are skipped four units at a time, too
+            while (m_end - m_p >= 4) {
+                quint64 units;
+                std::memcpy(&units, m_p, sizeof(units));
+                const quint64 stops = quote ? zeroLanes(units ^ (kLaneOnes * quote))
+                                            : zeroLanes(units ^ (kLaneOnes * u'>')) |
+                                                  zeroLanes(units ^ (kLaneOnes * u'"')) |
+                                                  zeroLanes(units ^ (kLaneOnes * u'\''));
+                if (stops) {
+                    break;
+                }
+                m_p += 4;
+            }
+            if (m_p == m_end) {
+                return;
+            }
+            
+            const char16_t c = *m_p++;
+            if (c > u'>') {
+                continue;
+            }
+            if (quote) {
+                if (c == quote) {
+                    quote = 0;
+                }
+            } else if (c == u'"' || c == u'\'') {
+                quote = c;
+            } else if (c == u'>') {
+                return;
+            }
+        }
+    }
+    
+    void markup()
+    {
+        const char16_t* tag = m_p + 1;
+        const bool closing = tag < m_end && *tag == u'/';
+        if (closing) {
+            ++tag;
+        }
+        
+        if (tag < m_end && !closing && (*tag == u'!' || *tag == u'?')) {
+            if (m_end - tag >= 3 && tag[1] == u'-' && tag[2] == u'-') {
+                m_p = tag + 3;
+                skipPast(u"-->");
+            } else {
+                m_p = tag;
+                skipTag();
+            }
+            return;
+        }
+        if (tag == m_end || !isAsciiAlpha(*tag)) {
+            // A lone '<' is text
+            ++m_p;
+            put(u'<');
+            return;
+        }
+        
+        char name[kTagNameSize] = {};
+        int length = 0;
+        m_p = tag;
+        while (m_p < m_end && isAsciiAlnum(*m_p)) {
+            if (length < kTagNameSize) {
+                name[length] = static_cast<char>(*m_p | 0x20);
+            }
+            ++length;
+            ++m_p;
+        }
+        skipTag();
+        const bool selfClosing = m_p[-1] == u'>' && m_p[-2] == u'/';
+        
+        // Longer names are none of ours
+        switch (length < kTagNameSize ? tagKind(name) : InlineTag) {
+            case InlineTag:
+                break;
+            case BlockTag:
+                lineBreak();
+                break;
+            case PreTag:
+                lineBreak();
+                m_preDepth = closing ? qMax(0, m_preDepth - 1) : m_preDepth + 1;
+                break;
+            case HiddenTag:
+                if (!closing && !selfClosing) {
+                    skipHiddenContent(name);
+                }
+                break;
+            case LineBreakTag:
+                m_pendingSpace = false;
+                *m_out++ = u'\n';
+                break;
+            case CellTag:
+                if (!closing && m_out > m_begin && m_out[-1] != u'\n') {
+                    m_pendingSpace = false;
+                    *m_out++ = u'\t';
+                }
+                break;
+        }
+    }
+    
+    // Skips to after the matching end tag, e.g. "</script>"
+    void skipHiddenContent(const char* name)
+    {
+        while (m_p < m_end) {
+            skipPast(u"</");
+            if (startsWithName(m_p, m_end, name)) {
+                skipTag();
+                return;
+            }
+        }
+    }
+    
+    void entity()
+    {
+        const char16_t* p = m_p + 1;
+        char32_t value = 0;
+        bool valid = false;
+        
+        if (p < m_end && *p == u'#') {
+            ++p;
+            const bool hex = p < m_end && (*p == u'x' || *p == u'X');
+            if (hex) {
+                ++p;
+            }
+            const char16_t* digits = p;
+            while (p < m_end && p - digits < 8) {
+                const char16_t c = *p;
+                int digit = -1;
+                if (c >= u'0' && c <= u'9') {
+                    digit = c - u'0';
+                } else if (hex && (c | 0x20) >= u'a' && (c | 0x20) <= u'f') {
+                    digit = (c | 0x20) - u'a' + 10;
+                }
+                if (digit < 0) {
+                    break;
+                }
+                value = value * (hex ? 16 : 10) + digit;
+                ++p;
+            }
+            valid = p > digits && p < m_end && *p == u';';
+            if (valid && (value == 0 || value > 0x10ffff || (value >= 0xd800 && value <= 0xdfff))) {
+                value = 0xfffd;
+            }
+        } else {
+            char name[kMaxEntityName + 1];
+            int length = 0;
+            while (p < m_end && length < kMaxEntityName && isAsciiAlnum(*p)) {
+                name[length++] = static_cast<char>(*p++);
+            }
+            name[length] = '\0';
+            if (length > 0 && p < m_end && *p == u';') {
+                for (const Entity& entity : kEntities) {
+                    if (std::strcmp(name, entity.name) == 0) {
+                        value = entity.value;
+                        valid = true;
+                        break;
+                    }
+                }
+            }
+        }
+        
+        if (!valid) {
+            // A lone '&' is text
+            ++m_p;
+            put(u'&');
+            return;
+        }
+        m_p = p + 1;
+        
+        if (value == 0) {
+            // Soft hyphens and joiners are invisible
+        } else if (QChar::requiresSurrogates(value)) {
+            put(QChar::highSurrogate(value));
+            *m_out++ = QChar(QChar::lowSurrogate(value));
+        } else {
+            put(static_cast<char16_t>(value));
+        }
+    }
+};
+
+}
+
+namespace HtmlText {
+
+QString toPlainText(QStringView html)
+{
+    // Every character written consumes at least one of the markup
+    QString text(html.size(), Qt::Uninitialized);
+    Extractor extractor(html, text.data());
+    text.truncate(extractor.run());
+    return text;
+}
+
+}
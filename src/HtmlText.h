@@ -0,0 +1,19 @@
+#ifndef HTMLTEXT_H
+#define HTMLTEXT_H
+
+#include <QString>
+#include <QStringView>
+
+// Visible text of copied HTML, for previews, search and secret scanning.
+// A single forward pass over the markup: tags and comments are dropped,
+// script, style and similar element contents are skipped, entities are
+// decoded and whitespace is collapsed as a browser would, with line breaks
+// for block elements and tabs between table cells. Nothing is allocated
+// besides the result, which is never longer than the markup.
+namespace HtmlText {
+
+QString toPlainText(QStringView html);
+
+}
+
+#endif // HTMLTEXT_H
@@ -0,0 +1,128 @@
+#include "ImageHashIndex.h"
+#include <QtGlobal>
+
+namespace {
+const int kHashWidth = 9;
+const int kHashHeight = 8;
+}
+
+void ImageHashIndex::insert(quint64 hash, quint64 id)
+{
+    if (m_ids.contains(id)) {
+        return;
+    }
+    insertNode(hash, id);
+}
+
+void ImageHashIndex::insertNode(quint64 hash, quint64 id)
+{
+    const int newIndex = static_cast<int>(m_nodes.size());
+    m_nodes.push_back(Node{hash, id, false, {}});
+    m_ids.insert(id, newIndex);
+    
+    if (newIndex == 0) {
+        return;
+    }
+    
+    // Walk down edges labelled with our distance to each node on the way
+    int current = 0;
+    while (true) {
+        const int d = distance(hash, m_nodes[current].hash);
+        bool descended = false;
+        for (const auto& child : m_nodes[current].children) {
+            if (child.first == d) {
+                current = child.second;
+                descended = true;
+                break;
+            }
+        }
+        if (!descended) {
+            m_nodes[current].children.emplace_back(d, newIndex);
+            return;
+        }
+    }
+}
+
+void ImageHashIndex::remove(quint64 id)
+{
+    const auto it = m_ids.find(id);
+    if (it == m_ids.end()) {
+        return;
+    }
+    
+    m_nodes[it.value()].removed = true;
+    m_ids.erase(it);
+    
+    if (m_ids.size() * 2 < static_cast<int>(m_nodes.size())) {
+        rebuild();
+    }
+}
+
+void ImageHashIndex::clear()
+{
+    m_nodes.clear();
+    m_ids.clear();
+}
+
+void ImageHashIndex::rebuild()
+{
+    std::vector<Node> nodes;
+    nodes.swap(m_nodes);
+    m_ids.clear();
+    
+    for (const Node& node : nodes) {
+        if (!node.removed) {
+            insertNode(node.hash, node.id);
+        }
+    }
+}
+
+QList<quint64> ImageHashIndex::find(quint64 hash, int maxDistance) const
+{
+    QList<quint64> results;
+    if (m_nodes.empty() || maxDistance < 0) {
+        return results;
+    }
+    
+    std::vector<int> stack{0};
+    while (!stack.empty()) {
+        const Node& node = m_nodes[stack.back()];
+        stack.pop_back();
+        
+        const int d = distance(hash, node.hash);
+        if (d <= maxDistance && !node.removed) {
+            results.append(node.id);
+        }
+        for (const auto& child : node.children) {
+            if (child.first >= d - maxDistance && child.first <= d + maxDistance) {
+                stack.push_back(child.second);
+            }
+        }
+    }
+    
+    return results;
+}
+
+quint64 ImageHashIndex::differenceHash(const QImage& image)
+{
+    if (image.isNull()) {
+        return 0;
+    }
+    
+    const QImage reduced = image.convertToFormat(QImage::Format_Grayscale8)
+                               .scaled(kHashWidth, kHashHeight, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    
+    quint64 hash = 0;
+    for (int y = 0; y < kHashHeight; ++y) {
+        const uchar* line = reduced.constScanLine(y);
+        for (int x = 0; x < kHashWidth - 1; ++x) {
+            hash = (hash << 1) | (line[x] < line[x + 1] ? 1 : 0);
+        }
+    }
+    return hash;
+}
+
+int ImageHashIndex::distance(quint64 a, quint64 b)
+{
+    return qPopulationCount(a ^ b);
+}
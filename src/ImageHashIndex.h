@@ -0,0 +1,48 @@
+#ifndef IMAGEHASHINDEX_H
+#define IMAGEHASHINDEX_H
+
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <utility>
+#include <vector>
+
+// BK-tree over 64-bit perceptual image hashes, keyed by item id. Children are
+// indexed by their Hamming distance to the parent, so the triangle inequality
+// prunes every subtree outside [d - maxDistance, d + maxDistance] and lookups
+// visit a small part of the tree. Removed ids are tombstoned; the tree is
+// rebuilt once tombstones make up half of it.
+class ImageHashIndex
+{
+public:
+    void insert(quint64 hash, quint64 id);
+    void remove(quint64 id);
+    void clear();
+    int size() const { return m_ids.size(); }
+    
+    // Ids whose hash is within maxDistance bits of hash
+    QList<quint64> find(quint64 hash, int maxDistance) const;
+    
+    // dHash: compares horizontally adjacent pixels of a 9x8 grayscale
+    // reduction. Robust to scaling and small edits; cheap enough to run on a
+    // thumbnail.
+    static quint64 differenceHash(const QImage& image);
+    static int distance(quint64 a, quint64 b);
+    
+private:
+    struct Node
+    {
+        quint64 hash;
+        quint64 id;
+        bool removed;
+        std::vector<std::pair<int, int>> children;  // (distance, node index)
+    };
+    
+    std::vector<Node> m_nodes;
+    QHash<quint64, int> m_ids;  // Live id -> node index
+    
+    void insertNode(quint64 hash, quint64 id);
+    void rebuild();
+};
+
+#endif // IMAGEHASHINDEX_H
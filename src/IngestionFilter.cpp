@@ -0,0 +1,235 @@
+#include "IngestionFilter.h"
+#include "Diagnostics.h"
+#include <QMimeData>
+
+namespace {
+const qint64 kDefaultMaxTextBytes = 16 * 1024 * 1024;
+const qint64 kDefaultMaxImageBytes = 64 * 1024 * 1024;
+
+// Formats password managers and similar apps add to mark content that must
+// not end up in clipboard history (KDE, macOS NSPasteboard conventions,
+// Windows clipboard history opt-out)
+const char* const kSensitiveMarkers[] = {
+    "x-kde-passwordManagerHint",
+    "ConcealedType",
+    "TransientType",
+    "ExcludeClipboardContentFromMonitorProcessing"
+};
+
+// Windows marker whose DWORD value 0 opts out of clipboard history
+const char kHistoryOptOut[] = "CanIncludeInClipboardHistory";
+
+const char kImagePrefix[] = "image/";
+const char kQtImageFormat[] = "application/x-qt-image";
+const char kHtmlFormat[] = "text/html";
+const char kTextFormat[] = "text/plain";
+const char kUriListFormat[] = "text/uri-list";
+}
+
+IngestionFilter::IngestionFilter()
+    : m_recent{}
+    , m_recentNext(0)
+    , m_recentBytes(0)
+    , m_counts{}
+{
+    m_maxBytes.insert(QStringLiteral("text/*"), kDefaultMaxTextBytes);
+    m_maxBytes.insert(QStringLiteral("image/*"), kDefaultMaxImageBytes);
+}
+
+IngestionFilter::Rule IngestionFilter::check(const QMimeData* mimeData, Payload* payload)
+{
+    const QStringList formats = mimeData->formats();
+    
+    // Pick the format ClipboardItem would build from: image, then HTML, then text
+    QString format;
+    QString imageFormat;
+    bool hasHtml = false;
+    bool hasText = false;
+    bool hasUrls = false;
+    for (const QString& offered : formats) {
+        for (const char* marker : kSensitiveMarkers) {
+            if (offered.contains(QLatin1String(marker), Qt::CaseInsensitive)) {
+                return reject(SensitiveMarker);
+            }
+        }
+        if (offered.contains(QLatin1String(kHistoryOptOut), Qt::CaseInsensitive)) {
+            const QByteArray value = mimeData->data(offered);
+            if (!value.isEmpty() && value.count('\0') == value.size()) {
+                return reject(SensitiveMarker);
+            }
+        }
+        
+        if (offered == QLatin1String("image/png") ||
+            (imageFormat.isEmpty() && (offered.startsWith(QLatin1String(kImagePrefix)) ||
+                                       offered == QLatin1String(kQtImageFormat)))) {
+            imageFormat = offered;
+        }
+        hasHtml = hasHtml || offered == QLatin1String(kHtmlFormat);
+        hasText = hasText || offered == QLatin1String(kTextFormat);
+        hasUrls = hasUrls || offered == QLatin1String(kUriListFormat);
+    }
+    
+    if (!imageFormat.isEmpty()) {
+        format = imageFormat;
+    } else if (hasHtml) {
+        format = QLatin1String(kHtmlFormat);
+    } else if (hasText) {
+        format = QLatin1String(kTextFormat);
+    } else if (hasUrls) {
+        // QMimeData::text() falls back to the URL list, e.g. for copied files
+        format = QLatin1String(kUriListFormat);
+    } else {
+        return reject(NoData);
+    }
+    
+    for (const QString& offered : formats) {
+        if (matches(offered, m_denied)) {
+            return reject(DeniedFormat);
+        }
+    }
+    if (!m_allowed.isEmpty() && !matches(format, m_allowed)) {
+        return reject(NotAllowedFormat);
+    }
+    
+    // Raw bytes only; images stay encoded and text is not converted yet
+    payload->format = format;
+    payload->data = mimeData->data(format);
+    
+    // Images set by this process have no byte form; they are checked once encoded
+    if (format == QLatin1String(kQtImageFormat)) {
+        return Accepted;
+    }
+    if (payload->data.isEmpty()) {
+        return reject(NoData);
+    }
+    
+    const qint64 maxBytes = maxBytesFor(format);
+    if (maxBytes >= 0 && payload->data.size() > maxBytes) {
+        return reject(TooLarge);
+    }
+    
+    payload->hash = qHashMulti(0, payload->format, payload->data);
+    for (const RecentEntry& entry : m_recent) {
+        if (entry.id != 0 && entry.hash == payload->hash && entry.format == payload->format &&
+            entry.data == payload->data) {
+            payload->recentId = entry.id;
+            return reject(RecentDuplicate);
+        }
+    }
+    
+    return Accepted;
+}
+
+void IngestionFilter::remember(const Payload& payload, quint64 id)
+{
+    if (payload.hash == 0 || payload.data.size() > kMaxRecentBytes) {
+        return;
+    }
+    
+    for (RecentEntry& entry : m_recent) {
+        if (entry.hash == payload.hash && entry.format == payload.format && entry.data == payload.data) {
+            entry.id = id;
+            return;
+        }
+    }
+    
+    m_recentBytes -= m_recent[m_recentNext].data.size();
+    m_recent[m_recentNext] = RecentEntry{payload.hash, id, payload.format, payload.data};
+    m_recentBytes += payload.data.size();
+    m_recentNext = (m_recentNext + 1) % kRecentCount;
+    
+    // Oldest first, never the entry just added
+    for (int i = 0; m_recentBytes > kMaxRecentBytes && i < kRecentCount - 1; ++i) {
+        RecentEntry& entry = m_recent[(m_recentNext + i) % kRecentCount];
+        m_recentBytes -= entry.data.size();
+        entry = RecentEntry();
+    }
+}
+
+void IngestionFilter::forget(quint64 id)
+{
+    for (RecentEntry& entry : m_recent) {
+        if (entry.id == id) {
+            m_recentBytes -= entry.data.size();
+            entry = RecentEntry();
+        }
+    }
+}
+
+void IngestionFilter::forgetRecent()
+{
+    m_recent.fill(RecentEntry());
+    m_recentNext = 0;
+    m_recentBytes = 0;
+}
+
+void IngestionFilter::setMaxBytes(const QString& pattern, qint64 maxBytes)
+{
+    if (maxBytes < 0) {
+        m_maxBytes.remove(pattern);
+    } else {
+        m_maxBytes.insert(pattern, maxBytes);
+    }
+}
+
+const char* IngestionFilter::ruleName(Rule rule)
+{
+    switch (rule) {
+        case Accepted: return "accepted";
+        case NoData: return "no data";
+        case SensitiveMarker: return "sensitive marker";
+        case DeniedFormat: return "denied format";
+        case NotAllowedFormat: return "format not allowed";
+        case TooLarge: return "too large";
+        case RecentDuplicate: return "recent duplicate";
+        default: return "unknown";
+    }
+}
+
+QString IngestionFilter::summary() const
+{
+    QStringList parts;
+    for (int rule = NoData; rule < RuleCount; ++rule) {
+        parts.append(QString("%1: %2").arg(ruleName(static_cast<Rule>(rule))).arg(m_counts[rule]));
+    }
+    return parts.join(", ");
+}
+
+IngestionFilter::Rule IngestionFilter::reject(Rule rule)
+{
+    ++m_counts[rule];
+    qCDebug(lcPerf) << "Clipboard change rejected:" << ruleName(rule) << "(" << m_counts[rule] << "so far)";
+    return rule;
+}
+
+qint64 IngestionFilter::maxBytesFor(const QString& format) const
+{
+    // The most specific (longest) matching pattern wins
+    qint64 maxBytes = -1;
+    int bestLength = -1;
+    for (auto it = m_maxBytes.constBegin(); it != m_maxBytes.constEnd(); ++it) {
+        if (it.key().size() > bestLength && matchesPattern(format, it.key())) {
+            maxBytes = it.value();
+            bestLength = it.key().size();
+        }
+    }
+    return maxBytes;
+}
+
+bool IngestionFilter::matches(const QString& format, const QStringList& patterns)
+{
+    for (const QString& pattern : patterns) {
+        if (matchesPattern(format, pattern)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool IngestionFilter::matchesPattern(const QString& format, const QString& pattern)
+{
+    if (pattern.endsWith(QLatin1Char('*'))) {
+        return format.startsWith(QStringView(pattern).chopped(1), Qt::CaseInsensitive);
+    }
+    return format.compare(pattern, Qt::CaseInsensitive) == 0;
+}
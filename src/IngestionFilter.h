@@ -0,0 +1,93 @@
+#ifndef INGESTIONFILTER_H
+#define INGESTIONFILTER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <array>
+
+class QMimeData;
+
+// First stage of capture, run on every clipboard change before a
+// ClipboardItem is built. It looks only at formats() and the raw bytes of the
+// format the item would be built from; nothing is decoded, converted to
+// QString or matched against regexes. Every rejection is counted per rule.
+class IngestionFilter
+{
+public:
+    enum Rule {
+        Accepted,
+        NoData,             // No format we capture, or an empty payload
+        SensitiveMarker,    // Password manager / concealed-content hints
+        DeniedFormat,       // A format on the denylist is offered
+        NotAllowedFormat,   // The payload format is not on a non-empty allowlist
+        TooLarge,           // Payload over the size cap for its format
+        RecentDuplicate,    // Same bytes as one of the last kRecentCount captures
+        RuleCount
+    };
+    
+    // The format an item would be built from, with its bytes already fetched
+    // so they are not requested from the clipboard twice
+    struct Payload
+    {
+        QString format;
+        QByteArray data;
+        quint64 hash = 0;       // Fast lookup key only; equal hashes are confirmed on the bytes
+        quint64 recentId = 0;   // For RecentDuplicate, the item captured with these bytes
+        
+        bool operator==(const Payload& other) const
+        {
+            return hash == other.hash && format == other.format && data == other.data;
+        }
+    };
+    
+    static const int kRecentCount = 32;
+    static const qint64 kMaxRecentBytes = 64 * 1024 * 1024;
+    
+    IngestionFilter();
+    
+    Rule check(const QMimeData* mimeData, Payload* payload);
+    
+    // Records which item was built from an accepted payload. The bytes are
+    // kept, shared with the payload, so a hash collision is never taken for
+    // a duplicate; past kMaxRecentBytes the oldest entries are dropped.
+    void remember(const Payload& payload, quint64 id);
+    void forget(quint64 id);
+    void forgetRecent();
+    
+    // Format patterns are exact MIME types, or prefixes ending in '*'
+    void setAllowedFormats(const QStringList& patterns) { m_allowed = patterns; }
+    void setDeniedFormats(const QStringList& patterns) { m_denied = patterns; }
+    
+    // Caps are keyed by format pattern; a negative cap removes it
+    void setMaxBytes(const QString& pattern, qint64 maxBytes);
+    
+    quint64 count(Rule rule) const { return m_counts[rule]; }
+    static const char* ruleName(Rule rule);
+    QString summary() const;
+    
+private:
+    struct RecentEntry
+    {
+        quint64 hash = 0;
+        quint64 id = 0;
+        QString format;
+        QByteArray data;
+    };
+    
+    QStringList m_allowed;
+    QStringList m_denied;
+    QHash<QString, qint64> m_maxBytes;
+    std::array<RecentEntry, kRecentCount> m_recent;
+    int m_recentNext;
+    qint64 m_recentBytes;
+    std::array<quint64, RuleCount> m_counts;
+    
+    Rule reject(Rule rule);
+    qint64 maxBytesFor(const QString& format) const;
+    static bool matches(const QString& format, const QStringList& patterns);
+    static bool matchesPattern(const QString& format, const QString& pattern);
+};
+
+#endif // INGESTIONFILTER_H
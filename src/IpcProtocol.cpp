@@ -0,0 +1,92 @@
+#include "IpcProtocol.h"
+#include <QIODevice>
+#include <QtEndian>
+
+namespace IpcProtocol {
+
+QString defaultServerName()
+{
+    QString user = qEnvironmentVariable("USER");
+    if (user.isEmpty()) {
+        user = qEnvironmentVariable("USERNAME");
+    }
+    return QStringLiteral("ClipboardManager-%1").arg(user);
+}
+
+QDataStream& beginMessage(QDataStream& stream, MessageType type)
+{
+    stream.setVersion(kStreamVersion);
+    stream << static_cast<quint8>(type);
+    return stream;
+}
+
+namespace {
+void writeRawFrame(QIODevice* device, const char* data, qsizetype size)
+{
+    uchar header[sizeof(quint32)];
+    qToBigEndian<quint32>(static_cast<quint32>(size), header);
+    device->write(reinterpret_cast<const char*>(header), sizeof(header));
+    device->write(data, size);
+}
+}
+
+void writeFrame(QIODevice* device, const QByteArray& payload)
+{
+    if (payload.size() <= kMaxFragmentSize) {
+        writeRawFrame(device, payload.constData(), payload.size());
+        return;
+    }
+    
+    QByteArray fragment;
+    fragment.reserve(2 + kMaxFragmentSize);
+    for (qsizetype offset = 0; offset < payload.size(); offset += kMaxFragmentSize) {
+        const qsizetype size = qMin(kMaxFragmentSize, payload.size() - offset);
+        fragment.resize(2);
+        fragment[0] = static_cast<char>(Fragment);
+        fragment[1] = offset + size == payload.size() ? 1 : 0;
+        fragment.append(payload.constData() + offset, size);
+        writeRawFrame(device, fragment.constData(), fragment.size());
+    }
+}
+
+bool readFrames(QIODevice* device, FrameReader& reader, QList<QByteArray>& frames)
+{
+    QByteArray& buffer = reader.buffer;
+    buffer.append(device->readAll());
+    
+    qsizetype offset = 0;
+    while (buffer.size() - offset >= static_cast<qsizetype>(sizeof(quint32))) {
+        const quint32 length = qFromBigEndian<quint32>(buffer.constData() + offset);
+        if (length > kMaxFrameSize) {
+            return false;
+        }
+        if (buffer.size() - offset - static_cast<qsizetype>(sizeof(quint32)) < length) {
+            break;
+        }
+        
+        const QByteArray frame = buffer.mid(offset + sizeof(quint32), length);
+        offset += sizeof(quint32) + length;
+        if (frame.isEmpty() || static_cast<quint8>(frame.at(0)) != Fragment) {
+            // Fragments of one message are never interleaved with others
+            if (!reader.message.isEmpty()) {
+                return false;
+            }
+            frames.append(frame);
+            continue;
+        }
+        
+        if (frame.size() < 2 || reader.message.size() + frame.size() - 2 > kMaxMessageSize) {
+            return false;
+        }
+        reader.message.append(frame.constData() + 2, frame.size() - 2);
+        if (frame.at(1) != 0) {
+            frames.append(reader.message);
+            reader.message.clear();
+        }
+    }
+    
+    buffer.remove(0, offset);
+    return true;
+}
+
+}
@@ -0,0 +1,90 @@
+#ifndef IPCPROTOCOL_H
+#define IPCPROTOCOL_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QList>
+#include <QString>
+
+class QIODevice;
+
+// Wire protocol between the capture daemon and its clients: attached GUIs and
+// clipctl. Every message is a frame: a big-endian quint32 payload length
+// followed by the payload. The payload is a QDataStream holding a quint8
+// MessageType and its fields.
+//
+// Item contents are never sent in one frame. A transfer is PayloadBegin, any
+// number of PayloadChunk frames of at most kChunkSize bytes, then PayloadEnd,
+// so neither side has to hold a large entry in a single buffer.
+//
+// Messages that carry whole items (HistoryPage, ItemAdded) can outgrow a
+// frame. writeFrame() splits any payload over kMaxFragmentSize into Fragment
+// frames and readFrames() puts it back together, so callers only see whole
+// messages.
+namespace IpcProtocol {
+
+const quint32 kVersion = 6;
+const int kStreamVersion = QDataStream::Qt_6_0;
+const quint32 kMaxFrameSize = 64 * 1024 * 1024;
+const int kChunkSize = 64 * 1024;
+const qsizetype kMaxFragmentSize = 4 * 1024 * 1024;
+const qsizetype kMaxMessageSize = 1024 * 1024 * 1024;
+
+// Time bound meaning "no limit" in Query messages
+const qint64 kUnboundedTime = -1;
+
+enum MessageType : quint8 {
+    Hello = 1,          // client -> daemon: quint32 version
+    Welcome,            // daemon -> client: quint32 version, qint32 total, qint32 maxHistorySize
+    RequestPage,        // client -> daemon: qint32 offset, qint32 count
+    HistoryPage,        // daemon -> client: qint32 offset, qint32 total, QList<ClipboardItem>
+    ItemAdded,          // daemon -> client: ClipboardItem, qint32 maxHistorySize
+    HistoryReset,       // daemon -> client: qint32 total; mirrors must refetch
+    RemoveItem,         // client -> daemon: quint64 id
+    ClearHistory,       // client -> daemon
+    CopyItem,           // client -> daemon: quint64 id
+    SetMaxHistorySize,  // client -> daemon: qint32 size
+    
+    // Scripted access, see clipctl
+    Query,              // client -> daemon: QString text, qint32 type, qint64 fromMsecs, qint64 toMsecs, qint32 limit
+    QueryResult,        // daemon -> client: quint64 id, qint32 type, qint64 timestampMsecs, qint64 size (UTF-8 bytes, -1 for images), QString preview
+    QueryEnd,           // daemon -> client: qint32 count
+    Fetch,              // client -> daemon: quint64 id; answered with a payload transfer
+    Push,               // client -> daemon: QString mimeType; followed by a payload transfer
+    PayloadBegin,       // quint64 id, QString mimeType, qint64 size (-1 if unknown)
+    PayloadChunk,       // QByteArray data
+    PayloadEnd,
+    Error,              // daemon -> client: QString message
+    
+    // Batch commands; the daemon answers each with one HistoryReset
+    RemoveItems,        // client -> daemon: QList<quint64> ids
+    SetPinned,          // client -> daemon: bool pinned, QList<quint64> ids
+    MergeItems,         // client -> daemon: QList<quint64> ids
+    
+    Fragment            // either way: bool last, then a slice of a larger message's payload
+};
+
+// Receive state of one connection
+struct FrameReader
+{
+    QByteArray buffer;      // Bytes of frames not complete yet
+    QByteArray message;     // Fragments of a message not complete yet
+};
+
+// Per-user name for the daemon's local socket
+QString defaultServerName();
+
+// Starts a payload with its message type
+QDataStream& beginMessage(QDataStream& stream, MessageType type);
+
+void writeFrame(QIODevice* device, const QByteArray& payload);
+
+// Appends whatever the device has buffered and moves each complete frame into
+// frames, fragmented messages once whole. Returns false if the stream is
+// corrupt and the peer should be dropped, including a frame arriving between
+// the fragments of a message.
+bool readFrames(QIODevice* device, FrameReader& reader, QList<QByteArray>& frames);
+
+}
+
+#endif // IPCPROTOCOL_H
@@ -1,14 +1,24 @@
 #include "MainWindow.h"
+#include "EntryViewer.h"
+#include "HighlightCache.h"
+#include "HistoryArchive.h"
+#include "StallWatchdog.h"
 #include <QApplication>
 #include <QCloseEvent>
+#include <QFileDialog>
+#include <QIntValidator>
 #include <QMessageBox>
 #include <QMenuBar>
 #include <QStatusBar>
+#include <QShortcut>
+#include <QSystemTrayIcon>
+#include <climits>
 
 MainWindow::MainWindow(QWidget* parent)
     : QMainWindow(parent)
     , m_clipboardManager(nullptr)
     , m_historyWidget(nullptr)
+    , m_shownId(0)
 {
     setWindowTitle("Clipboard Manager");
     setMinimumSize(800, 600);
@@ -29,6 +39,16 @@ void MainWindow::setClipboardManager(ClipboardManager* manager)
     if (m_historyWidget) {
         m_historyWidget->setClipboardManager(manager);
     }
+    if (m_clipboardManager) {
+        connect(m_clipboardManager, &ClipboardManager::historyChanged,
+                this, &MainWindow::onHistoryChanged);
+        connect(m_clipboardManager->highlightCache(), &HighlightCache::highlightReady,
+                this, &MainWindow::onHighlightReady);
+        connect(m_clipboardManager->transfer(), &HistoryTransfer::progress,
+                this, &MainWindow::onTransferProgress);
+        connect(m_clipboardManager->transfer(), &HistoryTransfer::finished,
+                this, &MainWindow::onTransferFinished);
+    }
 }
 
 void MainWindow::setupUI()
@@ -50,24 +70,86 @@ void MainWindow::setupUI()
     m_preferencesButton->setObjectName("headerButton");
     connect(m_preferencesButton, &QPushButton::clicked, this, &MainWindow::showPreferences);
     
+    m_exportButton = new QPushButton("Export...");
+    m_exportButton->setObjectName("headerButton");
+    connect(m_exportButton, &QPushButton::clicked, this, &MainWindow::exportHistory);
+    
+    m_importButton = new QPushButton("Import...");
+    m_importButton->setObjectName("headerButton");
+    connect(m_importButton, &QPushButton::clicked, this, &MainWindow::importHistory);
+    
     m_hideButton = new QPushButton("Hide to Tray");
     m_hideButton->setObjectName("headerButton");
     connect(m_hideButton, &QPushButton::clicked, this, &MainWindow::hideToTray);
     
     m_headerLayout->addWidget(m_titleLabel);
     m_headerLayout->addStretch();
+    m_headerLayout->addWidget(m_exportButton);
+    m_headerLayout->addWidget(m_importButton);
     m_headerLayout->addWidget(m_preferencesButton);
     m_headerLayout->addWidget(m_hideButton);
     
     // History widget
     m_historyWidget = new ClipboardHistoryWidget();
+    connect(m_historyWidget, &ClipboardHistoryWidget::currentItemChanged, this, &MainWindow::showEntry);
+    
+    // Viewer for the full text of the current item, with find and go-to-line
+    QWidget* viewerPane = new QWidget();
+    QVBoxLayout* viewerLayout = new QVBoxLayout(viewerPane);
+    viewerLayout->setContentsMargins(0, 0, 0, 0);
+    QHBoxLayout* viewerBar = new QHBoxLayout();
+    
+    m_findEdit = new QLineEdit();
+    m_findEdit->setPlaceholderText("Find in entry...");
+    connect(m_findEdit, &QLineEdit::returnPressed, this, &MainWindow::findNext);
+    
+    QPushButton* findButton = new QPushButton("Find Next");
+    connect(findButton, &QPushButton::clicked, this, &MainWindow::findNext);
+    
+    m_lineEdit = new QLineEdit();
+    m_lineEdit->setPlaceholderText("Line");
+    m_lineEdit->setValidator(new QIntValidator(1, INT_MAX, m_lineEdit));
+    m_lineEdit->setMaximumWidth(90);
+    connect(m_lineEdit, &QLineEdit::returnPressed, this, &MainWindow::goToLine);
+    
+    m_viewerStatus = new QLabel();
+    
+    viewerBar->addWidget(m_findEdit, 1);
+    viewerBar->addWidget(findButton);
+    viewerBar->addWidget(m_lineEdit);
+    viewerBar->addWidget(m_viewerStatus);
+    
+    m_entryViewer = new EntryViewer();
+    connect(m_entryViewer, &EntryViewer::indexingProgress, this, &MainWindow::onIndexingProgress);
+    connect(m_entryViewer, &EntryViewer::findFinished, this, &MainWindow::onFindFinished);
+    
+    viewerLayout->addLayout(viewerBar);
+    viewerLayout->addWidget(m_entryViewer, 1);
+    
+    m_splitter = new QSplitter(Qt::Horizontal);
+    m_splitter->addWidget(m_historyWidget);
+    m_splitter->addWidget(viewerPane);
+    m_splitter->setStretchFactor(0, 2);
+    m_splitter->setStretchFactor(1, 3);
     
     // Add to main layout
     m_mainLayout->addLayout(m_headerLayout);
-    m_mainLayout->addWidget(m_historyWidget, 1);
+    m_mainLayout->addWidget(m_splitter, 1);
     
     // Status bar
     statusBar()->showMessage("Ready");
+    
+    // Developer shortcut: time a full scroll through the history list
+    QShortcut* paintShortcut = new QShortcut(QKeySequence("Ctrl+Shift+P"), this);
+    connect(paintShortcut, &QShortcut::activated, this, &MainWindow::measureScrollPaint);
+    
+    // Developer shortcut: how many clipboard changes each ingestion rule rejected
+    QShortcut* filterShortcut = new QShortcut(QKeySequence("Ctrl+Shift+F"), this);
+    connect(filterShortcut, &QShortcut::activated, this, &MainWindow::showIngestionStats);
+    
+    // Developer shortcut: recent GUI-thread stalls and what was running
+    QShortcut* stallShortcut = new QShortcut(QKeySequence("Ctrl+Shift+S"), this);
+    connect(stallShortcut, &QShortcut::activated, this, &MainWindow::showStallReport);
 }
 
 void MainWindow::applyMacStyle()
@@ -160,4 +242,200 @@ void MainWindow::showPreferences()
                            "• Keyboard shortcuts\n"
                            "• Startup behavior\n"
                            "• Content filtering");
+}
+
+void MainWindow::showIngestionStats()
+{
+    if (!m_clipboardManager) {
+        return;
+    }
+    if (m_clipboardManager->isAttached()) {
+        statusBar()->showMessage("Rejected: capture runs in the daemon");
+        return;
+    }
+    
+    const ClipboardManager::ChangeStats changes = m_clipboardManager->changeStats();
+    QString message = QString("Changes: %1 raw (%2/min), %3 processed (%4/min), %5 coalesced, "
+                              "%6 identical, %7 rate-limited, %8 secrets dropped, worst latency %9 ms | ")
+                          .arg(changes.rawEvents)
+                          .arg(changes.rawPerMinute, 0, 'f', 1)
+                          .arg(changes.processedEvents)
+                          .arg(changes.processedPerMinute, 0, 'f', 1)
+                          .arg(changes.coalescedEvents)
+                          .arg(changes.collapsedDuplicates)
+                          .arg(changes.rateLimited)
+                          .arg(changes.droppedSecrets)
+                          .arg(changes.worstLatencyMsecs)
+                      + "Rejected: " + m_clipboardManager->ingestionFilter().summary();
+    const HistoryLog& log = m_clipboardManager->historyLog();
+    if (log.isOpen()) {
+        const HistoryLog::Stats stats = log.stats();
+        message += QString(" | Log: %1 records, %2 fsyncs/min, worst append %3 us, worst commit %4 ms")
+                       .arg(stats.records)
+                       .arg(stats.fsyncsPerMinute, 0, 'f', 1)
+                       .arg(stats.worstAppendUsecs, 0, 'f', 1)
+                       .arg(stats.worstCommitMsecs)
+                   + QString(" | Store: %1 KiB, %2% dead, %3 compactions, %4 KiB rewritten, worst pause %5 ms")
+                         .arg(stats.fileBytes / 1024)
+                         .arg(stats.deadSpaceRatio * 100, 0, 'f', 0)
+                         .arg(stats.compactions)
+                         .arg(stats.bytesRewritten / 1024)
+                         .arg(stats.worstCompactionPauseMsecs);
+    }
+    if (const Diagnostics::ActivityMonitor* monitor = Diagnostics::ActivityMonitor::instance()) {
+        message += " | Activity: " + monitor->summary();
+    }
+    const HistoryArchive* archive = m_clipboardManager->archive();
+    if (archive->isOpen()) {
+        message += QString(" | Archive: %1 items in %2 segments")
+                       .arg(archive->itemCount())
+                       .arg(archive->segmentCount());
+    }
+    statusBar()->showMessage(message);
+}
+
+void MainWindow::showStallReport()
+{
+    const StallWatchdog* watchdog = StallWatchdog::instance();
+    if (!watchdog) {
+        statusBar()->showMessage("Stall watchdog is off");
+        return;
+    }
+    QMessageBox box(QMessageBox::Information, "GUI Stalls",
+                    QString("%1 stalls of %2 ms or more").arg(watchdog->stallCount()).arg(watchdog->thresholdMsecs()),
+                    QMessageBox::Save | QMessageBox::Close, this);
+    box.setDetailedText(watchdog->report());
+    if (box.exec() != QMessageBox::Save) {
+        return;
+    }
+    
+    const QString path = QFileDialog::getSaveFileName(this, "Save Stall Report", "stalls.txt");
+    if (!path.isEmpty() && !watchdog->dump(path)) {
+        statusBar()->showMessage("Cannot write " + path);
+    }
+}
+
+void MainWindow::showEntry(quint64 id)
+{
+    const int index = m_clipboardManager ? m_clipboardManager->indexOf(id) : -1;
+    if (index < 0 || id == m_shownId) {
+        return;
+    }
+    
+    // The viewer shares the item's text, so even a huge entry costs no copy
+    const ClipboardItem& item = m_clipboardManager->history()[index];
+    m_shownId = id;
+    m_entryViewer->setText(item.type() == ClipboardItem::Image ? QString() : item.text());
+    if (item.type() == ClipboardItem::Code) {
+        m_entryViewer->setHighlight(m_clipboardManager->highlightCache()->highlight(id, item.text(), item.preview()));
+    }
+}
+
+void MainWindow::onHistoryChanged()
+{
+    // A removed, cleared, expired or renumbered item must not stay on screen
+    if (m_shownId != 0 && m_clipboardManager->indexOf(m_shownId) < 0) {
+        m_shownId = 0;
+        m_entryViewer->setText(QString());
+        m_viewerStatus->clear();
+    }
+}
+
+void MainWindow::onHighlightReady(quint64 id)
+{
+    const int index = id == m_shownId ? m_clipboardManager->indexOf(id) : -1;
+    if (index >= 0) {
+        const ClipboardItem& item = m_clipboardManager->history()[index];
+        m_entryViewer->setHighlight(m_clipboardManager->highlightCache()->highlight(id, item.text(), item.preview()));
+    }
+}
+
+void MainWindow::exportHistory()
+{
+    if (!m_clipboardManager) {
+        return;
+    }
+    const QString path = QFileDialog::getSaveFileName(this, "Export History", "clipboard-history.cbex",
+                                                      "Clipboard history (*.cbex)");
+    if (path.isEmpty()) {
+        return;
+    }
+    if (!m_clipboardManager->exportHistory(path)) {
+        statusBar()->showMessage("Another export or import is running");
+    }
+}
+
+void MainWindow::importHistory()
+{
+    if (!m_clipboardManager) {
+        return;
+    }
+    if (m_clipboardManager->isAttached()) {
+        statusBar()->showMessage("Rejected: the history is kept by the daemon");
+        return;
+    }
+    const QString path = QFileDialog::getOpenFileName(this, "Import History", QString(),
+                                                      "Clipboard history (*.cbex);;All files (*)");
+    if (path.isEmpty()) {
+        return;
+    }
+    if (!m_clipboardManager->importHistory(path)) {
+        statusBar()->showMessage("Another export or import is running");
+    }
+}
+
+void MainWindow::onTransferProgress(qint64 done, qint64 total)
+{
+    m_exportButton->setEnabled(false);
+    m_importButton->setEnabled(false);
+    const int percent = total > 0 ? static_cast<int>(done * 100 / total) : 100;
+    statusBar()->showMessage(QString("Transferring history: %1%").arg(percent));
+}
+
+void MainWindow::onTransferFinished(const HistoryTransfer::Result& result)
+{
+    m_exportButton->setEnabled(true);
+    m_importButton->setEnabled(true);
+    if (!result.ok) {
+        statusBar()->showMessage("Transfer failed: " + result.error);
+        return;
+    }
+    QString message = QString("%1 items, %2 KiB in %3 ms").arg(result.items).arg(result.bytes / 1024).arg(result.msecs);
+    if (result.duplicates > 0) {
+        message += QString(", %1 already in the history").arg(result.duplicates);
+    }
+    statusBar()->showMessage(message);
+}
+
+void MainWindow::goToLine()
+{
+    m_entryViewer->goToLine(m_lineEdit->text().toLongLong());
+    m_entryViewer->setFocus();
+}
+
+void MainWindow::findNext()
+{
+    m_entryViewer->findNext(m_findEdit->text());
+}
+
+void MainWindow::onIndexingProgress(qint64 lines, bool finished)
+{
+    m_viewerStatus->setText(QString(finished ? "%1 lines" : "%1 lines so far").arg(lines));
+}
+
+void MainWindow::onFindFinished(bool found)
+{
+    if (!found) {
+        statusBar()->showMessage(QString("\"%1\" not found").arg(m_findEdit->text()), 3000);
+    }
+}
+
+void MainWindow::measureScrollPaint()
+{
+    const Diagnostics::PaintStats stats = m_historyWidget->measureScrollPaint();
+    const double average = stats.frames > 0 ? stats.totalMsecs / stats.frames : 0.0;
+    statusBar()->showMessage(QString("Scroll paint: %1 frames, %2 ms average, %3 ms worst")
+                             .arg(stats.frames)
+                             .arg(average, 0, 'f', 2)
+                             .arg(stats.worstMsecs, 0, 'f', 2));
 }
\ No newline at end of file
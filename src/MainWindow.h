@@ -6,8 +6,13 @@
 #include <QHBoxLayout>
 #include <QLabel>
 #include <QPushButton>
+#include <QLineEdit>
+#include <QSplitter>
 #include "ClipboardManager.h"
 #include "ClipboardHistoryWidget.h"
+#include "HistoryTransfer.h"
+
+class EntryViewer;
 
 class MainWindow : public QMainWindow
 {
@@ -26,6 +31,20 @@ protected:
 private slots:
     void hideToTray();
     void showPreferences();
+    void measureScrollPaint();
+    void showIngestionStats();
+    void showStallReport();
+    void showEntry(quint64 id);
+    void goToLine();
+    void findNext();
+    void onIndexingProgress(qint64 lines, bool finished);
+    void onFindFinished(bool found);
+    void onHistoryChanged();
+    void onHighlightReady(quint64 id);
+    void exportHistory();
+    void importHistory();
+    void onTransferProgress(qint64 done, qint64 total);
+    void onTransferFinished(const HistoryTransfer::Result& result);
     
 private:
     ClipboardManager* m_clipboardManager;
@@ -38,6 +57,16 @@ private:
     QLabel* m_titleLabel;
     QPushButton* m_hideButton;
     QPushButton* m_preferencesButton;
+    QPushButton* m_exportButton;
+    QPushButton* m_importButton;
+    
+    // Full text of the current item
+    QSplitter* m_splitter;
+    EntryViewer* m_entryViewer;
+    QLineEdit* m_findEdit;
+    QLineEdit* m_lineEdit;
+    QLabel* m_viewerStatus;
+    quint64 m_shownId;
     
     void setupUI();
     void applyMacStyle();
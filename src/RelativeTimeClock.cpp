@@ -0,0 +1,80 @@
+#include "RelativeTimeClock.h"
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QEvent>
+#include <algorithm>
+
+namespace {
+// Labels change at whole minutes at the finest, so a now this old is never
+// visibly wrong; rows painted together still agree on it
+const qint64 kMaxStalenessMsecs = 1000;
+}
+
+RelativeTimeClock* RelativeTimeClock::instance()
+{
+    // Owned by the application, so the timer goes away before Qt does
+    static RelativeTimeClock* clock = new RelativeTimeClock(QCoreApplication::instance());
+    return clock;
+}
+
+RelativeTimeClock::RelativeTimeClock(QObject* parent)
+    : QObject(parent)
+    , m_now(QDateTime::currentMSecsSinceEpoch())
+    , m_tickAt(0)
+{
+    // A coarse timer may fire a few percent of an hour late
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &RelativeTimeClock::onTimeout);
+}
+
+qint64 RelativeTimeClock::now()
+{
+    const qint64 current = QDateTime::currentMSecsSinceEpoch();
+    if (current - m_now > kMaxStalenessMsecs || current < m_now) {
+        m_now = current;
+    }
+    return m_now;
+}
+
+void RelativeTimeClock::requestTick(qint64 msecs)
+{
+    if (msecs < 0 || (m_tickAt != 0 && msecs >= m_tickAt)) {
+        return;
+    }
+    
+    m_tickAt = msecs;
+    const qint64 delay = msecs - QDateTime::currentMSecsSinceEpoch();
+    m_timer.start(static_cast<int>(qBound<qint64>(0, delay, 24 * 60 * 60 * 1000)));
+}
+
+void RelativeTimeClock::watch(QWidget* viewport)
+{
+    m_viewports.append(viewport);
+    viewport->installEventFilter(this);
+    connect(this, &RelativeTimeClock::ticked, viewport, QOverload<>::of(&QWidget::update));
+}
+
+bool RelativeTimeClock::eventFilter(QObject* watched, QEvent* event)
+{
+    // Hiding a window hides its children too, so the viewport hears of it
+    if (event->type() == QEvent::Hide && m_timer.isActive()) {
+        const bool anyVisible = std::any_of(m_viewports.cbegin(), m_viewports.cend(),
+                                            [](const QPointer<QWidget>& viewport) {
+                                                return viewport && viewport->isVisible();
+                                            });
+        if (!anyVisible) {
+            m_timer.stop();
+            m_tickAt = 0;
+        }
+    }
+    return QObject::eventFilter(watched, event);
+}
+
+void RelativeTimeClock::onTimeout()
+{
+    // Views repaint and ask again for whatever they still show
+    m_now = QDateTime::currentMSecsSinceEpoch();
+    m_tickAt = 0;
+    emit ticked();
+}
@@ -0,0 +1,49 @@
+#ifndef RELATIVETIMECLOCK_H
+#define RELATIVETIMECLOCK_H
+
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+#include <QWidget>
+
+// The "now" that relative times ("5 minutes ago") are painted against. Views
+// paint labels from now() and tell the clock when the label they painted will
+// change; the clock then ticks once, at the earliest of those moments, and the
+// views repaint. Rows that are not painted ask for nothing, so an idle or
+// hidden view causes no wakeups, and one whose labels are all absolute dates
+// causes none either. A tick still pending when the last watched view hides
+// is cancelled.
+class RelativeTimeClock : public QObject
+{
+    Q_OBJECT
+    
+public:
+    static RelativeTimeClock* instance();
+    
+    // Epoch ms as of the last tick, at most kMaxStalenessMsecs old
+    qint64 now();
+    
+    // Asks for a tick at msecs since the epoch; -1 is ignored
+    void requestTick(qint64 msecs);
+    
+    // Repaints viewport on every tick
+    void watch(QWidget* viewport);
+    
+signals:
+    void ticked();
+    
+protected:
+    bool eventFilter(QObject* watched, QEvent* event) override;
+    
+private:
+    QTimer m_timer;
+    QList<QPointer<QWidget>> m_viewports;
+    qint64 m_now;
+    qint64 m_tickAt;    // 0 while no tick is scheduled
+    
+    explicit RelativeTimeClock(QObject* parent);
+    void onTimeout();
+};
+
+#endif // RELATIVETIMECLOCK_H
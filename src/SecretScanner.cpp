@@ -0,0 +1,466 @@
+#include "SecretScanner.h"
+#include <array>
+#include <climits>
+#include <cmath>
+#include <queue>
+
+namespace {
+const int kAlphabet = 128;
+
+// Transition entries carry the target state in the low bits and a flag for
+// "some anchor ends here" in the top bit, so the hot loop needs one lookup
+const quint16 kOutputFlag = 0x8000;
+const quint16 kStateMask = 0x7fff;
+
+// Long runs of token characters are checked for entropy
+const int kMinEntropyRun = 32;
+const int kMaxEntropyRun = 512;
+const double kMinEntropyBits = 4.2;
+
+// PEM blocks are searched this far for their END line
+const int kMaxPemLength = 16 * 1024;
+
+struct CharTables
+{
+    std::array<quint8, kAlphabet> fold;     // ASCII lowercase
+    std::array<bool, kAlphabet> token;      // [A-Za-z0-9+/=_-]
+    
+    CharTables()
+    {
+        for (int c = 0; c < kAlphabet; ++c) {
+            fold[c] = static_cast<quint8>(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+            token[c] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                       c == '+' || c == '/' || c == '=' || c == '_' || c == '-';
+        }
+    }
+};
+
+const CharTables& charTables()
+{
+    static const CharTables tables;
+    return tables;
+}
+
+bool isAlnum(QChar c)
+{
+    const ushort u = c.unicode();
+    return (u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') || (u >= '0' && u <= '9');
+}
+
+bool isUpperAlnum(QChar c)
+{
+    const ushort u = c.unicode();
+    return (u >= 'A' && u <= 'Z') || (u >= '0' && u <= '9');
+}
+
+bool isKeyChar(QChar c)
+{
+    return isAlnum(c) || c == QLatin1Char('_') || c == QLatin1Char('-');
+}
+
+bool isBase64UrlChar(QChar c)
+{
+    return isKeyChar(c);
+}
+
+bool isUnderscoreAlnum(QChar c)
+{
+    return isAlnum(c) || c == QLatin1Char('_');
+}
+
+bool isHyphenAlnum(QChar c)
+{
+    return isAlnum(c) || c == QLatin1Char('-');
+}
+
+// Length of the run of characters matching the predicate, starting at from
+int runLength(const QString& text, int from, bool (*predicate)(QChar), int max = INT_MAX)
+{
+    int end = from;
+    const int limit = from + qMin(max, text.size() - from);
+    while (end < limit && predicate(text[end])) {
+        ++end;
+    }
+    return end - from;
+}
+
+bool boundaryBefore(const QString& text, int start)
+{
+    return start == 0 || !isAlnum(text[start - 1]);
+}
+
+bool boundaryAt(const QString& text, int position)
+{
+    return position >= text.size() || !isAlnum(text[position]);
+}
+
+bool matchesAt(const QString& text, int position, const char* literal)
+{
+    const QLatin1String expected(literal);
+    return QStringView(text).mid(position, expected.size()) == expected;
+}
+
+// Shannon entropy of a token run, in bits per character. Requiring upper,
+// lower and digits keeps hex digests and words out.
+bool isHighEntropy(const QChar* run, int length)
+{
+    std::array<int, kAlphabet> counts{};
+    bool upper = false;
+    bool lower = false;
+    bool digit = false;
+    for (int i = 0; i < length; ++i) {
+        const ushort c = run[i].unicode();
+        ++counts[c];
+        upper = upper || (c >= 'A' && c <= 'Z');
+        lower = lower || (c >= 'a' && c <= 'z');
+        digit = digit || (c >= '0' && c <= '9');
+    }
+    if (!upper || !lower || !digit) {
+        return false;
+    }
+    
+    double entropy = 0.0;
+    for (const int count : counts) {
+        if (count > 0) {
+            const double p = static_cast<double>(count) / length;
+            entropy -= p * std::log2(p);
+        }
+    }
+    return entropy >= kMinEntropyBits;
+}
+}
+
+SecretScanner::SecretScanner()
+{
+    m_anchors = {
+        {QStringLiteral("-----begin "), PrivateKey},
+        {QStringLiteral("akia"), AwsAccessKey},
+        {QStringLiteral("asia"), AwsAccessKey},
+        {QStringLiteral("ghp_"), GitHubToken},
+        {QStringLiteral("gho_"), GitHubToken},
+        {QStringLiteral("ghu_"), GitHubToken},
+        {QStringLiteral("ghs_"), GitHubToken},
+        {QStringLiteral("ghr_"), GitHubToken},
+        {QStringLiteral("github_pat_"), GitHubToken},
+        {QStringLiteral("xoxb-"), SlackToken},
+        {QStringLiteral("xoxp-"), SlackToken},
+        {QStringLiteral("xoxa-"), SlackToken},
+        {QStringLiteral("xoxr-"), SlackToken},
+        {QStringLiteral("xoxs-"), SlackToken},
+        {QStringLiteral("sk_live_"), StripeKey},
+        {QStringLiteral("rk_live_"), StripeKey},
+        {QStringLiteral("aiza"), GoogleApiKey},
+        {QStringLiteral("sk-"), ApiKey},
+        {QStringLiteral("eyj"), JsonWebToken},
+        {QStringLiteral("password"), PasswordAssignment},
+        {QStringLiteral("passwd"), PasswordAssignment},
+        {QStringLiteral("secret"), PasswordAssignment},
+        {QStringLiteral("api_key"), PasswordAssignment},
+        {QStringLiteral("apikey"), PasswordAssignment},
+        {QStringLiteral("api-key"), PasswordAssignment},
+        {QStringLiteral("access_key"), PasswordAssignment}
+    };
+    build();
+}
+
+const SecretScanner& SecretScanner::instance()
+{
+    static const SecretScanner scanner;
+    return scanner;
+}
+
+void SecretScanner::build()
+{
+    // Trie of the anchors
+    std::vector<std::array<int, kAlphabet>> trie(1);
+    trie[0].fill(-1);
+    m_outputs.assign(1, {});
+    
+    for (int i = 0; i < static_cast<int>(m_anchors.size()); ++i) {
+        int state = 0;
+        for (const QChar c : m_anchors[i].literal) {
+            int& next = trie[state][c.unicode()];
+            if (next < 0) {
+                next = static_cast<int>(trie.size());
+                trie.emplace_back();
+                trie.back().fill(-1);
+                m_outputs.emplace_back();
+            }
+            state = next;
+        }
+        m_outputs[state].push_back(i);
+    }
+    
+    // Breadth-first over the trie: failure links, merged outputs, and the
+    // complete transition table with failures already followed
+    const int stateCount = static_cast<int>(trie.size());
+    Q_ASSERT(stateCount <= kStateMask);
+    std::vector<int> fail(stateCount, 0);
+    std::vector<int> next(stateCount * kAlphabet, 0);
+    std::queue<int> queue;
+    
+    for (int c = 0; c < kAlphabet; ++c) {
+        const int child = trie[0][c];
+        if (child >= 0) {
+            next[c] = child;
+            queue.push(child);
+        }
+    }
+    while (!queue.empty()) {
+        const int state = queue.front();
+        queue.pop();
+    
+        for (int c = 0; c < kAlphabet; ++c) {
+            const int child = trie[state][c];
+            if (child < 0) {
+                next[state * kAlphabet + c] = next[fail[state] * kAlphabet + c];
+                continue;
+            }
+    
+            fail[child] = next[fail[state] * kAlphabet + c];
+            const std::vector<int>& inherited = m_outputs[fail[child]];
+            m_outputs[child].insert(m_outputs[child].end(), inherited.begin(), inherited.end());
+            next[state * kAlphabet + c] = child;
+            queue.push(child);
+        }
+    }
+    
+    m_next.resize(next.size());
+    for (size_t i = 0; i < next.size(); ++i) {
+        m_next[i] = static_cast<quint16>(next[i]) | (m_outputs[next[i]].empty() ? 0 : kOutputFlag);
+    }
+}
+
+QList<SecretScanner::Finding> SecretScanner::scan(const QString& text) const
+{
+    QList<Finding> findings;
+    const CharTables& tables = charTables();
+    const QChar* data = text.constData();
+    const int size = text.size();
+    
+    quint16 state = 0;
+    int runStart = -1;      // Start of the current run of token characters
+    int coveredUntil = 0;   // End of the last finding; nothing is reported twice
+    
+    for (int i = 0; i < size; ++i) {
+        const ushort c = data[i].unicode();
+    
+        if (c < kAlphabet) {
+            if (tables.token[c]) {
+                if (runStart < 0) {
+                    runStart = i;
+                }
+            } else if (runStart >= 0) {
+                if (runStart >= coveredUntil && i - runStart >= kMinEntropyRun && i - runStart <= kMaxEntropyRun &&
+                    isHighEntropy(data + runStart, i - runStart)) {
+                    findings.append(Finding{HighEntropyToken, runStart, i - runStart});
+                    coveredUntil = i;
+                }
+                runStart = -1;
+            }
+    
+            const quint16 entry = m_next[(state & kStateMask) * kAlphabet + tables.fold[c]];
+            state = entry;
+            if (!(entry & kOutputFlag)) {
+                continue;
+            }
+        } else {
+            // Non-ASCII text never continues an anchor or a token
+            state = 0;
+            runStart = -1;
+            continue;
+        }
+    
+        for (const int anchorIndex : m_outputs[state & kStateMask]) {
+            const Anchor& anchor = m_anchors[anchorIndex];
+            const int start = i - anchor.literal.size() + 1;
+            Finding finding;
+            if (start >= coveredUntil && validate(text, anchor, start, &finding)) {
+                findings.append(finding);
+                coveredUntil = finding.start + finding.length;
+                break;
+            }
+        }
+    }
+    
+    if (runStart >= coveredUntil && runStart >= 0 && size - runStart >= kMinEntropyRun &&
+        size - runStart <= kMaxEntropyRun && isHighEntropy(data + runStart, size - runStart)) {
+        findings.append(Finding{HighEntropyToken, runStart, size - runStart});
+    }
+    
+    return findings;
+}
+
+bool SecretScanner::validate(const QString& text, const Anchor& anchor, int start, Finding* finding) const
+{
+    const int end = start + anchor.literal.size();
+    finding->kind = anchor.kind;
+    finding->start = start;
+    
+    switch (anchor.kind) {
+        case PrivateKey: {
+            // "-----BEGIN [RSA |EC |OPENSSH ]PRIVATE KEY-----", through its END line
+            const int lineEnd = text.indexOf(QLatin1Char('\n'), end);
+            const QStringView header = QStringView(text).mid(end, (lineEnd < 0 ? text.size() : lineEnd) - end);
+            if (!matchesAt(text, start, "-----BEGIN ") || !header.contains(QLatin1String("PRIVATE KEY-----"))) {
+                return false;
+            }
+            const int footer = text.indexOf(QLatin1String("-----END "), end);
+            if (footer >= 0 && footer - start <= kMaxPemLength) {
+                const int footerEnd = text.indexOf(QLatin1String("-----"), footer + 9);
+                finding->length = (footerEnd >= 0 ? footerEnd + 5 : text.size()) - start;
+            } else {
+                finding->length = end + header.size() - start;
+            }
+            return true;
+        }
+        case AwsAccessKey:
+            // Four-letter prefix and 16 uppercase base32 characters
+            if (!boundaryBefore(text, start) || !isUpperAlnum(text[start]) ||
+                !(matchesAt(text, start, "AKIA") || matchesAt(text, start, "ASIA")) ||
+                runLength(text, end, isUpperAlnum, 17) != 16) {
+                return false;
+            }
+            finding->length = 20;
+            return true;
+        case GitHubToken: {
+            if (!boundaryBefore(text, start) || !matchesAt(text, start, anchor.literal.toLatin1().constData())) {
+                return false;
+            }
+            const bool fineGrained = anchor.literal.size() > 4;
+            const int length = runLength(text, end, fineGrained ? isUnderscoreAlnum : isAlnum);
+            if (fineGrained ? length < 22 : length != 36) {
+                return false;
+            }
+            finding->length = end + length - start;
+            return true;
+        }
+        case SlackToken:
+        case StripeKey: {
+            if (!boundaryBefore(text, start) || !matchesAt(text, start, anchor.literal.toLatin1().constData())) {
+                return false;
+            }
+            const int length = runLength(text, end, anchor.kind == SlackToken ? isHyphenAlnum : isAlnum);
+            if (length < (anchor.kind == SlackToken ? 10 : 16)) {
+                return false;
+            }
+            finding->length = end + length - start;
+            return true;
+        }
+        case GoogleApiKey:
+            if (!boundaryBefore(text, start) || !matchesAt(text, start, "AIza") ||
+                runLength(text, end, isKeyChar, 36) != 35) {
+                return false;
+            }
+            finding->length = 39;
+            return true;
+        case ApiKey: {
+            if (!boundaryBefore(text, start) || !matchesAt(text, start, "sk-")) {
+                return false;
+            }
+            const int length = runLength(text, end, isKeyChar);
+            if (length < 32) {
+                return false;
+            }
+            finding->length = end + length - start;
+            return true;
+        }
+        case JsonWebToken: {
+            // Three base64url segments; the header always starts with "eyJ"
+            if ((start > 0 && isBase64UrlChar(text[start - 1])) || !matchesAt(text, start, "eyJ")) {
+                return false;
+            }
+            int position = start;
+            for (int segment = 0; segment < 3; ++segment) {
+                const int length = runLength(text, position, isBase64UrlChar);
+                if (length < 10) {
+                    return false;
+                }
+                position += length;
+                if (segment < 2) {
+                    if (position >= text.size() || text[position] != QLatin1Char('.')) {
+                        return false;
+                    }
+                    ++position;
+                }
+            }
+            finding->length = position - start;
+            return true;
+        }
+        case PasswordAssignment: {
+            // keyword[suffix]["'] [:=] ["']value; only the value is reported
+            int position = end + runLength(text, end, isKeyChar);
+            while (position < text.size() && (text[position] == QLatin1Char('"') || text[position] == QLatin1Char('\''))) {
+                ++position;
+            }
+            while (position < text.size() && text[position] == QLatin1Char(' ')) {
+                ++position;
+            }
+            if (position >= text.size() || (text[position] != QLatin1Char('=') && text[position] != QLatin1Char(':'))) {
+                return false;
+            }
+            ++position;
+            if (position < text.size() && (text[position] == QLatin1Char('=') || text[position] == QLatin1Char('>'))) {
+                // Comparisons and "=>" maps don't assign a literal
+                if (text[position] == QLatin1Char('=')) {
+                    return false;
+                }
+                ++position;
+            }
+            while (position < text.size() && text[position] == QLatin1Char(' ')) {
+                ++position;
+            }
+            QChar quote;
+            if (position < text.size() && (text[position] == QLatin1Char('"') || text[position] == QLatin1Char('\''))) {
+                quote = text[position++];
+            }
+    
+            const int valueStart = position;
+            while (position < text.size() && !text[position].isSpace() && text[position] != quote &&
+                   text[position] != QLatin1Char(',') && text[position] != QLatin1Char(';') &&
+                   text[position] != QLatin1Char(')') && position - valueStart <= 256) {
+                ++position;
+            }
+    
+            // Placeholders and variable references are not secrets
+            const int length = position - valueStart;
+            if (length < 6 || length > 256) {
+                return false;
+            }
+            const QChar first = text[valueStart];
+            if (first == QLatin1Char('$') || first == QLatin1Char('<') || first == QLatin1Char('{') ||
+                first == QLatin1Char('%') || first == QLatin1Char('*') || first == QLatin1Char('(')) {
+                return false;
+            }
+            finding->start = valueStart;
+            finding->length = length;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+QList<SecretScanner::Finding> SecretScanner::scanMarkup(const QString& html) const
+{
+    QList<Finding> findings = scan(html);
+    findings.removeIf([](const Finding& finding) { return finding.kind == HighEntropyToken; });
+    return findings;
+}
+
+const char* SecretScanner::kindName(Kind kind)
+{
+    switch (kind) {
+        case PrivateKey: return "private key";
+        case AwsAccessKey: return "AWS access key";
+        case GitHubToken: return "GitHub token";
+        case SlackToken: return "Slack token";
+        case StripeKey: return "Stripe key";
+        case GoogleApiKey: return "Google API key";
+        case ApiKey: return "API key";
+        case JsonWebToken: return "JSON web token";
+        case PasswordAssignment: return "password";
+        case HighEntropyToken: return "high-entropy token";
+        default: return "unknown";
+    }
+}
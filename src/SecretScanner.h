@@ -0,0 +1,67 @@
+#ifndef SECRETSCANNER_H
+#define SECRETSCANNER_H
+
+#include <QList>
+#include <QString>
+#include <vector>
+
+// Finds credentials in captured text in a single pass. Literal anchors
+// ("AKIA", "-----BEGIN ", "eyJ", "ghp_", "password", ...) are matched by an
+// Aho-Corasick automaton compiled into a dense ASCII transition table, so the
+// cost per character is one table lookup regardless of how many patterns
+// there are. Each anchor hit is then confirmed by a small validator for its
+// format. The same loop tracks runs of token characters and flags long,
+// high-entropy ones. The scanner is immutable after construction and safe to
+// share between threads.
+class SecretScanner
+{
+public:
+    enum Kind {
+        PrivateKey,
+        AwsAccessKey,
+        GitHubToken,
+        SlackToken,
+        StripeKey,
+        GoogleApiKey,
+        ApiKey,             // "sk-..." style keys
+        JsonWebToken,
+        PasswordAssignment, // password=..., api_key: ..., and similar
+        HighEntropyToken,
+        KindCount
+    };
+
+    struct Finding
+    {
+        Kind kind;
+        int start;          // Span of the secret itself, in UTF-16 units
+        int length;
+    };
+
+    static const SecretScanner& instance();
+
+    QList<Finding> scan(const QString& text) const;
+
+    // For HTML markup, which is full of ids, hashes and inline images that
+    // look random: only secrets recognized by their format are reported
+    QList<Finding> scanMarkup(const QString& html) const;
+
+    static const char* kindName(Kind kind);
+
+private:
+    struct Anchor
+    {
+        QString literal;    // Lowercase; validators check case where it matters
+        Kind kind;
+    };
+
+    std::vector<Anchor> m_anchors;
+    std::vector<quint16> m_next;                // State x ASCII char -> state
+    std::vector<std::vector<int>> m_outputs;    // State -> anchors ending here
+
+    SecretScanner();
+
+    void build();
+    bool validate(const QString& text, const Anchor& anchor, int start, Finding* finding) const;
+};
+
+#endif // SECRETSCANNER_H
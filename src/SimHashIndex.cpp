@@ -0,0 +1,144 @@
+#include "SimHashIndex.h"
+#include <QtGlobal>
+
+namespace {
+// Long items are fingerprinted by their beginning
+const int kMaxFeatureChars = 16 * 1024;
+const int kMinFeatures = 3;
+
+// splitmix64 finalizer, spreads FNV-1a output over all 64 bits
+quint64 mix(quint64 value)
+{
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return value;
+}
+
+quint64 hashToken(const QChar* begin, const QChar* end)
+{
+    quint64 hash = 0xcbf29ce484222325ULL;
+    for (const QChar* c = begin; c != end; ++c) {
+        hash ^= c->toLower().unicode();
+        hash *= 0x100000001b3ULL;
+    }
+    return mix(hash);
+}
+
+void addFeature(int* weights, quint64 hash)
+{
+    for (int bit = 0; bit < 64; ++bit) {
+        weights[bit] += (hash >> bit) & 1 ? 1 : -1;
+    }
+}
+}
+
+quint64 SimHashIndex::fingerprint(const QString& text)
+{
+    int weights[64] = {};
+    int features = 0;
+    quint64 previous = 0;
+    
+    // Features are lowercased word tokens and adjacent-token pairs. Digit runs
+    // all count as the same token, so log lines differing only in timestamps
+    // or ids fingerprint alike.
+    static const QChar kNumberToken = QLatin1Char('#');
+    static const quint64 kNumberHash = hashToken(&kNumberToken, &kNumberToken + 1);
+    const QChar* c = text.constData();
+    const QChar* const end = c + qMin<qsizetype>(text.size(), kMaxFeatureChars);
+    while (c != end) {
+        if (!c->isLetterOrNumber()) {
+            ++c;
+            continue;
+        }
+        
+        const QChar* start = c;
+        const bool number = c->isDigit();
+        while (c != end && c->isLetterOrNumber() && c->isDigit() == number) {
+            ++c;
+        }
+        
+        const quint64 token = number ? kNumberHash : hashToken(start, c);
+        addFeature(weights, token);
+        if (features > 0) {
+            addFeature(weights, mix(previous * 31 + token));
+        }
+        previous = token;
+        ++features;
+    }
+    
+    if (features < kMinFeatures) {
+        return 0;
+    }
+    
+    quint64 fingerprint = 0;
+    for (int bit = 0; bit < 64; ++bit) {
+        if (weights[bit] > 0) {
+            fingerprint |= quint64(1) << bit;
+        }
+    }
+    return fingerprint;
+}
+
+void SimHashIndex::insert(quint64 fingerprint, quint64 id)
+{
+    if (fingerprint == 0 || m_fingerprints.contains(id)) {
+        return;
+    }
+    
+    m_fingerprints.insert(id, fingerprint);
+    for (int i = 0; i < kBands; ++i) {
+        m_bands[i].insert(band(fingerprint, i), id);
+    }
+}
+
+void SimHashIndex::remove(quint64 id)
+{
+    const auto it = m_fingerprints.find(id);
+    if (it == m_fingerprints.end()) {
+        return;
+    }
+    
+    for (int i = 0; i < kBands; ++i) {
+        m_bands[i].remove(band(it.value(), i), id);
+    }
+    m_fingerprints.erase(it);
+}
+
+void SimHashIndex::clear()
+{
+    for (int i = 0; i < kBands; ++i) {
+        m_bands[i].clear();
+    }
+    m_fingerprints.clear();
+}
+
+quint64 SimHashIndex::findNearest(quint64 fingerprint) const
+{
+    if (fingerprint == 0) {
+        return 0;
+    }
+    
+    quint64 nearest = 0;
+    int nearestDistance = kMaxDistance + 1;
+    for (int i = 0; i < kBands; ++i) {
+        auto range = m_bands[i].equal_range(band(fingerprint, i));
+        for (auto it = range.first; it != range.second; ++it) {
+            const int distance = qPopulationCount(fingerprint ^ m_fingerprints.value(it.value()));
+            
+            // Prefer the closest, then the newest
+            if (distance < nearestDistance || (distance == nearestDistance && it.value() > nearest)) {
+                nearest = it.value();
+                nearestDistance = distance;
+            }
+        }
+    }
+    return nearestDistance <= kMaxDistance ? nearest : 0;
+}
+
+quint16 SimHashIndex::band(quint64 fingerprint, int index)
+{
+    return static_cast<quint16>(fingerprint >> (16 * index));
+}
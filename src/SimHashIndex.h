@@ -0,0 +1,36 @@
+#ifndef SIMHASHINDEX_H
+#define SIMHASHINDEX_H
+
+#include <QHash>
+#include <QString>
+
+// Near-duplicate lookup for text items. Each item gets a 64-bit SimHash of
+// its word features, computed once at capture. The index splits fingerprints
+// into four 16-bit bands; by pigeonhole, two fingerprints within kMaxDistance
+// bits agree exactly on at least one band, so only the items sharing a band
+// bucket are compared. Every entry costs a fixed 8 bytes plus one bucket slot
+// per band.
+class SimHashIndex
+{
+public:
+    static const int kBands = 4;
+    static const int kMaxDistance = kBands - 1;
+    
+    // 0 for texts with too few features to compare meaningfully
+    static quint64 fingerprint(const QString& text);
+    
+    void insert(quint64 fingerprint, quint64 id);
+    void remove(quint64 id);
+    void clear();
+    
+    // Closest indexed item within kMaxDistance bits, or 0 if there is none
+    quint64 findNearest(quint64 fingerprint) const;
+    
+private:
+    QMultiHash<quint16, quint64> m_bands[kBands];
+    QHash<quint64, quint64> m_fingerprints;     // Id -> fingerprint
+    
+    static quint16 band(quint64 fingerprint, int index);
+};
+
+#endif // SIMHASHINDEX_H
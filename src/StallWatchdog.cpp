@@ -0,0 +1,289 @@
+#include "StallWatchdog.h"
+#include "Diagnostics.h"
+#include <QAbstractEventDispatcher>
+#include <QCoreApplication>
+#include <QDeadlineTimer>
+#include <QFile>
+#include <QThread>
+
+StallWatchdog* StallWatchdog::s_instance = nullptr;
+
+StallWatchdog::Scope::Scope(const char* name, qint64 payloadSize)
+    : m_watchdog(StallWatchdog::instance())
+    , m_depth(-1)
+    , m_startNsecs(0)
+{
+    if (!m_watchdog || QThread::currentThread() != m_watchdog->thread()) {
+        m_watchdog = nullptr;
+        return;
+    }
+    
+    m_depth = m_watchdog->m_depth.load(std::memory_order_relaxed);
+    m_startNsecs = m_watchdog->m_clock.nsecsElapsed();
+    if (m_depth < kMaxDepth) {
+        ScopeSlot& slot = m_watchdog->m_scopes[m_depth];
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.startNsecs.store(m_startNsecs, std::memory_order_relaxed);
+        slot.payloadSize.store(payloadSize, std::memory_order_relaxed);
+    }
+    // Publishes the slot to the watchdog
+    m_watchdog->m_depth.store(m_depth + 1, std::memory_order_release);
+}
+
+StallWatchdog::Scope::~Scope()
+{
+    if (!m_watchdog) {
+        return;
+    }
+    
+    m_watchdog->m_depth.store(m_depth, std::memory_order_release);
+    if (m_depth < kMaxDepth) {
+        const ScopeSlot& slot = m_watchdog->m_scopes[m_depth];
+        m_watchdog->scopeFinished(slot.name.load(std::memory_order_relaxed),
+                                  m_watchdog->m_clock.nsecsElapsed() - m_startNsecs,
+                                  slot.payloadSize.load(std::memory_order_relaxed));
+    }
+}
+
+void StallWatchdog::Scope::setPayloadSize(qint64 size)
+{
+    if (m_watchdog && m_depth < kMaxDepth) {
+        m_watchdog->m_scopes[m_depth].payloadSize.store(size, std::memory_order_relaxed);
+    }
+}
+
+StallWatchdog* StallWatchdog::start(int thresholdMsecs)
+{
+    if (!s_instance) {
+        s_instance = new StallWatchdog(qMax(1, thresholdMsecs), QCoreApplication::instance());
+    }
+    return s_instance;
+}
+
+StallWatchdog::StallWatchdog(int thresholdMsecs, QObject* parent)
+    : QObject(parent)
+    , m_thresholdNsecs(qint64(thresholdMsecs) * 1000000)
+    , m_thread(nullptr)
+    , m_depth(0)
+    , m_busySince(-1)
+    , m_period(0)
+    , m_watcherWaiting(false)
+    , m_stopping(false)
+    , m_ring(kCapacity)
+    , m_ringNext(0)
+    , m_stallCount(0)
+    , m_openStall(-1)
+    , m_busy(false)
+    , m_longestScope(nullptr)
+    , m_longestScopeNsecs(0)
+    , m_longestScopePayload(-1)
+{
+    m_clock.start();
+    
+    // Any event means the loop is working; blocking means it is done. Both
+    // only touch the lock on a change between the two.
+    QCoreApplication::instance()->installEventFilter(this);
+    QAbstractEventDispatcher* dispatcher = QAbstractEventDispatcher::instance();
+    connect(dispatcher, &QAbstractEventDispatcher::awake, this, &StallWatchdog::beginBusy, Qt::DirectConnection);
+    connect(dispatcher, &QAbstractEventDispatcher::aboutToBlock, this, &StallWatchdog::endBusy,
+            Qt::DirectConnection);
+    
+    m_thread = QThread::create([this]() { watchLoop(); });
+    m_thread->start();
+}
+
+StallWatchdog::~StallWatchdog()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_wakeup.wakeAll();
+    }
+    m_thread->wait();
+    delete m_thread;
+    s_instance = nullptr;
+}
+
+bool StallWatchdog::eventFilter(QObject* watched, QEvent* event)
+{
+    if (!m_busy) {
+        beginBusy();
+    }
+    return QObject::eventFilter(watched, event);
+}
+
+void StallWatchdog::beginBusy()
+{
+    if (m_busy) {
+        return;
+    }
+    m_busy = true;
+    
+    QMutexLocker locker(&m_mutex);
+    m_busySince = m_clock.nsecsElapsed();
+    ++m_period;
+    if (m_watcherWaiting) {
+        m_wakeup.wakeOne();
+    }
+}
+
+void StallWatchdog::endBusy()
+{
+    if (!m_busy) {
+        return;
+    }
+    m_busy = false;
+    
+    QMutexLocker locker(&m_mutex);
+    const qint64 busyNsecs = m_clock.nsecsElapsed() - m_busySince;
+    if (busyNsecs >= m_thresholdNsecs) {
+        // The watchdog may not have got to it yet
+        if (m_openStall < 0) {
+            Stall stall;
+            stall.when = QDateTime::currentDateTime().addMSecs(-busyNsecs / 1000000);
+            m_openStall = record(stall);
+        }
+        
+        Stall& stall = m_ring[m_openStall];
+        stall.stallMsecs = busyNsecs / 1000000;
+        stall.finished = true;
+        if (m_longestScope) {
+            stall.scope = QString::fromLatin1(m_longestScope);
+            stall.scopeMsecs = m_longestScopeNsecs / 1000000;
+            stall.payloadSize = m_longestScopePayload;
+        }
+        qCDebug(lcPerf).noquote() << "GUI stall of" << stall.stallMsecs << "ms in"
+                                  << (stall.scope.isEmpty() ? QStringLiteral("unknown code") : stall.scope);
+    }
+    
+    m_busySince = -1;
+    m_openStall = -1;
+    m_longestScope = nullptr;
+    m_longestScopeNsecs = 0;
+    m_longestScopePayload = -1;
+}
+
+void StallWatchdog::scopeFinished(const char* name, qint64 nsecs, qint64 payloadSize)
+{
+    // Only the GUI thread reads these, under no lock
+    if (nsecs > m_longestScopeNsecs) {
+        m_longestScope = name;
+        m_longestScopeNsecs = nsecs;
+        m_longestScopePayload = payloadSize;
+    }
+}
+
+void StallWatchdog::watchLoop()
+{
+    QMutexLocker locker(&m_mutex);
+    while (!m_stopping) {
+        if (m_busySince < 0) {
+            m_watcherWaiting = true;
+            m_wakeup.wait(&m_mutex);
+            m_watcherWaiting = false;
+            continue;
+        }
+        
+        const quint64 period = m_period;
+        const qint64 remaining = m_busySince + m_thresholdNsecs - m_clock.nsecsElapsed();
+        if (remaining > 0) {
+            // Nobody wakes us when the period ends; the next check sees it
+            m_wakeup.wait(&m_mutex, QDeadlineTimer(remaining / 1000000 + 1));
+            continue;
+        }
+        
+        // Still the same busy period: a stall, note what is running now
+        const qint64 busyNsecs = m_clock.nsecsElapsed() - m_busySince;
+        Stall stall;
+        stall.when = QDateTime::currentDateTime().addMSecs(-busyNsecs / 1000000);
+        stall.stallMsecs = busyNsecs / 1000000;
+        stall.activeScopes = activeScopes();
+        m_openStall = record(stall);
+        
+        // Sleep until the period is over; endBusy finishes the record
+        m_watcherWaiting = true;
+        while (!m_stopping && m_period == period && m_busySince >= 0) {
+            m_wakeup.wait(&m_mutex);
+        }
+        m_watcherWaiting = false;
+    }
+}
+
+QString StallWatchdog::activeScopes() const
+{
+    // Racy by design: the GUI thread may leave a scope meanwhile, which at
+    // worst names a scope that just finished
+    const int depth = qMin(m_depth.load(std::memory_order_acquire), int(kMaxDepth));
+    const qint64 now = m_clock.nsecsElapsed();
+    QStringList names;
+    for (int i = 0; i < depth; ++i) {
+        const ScopeSlot& slot = m_scopes[i];
+        const char* name = slot.name.load(std::memory_order_relaxed);
+        const qint64 payloadSize = slot.payloadSize.load(std::memory_order_relaxed);
+        QString entry = QString("%1 (%2 ms").arg(QString::fromLatin1(name ? name : "?"))
+                                            .arg((now - slot.startNsecs.load(std::memory_order_relaxed)) / 1000000);
+        if (payloadSize >= 0) {
+            entry += QString(", size %1").arg(payloadSize);
+        }
+        names.append(entry + ')');
+    }
+    return names.join(QStringLiteral(" > "));
+}
+
+int StallWatchdog::record(const Stall& stall)
+{
+    const int index = m_ringNext;
+    m_ring[index] = stall;
+    m_ringNext = (m_ringNext + 1) % kCapacity;
+    ++m_stallCount;
+    return index;
+}
+
+QList<StallWatchdog::Stall> StallWatchdog::stalls() const
+{
+    QMutexLocker locker(&m_mutex);
+    QList<Stall> stalls;
+    const int count = static_cast<int>(qMin<qint64>(m_stallCount, kCapacity));
+    for (int i = 0; i < count; ++i) {
+        stalls.append(m_ring[(m_ringNext - count + i + kCapacity) % kCapacity]);
+    }
+    return stalls;
+}
+
+qint64 StallWatchdog::stallCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_stallCount;
+}
+
+QString StallWatchdog::report() const
+{
+    const QList<Stall> recent = stalls();
+    QString text = QString("%1 GUI stalls of %2 ms or more; the last %3:\n")
+                       .arg(stallCount()).arg(thresholdMsecs()).arg(recent.size());
+    for (auto it = recent.crbegin(); it != recent.crend(); ++it) {
+        text += QString("%1  %2 ms%3").arg(it->when.toString(Qt::ISODateWithMs))
+                                      .arg(it->stallMsecs)
+                                      .arg(it->finished ? QString() : QStringLiteral(" so far"));
+        if (!it->scope.isEmpty()) {
+            text += QString("  %1 %2 ms").arg(it->scope).arg(it->scopeMsecs);
+            if (it->payloadSize >= 0) {
+                text += QString(", size %1").arg(it->payloadSize);
+            }
+        }
+        if (!it->activeScopes.isEmpty()) {
+            text += QString("  [active: %1]").arg(it->activeScopes);
+        }
+        text += '\n';
+    }
+    return text;
+}
+
+bool StallWatchdog::dump(const QString& path) const
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        return false;
+    }
+    return file.write(report().toUtf8()) >= 0;
+}
@@ -0,0 +1,120 @@
+#ifndef STALLWATCHDOG_H
+#define STALLWATCHDOG_H
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QWaitCondition>
+#include <array>
+#include <atomic>
+#include <vector>
+
+class QThread;
+
+// Detects stalls of the GUI thread: stretches of at least the threshold
+// during which its event loop never went back to waiting. The loop reports
+// when it starts working and when it is about to block; a watchdog thread
+// sleeps while the loop waits and otherwise wakes once the threshold has
+// passed, so an idle process costs it nothing.
+//
+// Hot paths mark themselves with a Scope. A stall is attributed to the
+// longest scope that completed during it, or, for a stall still running, to
+// the scopes the watchdog saw active when it fired. The last kCapacity
+// stalls are kept in a ring buffer.
+class StallWatchdog : public QObject
+{
+    Q_OBJECT
+    
+public:
+    static const int kCapacity = 256;
+    static const int kMaxDepth = 8;
+    
+    struct Stall
+    {
+        QDateTime when;             // Start of the stall
+        qint64 stallMsecs = 0;      // So far, while unfinished
+        QString scope;              // Empty if no instrumented scope ran
+        qint64 scopeMsecs = 0;
+        qint64 payloadSize = -1;    // Bytes captured or copied, items listed or searched; -1 if unknown
+        QString activeScopes;       // "outer > inner" when the watchdog fired
+        bool finished = false;
+    };
+    
+    // Marks a hot path for attribution; name must outlive the process, e.g.
+    // a string literal. Nearly free while no watchdog runs.
+    class Scope
+    {
+    public:
+        explicit Scope(const char* name, qint64 payloadSize = -1);
+        ~Scope();
+        void setPayloadSize(qint64 size);
+        
+    private:
+        StallWatchdog* m_watchdog;
+        int m_depth;
+        qint64 m_startNsecs;
+        
+        Q_DISABLE_COPY(Scope)
+    };
+    
+    static StallWatchdog* start(int thresholdMsecs);
+    static StallWatchdog* instance() { return s_instance; }   // Null unless started
+    ~StallWatchdog() override;
+    
+    int thresholdMsecs() const { return static_cast<int>(m_thresholdNsecs / 1000000); }
+    QList<Stall> stalls() const;    // Oldest first
+    qint64 stallCount() const;      // Including stalls dropped from the buffer
+    QString report() const;
+    bool dump(const QString& path) const;
+    
+protected:
+    bool eventFilter(QObject* watched, QEvent* event) override;
+    
+private:
+    struct ScopeSlot
+    {
+        std::atomic<const char*> name{nullptr};
+        std::atomic<qint64> startNsecs{0};
+        std::atomic<qint64> payloadSize{-1};
+    };
+    
+    static StallWatchdog* s_instance;
+    const qint64 m_thresholdNsecs;
+    QElapsedTimer m_clock;
+    QThread* m_thread;
+    
+    // Written by the GUI thread, read by the watchdog without locking
+    std::array<ScopeSlot, kMaxDepth> m_scopes;
+    std::atomic<int> m_depth;
+    
+    // Shared, under m_mutex
+    mutable QMutex m_mutex;
+    QWaitCondition m_wakeup;
+    qint64 m_busySince;         // -1 while the loop waits
+    quint64 m_period;           // Counts busy periods
+    bool m_watcherWaiting;      // Sleeping until the loop gets busy
+    bool m_stopping;
+    std::vector<Stall> m_ring;
+    int m_ringNext;
+    qint64 m_stallCount;
+    int m_openStall;            // Ring index of the unfinished stall of this period, -1 if none
+    
+    // GUI thread only
+    bool m_busy;
+    const char* m_longestScope;
+    qint64 m_longestScopeNsecs;
+    qint64 m_longestScopePayload;
+    
+    explicit StallWatchdog(int thresholdMsecs, QObject* parent);
+    void beginBusy();
+    void endBusy();
+    void scopeFinished(const char* name, qint64 nsecs, qint64 payloadSize);
+    void watchLoop();
+    QString activeScopes() const;
+    int record(const Stall& stall);
+};
+
+#endif // STALLWATCHDOG_H
@@ -0,0 +1,383 @@
+#include "SyntaxHighlighter.h"
+#include <QSet>
+#include <array>
+#include <cstring>
+
+namespace {
+// Detection only looks at the start of the text
+const int kDetectionSample = 4096;
+
+// Below this score a text is highlighted as PlainLanguage
+const int kMinDetectionScore = 3;
+
+// Keywords are ASCII and short; longer words are never keywords
+const int kMaxKeywordLength = 16;
+
+struct LanguageSpec
+{
+    const char* name;
+    const char* keywords;           // Space-separated; lowercase if caseInsensitive
+    const char* lineComment;        // nullptr if none
+    const char* blockStart;
+    const char* blockEnd;
+    const char* quotes;             // Characters that start a string
+    const char* multilineQuotes;    // Of those, the ones whose strings may span lines
+    char directive;                 // '#' starts a preprocessor line; '@' and '$' prefix a name
+    bool tripleQuotes;
+    bool caseInsensitive;
+};
+
+const LanguageSpec kLanguages[SyntaxHighlighter::LanguageCount] = {
+    {"Text", "", nullptr, nullptr, nullptr, "\"'", "", 0, false, false},
+    {"C++",
+     "alignas auto bool break case catch char class const constexpr continue default delete do double else "
+     "enum explicit extern false final float for friend goto if inline int long mutable namespace new noexcept "
+     "nullptr operator override private protected public return short signed sizeof static struct switch "
+     "template this throw true try typedef typename union unsigned using virtual void volatile while",
+     "//", "/*", "*/", "\"'", "", '#', false, false},
+    {"Python",
+     "False None True and as assert async await break class continue def del elif else except finally for "
+     "from global if import in is lambda nonlocal not or pass raise return self try while with yield",
+     "#", nullptr, nullptr, "\"'", "", '@', true, false},
+    {"JavaScript",
+     "async await break case catch class const continue debugger default delete do else enum export extends "
+     "false finally for function if implements import in instanceof interface let new null of return static "
+     "super switch this throw true try type typeof undefined var void while with yield",
+     "//", "/*", "*/", "\"'`", "`", 0, false, false},
+    {"Rust",
+     "as async await break const continue crate dyn else enum extern false fn for if impl in let loop match "
+     "mod move mut pub ref return self Self static struct super trait true type unsafe use where while",
+     "//", "/*", "*/", "\"", "\"", 0, false, false},
+    {"Go",
+     "break case chan const continue default defer else fallthrough false for func go goto if import interface "
+     "map nil package range return select struct switch true type var",
+     "//", "/*", "*/", "\"'`", "`", 0, false, false},
+    {"Shell",
+     "case do done echo elif else esac exit export fi for function if in local read return set shift then "
+     "unset until while",
+     "#", nullptr, nullptr, "\"'", "\"'", '$', false, false},
+    {"SQL",
+     "add all alter and as asc between by case create delete desc distinct drop else end exists from full "
+     "group having in index inner insert into is join key left like limit not null offset on or order outer "
+     "primary references right select set table then union unique update values view when where with",
+     "--", "/*", "*/", "'", "'", 0, false, true},
+    {"JSON", "false null true", nullptr, nullptr, nullptr, "\"", "", 0, false, false},
+};
+
+struct Indicator
+{
+    SyntaxHighlighter::Language language;
+    const char* pattern;
+    int weight;
+};
+
+// Telltale fragments; a language's score is the weight of those present
+const Indicator kIndicators[] = {
+    {SyntaxHighlighter::Cpp, "#include", 5}, {SyntaxHighlighter::Cpp, "std::", 4},
+    {SyntaxHighlighter::Cpp, "#define", 4}, {SyntaxHighlighter::Cpp, "nullptr", 3},
+    {SyntaxHighlighter::Cpp, "template <", 3}, {SyntaxHighlighter::Cpp, "template<", 3},
+    {SyntaxHighlighter::Cpp, "int main(", 3}, {SyntaxHighlighter::Cpp, "->", 1},
+    {SyntaxHighlighter::Cpp, "::", 1}, {SyntaxHighlighter::Cpp, "printf(", 2},
+    {SyntaxHighlighter::Python, "def ", 3}, {SyntaxHighlighter::Python, "elif ", 4},
+    {SyntaxHighlighter::Python, "self.", 3}, {SyntaxHighlighter::Python, "__init__", 4},
+    {SyntaxHighlighter::Python, "):\n", 3}, {SyntaxHighlighter::Python, "None", 2},
+    {SyntaxHighlighter::Python, "lambda ", 2}, {SyntaxHighlighter::Python, "print(", 1},
+    {SyntaxHighlighter::JavaScript, "function ", 3}, {SyntaxHighlighter::JavaScript, "=>", 2},
+    {SyntaxHighlighter::JavaScript, "const ", 2}, {SyntaxHighlighter::JavaScript, "let ", 2},
+    {SyntaxHighlighter::JavaScript, "console.", 5}, {SyntaxHighlighter::JavaScript, "===", 4},
+    {SyntaxHighlighter::JavaScript, "require(", 3}, {SyntaxHighlighter::JavaScript, "undefined", 3},
+    {SyntaxHighlighter::JavaScript, "document.", 4},
+    {SyntaxHighlighter::Rust, "fn ", 3}, {SyntaxHighlighter::Rust, "let mut ", 5},
+    {SyntaxHighlighter::Rust, "impl ", 4}, {SyntaxHighlighter::Rust, "pub fn", 5},
+    {SyntaxHighlighter::Rust, "&mut ", 4}, {SyntaxHighlighter::Rust, "println!", 5},
+    {SyntaxHighlighter::Rust, "use std::", 5},
+    {SyntaxHighlighter::Go, "func ", 4}, {SyntaxHighlighter::Go, "package ", 4},
+    {SyntaxHighlighter::Go, ":= ", 3}, {SyntaxHighlighter::Go, "fmt.", 5},
+    {SyntaxHighlighter::Go, "err != nil", 5}, {SyntaxHighlighter::Go, "defer ", 4},
+    {SyntaxHighlighter::Shell, "#!/bin/", 8}, {SyntaxHighlighter::Shell, "#!/usr/bin/env bash", 8},
+    {SyntaxHighlighter::Shell, "echo ", 3}, {SyntaxHighlighter::Shell, "\nfi", 4},
+    {SyntaxHighlighter::Shell, "; then", 4}, {SyntaxHighlighter::Shell, "$(", 2},
+    {SyntaxHighlighter::Shell, "sudo ", 3}, {SyntaxHighlighter::Shell, "| grep", 3},
+    {SyntaxHighlighter::Sql, "select ", 3}, {SyntaxHighlighter::Sql, " from ", 3},
+    {SyntaxHighlighter::Sql, "where ", 2}, {SyntaxHighlighter::Sql, "insert into", 5},
+    {SyntaxHighlighter::Sql, "create table", 5}, {SyntaxHighlighter::Sql, "group by", 4},
+    {SyntaxHighlighter::Sql, "order by", 4}, {SyntaxHighlighter::Sql, " join ", 2},
+};
+
+// Built once, on first use from whichever thread
+const std::array<QSet<QLatin1String>, SyntaxHighlighter::LanguageCount>& keywordSets()
+{
+    static const std::array<QSet<QLatin1String>, SyntaxHighlighter::LanguageCount> sets = []() {
+        std::array<QSet<QLatin1String>, SyntaxHighlighter::LanguageCount> result;
+        for (int language = 0; language < SyntaxHighlighter::LanguageCount; ++language) {
+            const char* word = kLanguages[language].keywords;
+            while (*word) {
+                const char* end = std::strchr(word, ' ');
+                const int length = end ? int(end - word) : int(std::strlen(word));
+                result[language].insert(QLatin1String(word, length));
+                word += length + (end ? 1 : 0);
+            }
+        }
+        return result;
+    }();
+    return sets;
+}
+
+bool isIdentifierStart(QChar c)
+{
+    return c == u'_' || (c.unicode() < 128 ? QChar::isLetter(c.unicode()) : c.isLetter());
+}
+
+bool isIdentifierPart(QChar c)
+{
+    return isIdentifierStart(c) || (c >= u'0' && c <= u'9');
+}
+
+bool startsWithAt(QStringView text, qsizetype position, const char* token)
+{
+    for (; *token; ++token, ++position) {
+        if (position >= text.size() || text[position] != QLatin1Char(*token)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void addSpan(std::vector<SyntaxHighlighter::Span>* spans, qsizetype start, qsizetype end,
+             SyntaxHighlighter::TokenKind kind)
+{
+    while (start < end) {
+        const qsizetype length = qMin<qsizetype>(end - start, 0xffff);
+        spans->push_back({static_cast<quint32>(start), static_cast<quint16>(length), kind});
+        start += length;
+    }
+}
+}
+
+SyntaxHighlighter::Language SyntaxHighlighter::detectLanguage(QStringView text)
+{
+    const QStringView sample = text.left(kDetectionSample);
+    
+    // JSON is unmistakable by its shape
+    const QStringView trimmed = sample.trimmed();
+    if ((trimmed.startsWith(u'{') || trimmed.startsWith(u'[')) && sample.contains(u"\":")) {
+        return Json;
+    }
+    
+    std::array<int, LanguageCount> scores{};
+    for (const Indicator& indicator : kIndicators) {
+        const Qt::CaseSensitivity sensitivity = kLanguages[indicator.language].caseInsensitive
+                                              ? Qt::CaseInsensitive : Qt::CaseSensitive;
+        if (sample.contains(QLatin1String(indicator.pattern), sensitivity)) {
+            scores[indicator.language] += indicator.weight;
+        }
+    }
+    
+    Language best = PlainLanguage;
+    for (int language = 0; language < LanguageCount; ++language) {
+        if (scores[language] > scores[best]) {
+            best = static_cast<Language>(language);
+        }
+    }
+    return scores[best] >= kMinDetectionScore ? best : PlainLanguage;
+}
+
+QString SyntaxHighlighter::languageName(Language language)
+{
+    return QString::fromLatin1(kLanguages[language < LanguageCount ? language : PlainLanguage].name);
+}
+
+std::vector<SyntaxHighlighter::Span> SyntaxHighlighter::tokenize(QStringView text, Language language)
+{
+    const LanguageSpec& spec = kLanguages[language < LanguageCount ? language : PlainLanguage];
+    const QSet<QLatin1String>& keywords = keywordSets()[language < LanguageCount ? language : PlainLanguage];
+    const qsizetype length = qMin<qsizetype>(text.size(), kMaxHighlightLength);
+    std::vector<Span> spans;
+    
+    qsizetype i = 0;
+    bool lineStart = true;
+    while (i < length) {
+        const QChar c = text[i];
+        if (c == u'\n') {
+            lineStart = true;
+            ++i;
+            continue;
+        }
+        if (c.isSpace()) {
+            ++i;
+            continue;
+        }
+        const bool atLineStart = lineStart;
+        lineStart = false;
+        
+        if (spec.lineComment && startsWithAt(text, i, spec.lineComment) &&
+            (spec.directive != '$' || i == 0 || text[i - 1].isSpace())) {
+            qsizetype end = text.indexOf(u'\n', i);
+            end = end < 0 || end > length ? length : end;
+            addSpan(&spans, i, end, Comment);
+            i = end;
+        } else if (spec.blockStart && startsWithAt(text, i, spec.blockStart)) {
+            const qsizetype close = text.left(length).indexOf(QLatin1String(spec.blockEnd), i + 2);
+            const qsizetype end = close < 0 ? length : close + qsizetype(std::strlen(spec.blockEnd));
+            addSpan(&spans, i, end, Comment);
+            i = end;
+        } else if (spec.directive && c == QLatin1Char(spec.directive) && (spec.directive != '#' || atLineStart)) {
+            qsizetype end = i + 1;
+            if (spec.directive == '#') {
+                // The rest of the line, as a preprocessor sees it
+                end = text.indexOf(u'\n', i);
+                end = end < 0 || end > length ? length : end;
+            } else if (spec.directive == '$' && end < length && text[end] == u'{') {
+                const qsizetype close = text.left(length).indexOf(u'}', end);
+                end = close < 0 ? length : close + 1;
+            } else {
+                while (end < length && (isIdentifierPart(text[end]) || text[end] == u'.')) {
+                    ++end;
+                }
+            }
+            addSpan(&spans, i, end, Directive);
+            i = end;
+        } else if (c.unicode() > 0 && c.unicode() < 128 && std::strchr(spec.quotes, c.toLatin1())) {
+            const bool triple = spec.tripleQuotes && i + 2 < length && text[i + 1] == c && text[i + 2] == c;
+            const bool multiline = triple || std::strchr(spec.multilineQuotes, c.toLatin1());
+            qsizetype end = i + (triple ? 3 : 1);
+            while (end < length) {
+                const QChar d = text[end];
+                if (d == u'\\' && !spec.caseInsensitive) {
+                    end += 2;
+                    continue;
+                }
+                if (d == c && (!triple || (end + 2 < length && text[end + 1] == c && text[end + 2] == c))) {
+                    end += triple ? 3 : 1;
+                    break;
+                }
+                if (d == u'\n' && !multiline) {
+                    break;
+                }
+                ++end;
+            }
+            end = qMin(end, length);
+            addSpan(&spans, i, end, String);
+            i = end;
+        } else if ((c >= u'0' && c <= u'9') || (c == u'.' && i + 1 < length && text[i + 1].isDigit())) {
+            qsizetype end = i + 1;
+            while (end < length && (isIdentifierPart(text[end]) || text[end] == u'.')) {
+                ++end;
+            }
+            addSpan(&spans, i, end, Number);
+            i = end;
+        } else if (isIdentifierStart(c)) {
+            qsizetype end = i + 1;
+            while (end < length && isIdentifierPart(text[end])) {
+                ++end;
+            }
+            
+            // Keywords are matched as Latin-1, lowercased for SQL
+            bool keyword = false;
+            if (end - i <= kMaxKeywordLength) {
+                char word[kMaxKeywordLength];
+                bool ascii = true;
+                for (qsizetype k = i; k < end; ++k) {
+                    const char16_t unit = text[k].unicode();
+                    ascii = ascii && unit < 128;
+                    word[k - i] = static_cast<char>(spec.caseInsensitive && unit >= u'A' && unit <= u'Z' ? unit | 0x20 : unit);
+                }
+                keyword = ascii && keywords.contains(QLatin1String(word, int(end - i)));
+            }
+            
+            qsizetype next = end;
+            while (next < length && (text[next] == u' ' || text[next] == u'\t')) {
+                ++next;
+            }
+            if (keyword) {
+                addSpan(&spans, i, end, Keyword);
+            } else if (next < length && text[next] == u'(' && language != PlainLanguage) {
+                addSpan(&spans, i, end, Function);
+            }
+            i = end;
+        } else {
+            ++i;
+        }
+    }
+    return spans;
+}
+
+std::vector<SyntaxHighlighter::Span> SyntaxHighlighter::mapToPreview(QStringView text, const std::vector<Span>& spans,
+                                                                     QStringView preview)
+{
+    // Walks both strings together: runs of whitespace in text are one space
+    // or nothing in preview. The first mismatch, e.g. the "..." of a
+    // truncated preview, ends the mapping.
+    std::vector<Span> previewSpans;
+    size_t next = 0;
+    qsizetype i = 0;
+    qsizetype runStart = -1;
+    TokenKind runKind = Keyword;
+    const auto closeRun = [&](qsizetype end) {
+        if (runStart >= 0) {
+            addSpan(&previewSpans, runStart, end, runKind);
+            runStart = -1;
+        }
+    };
+    
+    qsizetype j = 0;
+    for (; j < preview.size(); ++j) {
+        const QChar p = preview[j];
+        if (p == u' ') {
+            if (i < text.size() && !text[i].isSpace()) {
+                break;
+            }
+            while (i < text.size() && text[i].isSpace()) {
+                ++i;
+            }
+        } else {
+            while (i < text.size() && text[i].isSpace()) {
+                ++i;
+            }
+            if (i >= text.size() || text[i] != p) {
+                break;
+            }
+            ++i;
+        }
+        
+        // The kind of the text character this preview character came from;
+        // a space takes the kind of what precedes it only inside a token
+        const qsizetype source = i - 1;
+        while (next < spans.size() && spans[next].start + spans[next].length <= source) {
+            ++next;
+        }
+        const bool inSpan = next < spans.size() && spans[next].start <= source;
+        if (inSpan && runStart >= 0 && runKind == spans[next].kind) {
+            continue;
+        }
+        closeRun(j);
+        if (inSpan) {
+            runStart = j;
+            runKind = spans[next].kind;
+        }
+    }
+    closeRun(j);
+    return previewSpans;
+}
+
+SyntaxHighlighter::Highlight SyntaxHighlighter::highlight(QStringView text, QStringView preview)
+{
+    Highlight result;
+    result.language = detectLanguage(text);
+    result.spans = tokenize(text, result.language);
+    result.previewSpans = mapToPreview(text, result.spans, preview);
+    return result;
+}
+
+QColor SyntaxHighlighter::color(TokenKind kind)
+{
+    switch (kind) {
+        case Keyword: return QColor(155, 35, 147);
+        case String: return QColor(196, 26, 22);
+        case Comment: return QColor(93, 108, 121);
+        case Number: return QColor(28, 0, 207);
+        case Function: return QColor(50, 109, 116);
+        case Directive: return QColor(100, 56, 32);
+    }
+    return QColor();
+}
@@ -0,0 +1,69 @@
+#ifndef SYNTAXHIGHLIGHTER_H
+#define SYNTAXHIGHLIGHTER_H
+
+#include <QColor>
+#include <QString>
+#include <QStringView>
+#include <vector>
+
+// Language detection and token-level highlighting of code items. Results
+// are compact span runs, 8 bytes per token with plain text between tokens
+// not stored, rather than rich text. Everything here is a pure function of
+// the text, meant to run on worker threads; views only paint the spans.
+class SyntaxHighlighter
+{
+public:
+    enum Language : quint8 {
+        PlainLanguage,      // Strings and numbers only
+        Cpp,
+        Python,
+        JavaScript,
+        Rust,
+        Go,
+        Shell,
+        Sql,
+        Json,
+        LanguageCount
+    };
+    
+    enum TokenKind : quint8 {
+        Keyword,
+        String,
+        Comment,
+        Number,
+        Function,           // An identifier followed by '('
+        Directive           // Preprocessor lines, decorators, shell variables
+    };
+    
+    struct Span
+    {
+        quint32 start;
+        quint16 length;     // Longer tokens are split
+        TokenKind kind;
+    };
+    
+    struct Highlight
+    {
+        Language language = PlainLanguage;
+        std::vector<Span> spans;            // Over the item's text, in order
+        std::vector<Span> previewSpans;     // Over its preview
+        
+        qint64 sizeInBytes() const { return qint64(spans.size() + previewSpans.size()) * sizeof(Span); }
+    };
+    
+    // Text past this many characters is left plain
+    static const int kMaxHighlightLength = 1024 * 1024;
+    
+    static Language detectLanguage(QStringView text);
+    static QString languageName(Language language);
+    static std::vector<Span> tokenize(QStringView text, Language language);
+    
+    // Carries spans over to preview, a whitespace-simplified and possibly
+    // truncated copy of text
+    static std::vector<Span> mapToPreview(QStringView text, const std::vector<Span>& spans, QStringView preview);
+    
+    static Highlight highlight(QStringView text, QStringView preview);
+    static QColor color(TokenKind kind);
+};
+
+#endif // SYNTAXHIGHLIGHTER_H
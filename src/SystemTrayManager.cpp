@@ -1,44 +1,93 @@
 #include "SystemTrayManager.h"
 #include "MainWindow.h"
+#include "Diagnostics.h"
 #include <QApplication>
 #include <QMessageBox>
 #include <QScreen>
 #include <QRect>
 #include <QStyle>
+#include <QEvent>
 
-SystemTrayManager::SystemTrayManager(MainWindow* mainWindow, QObject* parent)
+namespace {
+const int kDefaultMainWindowReleaseDelay = 5 * 60 * 1000;
+}
+
+SystemTrayManager::SystemTrayManager(ClipboardManager* clipboardManager, QObject* parent)
     : QObject(parent)
-    , m_mainWindow(mainWindow)
     , m_trayIcon(nullptr)
     , m_trayMenu(nullptr)
-    , m_clipboardManager(new ClipboardManager(this))
+    , m_clipboardManager(clipboardManager)
     , m_trayPopup(nullptr)
+    , m_mainWindowReleaseTimer(new QTimer(this))
+    , m_mainWindowReleaseDelay(kDefaultMainWindowReleaseDelay)
 {
     createTrayIcon();
     createContextMenu();
     
-    // Create tray popup
-    m_trayPopup = new TrayPopupWidget(m_clipboardManager);
-    
     // Connect clipboard manager signals
     connect(m_clipboardManager, &ClipboardManager::historyChanged,
             this, &SystemTrayManager::onHistoryChanged);
     
-    // Connect popup signals
-    connect(m_trayPopup, &TrayPopupWidget::openMainWindow,
-            this, &SystemTrayManager::showMainWindow);
-    
-    // Pass clipboard manager to main window
-    m_mainWindow->setClipboardManager(m_clipboardManager);
+    // The main window is only created when first requested and released again
+    // after staying hidden for a while
+    m_mainWindowReleaseTimer->setSingleShot(true);
+    connect(m_mainWindowReleaseTimer, &QTimer::timeout, this, &SystemTrayManager::releaseMainWindow);
     
     updateTrayIcon();
 }
 
+SystemTrayManager::~SystemTrayManager()
+{
+    delete m_mainWindow;
+    delete m_trayPopup;
+    delete m_trayMenu;
+}
+
 void SystemTrayManager::show()
 {
     if (m_trayIcon) {
         m_trayIcon->show();
     }
+    
+    // Once the icon is up, build the popup in the background so the first
+    // click finds it ready
+    QTimer::singleShot(0, this, [this]() {
+        trayPopup();
+        emit trayReady();
+    });
+}
+
+void SystemTrayManager::setMainWindowReleaseDelay(int msecs)
+{
+    m_mainWindowReleaseDelay = qMax(0, msecs);
+    if (m_mainWindowReleaseDelay == 0) {
+        m_mainWindowReleaseTimer->stop();
+    }
+}
+
+bool SystemTrayManager::eventFilter(QObject* watched, QEvent* event)
+{
+    if (watched == m_mainWindow) {
+        if (event->type() == QEvent::Hide && m_mainWindowReleaseDelay > 0) {
+            m_mainWindowReleaseTimer->start(m_mainWindowReleaseDelay);
+        } else if (event->type() == QEvent::Show) {
+            m_mainWindowReleaseTimer->stop();
+        }
+    }
+    
+    return QObject::eventFilter(watched, event);
+}
+
+TrayPopupWidget* SystemTrayManager::trayPopup()
+{
+    if (!m_trayPopup) {
+        m_trayPopup = new TrayPopupWidget(m_clipboardManager);
+        m_trayPopup->setRanking(m_frecencyAction->isChecked() ? ClipboardManager::FrecencyRanking
+                                                              : ClipboardManager::RecencyRanking);
+        connect(m_trayPopup, &TrayPopupWidget::openMainWindow,
+                this, &SystemTrayManager::showMainWindow);
+    }
+    return m_trayPopup;
 }
 
 void SystemTrayManager::hide()
@@ -68,6 +117,10 @@ void SystemTrayManager::createContextMenu()
     m_showAction = m_trayMenu->addAction("Show Clipboard Manager");
     connect(m_showAction, &QAction::triggered, this, &SystemTrayManager::showMainWindow);
     
+    m_frecencyAction = m_trayMenu->addAction("Sort Popup by Frequency");
+    m_frecencyAction->setCheckable(true);
+    connect(m_frecencyAction, &QAction::toggled, this, &SystemTrayManager::setFrecencyRanking);
+    
     m_trayMenu->addSeparator();
     
     m_aboutAction = m_trayMenu->addAction("About");
@@ -96,16 +149,29 @@ void SystemTrayManager::onTrayIconActivated(QSystemTrayIcon::ActivationReason re
 
 void SystemTrayManager::toggleTrayPopup()
 {
-    if (m_trayPopup->isVisible()) {
-        m_trayPopup->hide();
+    TrayPopupWidget* popup = trayPopup();
+    
+    if (popup->isVisible()) {
+        popup->hide();
     } else {
+        popup->markShowRequested();
         positionTrayPopup();
-        m_trayPopup->show();
-        m_trayPopup->raise();
-        m_trayPopup->activateWindow();
+        popup->show();
+        popup->raise();
+        popup->activateWindow();
     }
 }
 
+void SystemTrayManager::setFrecencyRanking(bool enabled)
+{
+    if (!m_trayPopup) {
+        return; // Picked up from the action when the popup is created
+    }
+    
+    m_trayPopup->setRanking(enabled ? ClipboardManager::FrecencyRanking
+                                    : ClipboardManager::RecencyRanking);
+}
+
 void SystemTrayManager::positionTrayPopup()
 {
     if (!m_trayIcon || !m_trayPopup) {
@@ -136,11 +202,19 @@ void SystemTrayManager::positionTrayPopup()
     y = screenGeometry.top() + 25; // Account for menu bar height
 #endif
     
-    m_trayPopup->setGeometry(x, y, popupWidth, popupHeight);
+    // The popup window extends past the panel to leave room for its shadow
+    const int margin = TrayPopupWidget::shadowMargin();
+    m_trayPopup->setGeometry(x - margin, y - margin, popupWidth + 2 * margin, popupHeight + 2 * margin);
 }
 
 void SystemTrayManager::showMainWindow()
 {
+    if (!m_mainWindow) {
+        m_mainWindow = new MainWindow();
+        m_mainWindow->setClipboardManager(m_clipboardManager);
+        m_mainWindow->installEventFilter(this);
+    }
+    
     m_mainWindow->show();
     m_mainWindow->raise();
     m_mainWindow->activateWindow();
@@ -151,6 +225,15 @@ void SystemTrayManager::showMainWindow()
     }
 }
 
+void SystemTrayManager::releaseMainWindow()
+{
+    if (m_mainWindow && !m_mainWindow->isVisible()) {
+        m_mainWindow->deleteLater();
+        m_mainWindow = nullptr;
+        qCDebug(lcPerf) << "Released hidden main window";
+    }
+}
+
 void SystemTrayManager::showAbout()
 {
     QMessageBox::about(nullptr, "About Clipboard Manager",
@@ -172,11 +255,6 @@ void SystemTrayManager::quitApplication()
 void SystemTrayManager::onHistoryChanged()
 {
     updateTrayIcon();
-    
-    // Update tray popup if visible
-    if (m_trayPopup && m_trayPopup->isVisible()) {
-        m_trayPopup->refreshHistory();
-    }
 }
 
 void SystemTrayManager::updateTrayIcon()
@@ -5,6 +5,8 @@
 #include <QSystemTrayIcon>
 #include <QMenu>
 #include <QAction>
+#include <QPointer>
+#include <QTimer>
 #include "ClipboardManager.h"
 #include "TrayPopupWidget.h"
 
@@ -15,11 +17,23 @@ class SystemTrayManager : public QObject
     Q_OBJECT
     
 public:
-    explicit SystemTrayManager(MainWindow* mainWindow, QObject* parent = nullptr);
+    explicit SystemTrayManager(ClipboardManager* clipboardManager, QObject* parent = nullptr);
+    ~SystemTrayManager();
     
     void show();
     void hide();
     
+    // How long the main window may stay hidden before it is destroyed to give
+    // its memory back; 0 keeps it alive once created
+    int mainWindowReleaseDelay() const { return m_mainWindowReleaseDelay; }
+    void setMainWindowReleaseDelay(int msecs);
+    
+signals:
+    void trayReady();
+    
+protected:
+    bool eventFilter(QObject* watched, QEvent* event) override;
+    
 private slots:
     void onTrayIconActivated(QSystemTrayIcon::ActivationReason reason);
     void showMainWindow();
@@ -27,18 +41,24 @@ private slots:
     void quitApplication();
     void onHistoryChanged();
     void toggleTrayPopup();
+    void setFrecencyRanking(bool enabled);
+    void releaseMainWindow();
     
 private:
     QSystemTrayIcon* m_trayIcon;
     QMenu* m_trayMenu;
     QAction* m_showAction;
+    QAction* m_frecencyAction;
     QAction* m_aboutAction;
     QAction* m_quitAction;
     
-    MainWindow* m_mainWindow;
+    QPointer<MainWindow> m_mainWindow;
     ClipboardManager* m_clipboardManager;
     TrayPopupWidget* m_trayPopup;
+    QTimer* m_mainWindowReleaseTimer;
+    int m_mainWindowReleaseDelay;
     
+    TrayPopupWidget* trayPopup();
     void createTrayIcon();
     void createContextMenu();
     void updateTrayIcon();
@@ -0,0 +1,159 @@
+#include "ThumbnailCache.h"
+#include "Diagnostics.h"
+#include "ImageHashIndex.h"
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QImageReader>
+#include <QImageWriter>
+
+namespace {
+// About a hundred full-size thumbnails
+const int kMaxCacheBytes = 2 * 1024 * 1024;
+
+// Decoding is bursty and idle most of the time; let the threads expire
+const int kMaxWorkerThreads = 2;
+
+// Visible rows waiting for a thumbnail go ahead of background encoding
+const int kThumbnailPriority = 1;
+const int kEncodePriority = 0;
+}
+
+ThumbnailCache::ThumbnailCache(QObject* parent)
+    : QObject(parent)
+    , m_cache(kMaxCacheBytes)
+{
+    m_pool.setMaxThreadCount(kMaxWorkerThreads);
+}
+
+ThumbnailCache::~ThumbnailCache()
+{
+    // Workers post their results back to this object
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+QPixmap ThumbnailCache::thumbnail(quint64 id, const QByteArray& imageData)
+{
+    if (const QPixmap* pixmap = m_cache.object(id)) {
+        return *pixmap;
+    }
+    if (imageData.isEmpty() || m_pending.contains(id) || m_failed.contains(id)) {
+        return QPixmap();
+    }
+    
+    // imageData is implicitly shared, so the worker gets it without a copy
+    m_pending.insert(id);
+    m_pool.start([this, id, imageData]() {
+        const QImage thumbnail = decodeThumbnail(imageData);
+        QMetaObject::invokeMethod(this, [this, id, thumbnail]() {
+            insert(id, thumbnail);
+        }, Qt::QueuedConnection);
+    }, kThumbnailPriority);
+    
+    return QPixmap();
+}
+
+void ThumbnailCache::encodeImage(quint64 id, const QImage& image)
+{
+    m_pending.insert(id);
+    m_pool.start([this, id, image]() {
+        QElapsedTimer timer;
+        timer.start();
+        
+        QByteArray imageData;
+        QBuffer buffer(&imageData);
+        buffer.open(QIODevice::WriteOnly);
+        QImageWriter writer(&buffer, "PNG");
+        writer.write(image);
+        
+        const QImage thumbnail = scaleToThumbnail(image);
+        const quint64 hash = ImageHashIndex::differenceHash(thumbnail);
+        qCDebug(lcPerf) << "Encoded" << image.size() << "image to" << imageData.size() / 1024
+                        << "KiB in" << timer.elapsed() << "ms";
+        
+        QMetaObject::invokeMethod(this, [this, id, imageData, thumbnail, hash]() {
+            insert(id, thumbnail);
+            emit imageEncoded(id, imageData);
+            if (!thumbnail.isNull()) {
+                emit imageHashed(id, hash);
+            }
+        }, Qt::QueuedConnection);
+    }, kEncodePriority);
+}
+
+void ThumbnailCache::analyzeImage(quint64 id, const QByteArray& imageData)
+{
+    m_pending.insert(id);
+    m_pool.start([this, id, imageData]() {
+        const QImage thumbnail = decodeThumbnail(imageData);
+        const quint64 hash = ImageHashIndex::differenceHash(thumbnail);
+        
+        QMetaObject::invokeMethod(this, [this, id, thumbnail, hash]() {
+            insert(id, thumbnail);
+            if (!thumbnail.isNull()) {
+                emit imageHashed(id, hash);
+            }
+        }, Qt::QueuedConnection);
+    }, kEncodePriority);
+}
+
+void ThumbnailCache::remove(quint64 id)
+{
+    m_cache.remove(id);
+    m_failed.remove(id);
+}
+
+void ThumbnailCache::clear()
+{
+    m_cache.clear();
+    m_failed.clear();
+}
+
+QImage ThumbnailCache::scaleToThumbnail(const QImage& image)
+{
+    if (image.isNull()) {
+        return QImage();
+    }
+    
+    // Smooth scaling of 32-bit premultiplied pixels takes Qt's vectorized
+    // path; other formats are converted first either way
+    QImage source = image.format() == QImage::Format_ARGB32_Premultiplied ||
+                    image.format() == QImage::Format_RGB32
+                  ? image
+                  : image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                                  : QImage::Format_RGB32);
+    if (source.width() <= kThumbnailExtent && source.height() <= kThumbnailExtent) {
+        return source;
+    }
+    return source.scaled(kThumbnailExtent, kThumbnailExtent, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+}
+
+QImage ThumbnailCache::decodeThumbnail(const QByteArray& imageData)
+{
+    QBuffer buffer;
+    buffer.setData(imageData);
+    buffer.open(QIODevice::ReadOnly);
+    
+    // Let the decoder scale while reading; JPEG then never expands full size
+    QImageReader reader(&buffer);
+    const QSize size = reader.size();
+    if (size.isValid() && (size.width() > kThumbnailExtent || size.height() > kThumbnailExtent)) {
+        reader.setScaledSize(size.scaled(kThumbnailExtent, kThumbnailExtent, Qt::KeepAspectRatio));
+    }
+    
+    return scaleToThumbnail(reader.read());
+}
+
+void ThumbnailCache::insert(quint64 id, const QImage& thumbnail)
+{
+    m_pending.remove(id);
+    if (thumbnail.isNull()) {
+        m_failed.insert(id);
+        return;
+    }
+    
+    // Pixmaps can only be created on the GUI thread
+    QPixmap* pixmap = new QPixmap(QPixmap::fromImage(thumbnail));
+    m_cache.insert(id, pixmap, static_cast<int>(thumbnail.sizeInBytes()));
+    emit thumbnailReady(id);
+}
@@ -0,0 +1,60 @@
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QCache>
+#include <QImage>
+#include <QPixmap>
+#include <QSet>
+#include <QThreadPool>
+
+// Image items are stored encoded; views only ever draw small thumbnails.
+// Decoding, downscaling and PNG encoding run on a private thread pool, and
+// the finished thumbnails are kept as pixmaps in an LRU bounded by pixel bytes.
+class ThumbnailCache : public QObject
+{
+    Q_OBJECT
+    
+public:
+    // Longest side of a thumbnail, enough for a 32px slot on a 2x display
+    static const int kThumbnailExtent = 64;
+    
+    explicit ThumbnailCache(QObject* parent = nullptr);
+    ~ThumbnailCache() override;
+    
+    // Returns the cached thumbnail, or a null pixmap after queueing a decode of
+    // imageData; thumbnailReady() follows once it is available
+    QPixmap thumbnail(quint64 id, const QByteArray& imageData);
+    
+    // Encodes an image the clipboard handed over decoded as PNG, and seeds its
+    // thumbnail from the pixels already in memory; imageEncoded() and
+    // imageHashed() follow
+    void encodeImage(quint64 id, const QImage& image);
+    
+    // Decodes the thumbnail of a newly captured, already encoded image and
+    // hashes it; imageHashed() follows
+    void analyzeImage(quint64 id, const QByteArray& imageData);
+    
+    void remove(quint64 id);
+    void clear();
+    
+    // Worker-side helpers, safe to call from any thread
+    static QImage scaleToThumbnail(const QImage& image);
+    static QImage decodeThumbnail(const QByteArray& imageData);
+    
+signals:
+    void thumbnailReady(quint64 id);
+    void imageEncoded(quint64 id, const QByteArray& imageData);
+    void imageHashed(quint64 id, quint64 hash);    // ImageHashIndex::differenceHash() of the thumbnail
+    
+private:
+    QThreadPool m_pool;
+    QCache<quint64, QPixmap> m_cache;   // Cost is pixel bytes
+    QSet<quint64> m_pending;
+    QSet<quint64> m_failed;
+    
+    void insert(quint64 id, const QImage& thumbnail);
+};
+
+#endif // THUMBNAILCACHE_H
@@ -0,0 +1,84 @@
+#include "TimestampIndex.h"
+#include <algorithm>
+
+TimestampIndex::TimestampIndex()
+    : m_sorted(true)
+{
+}
+
+void TimestampIndex::insert(qint64 msecs, quint64 id)
+{
+    const Entry entry{msecs, id};
+    if (m_sorted && !m_entries.empty() && entry < m_entries.back()) {
+        m_sorted = false;
+    }
+    m_entries.push_back(entry);
+}
+
+void TimestampIndex::remove(qint64 msecs, quint64 id)
+{
+    ensureSorted();
+    const Entry entry{msecs, id};
+    const auto it = std::lower_bound(m_entries.begin(), m_entries.end(), entry);
+    if (it != m_entries.end() && it->id == id && it->msecs == msecs) {
+        m_entries.erase(it);
+    }
+}
+
+void TimestampIndex::remove(const QSet<quint64>& ids)
+{
+    // Order is kept, sorted or not
+    m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(),
+                                   [&ids](const Entry& entry) { return ids.contains(entry.id); }),
+                    m_entries.end());
+}
+
+void TimestampIndex::clear()
+{
+    m_entries.clear();
+    m_sorted = true;
+}
+
+std::vector<quint64> TimestampIndex::range(qint64 from, qint64 to) const
+{
+    std::vector<quint64> ids;
+    if (from >= to) {
+        return ids;
+    }
+    
+    const auto begin = lowerBound(from);
+    const auto end = lowerBound(to);
+    ids.reserve(end - begin);
+    for (auto it = end; it != begin; --it) {
+        ids.push_back((it - 1)->id);
+    }
+    return ids;
+}
+
+int TimestampIndex::count(qint64 from, qint64 to) const
+{
+    return from < to ? static_cast<int>(lowerBound(to) - lowerBound(from)) : 0;
+}
+
+quint64 TimestampIndex::newestBefore(qint64 msecs) const
+{
+    const auto it = lowerBound(msecs);
+    return it == m_entries.cbegin() ? 0 : (it - 1)->id;
+}
+
+void TimestampIndex::ensureSorted() const
+{
+    if (!m_sorted) {
+        std::sort(m_entries.begin(), m_entries.end());
+        m_sorted = true;
+    }
+}
+
+std::vector<TimestampIndex::Entry>::const_iterator TimestampIndex::lowerBound(qint64 msecs) const
+{
+    ensureSorted();
+    return std::lower_bound(m_entries.cbegin(), m_entries.cend(), msecs,
+                            [](const Entry& entry, qint64 value) {
+                                return entry.msecs < value;
+                            });
+}
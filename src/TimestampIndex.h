@@ -0,0 +1,49 @@
+#ifndef TIMESTAMPINDEX_H
+#define TIMESTAMPINDEX_H
+
+#include <QSet>
+#include <QtGlobal>
+#include <vector>
+
+// Capture times of the history items as epoch milliseconds, sorted, so time
+// ranges are found by binary search instead of converting every item's
+// QDateTime. Items are nearly always inserted newest last; bulk loads in any
+// other order are sorted once, on the next lookup.
+class TimestampIndex
+{
+public:
+    TimestampIndex();
+    
+    void insert(qint64 msecs, quint64 id);
+    void remove(qint64 msecs, quint64 id);
+    void remove(const QSet<quint64>& ids);     // One pass, however many
+    void clear();
+    int size() const { return static_cast<int>(m_entries.size()); }
+    
+    // Ids captured in [from, to), newest first
+    std::vector<quint64> range(qint64 from, qint64 to) const;
+    int count(qint64 from, qint64 to) const;
+    
+    // Id of the newest item captured before msecs, or 0 if there is none
+    quint64 newestBefore(qint64 msecs) const;
+    
+private:
+    struct Entry
+    {
+        qint64 msecs;
+        quint64 id;
+        
+        bool operator<(const Entry& other) const
+        {
+            return msecs != other.msecs ? msecs < other.msecs : id < other.id;
+        }
+    };
+    
+    mutable std::vector<Entry> m_entries;   // Oldest first once sorted
+    mutable bool m_sorted;
+    
+    void ensureSorted() const;
+    std::vector<Entry>::const_iterator lowerBound(qint64 msecs) const;
+};
+
+#endif // TIMESTAMPINDEX_H
@@ -1,33 +1,108 @@
 #include "TrayPopupWidget.h"
+#include "ClipboardItemDelegate.h"
+#include "HighlightCache.h"
+#include "ThumbnailCache.h"
+#include "Diagnostics.h"
+#include "StallWatchdog.h"
 #include <QApplication>
 #include <QListWidgetItem>
 #include <QKeyEvent>
-#include <QTimer>
-#include <QGraphicsDropShadowEffect>
+#include <QHelpEvent>
+#include <QHash>
+#include <QImage>
+#include <QPainter>
+#include <QPainterPath>
+#include <QToolTip>
+
+namespace {
+const int kMaxPopupItems = 10;
+
+const int kShadowBlurRadius = 10;
+const int kShadowOffsetY = 4;
+const int kCornerRadius = 8;
+
+// Three box blur passes per axis approximate a gaussian. The shadow is a single
+// color, so blurring every premultiplied channel the same way is exact.
+void boxBlur(QImage& image, int radius)
+{
+    const int width = image.width();
+    const int height = image.height();
+    const int window = 2 * radius + 1;
+    QList<quint32> line(qMax(width, height));
+    
+    for (int pass = 0; pass < 3; ++pass) {
+        for (int axis = 0; axis < 2; ++axis) {
+            const int length = axis == 0 ? width : height;
+            const int lines = axis == 0 ? height : width;
+            
+            for (int l = 0; l < lines; ++l) {
+                for (int i = 0; i < length; ++i) {
+                    const QRgb* row = reinterpret_cast<const QRgb*>(image.constScanLine(axis == 0 ? l : i));
+                    line[i] = row[axis == 0 ? i : l];
+                }
+                
+                quint32 sum[4] = {0, 0, 0, 0};
+                for (int i = -radius; i < length; ++i) {
+                    const int in = i + radius;
+                    const int out = i - radius - 1;
+                    if (in < length) {
+                        sum[0] += qAlpha(line[in]);
+                        sum[1] += qRed(line[in]);
+                        sum[2] += qGreen(line[in]);
+                        sum[3] += qBlue(line[in]);
+                    }
+                    if (out >= 0) {
+                        sum[0] -= qAlpha(line[out]);
+                        sum[1] -= qRed(line[out]);
+                        sum[2] -= qGreen(line[out]);
+                        sum[3] -= qBlue(line[out]);
+                    }
+                    if (i >= 0) {
+                        QRgb* row = reinterpret_cast<QRgb*>(image.scanLine(axis == 0 ? l : i));
+                        row[axis == 0 ? i : l] = qRgba(sum[1] / window, sum[2] / window,
+                                                       sum[3] / window, sum[0] / window);
+                    }
+                }
+            }
+        }
+    }
+}
+}
 
 TrayPopupWidget::TrayPopupWidget(ClipboardManager* clipboardManager, QWidget* parent)
     : QWidget(parent)
     , m_clipboardManager(clipboardManager)
+    , m_ranking(ClipboardManager::RecencyRanking)
+    , m_lastShowLatencyUsecs(0)
 {
     setWindowFlags(Qt::FramelessWindowHint | Qt::WindowStaysOnTopHint | Qt::Tool);
     setAttribute(Qt::WA_ShowWithoutActivating, false);
+    setAttribute(Qt::WA_TranslucentBackground);
     setFocusPolicy(Qt::StrongFocus);
     
     setupUI();
     applyMacStyle();
     
-    // Connect clipboard manager signals
+    // Keep the list current while hidden so showing the popup does no list work
     connect(m_clipboardManager, &ClipboardManager::historyChanged,
-            this, &TrayPopupWidget::updateHistoryList);
+            this, QOverload<>::of(&TrayPopupWidget::updateHistoryList));
+    connect(m_clipboardManager->thumbnailCache(), &ThumbnailCache::thumbnailReady,
+            m_historyList->viewport(), QOverload<>::of(&QWidget::update));
+    connect(m_clipboardManager->highlightCache(), &HighlightCache::highlightReady,
+            m_historyList->viewport(), QOverload<>::of(&QWidget::update));
     
     // Initial update
     updateHistoryList();
+    
+    // Resolve styles and create the native window now rather than on first click
+    ensurePolished();
+    create();
 }
 
 void TrayPopupWidget::setupUI()
 {
     m_mainLayout = new QVBoxLayout(this);
-    m_mainLayout->setContentsMargins(0, 0, 0, 0);
+    m_mainLayout->setContentsMargins(shadowMargin(), shadowMargin(), shadowMargin(), shadowMargin());
     m_mainLayout->setSpacing(0);
     
     // Header
@@ -50,9 +125,16 @@ void TrayPopupWidget::setupUI()
     m_historyList = new QListWidget();
     m_historyList->setObjectName("historyList");
     m_historyList->setAlternatingRowColors(false);
+    m_historyList->setUniformItemSizes(true);
     m_historyList->setSelectionMode(QAbstractItemView::SingleSelection);
+    ClipboardItemDelegate* delegate = new ClipboardItemDelegate(m_historyList);
+    delegate->setCompact(true);
+    delegate->setThumbnailCache(m_clipboardManager->thumbnailCache());
+    delegate->setHighlightCache(m_clipboardManager->highlightCache());
+    m_historyList->setItemDelegate(delegate);
     connect(m_historyList, &QListWidget::itemClicked, this, &TrayPopupWidget::onItemClicked);
     connect(m_historyList, &QListWidget::itemDoubleClicked, this, &TrayPopupWidget::onItemDoubleClicked);
+    m_historyList->viewport()->installEventFilter(this);
     
     // Footer
     m_footerLayout = new QHBoxLayout();
@@ -79,13 +161,8 @@ void TrayPopupWidget::setupUI()
 
 void TrayPopupWidget::applyMacStyle()
 {
+    // The panel background, border and shadow are painted from m_frameCache
     setStyleSheet(R"(
-        TrayPopupWidget {
-            background-color: rgba(248, 248, 248, 245);
-            border: 1px solid rgba(0, 0, 0, 0.15);
-            border-radius: 8px;
-        }
-        
         QLabel#titleLabel {
             font-weight: 600;
             font-size: 13px;
@@ -113,22 +190,6 @@ void TrayPopupWidget::applyMacStyle()
             margin: 0 8px;
         }
         
-        QListWidget#historyList::item {
-            border: none;
-            padding: 8px;
-            margin: 1px 0px;
-            border-radius: 4px;
-            min-height: 20px;
-        }
-        
-        QListWidget#historyList::item:hover {
-            background-color: rgba(0, 122, 255, 0.1);
-        }
-        
-        QListWidget#historyList::item:selected {
-            background-color: rgba(0, 122, 255, 0.2);
-        }
-        
         QPushButton#openAppButton {
             background-color: #007AFF;
             color: white;
@@ -157,13 +218,83 @@ void TrayPopupWidget::applyMacStyle()
             color: #FF3B30;
         }
     )");
+}
+
+int TrayPopupWidget::shadowMargin()
+{
+    return 2 * kShadowBlurRadius;
+}
+
+void TrayPopupWidget::renderFrame()
+{
+    const qreal dpr = devicePixelRatioF();
+    QImage frame(size() * dpr, QImage::Format_ARGB32_Premultiplied);
+    frame.setDevicePixelRatio(dpr);
+    frame.fill(Qt::transparent);
+    
+    const QRectF panel = QRectF(rect()).adjusted(shadowMargin(), shadowMargin(),
+                                                 -shadowMargin(), -shadowMargin());
+    QPainterPath panelPath;
+    panelPath.addRoundedRect(panel, kCornerRadius, kCornerRadius);
+    
+    // Shadow: the panel shape, offset and blurred
+    {
+        QPainter painter(&frame);
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.fillPath(panelPath.translated(0, kShadowOffsetY), QColor(0, 0, 0, 60));
+    }
+    boxBlur(frame, qRound(kShadowBlurRadius * dpr / 2));
+    
+    // Panel on top
+    QPainter painter(&frame);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.fillPath(panelPath, QColor(248, 248, 248, 245));
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    painter.setPen(QPen(QColor(0, 0, 0, 38), 1));
+    painter.drawPath(panelPath);
+    painter.end();
+    
+    m_frameCache = QPixmap::fromImage(frame);
+}
+
+void TrayPopupWidget::markShowRequested()
+{
+    m_showTimer.start();
+}
+
+void TrayPopupWidget::paintEvent(QPaintEvent* event)
+{
+    Q_UNUSED(event);
+    
+    if (m_frameCache.isNull() || m_frameCache.size() != size() * devicePixelRatioF()) {
+        renderFrame();
+    }
     
-    // Add drop shadow effect
-    QGraphicsDropShadowEffect* shadow = new QGraphicsDropShadowEffect(this);
-    shadow->setBlurRadius(20);
-    shadow->setColor(QColor(0, 0, 0, 60));
-    shadow->setOffset(0, 4);
-    setGraphicsEffect(shadow);
+    QPainter painter(this);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawPixmap(0, 0, m_frameCache);
+    
+    if (m_showTimer.isValid()) {
+        m_lastShowLatencyUsecs = m_showTimer.nsecsElapsed() / 1000;
+        m_showTimer.invalidate();
+        
+        if (m_lastShowLatencyUsecs > Diagnostics::kFrameBudgetMsecs * 1000) {
+            qCWarning(lcPerf) << "Tray popup click-to-first-paint took"
+                              << m_lastShowLatencyUsecs / 1000.0 << "ms";
+        } else {
+            qCDebug(lcPerf) << "Tray popup click-to-first-paint:"
+                            << m_lastShowLatencyUsecs / 1000.0 << "ms";
+        }
+    }
+}
+
+void TrayPopupWidget::resizeEvent(QResizeEvent* event)
+{
+    QWidget::resizeEvent(event);
+    
+    // Re-rendered lazily on the next paint at the new size
+    m_frameCache = QPixmap();
 }
 
 void TrayPopupWidget::refreshHistory()
@@ -171,36 +302,66 @@ void TrayPopupWidget::refreshHistory()
     updateHistoryList();
 }
 
+void TrayPopupWidget::setRanking(ClipboardManager::Ranking ranking)
+{
+    if (m_ranking != ranking) {
+        m_ranking = ranking;
+        updateHistoryList();
+    }
+}
+
 void TrayPopupWidget::showEvent(QShowEvent* event)
 {
     QWidget::showEvent(event);
     
-    // Focus the search edit when shown
+    // The list was kept up to date while hidden, only focus the search edit
     m_searchEdit->setFocus();
-    m_searchEdit->clear();
-    
-    // Refresh history
-    updateHistoryList();
 }
 
 void TrayPopupWidget::hideEvent(QHideEvent* event)
 {
     QWidget::hideEvent(event);
     
-    // Clear search when hidden
+    // Clear search when hidden, so the list is back to the default view before the next show
     m_searchEdit->clear();
 }
 
-void TrayPopupWidget::focusOutEvent(QFocusEvent* event)
+void TrayPopupWidget::changeEvent(QEvent* event)
 {
-    QWidget::focusOutEvent(event);
+    QWidget::changeEvent(event);
     
-    // Hide popup when focus is lost (with a small delay)
-    QTimer::singleShot(100, this, [this]() {
-        if (!hasFocus() && !m_searchEdit->hasFocus() && !m_historyList->hasFocus()) {
-            hide();
+    // Hide when another window becomes active. Focus moving between our own
+    // children doesn't deactivate the window, so this needs no grace timer.
+    if (event->type() == QEvent::ActivationChange && isVisible() && !isActiveWindow()) {
+        hide();
+    }
+}
+
+bool TrayPopupWidget::eventFilter(QObject* watched, QEvent* event)
+{
+    // Row tooltips are built only when one is about to show, so refreshes
+    // don't format a time and copy the text of every row, and the relative
+    // time in them is never stale
+    if (watched == m_historyList->viewport() && event->type() == QEvent::ToolTip) {
+        const QHelpEvent* helpEvent = static_cast<QHelpEvent*>(event);
+        QListWidgetItem* row = m_historyList->itemAt(helpEvent->pos());
+        const int index = row ? m_clipboardManager->indexOf(row->data(ClipboardItemDelegate::ItemIdRole).toULongLong())
+                              : -1;
+        if (index < 0) {
+            QToolTip::hideText();
+            return true;
         }
-    });
+        
+        const ClipboardItem& item = m_clipboardManager->history()[index];
+        const QString text = item.text();
+        const int toolTipLength = ClipboardItemDelegate::kToolTipLength;
+        QToolTip::showText(helpEvent->globalPos(),
+                           QString("%1\n%2").arg(item.formattedTimestamp())
+                               .arg(text.size() > toolTipLength ? text.left(toolTipLength) + "..." : text),
+                           m_historyList->viewport(), m_historyList->visualItemRect(row));
+        return true;
+    }
+    return QWidget::eventFilter(watched, event);
 }
 
 void TrayPopupWidget::keyPressEvent(QKeyEvent* event)
@@ -215,20 +376,18 @@ void TrayPopupWidget::keyPressEvent(QKeyEvent* event)
 
 void TrayPopupWidget::onSearchTextChanged()
 {
-    const QString searchText = m_searchEdit->text();
-    const QList<ClipboardItem> results = m_clipboardManager->search(searchText);
-    updateHistoryList(results);
+    updateHistoryList();
 }
 
 void TrayPopupWidget::onItemClicked(QListWidgetItem* item)
 {
     if (!item) return;
     
-    int index = item->data(Qt::UserRole).toInt();
+    const int index = m_clipboardManager->indexOf(item->data(ClipboardItemDelegate::ItemIdRole).toULongLong());
     const QList<ClipboardItem>& history = m_clipboardManager->history();
     
     if (index >= 0 && index < history.size()) {
-        history[index].copyToClipboard();
+        m_clipboardManager->copyToClipboard(index);
         hide();
     }
 }
@@ -252,21 +411,45 @@ void TrayPopupWidget::onOpenMainWindowClicked()
 
 void TrayPopupWidget::updateHistoryList()
 {
-    updateHistoryList(m_clipboardManager->history());
+    // Only the first few rows are ever shown. Browsing stops scanning once it
+    // has them; a search keeps the best scored matches, not the first ones.
+    const QString query = m_searchEdit->text();
+    if (query.trimmed().isEmpty()) {
+        updateHistoryList(m_clipboardManager->topItems(QString(), kMaxPopupItems, m_ranking));
+    } else {
+        updateHistoryList(m_clipboardManager->rankedSearch(query, kMaxPopupItems));
+    }
 }
 
-void TrayPopupWidget::updateHistoryList(const QList<ClipboardItem>& items)
+void TrayPopupWidget::updateHistoryList(const QList<ClipboardManager::SearchResult>& results)
 {
-    m_historyList->clear();
+    StallWatchdog::Scope scope("updateHistoryList", results.size());
+    // Rows are keyed by item id, so rows that are still shown are reused and
+    // only new items pay for building a row
+    QHash<quint64, QListWidgetItem*> rows;
+    while (m_historyList->count() > 0) {
+        QListWidgetItem* row = m_historyList->takeItem(0);
+        const quint64 id = row->data(ClipboardItemDelegate::ItemIdRole).toULongLong();
+        if (id != 0) {
+            rows.insert(id, row);
+        } else {
+            delete row;
+        }
+    }
     
-    for (int i = 0; i < items.size() && i < 10; ++i) { // Show max 10 items in popup
-        const ClipboardItem& item = items[i];
-        QListWidgetItem* listItem = createHistoryItem(item);
-        listItem->setData(Qt::UserRole, i); // Store original index
+    const QList<ClipboardItem>& history = m_clipboardManager->history();
+    for (const ClipboardManager::SearchResult& result : results) {
+        const ClipboardItem& clipboardItem = history[result.index];
+        QListWidgetItem* listItem = rows.take(clipboardItem.id());
+        if (!listItem) {
+            listItem = createHistoryItem(clipboardItem);
+        }
+        updateHistoryItem(listItem, clipboardItem, result);
         m_historyList->addItem(listItem);
     }
+    qDeleteAll(rows);
     
-    if (items.isEmpty()) {
+    if (results.isEmpty()) {
         QListWidgetItem* emptyItem = new QListWidgetItem("No clipboard items");
         emptyItem->setFlags(Qt::NoItemFlags);
         emptyItem->setTextAlignment(Qt::AlignCenter);
@@ -278,14 +461,24 @@ QListWidgetItem* TrayPopupWidget::createHistoryItem(const ClipboardItem& clipboa
 {
     QListWidgetItem* item = new QListWidgetItem();
     
-    // Set text with type and preview
-    QString displayText = QString("%1 • %2")
-                         .arg(clipboardItem.typeString())
-                         .arg(clipboardItem.preview());
-    
-    item->setText(displayText);
+    // The delegate draws "type • preview" from these roles
+    item->setText(clipboardItem.preview());
     item->setIcon(clipboardItem.icon());
-    item->setToolTip(QString("%1\n%2").arg(clipboardItem.formattedTimestamp()).arg(clipboardItem.text()));
+    item->setData(ClipboardItemDelegate::ItemIdRole, clipboardItem.id());
+    item->setData(ClipboardItemDelegate::TypeRole, clipboardItem.typeString());
+    if (clipboardItem.type() == ClipboardItem::Code) {
+        item->setData(ClipboardItemDelegate::CodeTextRole, clipboardItem.text());
+    }
     
     return item;
+}
+
+void TrayPopupWidget::updateHistoryItem(QListWidgetItem* item, const ClipboardItem& clipboardItem,
+                                        const ClipboardManager::SearchResult& result)
+{
+    item->setData(ClipboardItemDelegate::MatchPositionsRole, QVariant::fromValue(result.positions));
+    item->setData(ClipboardItemDelegate::PinnedRole, clipboardItem.isPinned());
+    if (clipboardItem.type() == ClipboardItem::Image) {
+        item->setData(ClipboardItemDelegate::ImageDataRole, clipboardItem.imageData());
+    }
 }
\ No newline at end of file
@@ -8,6 +8,8 @@
 #include <QLabel>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
+#include <QElapsedTimer>
+#include <QPixmap>
 #include "ClipboardManager.h"
 
 class TrayPopupWidget : public QWidget
@@ -19,13 +21,26 @@ public:
     
     void refreshHistory();
     
+    ClipboardManager::Ranking ranking() const { return m_ranking; }
+    void setRanking(ClipboardManager::Ranking ranking);
+    
+    // Space around the panel reserved for its drop shadow
+    static int shadowMargin();
+    
+    // Starts the click-to-first-paint measurement for the next show
+    void markShowRequested();
+    qint64 lastShowLatencyUsecs() const { return m_lastShowLatencyUsecs; }
+    
 signals:
     void openMainWindow();
     
 protected:
+    void paintEvent(QPaintEvent* event) override;
+    void resizeEvent(QResizeEvent* event) override;
     void showEvent(QShowEvent* event) override;
     void hideEvent(QHideEvent* event) override;
-    void focusOutEvent(QFocusEvent* event) override;
+    void changeEvent(QEvent* event) override;
+    bool eventFilter(QObject* watched, QEvent* event) override;
     void keyPressEvent(QKeyEvent* event) override;
     
 private slots:
@@ -37,6 +52,7 @@ private slots:
     
 private:
     ClipboardManager* m_clipboardManager;
+    ClipboardManager::Ranking m_ranking;
     
     // UI elements
     QVBoxLayout* m_mainLayout;
@@ -49,11 +65,18 @@ private:
     QPushButton* m_openAppButton;
     QPushButton* m_clearButton;
     
+    QPixmap m_frameCache;
+    QElapsedTimer m_showTimer;
+    qint64 m_lastShowLatencyUsecs;
+    
     void setupUI();
     void applyMacStyle();
+    void renderFrame();
     void updateHistoryList();
-    void updateHistoryList(const QList<ClipboardItem>& items);
+    void updateHistoryList(const QList<ClipboardManager::SearchResult>& results);
     QListWidgetItem* createHistoryItem(const ClipboardItem& clipboardItem);
+    void updateHistoryItem(QListWidgetItem* item, const ClipboardItem& clipboardItem,
+                           const ClipboardManager::SearchResult& result);
 };
 
 #endif // TRAYPOPUPWIDGET_H
\ No newline at end of file
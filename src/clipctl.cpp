@@ -0,0 +1,400 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QFile>
+#include <QLocalSocket>
+#include <QTextStream>
+#include <cstdio>
+#include "IpcProtocol.h"
+
+// Command-line client for the history server in a running ClipboardManager
+// (either the tray app or --daemon). Talks the same framed protocol as the
+// GUI client, but synchronously.
+
+namespace {
+const int kConnectTimeoutMsecs = 2000;
+const int kReadTimeoutMsecs = 10000;
+const qint64 kMaxQueuedBytes = 4 * IpcProtocol::kChunkSize;
+
+// Same order as ClipboardItem::ItemType; clipctl doesn't link the GUI model
+const char* const kTypeNames[] = { "text", "image", "html", "url", "file", "code" };
+const int kTypeCount = sizeof(kTypeNames) / sizeof(kTypeNames[0]);
+
+int typeFromName(const QString& name)
+{
+    for (int i = 0; i < kTypeCount; ++i) {
+        if (name.compare(QLatin1String(kTypeNames[i]), Qt::CaseInsensitive) == 0) {
+            return i;
+        }
+    }
+    return -2;
+}
+
+QString typeName(int type)
+{
+    return type >= 0 && type < kTypeCount ? QString::fromLatin1(kTypeNames[type]) : QStringLiteral("unknown");
+}
+
+// Parses durations like "90s", "15m", "2h" or "3d"
+qint64 parseDurationMsecs(const QString& text)
+{
+    if (text.size() < 2) {
+        return -1;
+    }
+    
+    bool ok = false;
+    const qint64 value = text.left(text.size() - 1).toLongLong(&ok);
+    if (!ok || value < 0) {
+        return -1;
+    }
+    
+    switch (text.back().toLatin1()) {
+        case 's': return value * 1000;
+        case 'm': return value * 60 * 1000;
+        case 'h': return value * 60 * 60 * 1000;
+        case 'd': return value * 24 * 60 * 60 * 1000;
+        default: return -1;
+    }
+}
+
+class Connection
+{
+public:
+    bool open(const QString& name)
+    {
+        m_socket.connectToServer(name);
+        if (!m_socket.waitForConnected(kConnectTimeoutMsecs)) {
+            return false;
+        }
+    
+        QByteArray payload;
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        IpcProtocol::beginMessage(out, IpcProtocol::Hello) << IpcProtocol::kVersion;
+        send(payload);
+    
+        // Welcome confirms the server speaks our protocol version
+        QByteArray frame;
+        while (nextFrame(frame)) {
+            if (messageType(frame) == IpcProtocol::Welcome) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    void send(const QByteArray& payload)
+    {
+        IpcProtocol::writeFrame(&m_socket, payload);
+        while (m_socket.bytesToWrite() > kMaxQueuedBytes) {
+            if (!m_socket.waitForBytesWritten(kReadTimeoutMsecs)) {
+                break;
+            }
+        }
+    }
+    
+    void flush()
+    {
+        while (m_socket.bytesToWrite() > 0 && m_socket.waitForBytesWritten(kReadTimeoutMsecs)) {
+        }
+    }
+    
+    bool nextFrame(QByteArray& frame)
+    {
+        while (m_frames.isEmpty()) {
+            if (m_socket.state() != QLocalSocket::ConnectedState ||
+                !m_socket.waitForReadyRead(kReadTimeoutMsecs)) {
+                return false;
+            }
+            if (!IpcProtocol::readFrames(&m_socket, m_reader, m_frames)) {
+                return false;
+            }
+        }
+        frame = m_frames.takeFirst();
+        return true;
+    }
+    
+    QString errorString() const { return m_socket.errorString(); }
+    
+    static quint8 messageType(const QByteArray& frame)
+    {
+        return frame.isEmpty() ? 0xff : static_cast<quint8>(frame.at(0));
+    }
+    
+private:
+    QLocalSocket m_socket;
+    IpcProtocol::FrameReader m_reader;
+    QList<QByteArray> m_frames;
+};
+
+QTextStream& standardOutput()
+{
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+QTextStream& standardError()
+{
+    static QTextStream stream(stderr);
+    return stream;
+}
+
+// Reads a server Error message out of its frame
+QString errorMessage(const QByteArray& frame)
+{
+    QDataStream in(frame);
+    in.setVersion(IpcProtocol::kStreamVersion);
+    quint8 type = 0;
+    QString message;
+    in >> type >> message;
+    return message;
+}
+
+struct QueryResult
+{
+    quint64 id = 0;
+    qint32 type = 0;
+    qint64 timestampMsecs = 0;
+    qint64 size = 0;
+    QString preview;
+};
+
+bool runQuery(Connection& connection, const QString& text, int typeFilter, qint64 fromMsecs,
+              qint64 toMsecs, int limit, QList<QueryResult>& results)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::Query)
+        << text << static_cast<qint32>(typeFilter) << fromMsecs << toMsecs << static_cast<qint32>(limit);
+    connection.send(payload);
+    
+    QByteArray frame;
+    while (connection.nextFrame(frame)) {
+        QDataStream in(frame);
+        in.setVersion(IpcProtocol::kStreamVersion);
+        quint8 type = 0;
+        in >> type;
+    
+        if (type == IpcProtocol::QueryResult) {
+            QueryResult result;
+            in >> result.id >> result.type >> result.timestampMsecs >> result.size >> result.preview;
+            results.append(result);
+        } else if (type == IpcProtocol::QueryEnd) {
+            return true;
+        } else if (type == IpcProtocol::Error) {
+            standardError() << "clipctl: " << errorMessage(frame) << Qt::endl;
+            return false;
+        }
+        // Change notifications for GUI clients are ignored
+    }
+    
+    standardError() << "clipctl: connection lost" << Qt::endl;
+    return false;
+}
+
+// Streams an item's payload to stdout chunk by chunk
+bool fetchItem(Connection& connection, quint64 id)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::Fetch) << id;
+    connection.send(payload);
+    
+    QFile output;
+    if (!output.open(stdout, QIODevice::WriteOnly)) {
+        return false;
+    }
+    
+    QByteArray frame;
+    while (connection.nextFrame(frame)) {
+        QDataStream in(frame);
+        in.setVersion(IpcProtocol::kStreamVersion);
+        quint8 type = 0;
+        in >> type;
+    
+        if (type == IpcProtocol::PayloadChunk) {
+            QByteArray data;
+            in >> data;
+            output.write(data);
+        } else if (type == IpcProtocol::PayloadEnd) {
+            output.flush();
+            return true;
+        } else if (type == IpcProtocol::Error) {
+            standardError() << "clipctl: " << errorMessage(frame) << Qt::endl;
+            return false;
+        }
+    }
+    
+    standardError() << "clipctl: connection lost" << Qt::endl;
+    return false;
+}
+
+// Sends stdin to the clipboard in chunks, never holding more than a few in memory
+bool pushStandardInput(Connection& connection, const QString& mimeType)
+{
+    QFile input;
+    if (!input.open(stdin, QIODevice::ReadOnly)) {
+        return false;
+    }
+    
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(out, IpcProtocol::Push) << mimeType;
+    connection.send(payload);
+    
+    QByteArray chunk(IpcProtocol::kChunkSize, Qt::Uninitialized);
+    qint64 read = 0;
+    while ((read = input.read(chunk.data(), chunk.size())) > 0) {
+        QByteArray chunkPayload;
+        QDataStream chunkOut(&chunkPayload, QIODevice::WriteOnly);
+        IpcProtocol::beginMessage(chunkOut, IpcProtocol::PayloadChunk) << QByteArray(chunk.constData(), read);
+        connection.send(chunkPayload);
+    }
+    
+    QByteArray endPayload;
+    QDataStream endOut(&endPayload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(endOut, IpcProtocol::PayloadEnd);
+    connection.send(endPayload);
+    connection.flush();
+    return read == 0;
+}
+
+QString mimeTypeForType(int type)
+{
+    switch (type) {
+        case 1: return QStringLiteral("image/png");
+        case 2: return QStringLiteral("text/html");
+        default: return QStringLiteral("text/plain;charset=utf-8");
+    }
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("clipctl");
+    QCoreApplication::setApplicationVersion("1.0.0");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Query and control the clipboard history of a running Clipboard Manager.\n\n"
+        "Commands:\n"
+        "  query          List matching items as id, type, time, size and preview\n"
+        "  get <id>       Write an item's contents to stdout\n"
+        "  last           Write the newest (matching) item's contents to stdout\n"
+        "  push           Put stdin on the clipboard");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("command", "query, get, last or push");
+
+    const QCommandLineOption textOption("text", "Fuzzy filter on item text.", "pattern");
+    const QCommandLineOption typeOption("type", "Only items of this type (text, image, html, url, file, code).", "type");
+    const QCommandLineOption sinceOption("since", "Only items newer than this, e.g. 30m, 2h, 7d.", "duration");
+    const QCommandLineOption fromOption("from", "Only items at or after this ISO 8601 time.", "time");
+    const QCommandLineOption toOption("to", "Only items at or before this ISO 8601 time.", "time");
+    const QCommandLineOption limitOption("limit", "Maximum number of results (default 20).", "count", "20");
+    const QCommandLineOption mimeOption("mime", "MIME type of pushed data (default from --type).", "type");
+    const QCommandLineOption serverOption("server", "Local server name to connect to.", "name",
+                                          IpcProtocol::defaultServerName());
+    parser.addOptions({ textOption, typeOption, sinceOption, fromOption, toOption, limitOption,
+                        mimeOption, serverOption });
+    parser.process(app);
+
+    const QStringList arguments = parser.positionalArguments();
+    if (arguments.isEmpty()) {
+        parser.showHelp(2);
+    }
+    const QString command = arguments.first();
+
+    int typeFilter = -1;
+    if (parser.isSet(typeOption)) {
+        typeFilter = typeFromName(parser.value(typeOption));
+        if (typeFilter < 0) {
+            standardError() << "clipctl: unknown type " << parser.value(typeOption) << Qt::endl;
+            return 2;
+        }
+    }
+
+    qint64 fromMsecs = IpcProtocol::kUnboundedTime;
+    qint64 toMsecs = IpcProtocol::kUnboundedTime;
+    if (parser.isSet(sinceOption)) {
+        const qint64 duration = parseDurationMsecs(parser.value(sinceOption));
+        if (duration < 0) {
+            standardError() << "clipctl: invalid duration " << parser.value(sinceOption) << Qt::endl;
+            return 2;
+        }
+        fromMsecs = QDateTime::currentMSecsSinceEpoch() - duration;
+    }
+    if (parser.isSet(fromOption)) {
+        const QDateTime from = QDateTime::fromString(parser.value(fromOption), Qt::ISODate);
+        if (!from.isValid()) {
+            standardError() << "clipctl: invalid time " << parser.value(fromOption) << Qt::endl;
+            return 2;
+        }
+        fromMsecs = from.toMSecsSinceEpoch();
+    }
+    if (parser.isSet(toOption)) {
+        const QDateTime to = QDateTime::fromString(parser.value(toOption), Qt::ISODate);
+        if (!to.isValid()) {
+            standardError() << "clipctl: invalid time " << parser.value(toOption) << Qt::endl;
+            return 2;
+        }
+        toMsecs = to.toMSecsSinceEpoch();
+    }
+
+    Connection connection;
+    if (!connection.open(parser.value(serverOption))) {
+        standardError() << "clipctl: cannot connect to Clipboard Manager: " << connection.errorString() << Qt::endl;
+        return 1;
+    }
+
+    if (command == QLatin1String("query")) {
+        QList<QueryResult> results;
+        if (!runQuery(connection, parser.value(textOption), typeFilter, fromMsecs, toMsecs,
+                      parser.value(limitOption).toInt(), results)) {
+            return 1;
+        }
+
+        QTextStream& output = standardOutput();
+        for (const QueryResult& result : results) {
+            QString preview = result.preview;
+            preview.replace(QLatin1Char('\t'), QLatin1Char(' ')).replace(QLatin1Char('\n'), QLatin1Char(' '));
+            output << result.id << '\t' << typeName(result.type) << '\t'
+                   << QDateTime::fromMSecsSinceEpoch(result.timestampMsecs).toString(Qt::ISODate) << '\t'
+                   << result.size << '\t' << preview << '\n';
+        }
+        output.flush();
+        return 0;
+    }
+
+    if (command == QLatin1String("get")) {
+        bool ok = false;
+        const quint64 id = arguments.value(1).toULongLong(&ok);
+        if (!ok) {
+            standardError() << "clipctl: get needs an item id" << Qt::endl;
+            return 2;
+        }
+        return fetchItem(connection, id) ? 0 : 1;
+    }
+
+    if (command == QLatin1String("last")) {
+        QList<QueryResult> results;
+        if (!runQuery(connection, parser.value(textOption), typeFilter, fromMsecs, toMsecs, 1, results)) {
+            return 1;
+        }
+        if (results.isEmpty()) {
+            standardError() << "clipctl: no matching item" << Qt::endl;
+            return 1;
+        }
+        return fetchItem(connection, results.first().id) ? 0 : 1;
+    }
+
+    if (command == QLatin1String("push")) {
+        const QString mimeType = parser.isSet(mimeOption) ? parser.value(mimeOption)
+                                                          : mimeTypeForType(typeFilter);
+        return pushStandardInput(connection, mimeType) ? 0 : 1;
+    }
+
+    standardError() << "clipctl: unknown command " << command << Qt::endl;
+    return 2;
+}
@@ -1,22 +1,204 @@
 #include <QApplication>
+#include <QGuiApplication>
 #include <QSystemTrayIcon>
 #include <QMessageBox>
 #include <QDir>
 #include <QStandardPaths>
 #include <QStyleFactory>
 #include <QFont>
-#include "MainWindow.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTimer>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "Diagnostics.h"
+#include "ClipboardManager.h"
+#include "HistoryServer.h"
+#include "IpcProtocol.h"
+#include "SecretScanner.h"
+#include "StallWatchdog.h"
 #include "SystemTrayManager.h"
 
+namespace {
+
+// Checked before any application object exists, since the mode decides
+// which application class to create
+bool hasArgument(int argc, char* argv[], const char* name)
+{
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Value following name, e.g. "30" for --quit-after 30
+const char* argumentValue(int argc, char* argv[], const char* name)
+{
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::strcmp(argv[i], name) == 0) {
+            return argv[i + 1];
+        }
+    }
+    return "";
+}
+
+// --activity-stats [--quit-after SECONDS]: counts what wakes the main thread
+// and prints it per minute on exit, e.g. to check an idle run stays quiet
+void startActivityMonitor(int argc, char* argv[])
+{
+    if (!hasArgument(argc, argv, "--activity-stats")) {
+        return;
+    }
+    
+    Diagnostics::ActivityMonitor* monitor = Diagnostics::ActivityMonitor::start();
+    QObject::connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, monitor, [monitor]() {
+        std::fprintf(stderr, "Activity: %s\n", qPrintable(monitor->summary()));
+    });
+    
+    const int quitAfterSecs = std::atoi(argumentValue(argc, argv, "--quit-after"));
+    if (quitAfterSecs > 0) {
+        QTimer::singleShot(quitAfterSecs * 1000, QCoreApplication::instance(), &QCoreApplication::quit);
+    }
+}
+
+// The stall watchdog runs unless --stall-threshold 0; with --stall-log FILE
+// the stalls it recorded are written to FILE on exit
+void startStallWatchdog(int argc, char* argv[])
+{
+    const char* threshold = argumentValue(argc, argv, "--stall-threshold");
+    const int thresholdMsecs = *threshold ? std::atoi(threshold) : 100;
+    if (thresholdMsecs <= 0) {
+        return;
+    }
+    
+    StallWatchdog* watchdog = StallWatchdog::start(thresholdMsecs);
+    const QString logPath = QString::fromLocal8Bit(argumentValue(argc, argv, "--stall-log"));
+    if (!logPath.isEmpty()) {
+        QObject::connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, watchdog, [watchdog, logPath]() {
+            if (!watchdog->dump(logPath)) {
+                qWarning("Cannot write stall log %s", qPrintable(logPath));
+            }
+        });
+    }
+}
+
+QString dataPath(const QString& name)
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QLatin1Char('/') + name;
+}
+
+void openPersistentHistory(ClipboardManager& clipboardManager)
+{
+    // The archive first, so items the log recovery trims are archived
+    const QString archivePath = dataPath(QStringLiteral("archive"));
+    if (!clipboardManager.openArchive(archivePath)) {
+        qWarning("Evicted items are not archived: cannot create %s", qPrintable(archivePath));
+    }
+    
+    const QString logPath = dataPath(QStringLiteral("history.log"));
+    if (!clipboardManager.openHistoryLog(logPath)) {
+        qWarning("History is not persisted: %s: %s", qPrintable(logPath),
+                 qPrintable(clipboardManager.historyLog().errorString()));
+    }
+}
+
+void setApplicationProperties()
+{
+    QCoreApplication::setApplicationName("Clipboard Manager");
+    QCoreApplication::setApplicationVersion("1.0.0");
+    QCoreApplication::setOrganizationName("ClipboardManager");
+    QCoreApplication::setOrganizationDomain("clipboardmanager.com");
+}
+
+// --daemon: capture pipeline and history only, no widgets
+int runDaemon(int argc, char* argv[])
+{
+    QGuiApplication app(argc, argv);
+    setApplicationProperties();
+    startActivityMonitor(argc, argv);
+    startStallWatchdog(argc, argv);
+    
+    ClipboardManager clipboardManager;
+    HistoryServer server(&clipboardManager);
+    
+    if (!server.listen(IpcProtocol::defaultServerName())) {
+        qCritical("Failed to listen on %s: %s", qPrintable(IpcProtocol::defaultServerName()),
+                  qPrintable(server.errorString()));
+        return 1;
+    }
+    openPersistentHistory(clipboardManager);
+    
+    qCDebug(lcPerf) << "Daemon ready" << Diagnostics::msecsSinceProcessStart()
+                    << "ms after process start, RSS" << Diagnostics::residentSetBytes() / 1024 << "KiB";
+    
+    return app.exec();
+}
+
+// --bench-secrets FILE...: secret scanner throughput over a corpus of files
+int runSecretBenchmark(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    
+    QList<QString> corpus;
+    qint64 corpusBytes = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] == '-') {
+            continue;
+        }
+        QFile file(QString::fromLocal8Bit(argv[i]));
+        if (!file.open(QIODevice::ReadOnly)) {
+            std::fprintf(stderr, "Cannot read %s\n", argv[i]);
+            return 1;
+        }
+        const QByteArray data = file.readAll();
+        corpusBytes += data.size();
+        corpus.append(QString::fromUtf8(data));
+    }
+    if (corpus.isEmpty()) {
+        std::fprintf(stderr, "Usage: %s --bench-secrets FILE...\n", argv[0]);
+        return 1;
+    }
+    
+    // Build the automaton before timing, then repeat for at least a second
+    const SecretScanner& scanner = SecretScanner::instance();
+    int findings = 0;
+    int rounds = 0;
+    QElapsedTimer timer;
+    timer.start();
+    while (rounds < 3 || timer.elapsed() < 1000) {
+        findings = 0;
+        for (const QString& text : corpus) {
+            findings += scanner.scan(text).size();
+        }
+        ++rounds;
+    }
+    
+    const double seconds = timer.nsecsElapsed() / 1e9;
+    std::printf("%lld bytes x %d rounds in %.3f s: %.3f GB/s, %d findings per round\n",
+                static_cast<long long>(corpusBytes), rounds, seconds, corpusBytes * rounds / seconds / 1e9, findings);
+    return 0;
+}
+
+}
+
 int main(int argc, char *argv[])
 {
+    if (hasArgument(argc, argv, "--daemon")) {
+        return runDaemon(argc, argv);
+    }
+    if (hasArgument(argc, argv, "--bench-secrets")) {
+        return runSecretBenchmark(argc, argv);
+    }
+    
     QApplication app(argc, argv);
     
     // Set application properties
-    app.setApplicationName("Clipboard Manager");
-    app.setApplicationVersion("1.0.0");
-    app.setOrganizationName("ClipboardManager");
-    app.setOrganizationDomain("clipboardmanager.com");
+    setApplicationProperties();
+    startActivityMonitor(argc, argv);
+    startStallWatchdog(argc, argv);
     
     // Check if system tray is available
     if (!QSystemTrayIcon::isSystemTrayAvailable()) {
@@ -34,14 +216,39 @@ int main(int argc, char *argv[])
     app.setFont(systemFont);
 #endif
     
-    // Create main window
-    MainWindow mainWindow;
+    // Capture in this process, or with --attach mirror a running daemon
+    ClipboardManager clipboardManager;
+    HistoryServer server(&clipboardManager);
+    bool persistHistory = false;
+    if (hasArgument(argc, argv, "--attach")) {
+        clipboardManager.attachToDaemon(IpcProtocol::defaultServerName());
+    } else if (server.listen(IpcProtocol::defaultServerName())) {
+        // Owning the server name also makes this the only writer of the log and archive
+        persistHistory = true;
+    } else {
+        // clipctl still works against whichever instance owns the name
+        qWarning("Not serving local queries or persisting history on %s: %s",
+                 qPrintable(IpcProtocol::defaultServerName()), qPrintable(server.errorString()));
+    }
+    
+    // Create system tray manager; the main window is created on first use
+    SystemTrayManager trayManager(&clipboardManager);
     
-    // Create system tray manager
-    SystemTrayManager trayManager(&mainWindow);
+    // Replaying the log and mapping the archive take time in proportion to
+    // the history, so they wait until the icon is up; the popup fills in
+    // once they are done, and what was captured meanwhile is kept
+    QObject::connect(&trayManager, &SystemTrayManager::trayReady, [&]() {
+        qCDebug(lcPerf) << "Tray ready" << Diagnostics::msecsSinceProcessStart()
+                        << "ms after process start, RSS" << Diagnostics::residentSetBytes() / 1024 << "KiB";
+        if (persistHistory) {
+            QTimer::singleShot(0, &clipboardManager, [&clipboardManager]() {
+                openPersistentHistory(clipboardManager);
+            });
+        }
+    });
     
     // Show tray icon
     trayManager.show();
     
     return app.exec();
-}
\ No newline at end of file
+}
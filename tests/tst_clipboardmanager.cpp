@@ -0,0 +1,132 @@
+#include "ClipboardManager.h"
+#include <QGuiApplication>
+#include <QtTest>
+
+namespace {
+// Puts text on the clipboard and waits for it to become the newest item
+void copy(ClipboardManager* manager, const QString& text)
+{
+    QGuiApplication::clipboard()->setText(text);
+    QTRY_VERIFY(!manager->history().isEmpty() && manager->history().first().text() == text);
+}
+
+QStringList textsOf(const ClipboardManager& manager, const QList<ClipboardManager::SearchResult>& results)
+{
+    QStringList texts;
+    for (const ClipboardManager::SearchResult& result : results) {
+        texts.append(manager.history()[result.index].text());
+    }
+    return texts;
+}
+}
+
+// Drives the manager through the clipboard, so it needs a platform with one;
+// ctest runs it on the offscreen platform
+class TestClipboardManager : public QObject
+{
+    Q_OBJECT
+    
+private slots:
+    void init();
+    void rankedSearchKeepsBestMatches();
+    void coalescesBursts();
+    void dropsChangesOverRate();
+    void keepsLatestChangeOverRate();
+};
+
+void TestClipboardManager::init()
+{
+    // Each test's manager starts from an empty clipboard
+    QGuiApplication::clipboard()->clear();
+}
+
+void TestClipboardManager::rankedSearchKeepsBestMatches()
+{
+    ClipboardManager manager;
+    manager.setCoalesceDelayMsecs(0);
+    copy(&manager, "acme corp");
+    copy(&manager, "clipboard manager");
+    copy(&manager, "nothing here");
+    copy(&manager, "cm");
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+    
+    // Three items match; only the best two are kept, best first
+    const QList<ClipboardManager::SearchResult> results = manager.rankedSearch("cm", 2);
+    QCOMPARE(textsOf(manager, results), (QStringList{"cm", "clipboard manager"}));
+    QVERIFY(results[0].score > results[1].score);
+    QCOMPARE(results[1].positions, (QList<int>{0, 10}));
+    
+    QCOMPARE(manager.rankedSearch("cm", 10).size(), 3);
+    QVERIFY(manager.rankedSearch("cm", 0).isEmpty());
+}
+
+void TestClipboardManager::coalescesBursts()
+{
+    ClipboardManager manager;
+    manager.setCoalesceDelayMsecs(50);
+    const ClipboardManager::ChangeStats before = manager.changeStats();
+    
+    // Each change pushes processing back; only the clipboard as it ends up is read
+    QClipboard* clipboard = QGuiApplication::clipboard();
+    clipboard->setText("first");
+    clipboard->setText("second");
+    clipboard->setText("third");
+    QTRY_VERIFY(!manager.history().isEmpty() && manager.history().first().text() == "third");
+    
+    const ClipboardManager::ChangeStats stats = manager.changeStats();
+    QCOMPARE(stats.rawEvents - before.rawEvents, quint64(3));
+    QCOMPARE(stats.coalescedEvents - before.coalescedEvents, quint64(2));
+    QCOMPARE(stats.processedEvents - before.processedEvents, quint64(1));
+    QCOMPARE(manager.history().size(), 1);
+}
+
+void TestClipboardManager::dropsChangesOverRate()
+{
+    ClipboardManager manager;
+    manager.setCoalesceDelayMsecs(0);
+    manager.setMaxIngestRate(2);
+    manager.setRateLimitPolicy(ClipboardManager::DropExcess);
+    
+    // The bucket fills up to one second's worth of changes
+    QTest::qWait(1100);
+    copy(&manager, "a");
+    copy(&manager, "b");
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+    QCOMPARE(manager.changeStats().rateLimited, quint64(0));
+    
+    QGuiApplication::clipboard()->setText("c");
+    QTRY_COMPARE(manager.changeStats().rateLimited, quint64(1));
+    QTest::qWait(100);
+    QCOMPARE(manager.history().first().text(), QString("b"));
+}
+
+void TestClipboardManager::keepsLatestChangeOverRate()
+{
+    ClipboardManager manager;
+    manager.setCoalesceDelayMsecs(0);
+    manager.setMaxIngestRate(1);
+    manager.setRateLimitPolicy(ClipboardManager::KeepLatest);
+    
+    QTest::qWait(1100);
+    copy(&manager, "first");
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+    
+    // Deferred until a token is back, by which time the clipboard moved on
+    QClipboard* clipboard = QGuiApplication::clipboard();
+    clipboard->setText("second");
+    QTRY_COMPARE(manager.changeStats().rateLimited, quint64(1));
+    clipboard->setText("third");
+    QCOMPARE(manager.history().first().text(), QString("first"));
+    
+    QTRY_VERIFY_WITH_TIMEOUT(manager.history().first().text() == "third", 3000);
+    QCOMPARE(manager.history().size(), 2);
+}
+
+QTEST_MAIN(TestClipboardManager)
+#include "tst_clipboardmanager.moc"
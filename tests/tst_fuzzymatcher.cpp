@@ -0,0 +1,68 @@
+#include "FuzzyMatcher.h"
+#include <QtTest>
+
+class TestFuzzyMatcher : public QObject
+{
+    Q_OBJECT
+    
+private slots:
+    void match_data();
+    void match();
+    void emptyPatternMatchesAnything();
+    void prefersWordBoundaries();
+    void prefersConsecutiveMatches();
+};
+
+void TestFuzzyMatcher::match_data()
+{
+    QTest::addColumn<QString>("pattern");
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<QList<int>>("positions");  // Empty if it must not match
+    
+    QTest::newRow("subsequence") << QString("abc") << QString("a_b_c") << QList<int>{0, 2, 4};
+    QTest::newRow("word starts") << QString("fb") << QString("foo bar") << QList<int>{0, 4};
+    QTest::newRow("camel case") << QString("fb") << QString("fooBar") << QList<int>{0, 3};
+    QTest::newRow("window tightened") << QString("ab") << QString("a a ab") << QList<int>{4, 5};
+    QTest::newRow("lowercase ignores case") << QString("foo") << QString("FOO") << QList<int>{0, 1, 2};
+    QTest::newRow("uppercase is exact") << QString("Foo") << QString("foo") << QList<int>();
+    QTest::newRow("out of order") << QString("ba") << QString("ab") << QList<int>();
+    QTest::newRow("longer than text") << QString("abcd") << QString("abc") << QList<int>();
+}
+
+void TestFuzzyMatcher::match()
+{
+    QFETCH(QString, pattern);
+    QFETCH(QString, text);
+    QFETCH(QList<int>, positions);
+    
+    QList<int> matched;
+    const int score = FuzzyMatcher(pattern).match(text, &matched);
+    if (positions.isEmpty()) {
+        QCOMPARE(score, -1);
+        return;
+    }
+    QVERIFY(score > 0);
+    QCOMPARE(matched, positions);
+}
+
+void TestFuzzyMatcher::emptyPatternMatchesAnything()
+{
+    const FuzzyMatcher matcher("   ");
+    QVERIFY(matcher.isEmpty());
+    QCOMPARE(matcher.match("anything"), 0);
+}
+
+void TestFuzzyMatcher::prefersWordBoundaries()
+{
+    const FuzzyMatcher matcher("cm");
+    QVERIFY(matcher.match("clipboard manager") > matcher.match("acme"));
+}
+
+void TestFuzzyMatcher::prefersConsecutiveMatches()
+{
+    const FuzzyMatcher matcher("abc");
+    QVERIFY(matcher.match("abcxx") > matcher.match("axbxc"));
+}
+
+QTEST_GUILESS_MAIN(TestFuzzyMatcher)
+#include "tst_fuzzymatcher.moc"
@@ -0,0 +1,186 @@
+#include "HistoryArchive.h"
+#include <QDir>
+#include <QTemporaryDir>
+#include <QtTest>
+
+namespace {
+ClipboardItem archivedItem(quint64 id, const QString& text, ClipboardItem::ItemType type = ClipboardItem::Text)
+{
+    ClipboardItem item(text, type);
+    item.setId(id);
+    item.setTimestamp(QDateTime::fromMSecsSinceEpoch(qint64(id) * 1000));
+    return item;
+}
+
+// Ids 1 to 4, oldest first, as evicted from the history
+QList<ClipboardItem> evictedItems()
+{
+    return {archivedItem(1, "Hello world"), archivedItem(2, "https://example.com", ClipboardItem::Url),
+            archivedItem(3, "shopping list"), archivedItem(4, "hello again")};
+}
+
+QList<quint64> idsOf(const QList<ClipboardItem>& items)
+{
+    QList<quint64> ids;
+    for (const ClipboardItem& item : items) {
+        ids.append(item.id());
+    }
+    return ids;
+}
+}
+
+class TestHistoryArchive : public QObject
+{
+    Q_OBJECT
+    
+private slots:
+    void initTestCase();
+    void searchesPendingItems();
+    void searchesSealedSegments();
+    void skipsSegmentsThatCannotMatch();
+    void reopensSegments();
+    void clearDeletesSegments();
+    
+private:
+    QTemporaryDir m_dir;
+    
+    // A fresh archive directory per test function
+    QString archivePath() const;
+};
+
+void TestHistoryArchive::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+}
+
+QString TestHistoryArchive::archivePath() const
+{
+    return m_dir.filePath(QString::fromLatin1(QTest::currentTestFunction()));
+}
+
+void TestHistoryArchive::searchesPendingItems()
+{
+    HistoryArchive archive;
+    archive.archive(evictedItems());
+    QCOMPARE(archive.itemCount(), qint64(0));  // Not open, so nothing is kept
+    
+    QVERIFY(archive.open(archivePath()));
+    archive.archive(evictedItems());
+    QCOMPARE(archive.itemCount(), qint64(4));
+    QCOMPARE(archive.maxId(), quint64(4));
+    QCOMPARE(archive.segmentCount(), 0);
+    
+    QCOMPARE(idsOf(archive.search({}, 10)), (QList<quint64>{4, 3, 2, 1}));
+    QCOMPARE(idsOf(archive.search({}, 2, 1)), (QList<quint64>{3, 2}));
+    QCOMPARE(idsOf(archive.search({"HELLO"}, 10)), (QList<quint64>{4, 1}));
+    
+    ClipboardItem item;
+    QVERIFY(archive.item(2, &item));
+    QCOMPARE(item.text(), QString("https://example.com"));
+    QVERIFY(!archive.item(5, &item));
+}
+
+void TestHistoryArchive::searchesSealedSegments()
+{
+    HistoryArchive archive;
+    QVERIFY(archive.open(archivePath()));
+    archive.archive(evictedItems());
+    archive.flush();
+    QTRY_COMPARE(archive.segmentCount(), 1);
+    QCOMPARE(archive.itemCount(), qint64(4));
+    QCOMPARE(archive.maxId(), quint64(4));
+    
+    QCOMPARE(idsOf(archive.search({}, 10)), (QList<quint64>{4, 3, 2, 1}));
+    QCOMPARE(idsOf(archive.search({"hello"}, 1)), (QList<quint64>{4}));
+    QCOMPARE(idsOf(archive.search({"hello"}, 10, 1)), (QList<quint64>{1}));
+    
+    HistoryArchive::Query urls;
+    urls.typeFilter = ClipboardItem::Url;
+    QCOMPARE(idsOf(archive.search(urls, 10)), (QList<quint64>{2}));
+    
+    HistoryArchive::Query range;
+    range.from = QDateTime::fromMSecsSinceEpoch(2000);
+    range.to = QDateTime::fromMSecsSinceEpoch(3000);
+    QCOMPARE(idsOf(archive.search(range, 10)), (QList<quint64>{3, 2}));
+    
+    // Decoded from the mapping, whole
+    ClipboardItem item;
+    QVERIFY(archive.item(3, &item));
+    QCOMPARE(item.text(), QString("shopping list"));
+    QCOMPARE(item.timestamp(), QDateTime::fromMSecsSinceEpoch(3000));
+    QVERIFY(!archive.item(5, &item));
+    QVERIFY(!archive.item(0, &item));
+}
+
+void TestHistoryArchive::skipsSegmentsThatCannotMatch()
+{
+    HistoryArchive archive;
+    QVERIFY(archive.open(archivePath()));
+    archive.archive(evictedItems());
+    archive.flush();
+    QTRY_COMPARE(archive.segmentCount(), 1);
+    
+    HistoryArchive::SearchStats stats;
+    QVERIFY(archive.search({"no such text"}, 10, 0, &stats).isEmpty());
+    QCOMPARE(stats.segmentsSkipped, 1);
+    QCOMPARE(stats.segmentsScanned, 0);
+    
+    QCOMPARE(archive.search({"list"}, 10, 0, &stats).size(), 1);
+    QCOMPARE(stats.segmentsScanned, 1);
+    
+    HistoryArchive::Query images;
+    images.typeFilter = ClipboardItem::Image;
+    QVERIFY(archive.search(images, 10, 0, &stats).isEmpty());
+    QCOMPARE(stats.segmentsSkipped, 1);
+    
+    HistoryArchive::Query later;
+    later.from = QDateTime::fromMSecsSinceEpoch(5000);
+    QVERIFY(archive.search(later, 10, 0, &stats).isEmpty());
+    QCOMPARE(stats.segmentsSkipped, 1);
+}
+
+void TestHistoryArchive::reopensSegments()
+{
+    {
+        HistoryArchive archive;
+        QVERIFY(archive.open(archivePath()));
+        archive.archive(evictedItems());
+        archive.flush();
+        QTRY_COMPARE(archive.segmentCount(), 1);
+        archive.archive({archivedItem(5, "newer batch")});
+        archive.flush();
+        QTRY_COMPARE(archive.segmentCount(), 2);
+    }
+    
+    HistoryArchive archive;
+    QVERIFY(archive.open(archivePath()));
+    QCOMPARE(archive.segmentCount(), 2);
+    QCOMPARE(archive.itemCount(), qint64(5));
+    QCOMPARE(archive.maxId(), quint64(5));
+    QCOMPARE(idsOf(archive.search({}, 10)), (QList<quint64>{5, 4, 3, 2, 1}));
+    
+    ClipboardItem item;
+    QVERIFY(archive.item(5, &item));
+    QCOMPARE(item.text(), QString("newer batch"));
+    QVERIFY(archive.item(1, &item));
+    QCOMPARE(item.text(), QString("Hello world"));
+}
+
+void TestHistoryArchive::clearDeletesSegments()
+{
+    HistoryArchive archive;
+    QVERIFY(archive.open(archivePath()));
+    archive.archive(evictedItems());
+    archive.flush();
+    QTRY_COMPARE(archive.segmentCount(), 1);
+    archive.archive({archivedItem(5, "still pending")});
+    
+    archive.clear();
+    QCOMPARE(archive.segmentCount(), 0);
+    QCOMPARE(archive.itemCount(), qint64(0));
+    QCOMPARE(archive.maxId(), quint64(0));
+    QVERIFY(QDir(archivePath()).entryList(QDir::Files).isEmpty());
+}
+
+QTEST_GUILESS_MAIN(TestHistoryArchive)
+#include "tst_historyarchive.moc"
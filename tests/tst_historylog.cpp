@@ -0,0 +1,305 @@
+#include "HistoryLog.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QtEndian>
+#include <QtTest>
+
+namespace {
+ClipboardItem textItem(quint64 id, const QString& text, bool pinned = false)
+{
+    ClipboardItem item(text);
+    item.setId(id);
+    item.setPinned(pinned);
+    return item;
+}
+
+QList<quint64> idsOf(const QList<ClipboardItem>& items)
+{
+    QList<quint64> ids;
+    for (const ClipboardItem& item : items) {
+        ids.append(item.id());
+    }
+    return ids;
+}
+
+qint64 fileSize(const QString& path)
+{
+    return QFileInfo(path).size();
+}
+
+quint32 checksum(const QByteArray& data)
+{
+    quint32 crc = 0xffffffff;
+    for (const char byte : data) {
+        crc ^= static_cast<uchar>(byte);
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+// An AddItem record as version 1 logs wrote it, before items carried their
+// markup and pin
+QByteArray legacyAddItem(quint64 id, ClipboardItem::ItemType type, const QString& text)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << quint8(HistoryLog::AddItem) << id << qint32(type) << text << text.left(100)
+        << QDateTime::fromMSecsSinceEpoch(qint64(id) * 1000) << QByteArray() << QSize()
+        << quint64(0) << quint64(0) << qint32(0) << 0.0;
+    
+    QByteArray record(8, Qt::Uninitialized);
+    qToBigEndian<quint32>(payload.size(), record.data());
+    qToBigEndian<quint32>(checksum(payload), record.data() + 4);
+    return record + payload;
+}
+
+quint32 fileVersion(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+    return qFromBigEndian<quint32>(file.read(8).constData() + 4);
+}
+}
+
+class TestHistoryLog : public QObject
+{
+    Q_OBJECT
+    
+private slots:
+    void initTestCase();
+    void replaysCommittedRecords();
+    void dropsTornTail();
+    void dropsRecordFailingChecksum();
+    void appendsAfterRecoveredTail();
+    void keepsPinChangesAcrossCompaction();
+    void trimsWithoutUnloggedItems();
+    void upgradesVersion1Files();
+    
+private:
+    QTemporaryDir m_dir;
+    
+    // A fresh log file per test function
+    QString logPath() const;
+};
+
+void TestHistoryLog::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+}
+
+QString TestHistoryLog::logPath() const
+{
+    return m_dir.filePath(QString::fromLatin1(QTest::currentTestFunction()) + ".log");
+}
+
+void TestHistoryLog::replaysCommittedRecords()
+{
+    {
+        HistoryLog log;
+        HistoryLog::Recovered recovered;
+        QVERIFY(log.open(logPath(), &recovered));
+        QVERIFY(recovered.items.isEmpty());
+        
+        log.appendItem(textItem(1, "first"));
+        log.appendItem(textItem(2, "second"));
+        log.appendItem(textItem(3, "third"));
+        log.appendRemove(2);
+        log.appendMaxSize(50);
+    }
+    
+    HistoryLog log;
+    HistoryLog::Recovered recovered;
+    QVERIFY(log.open(logPath(), &recovered));
+    QCOMPARE(idsOf(recovered.items), (QList<quint64>{3, 1}));
+    QCOMPARE(recovered.items.first().text(), QString("third"));
+    QCOMPARE(recovered.maxHistorySize, 50);
+    QCOMPARE(recovered.records, 5);
+    QCOMPARE(recovered.truncatedBytes, qint64(0));
+}
+
+void TestHistoryLog::dropsTornTail()
+{
+    {
+        HistoryLog log;
+        HistoryLog::Recovered recovered;
+        QVERIFY(log.open(logPath(), &recovered));
+        for (quint64 id = 1; id <= 3; ++id) {
+            log.appendItem(textItem(id, QString("item %1").arg(id)));
+        }
+    }
+    const qint64 committedSize = fileSize(logPath());
+    
+    // A record header promising more payload than made it to disk
+    QByteArray torn(8, '\0');
+    qToBigEndian<quint32>(100, torn.data());
+    torn.append("partial");
+    {
+        QFile file(logPath());
+        QVERIFY(file.open(QIODevice::Append));
+        QCOMPARE(file.write(torn), qint64(torn.size()));
+    }
+    
+    HistoryLog log;
+    HistoryLog::Recovered recovered;
+    QVERIFY(log.open(logPath(), &recovered));
+    QCOMPARE(idsOf(recovered.items), (QList<quint64>{3, 2, 1}));
+    QCOMPARE(recovered.truncatedBytes, qint64(torn.size()));
+    QCOMPARE(fileSize(logPath()), committedSize);
+}
+
+void TestHistoryLog::dropsRecordFailingChecksum()
+{
+    qint64 goodSize = 0;
+    {
+        HistoryLog log;
+        HistoryLog::Recovered recovered;
+        QVERIFY(log.open(logPath(), &recovered));
+        log.appendItem(textItem(1, "kept"));
+        log.appendItem(textItem(2, "kept too"));
+        log.flush();
+        goodSize = fileSize(logPath());
+        log.appendItem(textItem(3, "damaged"));
+    }
+    const qint64 fullSize = fileSize(logPath());
+    QVERIFY(fullSize > goodSize);
+    
+    // Flip a bit in the last record's payload
+    {
+        QFile file(logPath());
+        QVERIFY(file.open(QIODevice::ReadWrite));
+        QVERIFY(file.seek(fullSize - 1));
+        const char last = file.read(1).at(0);
+        QVERIFY(file.seek(fullSize - 1));
+        QCOMPARE(file.write(QByteArray(1, char(last ^ 0x01))), qint64(1));
+    }
+    
+    HistoryLog log;
+    HistoryLog::Recovered recovered;
+    QVERIFY(log.open(logPath(), &recovered));
+    QCOMPARE(idsOf(recovered.items), (QList<quint64>{2, 1}));
+    QCOMPARE(recovered.truncatedBytes, fullSize - goodSize);
+}
+
+void TestHistoryLog::appendsAfterRecoveredTail()
+{
+    {
+        HistoryLog log;
+        HistoryLog::Recovered recovered;
+        QVERIFY(log.open(logPath(), &recovered));
+        log.appendItem(textItem(1, "before the crash"));
+    }
+    {
+        QFile file(logPath());
+        QVERIFY(file.open(QIODevice::Append));
+        QCOMPARE(file.write(QByteArray(5, '\x7f')), qint64(5));
+    }
+    
+    // Records appended after recovery must not end up behind the torn bytes
+    {
+        HistoryLog log;
+        HistoryLog::Recovered recovered;
+        QVERIFY(log.open(logPath(), &recovered));
+        QCOMPARE(recovered.truncatedBytes, qint64(5));
+        log.appendItem(textItem(2, "after the crash"));
+    }
+    
+    HistoryLog log;
+    HistoryLog::Recovered recovered;
+    QVERIFY(log.open(logPath(), &recovered));
+    QCOMPARE(idsOf(recovered.items), (QList<quint64>{2, 1}));
+    QCOMPARE(recovered.truncatedBytes, qint64(0));
+}
+
+void TestHistoryLog::keepsPinChangesAcrossCompaction()
+{
+    {
+        HistoryLog log;
+        HistoryLog::Recovered recovered;
+        QVERIFY(log.open(logPath(), &recovered));
+        
+        // Enough dead records to make the writer compact once they are removed
+        QList<quint64> removed;
+        for (quint64 id = 1; id <= 8; ++id) {
+            log.appendItem(textItem(id, QString(100 * 1000, QChar(char16_t(u'a' + id)))));
+            removed.append(id);
+        }
+        log.appendItem(textItem(9, "added pinned", true));
+        log.appendItem(textItem(10, "added unpinned"));
+        log.appendPinned({9}, false);
+        log.appendPinned({10}, true);
+        log.appendRemove(removed);
+        log.flush();
+        
+        // Compaction copies AddItem records as they are, pin flag included
+        QTRY_COMPARE_WITH_TIMEOUT(log.stats().compactions, qint64(1), 10000);
+        QVERIFY(log.stats().fileBytes < 64 * 1024);
+    }
+    
+    HistoryLog log;
+    HistoryLog::Recovered recovered;
+    QVERIFY(log.open(logPath(), &recovered));
+    QCOMPARE(idsOf(recovered.items), (QList<quint64>{10, 9}));
+    QVERIFY(recovered.items[0].isPinned());
+    QVERIFY(!recovered.items[1].isPinned());
+}
+
+void TestHistoryLog::trimsWithoutUnloggedItems()
+{
+    // Item 3 held a secret due to expire, so it was never logged. The live
+    // history leaves it out of the count toward the maximum and evicts only
+    // item 1 to the archive; replay must keep item 2 as well, and not item 1.
+    {
+        HistoryLog log;
+        HistoryLog::Recovered recovered;
+        QVERIFY(log.open(logPath(), &recovered));
+        log.appendMaxSize(2);
+        log.appendItem(textItem(1, "archived"));
+        log.appendItem(textItem(2, "kept"));
+        log.appendItem(textItem(4, "newest"));
+    }
+    
+    HistoryLog log;
+    HistoryLog::Recovered recovered;
+    QVERIFY(log.open(logPath(), &recovered));
+    QCOMPARE(idsOf(recovered.items), (QList<quint64>{4, 2}));
+}
+
+void TestHistoryLog::upgradesVersion1Files()
+{
+    QByteArray data(8, Qt::Uninitialized);
+    qToBigEndian<quint32>(0x43424c47, data.data());
+    qToBigEndian<quint32>(1, data.data() + 4);
+    data.append(legacyAddItem(1, ClipboardItem::Text, "plain"));
+    data.append(legacyAddItem(2, ClipboardItem::Html, "<b>bold</b> text"));
+    {
+        QFile file(logPath());
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QCOMPARE(file.write(data), qint64(data.size()));
+    }
+    
+    // The markup was stored as the text back then
+    for (int open = 0; open < 2; ++open) {
+        HistoryLog log;
+        HistoryLog::Recovered recovered;
+        QVERIFY(log.open(logPath(), &recovered));
+        QCOMPARE(idsOf(recovered.items), (QList<quint64>{2, 1}));
+        QCOMPARE(recovered.items[0].html(), QString("<b>bold</b> text"));
+        QCOMPARE(recovered.items[0].text(), QString("bold text"));
+        QCOMPARE(recovered.items[1].text(), QString("plain"));
+        QVERIFY(recovered.items[1].html().isEmpty());
+        QVERIFY(!recovered.items[1].isPinned());
+        QCOMPARE(recovered.truncatedBytes, qint64(0));
+        
+        // Rewritten in the current layout on the first open
+        QVERIFY(fileVersion(logPath()) > 1);
+    }
+}
+
+QTEST_GUILESS_MAIN(TestHistoryLog)
+#include "tst_historylog.moc"
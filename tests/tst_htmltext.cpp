@@ -0,0 +1,55 @@
+#include "HtmlText.h"
+#include <QtTest>
+
+class TestHtmlText : public QObject
+{
+    Q_OBJECT
+    
+private slots:
+    void toPlainText_data();
+    void toPlainText();
+    void neverGrows();
+};
+
+void TestHtmlText::toPlainText_data()
+{
+    QTest::addColumn<QString>("html");
+    QTest::addColumn<QString>("text");
+    
+    QTest::newRow("empty") << QString() << QString();
+    QTest::newRow("plain") << QString("just text") << QString("just text");
+    QTest::newRow("collapsed whitespace") << QString("<p>Hello   <b>world</b></p>") << QString("Hello world");
+    QTest::newRow("entities") << QString("a&amp;b &lt;c&gt; &#65;&#x42; &bogus; &")
+                              << QString("a&b <c> AB &bogus; &");
+    QTest::newRow("hidden content") << QString("<style>p{}</style><script>var a = \"<b>\";</script>"
+                                               "Visible<!-- hidden -->Text")
+                                    << QString("VisibleText");
+    QTest::newRow("blocks and cells") << QString("<div>one</div><div>two</div>"
+                                                 "<table><tr><td>a</td><td>b</td></tr></table>")
+                                      << QString("one\ntwo\na\tb");
+    QTest::newRow("line break and pre") << QString("line1<br>line2<pre>  a\n  b</pre>")
+                                        << QString("line1\nline2\n  a\n  b");
+    QTest::newRow("quoted '>' in attributes") << QString("<a title=\"x > y\" href='z'>link</a>") << QString("link");
+    QTest::newRow("lone '<'") << QString("1 < 2") << QString("1 < 2");
+}
+
+void TestHtmlText::toPlainText()
+{
+    QFETCH(QString, html);
+    QFETCH(QString, text);
+    
+    QCOMPARE(HtmlText::toPlainText(html), text);
+}
+
+void TestHtmlText::neverGrows()
+{
+    // Entities decode to at most what they were written as
+    const QString html = QString("&lt;").repeated(1000) + QString("&#x1F600;").repeated(1000);
+    const QString text = HtmlText::toPlainText(html);
+    QVERIFY(text.size() <= html.size());
+    QCOMPARE(text.left(3), QString("<<<"));
+    QCOMPARE(text.right(2), QString::fromUcs4(U"\U0001F600"));
+}
+
+QTEST_GUILESS_MAIN(TestHtmlText)
+#include "tst_htmltext.moc"
@@ -0,0 +1,148 @@
+#include "ImageHashIndex.h"
+#include <QtTest>
+#include <algorithm>
+
+namespace {
+// Grayscale ramp across the width, brightening left to right when ascending
+QImage gradient(int width, int height, bool ascending)
+{
+    QImage image(width, height, QImage::Format_Grayscale8);
+    for (int y = 0; y < height; ++y) {
+        uchar* line = image.scanLine(y);
+        for (int x = 0; x < width; ++x) {
+            const int value = x * 255 / (width - 1);
+            line[x] = static_cast<uchar>(ascending ? value : 255 - value);
+        }
+    }
+    return image;
+}
+
+QList<quint64> sorted(QList<quint64> ids)
+{
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+}
+
+class TestImageHashIndex : public QObject
+{
+    Q_OBJECT
+    
+private slots:
+    void distance_data();
+    void distance();
+    void findsHashesWithinDistance();
+    void ignoresIdsAlreadyIndexed();
+    void removedIdsAreNotFound();
+    void rebuildsAfterManyRemovals();
+    void differenceHash();
+};
+
+void TestImageHashIndex::distance_data()
+{
+    QTest::addColumn<quint64>("a");
+    QTest::addColumn<quint64>("b");
+    QTest::addColumn<int>("distance");
+    
+    QTest::newRow("equal") << quint64(0x1234) << quint64(0x1234) << 0;
+    QTest::newRow("one bit") << quint64(0) << quint64(1) << 1;
+    QTest::newRow("low byte") << quint64(0) << quint64(0xFF) << 8;
+    QTest::newRow("all bits") << quint64(0) << ~quint64(0) << 64;
+}
+
+void TestImageHashIndex::distance()
+{
+    QFETCH(quint64, a);
+    QFETCH(quint64, b);
+    QFETCH(int, distance);
+    
+    QCOMPARE(ImageHashIndex::distance(a, b), distance);
+    QCOMPARE(ImageHashIndex::distance(b, a), distance);
+}
+
+void TestImageHashIndex::findsHashesWithinDistance()
+{
+    ImageHashIndex index;
+    index.insert(0x0, 1);
+    index.insert(0x1, 2);
+    index.insert(0xFF, 3);
+    index.insert(0xFFFF, 4);
+    index.insert(0x3, 5);
+    QCOMPARE(index.size(), 5);
+    
+    QCOMPARE(sorted(index.find(0x0, 0)), (QList<quint64>{1}));
+    QCOMPARE(sorted(index.find(0x0, 1)), (QList<quint64>{1, 2}));
+    QCOMPARE(sorted(index.find(0x0, 2)), (QList<quint64>{1, 2, 5}));
+    QCOMPARE(sorted(index.find(0x0, 8)), (QList<quint64>{1, 2, 3, 5}));
+    QCOMPARE(sorted(index.find(0xFFFF, 8)), (QList<quint64>{3, 4}));
+    QVERIFY(index.find(0x0, -1).isEmpty());
+    QVERIFY(ImageHashIndex().find(0x0, 64).isEmpty());
+}
+
+void TestImageHashIndex::ignoresIdsAlreadyIndexed()
+{
+    ImageHashIndex index;
+    index.insert(0x0, 1);
+    index.insert(0xFF, 1);
+    QCOMPARE(index.size(), 1);
+    QCOMPARE(index.find(0x0, 0), (QList<quint64>{1}));
+    QVERIFY(index.find(0xFF, 0).isEmpty());
+}
+
+void TestImageHashIndex::removedIdsAreNotFound()
+{
+    ImageHashIndex index;
+    index.insert(0x0, 1);
+    index.insert(0x1, 2);
+    index.insert(0x3, 3);
+    
+    // The root is tombstoned, but still routes lookups to its children
+    index.remove(1);
+    index.remove(42);
+    QCOMPARE(index.size(), 2);
+    QCOMPARE(sorted(index.find(0x0, 2)), (QList<quint64>{2, 3}));
+    
+    // A removed id can be indexed again
+    index.insert(0x0, 1);
+    QCOMPARE(sorted(index.find(0x0, 2)), (QList<quint64>{1, 2, 3}));
+    
+    index.clear();
+    QCOMPARE(index.size(), 0);
+    QVERIFY(index.find(0x0, 64).isEmpty());
+}
+
+void TestImageHashIndex::rebuildsAfterManyRemovals()
+{
+    ImageHashIndex index;
+    for (quint64 id = 0; id < 16; ++id) {
+        index.insert((quint64(1) << id) - 1, id);  // id low bits set
+    }
+    for (quint64 id = 0; id < 16; id += 2) {
+        index.remove(id);
+    }
+    index.remove(1);  // Tombstones now outnumber live nodes
+    
+    QCOMPARE(index.size(), 7);
+    QCOMPARE(sorted(index.find(0x0, 5)), (QList<quint64>{3, 5}));
+    QCOMPARE(sorted(index.find(0x0, 64)), (QList<quint64>{3, 5, 7, 9, 11, 13, 15}));
+}
+
+void TestImageHashIndex::differenceHash()
+{
+    QCOMPARE(ImageHashIndex::differenceHash(QImage()), quint64(0));
+    
+    // Every adjacent pair brightens, or none does
+    const quint64 ascending = ImageHashIndex::differenceHash(gradient(180, 160, true));
+    QCOMPARE(ascending, ~quint64(0));
+    QCOMPARE(ImageHashIndex::differenceHash(gradient(180, 160, false)), quint64(0));
+    
+    // Robust to scaling
+    QCOMPARE(ImageHashIndex::differenceHash(gradient(360, 90, true)), ascending);
+    
+    QImage flat(64, 64, QImage::Format_RGB32);
+    flat.fill(Qt::gray);
+    QCOMPARE(ImageHashIndex::differenceHash(flat), quint64(0));
+}
+
+QTEST_GUILESS_MAIN(TestImageHashIndex)
+#include "tst_imagehashindex.moc"
@@ -0,0 +1,202 @@
+#include "IngestionFilter.h"
+#include <QMimeData>
+#include <QtTest>
+
+namespace {
+IngestionFilter::Rule checkText(IngestionFilter* filter, const QString& text,
+                                IngestionFilter::Payload* payload = nullptr)
+{
+    QMimeData mimeData;
+    mimeData.setText(text);
+    IngestionFilter::Payload ignored;
+    return filter->check(&mimeData, payload ? payload : &ignored);
+}
+}
+
+class TestIngestionFilter : public QObject
+{
+    Q_OBJECT
+    
+private slots:
+    void rejectsMissingData();
+    void picksPayloadFormat();
+    void rejectsSensitiveMarkers();
+    void rejectsDeniedFormats();
+    void rejectsFormatsNotAllowed();
+    void capsSizeByMostSpecificPattern();
+    void rejectsRecentDuplicates();
+    void forgetsRecentCaptures();
+    void countsRejectionsPerRule();
+};
+
+void TestIngestionFilter::rejectsMissingData()
+{
+    IngestionFilter filter;
+    IngestionFilter::Payload payload;
+    QMimeData empty;
+    QCOMPARE(filter.check(&empty, &payload), IngestionFilter::NoData);
+    
+    QMimeData unknown;
+    unknown.setData("application/x-unknown", "bytes");
+    QCOMPARE(filter.check(&unknown, &payload), IngestionFilter::NoData);
+    
+    QCOMPARE(checkText(&filter, QString()), IngestionFilter::NoData);
+}
+
+void TestIngestionFilter::picksPayloadFormat()
+{
+    IngestionFilter filter;
+    IngestionFilter::Payload payload;
+    QCOMPARE(checkText(&filter, "plain", &payload), IngestionFilter::Accepted);
+    QCOMPARE(payload.format, QString("text/plain"));
+    QCOMPARE(payload.data, QByteArray("plain"));
+    QVERIFY(payload.hash != 0);
+    
+    // HTML is preferred over its plain text alternative
+    QMimeData mimeData;
+    mimeData.setText("bold");
+    mimeData.setHtml("<b>bold</b>");
+    QCOMPARE(filter.check(&mimeData, &payload), IngestionFilter::Accepted);
+    QCOMPARE(payload.format, QString("text/html"));
+    QCOMPARE(payload.data, QByteArray("<b>bold</b>"));
+}
+
+void TestIngestionFilter::rejectsSensitiveMarkers()
+{
+    IngestionFilter filter;
+    IngestionFilter::Payload payload;
+    QMimeData password;
+    password.setText("hunter2");
+    password.setData("x-kde-passwordManagerHint", "secret");
+    QCOMPARE(filter.check(&password, &payload), IngestionFilter::SensitiveMarker);
+    
+    // Only a zero value opts out of history
+    QMimeData optedOut;
+    optedOut.setText("opted out");
+    optedOut.setData("application/x-qt-windows-mime;value=\"CanIncludeInClipboardHistory\"",
+                     QByteArray(4, '\0'));
+    QCOMPARE(filter.check(&optedOut, &payload), IngestionFilter::SensitiveMarker);
+    
+    QMimeData optedIn;
+    optedIn.setText("opted in");
+    optedIn.setData("application/x-qt-windows-mime;value=\"CanIncludeInClipboardHistory\"",
+                    QByteArray("\x01\0\0\0", 4));
+    QCOMPARE(filter.check(&optedIn, &payload), IngestionFilter::Accepted);
+}
+
+void TestIngestionFilter::rejectsDeniedFormats()
+{
+    IngestionFilter filter;
+    filter.setDeniedFormats({"application/x-secret*"});
+    IngestionFilter::Payload payload;
+    
+    // Any format offered is checked, not only the payload's
+    QMimeData mimeData;
+    mimeData.setText("token");
+    mimeData.setData("application/x-secret-token", "token");
+    QCOMPARE(filter.check(&mimeData, &payload), IngestionFilter::DeniedFormat);
+    
+    QCOMPARE(checkText(&filter, "token"), IngestionFilter::Accepted);
+}
+
+void TestIngestionFilter::rejectsFormatsNotAllowed()
+{
+    IngestionFilter filter;
+    filter.setAllowedFormats({"image/*", "TEXT/HTML"});
+    QCOMPARE(checkText(&filter, "plain"), IngestionFilter::NotAllowedFormat);
+    
+    QMimeData mimeData;
+    mimeData.setHtml("<i>markup</i>");
+    IngestionFilter::Payload payload;
+    QCOMPARE(filter.check(&mimeData, &payload), IngestionFilter::Accepted);
+    
+    filter.setAllowedFormats({});
+    QCOMPARE(checkText(&filter, "plain"), IngestionFilter::Accepted);
+}
+
+void TestIngestionFilter::capsSizeByMostSpecificPattern()
+{
+    IngestionFilter filter;
+    filter.setMaxBytes("text/*", 4);
+    QCOMPARE(checkText(&filter, "four"), IngestionFilter::Accepted);
+    QCOMPARE(checkText(&filter, "longer"), IngestionFilter::TooLarge);
+    
+    filter.setMaxBytes("text/plain", 16);
+    QCOMPARE(checkText(&filter, "longer"), IngestionFilter::Accepted);
+    
+    filter.setMaxBytes("text/plain", -1);
+    QCOMPARE(checkText(&filter, "longer"), IngestionFilter::TooLarge);
+    
+    filter.setMaxBytes("text/*", -1);
+    QCOMPARE(checkText(&filter, QString(1024, 'x')), IngestionFilter::Accepted);
+}
+
+void TestIngestionFilter::rejectsRecentDuplicates()
+{
+    IngestionFilter filter;
+    IngestionFilter::Payload payload;
+    QCOMPARE(checkText(&filter, "again", &payload), IngestionFilter::Accepted);
+    filter.remember(payload, 7);
+    
+    IngestionFilter::Payload repeated;
+    QCOMPARE(checkText(&filter, "again", &repeated), IngestionFilter::RecentDuplicate);
+    QCOMPARE(repeated.recentId, quint64(7));
+    QVERIFY(repeated == payload);
+    
+    // Same bytes in another format are a different capture
+    QMimeData html;
+    html.setHtml("again");
+    QCOMPARE(filter.check(&html, &repeated), IngestionFilter::Accepted);
+    
+    // Captured again, the entry follows the newer item
+    filter.remember(payload, 9);
+    QCOMPARE(checkText(&filter, "again", &repeated), IngestionFilter::RecentDuplicate);
+    QCOMPARE(repeated.recentId, quint64(9));
+}
+
+void TestIngestionFilter::forgetsRecentCaptures()
+{
+    IngestionFilter filter;
+    IngestionFilter::Payload first;
+    IngestionFilter::Payload second;
+    QCOMPARE(checkText(&filter, "first", &first), IngestionFilter::Accepted);
+    filter.remember(first, 1);
+    QCOMPARE(checkText(&filter, "second", &second), IngestionFilter::Accepted);
+    filter.remember(second, 2);
+    
+    filter.forget(1);
+    QCOMPARE(checkText(&filter, "first"), IngestionFilter::Accepted);
+    QCOMPARE(checkText(&filter, "second"), IngestionFilter::RecentDuplicate);
+    
+    filter.forgetRecent();
+    QCOMPARE(checkText(&filter, "second"), IngestionFilter::Accepted);
+    
+    // Only the last kRecentCount captures are kept
+    for (int i = 0; i <= IngestionFilter::kRecentCount; ++i) {
+        IngestionFilter::Payload payload;
+        QCOMPARE(checkText(&filter, QString::number(i), &payload), IngestionFilter::Accepted);
+        filter.remember(payload, i + 1);
+    }
+    QCOMPARE(checkText(&filter, "0"), IngestionFilter::Accepted);
+    QCOMPARE(checkText(&filter, "1"), IngestionFilter::RecentDuplicate);
+}
+
+void TestIngestionFilter::countsRejectionsPerRule()
+{
+    IngestionFilter filter;
+    filter.setMaxBytes("text/*", 2);
+    checkText(&filter, QString());
+    checkText(&filter, QString());
+    checkText(&filter, "too long");
+    checkText(&filter, "ok");
+    
+    QCOMPARE(filter.count(IngestionFilter::NoData), quint64(2));
+    QCOMPARE(filter.count(IngestionFilter::TooLarge), quint64(1));
+    QCOMPARE(filter.count(IngestionFilter::Accepted), quint64(0));
+    QCOMPARE(filter.count(IngestionFilter::RecentDuplicate), quint64(0));
+    QVERIFY(filter.summary().contains("no data: 2"));
+    QVERIFY(filter.summary().contains("too large: 1"));
+}
+
+QTEST_GUILESS_MAIN(TestIngestionFilter)
+#include "tst_ingestionfilter.moc"
@@ -0,0 +1,174 @@
+#include "IpcProtocol.h"
+#include <QBuffer>
+#include <QtEndian>
+#include <QtTest>
+
+namespace {
+QByteArray written(const QList<QByteArray>& payloads)
+{
+    QByteArray bytes;
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::WriteOnly);
+    for (const QByteArray& payload : payloads) {
+        IpcProtocol::writeFrame(&buffer, payload);
+    }
+    return bytes;
+}
+
+// Hands bytes to the reader as one read of the device
+bool feed(IpcProtocol::FrameReader& reader, const QByteArray& bytes, QList<QByteArray>* frames)
+{
+    QByteArray data = bytes;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+    return IpcProtocol::readFrames(&buffer, reader, *frames);
+}
+
+QByteArray rawFrame(const QByteArray& payload)
+{
+    QByteArray bytes(sizeof(quint32), Qt::Uninitialized);
+    qToBigEndian<quint32>(static_cast<quint32>(payload.size()), bytes.data());
+    return bytes + payload;
+}
+
+QByteArray fragment(const QByteArray& slice, bool last)
+{
+    QByteArray payload(2, Qt::Uninitialized);
+    payload[0] = static_cast<char>(IpcProtocol::Fragment);
+    payload[1] = last ? 1 : 0;
+    return rawFrame(payload + slice);
+}
+
+QByteArray message(IpcProtocol::MessageType type, const QString& text)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    IpcProtocol::beginMessage(stream, type) << text;
+    return payload;
+}
+
+// Large enough to be split into three fragments
+QByteArray largePayload()
+{
+    QByteArray payload(2 * IpcProtocol::kMaxFragmentSize + 1000, Qt::Uninitialized);
+    payload[0] = static_cast<char>(IpcProtocol::HistoryPage);
+    for (qsizetype i = 1; i < payload.size(); ++i) {
+        payload[i] = static_cast<char>(i % 251);
+    }
+    return payload;
+}
+}
+
+class TestIpcProtocol : public QObject
+{
+    Q_OBJECT
+    
+private slots:
+    void roundTripsFrames();
+    void joinsFramesSplitAcrossReads();
+    void reassemblesFragmentedMessages();
+    void rejectsOversizedFrames();
+    void rejectsOversizedMessages();
+    void rejectsFramesBetweenFragments();
+};
+
+void TestIpcProtocol::roundTripsFrames()
+{
+    const QList<QByteArray> payloads = {message(IpcProtocol::Query, "needle"), QByteArray(),
+                                        message(IpcProtocol::Error, "failed")};
+    IpcProtocol::FrameReader reader;
+    QList<QByteArray> frames;
+    QVERIFY(feed(reader, written(payloads), &frames));
+    QCOMPARE(frames, payloads);
+    QVERIFY(reader.buffer.isEmpty());
+    
+    QDataStream stream(frames[0]);
+    stream.setVersion(IpcProtocol::kStreamVersion);
+    quint8 type = 0;
+    QString text;
+    stream >> type >> text;
+    QCOMPARE(type, quint8(IpcProtocol::Query));
+    QCOMPARE(text, QString("needle"));
+}
+
+void TestIpcProtocol::joinsFramesSplitAcrossReads()
+{
+    const QByteArray first = message(IpcProtocol::Query, "first");
+    const QByteArray second = message(IpcProtocol::Query, "second");
+    const QByteArray bytes = written({first, second});
+    
+    // Byte by byte, including through the length prefixes
+    IpcProtocol::FrameReader reader;
+    QList<QByteArray> frames;
+    for (qsizetype i = 0; i < bytes.size(); ++i) {
+        QVERIFY(feed(reader, bytes.mid(i, 1), &frames));
+        QCOMPARE(int(frames.size()), i + 1 < rawFrame(first).size() ? 0 : i + 1 < bytes.size() ? 1 : 2);
+    }
+    QCOMPARE(frames, (QList<QByteArray>{first, second}));
+    QVERIFY(reader.buffer.isEmpty());
+}
+
+void TestIpcProtocol::reassemblesFragmentedMessages()
+{
+    const QByteArray payload = largePayload();
+    const QByteArray small = message(IpcProtocol::Error, "after");
+    const QByteArray bytes = written({payload, small});
+    
+    // Split mid-fragment; nothing is delivered until the last fragment
+    IpcProtocol::FrameReader reader;
+    QList<QByteArray> frames;
+    const qsizetype half = bytes.size() / 2;
+    QVERIFY(feed(reader, bytes.left(half), &frames));
+    QVERIFY(frames.isEmpty());
+    QVERIFY(!reader.message.isEmpty());
+    
+    QVERIFY(feed(reader, bytes.mid(half), &frames));
+    QCOMPARE(frames.size(), 2);
+    QVERIFY(frames[0] == payload);
+    QCOMPARE(frames[1], small);
+    QVERIFY(reader.message.isEmpty());
+    QVERIFY(reader.buffer.isEmpty());
+}
+
+void TestIpcProtocol::rejectsOversizedFrames()
+{
+    QByteArray header(sizeof(quint32), Qt::Uninitialized);
+    
+    // A frame at the limit is waited for
+    qToBigEndian<quint32>(IpcProtocol::kMaxFrameSize, header.data());
+    IpcProtocol::FrameReader reader;
+    QList<QByteArray> frames;
+    QVERIFY(feed(reader, header, &frames));
+    QVERIFY(frames.isEmpty());
+    
+    qToBigEndian<quint32>(IpcProtocol::kMaxFrameSize + 1, header.data());
+    IpcProtocol::FrameReader oversized;
+    QVERIFY(!feed(oversized, header, &frames));
+}
+
+void TestIpcProtocol::rejectsOversizedMessages()
+{
+    // Checked before anything is appended; the message is never written to,
+    // so it costs address space rather than memory
+    IpcProtocol::FrameReader reader;
+    reader.message = QByteArray(IpcProtocol::kMaxMessageSize - 1, Qt::Uninitialized);
+    QList<QByteArray> frames;
+    QVERIFY(!feed(reader, fragment("ab", true), &frames));
+    QVERIFY(frames.isEmpty());
+    
+    // A truncated fragment header is corrupt too
+    IpcProtocol::FrameReader truncated;
+    QVERIFY(!feed(truncated, rawFrame(QByteArray(1, static_cast<char>(IpcProtocol::Fragment))), &frames));
+}
+
+void TestIpcProtocol::rejectsFramesBetweenFragments()
+{
+    IpcProtocol::FrameReader reader;
+    QList<QByteArray> frames;
+    QVERIFY(feed(reader, fragment("partial", false), &frames));
+    QVERIFY(!feed(reader, rawFrame(message(IpcProtocol::Error, "interleaved")), &frames));
+    QVERIFY(frames.isEmpty());
+}
+
+QTEST_GUILESS_MAIN(TestIpcProtocol)
+#include "tst_ipcprotocol.moc"
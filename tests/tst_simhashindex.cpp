@@ -0,0 +1,108 @@
+#include "SimHashIndex.h"
+#include <QtTest>
+
+namespace {
+const quint64 kFingerprint = 0x0123456789abcdefULL;
+
+// One bit flipped in each 16-bit band
+const quint64 kEveryBand = 0x0001000100010001ULL;
+}
+
+class TestSimHashIndex : public QObject
+{
+    Q_OBJECT
+    
+private slots:
+    void fingerprintNeedsEnoughFeatures();
+    void fingerprintIgnoresCaseAndNumbers();
+    void fingerprintSeparatesDifferentTexts();
+    void findsWithinMaxDistance();
+    void prefersClosestThenNewest();
+    void removedIdsAreNotFound();
+    void ignoresEmptyFingerprints();
+};
+
+void TestSimHashIndex::fingerprintNeedsEnoughFeatures()
+{
+    QCOMPARE(SimHashIndex::fingerprint(QString()), quint64(0));
+    QCOMPARE(SimHashIndex::fingerprint("two words"), quint64(0));
+    QCOMPARE(SimHashIndex::fingerprint("  --  ..  "), quint64(0));
+    QVERIFY(SimHashIndex::fingerprint("three whole words") != 0);
+}
+
+void TestSimHashIndex::fingerprintIgnoresCaseAndNumbers()
+{
+    const quint64 line = SimHashIndex::fingerprint("2024-05-01 12:00:03 request 1842 served in 35 ms");
+    QVERIFY(line != 0);
+    QCOMPARE(SimHashIndex::fingerprint("2024-05-02 09:41:17 request 977 served in 8 ms"), line);
+    QCOMPARE(SimHashIndex::fingerprint("2024-05-01 12:00:03 REQUEST 1842 Served In 35 MS"), line);
+}
+
+void TestSimHashIndex::fingerprintSeparatesDifferentTexts()
+{
+    const quint64 a = SimHashIndex::fingerprint("the quick brown fox jumps over the lazy dog");
+    const quint64 b = SimHashIndex::fingerprint("a completely unrelated sentence about clipboard managers");
+    QVERIFY(qPopulationCount(a ^ b) > SimHashIndex::kMaxDistance);
+}
+
+void TestSimHashIndex::findsWithinMaxDistance()
+{
+    SimHashIndex index;
+    index.insert(kFingerprint, 1);
+    
+    QCOMPARE(index.findNearest(kFingerprint), quint64(1));
+    QCOMPARE(index.findNearest(kFingerprint ^ 0x7), quint64(1));
+    QCOMPARE(index.findNearest(kFingerprint ^ 0x0007000000000000ULL), quint64(1));
+    
+    // Shares a band, but too far
+    QCOMPARE(index.findNearest(kFingerprint ^ 0xf), quint64(0));
+    
+    // Within reach of a full comparison, but no band agrees
+    QCOMPARE(index.findNearest(kFingerprint ^ kEveryBand), quint64(0));
+}
+
+void TestSimHashIndex::prefersClosestThenNewest()
+{
+    SimHashIndex index;
+    index.insert(kFingerprint ^ 0x3, 1);
+    index.insert(kFingerprint ^ 0x1, 2);
+    index.insert(kFingerprint ^ 0x7, 3);
+    QCOMPARE(index.findNearest(kFingerprint), quint64(2));
+    
+    index.insert(kFingerprint ^ 0x2, 4);
+    QCOMPARE(index.findNearest(kFingerprint), quint64(4));
+}
+
+void TestSimHashIndex::removedIdsAreNotFound()
+{
+    SimHashIndex index;
+    index.insert(kFingerprint, 1);
+    index.insert(kFingerprint ^ 0x1, 2);
+    
+    index.remove(1);
+    index.remove(42);
+    QCOMPARE(index.findNearest(kFingerprint), quint64(2));
+    
+    index.remove(2);
+    QCOMPARE(index.findNearest(kFingerprint), quint64(0));
+    
+    index.insert(kFingerprint, 1);
+    index.clear();
+    QCOMPARE(index.findNearest(kFingerprint), quint64(0));
+}
+
+void TestSimHashIndex::ignoresEmptyFingerprints()
+{
+    SimHashIndex index;
+    index.insert(0, 1);
+    QCOMPARE(index.findNearest(0), quint64(0));
+    
+    // An id keeps the fingerprint it was first indexed with
+    index.insert(kFingerprint, 2);
+    index.insert(~kFingerprint, 2);
+    QCOMPARE(index.findNearest(kFingerprint), quint64(2));
+    QCOMPARE(index.findNearest(~kFingerprint), quint64(0));
+}
+
+QTEST_GUILESS_MAIN(TestSimHashIndex)
+#include "tst_simhashindex.moc"
@@ -0,0 +1,111 @@
+#include "SyntaxHighlighter.h"
+#include <QStringList>
+#include <QtTest>
+
+namespace {
+// Spans as "Kind start+length" joined by ", ", so a mismatch reads well
+QString describe(const std::vector<SyntaxHighlighter::Span>& spans)
+{
+    static const char* const kinds[] = {"Keyword", "String", "Comment", "Number", "Function", "Directive"};
+    QStringList parts;
+    for (const SyntaxHighlighter::Span& span : spans) {
+        parts.append(QString("%1 %2+%3").arg(kinds[span.kind]).arg(span.start).arg(span.length));
+    }
+    return parts.join(", ");
+}
+}
+
+class TestSyntaxHighlighter : public QObject
+{
+    Q_OBJECT
+    
+private slots:
+    void detectLanguage_data();
+    void detectLanguage();
+    void tokenize_data();
+    void tokenize();
+    void splitsLongTokens();
+    void mapsSpansToPreview_data();
+    void mapsSpansToPreview();
+};
+
+void TestSyntaxHighlighter::detectLanguage_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<int>("language");
+    
+    QTest::newRow("c++") << QString("#include <vector>\nint main() { return 0; }") << int(SyntaxHighlighter::Cpp);
+    QTest::newRow("python") << QString("def f(x):\n    return None\n") << int(SyntaxHighlighter::Python);
+    QTest::newRow("json") << QString("{\"a\": 1}") << int(SyntaxHighlighter::Json);
+    QTest::newRow("sql, any case") << QString("SELECT id FROM users WHERE id = 1") << int(SyntaxHighlighter::Sql);
+    QTest::newRow("prose") << QString("hello world") << int(SyntaxHighlighter::PlainLanguage);
+}
+
+void TestSyntaxHighlighter::detectLanguage()
+{
+    QFETCH(QString, text);
+    QFETCH(int, language);
+    
+    QCOMPARE(int(SyntaxHighlighter::detectLanguage(text)), language);
+}
+
+void TestSyntaxHighlighter::tokenize_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<int>("language");
+    QTest::addColumn<QString>("spans");
+    
+    QTest::newRow("keyword, number, comment") << QString("int x = 42; // note") << int(SyntaxHighlighter::Cpp)
+                                              << QString("Keyword 0+3, Number 8+2, Comment 12+7");
+    QTest::newRow("function call") << QString("foo(1)") << int(SyntaxHighlighter::Cpp)
+                                   << QString("Function 0+3, Number 4+1");
+    QTest::newRow("block comment") << QString("/* a\nb */ x") << int(SyntaxHighlighter::Cpp)
+                                   << QString("Comment 0+10");
+    QTest::newRow("preprocessor line") << QString("#define X 1\nint") << int(SyntaxHighlighter::Cpp)
+                                       << QString("Directive 0+11, Keyword 12+3");
+    QTest::newRow("triple-quoted string") << QString("s = \"\"\"a\nb\"\"\"") << int(SyntaxHighlighter::Python)
+                                          << QString("String 4+9");
+    QTest::newRow("plain text has no functions") << QString("call (me) \"maybe\"")
+                                                 << int(SyntaxHighlighter::PlainLanguage) << QString("String 10+7");
+}
+
+void TestSyntaxHighlighter::tokenize()
+{
+    QFETCH(QString, text);
+    QFETCH(int, language);
+    QFETCH(QString, spans);
+    
+    QCOMPARE(describe(SyntaxHighlighter::tokenize(text, SyntaxHighlighter::Language(language))), spans);
+}
+
+void TestSyntaxHighlighter::splitsLongTokens()
+{
+    // Span lengths are 16 bits
+    const QString text = '"' + QString(70000, 'a') + '"';
+    QCOMPARE(describe(SyntaxHighlighter::tokenize(text, SyntaxHighlighter::PlainLanguage)),
+             QString("String 0+65535, String 65535+4467"));
+}
+
+void TestSyntaxHighlighter::mapsSpansToPreview_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<QString>("preview");
+    QTest::addColumn<QString>("spans");
+    
+    QTest::newRow("collapsed whitespace") << QString("int  x\n=\t42;") << QString("int x = 42;")
+                                          << QString("Keyword 0+3, Number 8+2");
+    QTest::newRow("truncated") << QString("int value = 1;") << QString("int val...") << QString("Keyword 0+3");
+}
+
+void TestSyntaxHighlighter::mapsSpansToPreview()
+{
+    QFETCH(QString, text);
+    QFETCH(QString, preview);
+    QFETCH(QString, spans);
+    
+    const std::vector<SyntaxHighlighter::Span> textSpans = SyntaxHighlighter::tokenize(text, SyntaxHighlighter::Cpp);
+    QCOMPARE(describe(SyntaxHighlighter::mapToPreview(text, textSpans, preview)), spans);
+}
+
+QTEST_GUILESS_MAIN(TestSyntaxHighlighter)
+#include "tst_syntaxhighlighter.moc"
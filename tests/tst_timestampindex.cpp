@@ -0,0 +1,109 @@
+#include "TimestampIndex.h"
+#include <QtTest>
+
+namespace {
+// Two items share a millisecond; the later id is the newer one
+void fill(TimestampIndex* index)
+{
+    index->insert(1000, 1);
+    index->insert(2000, 2);
+    index->insert(2000, 3);
+    index->insert(3000, 4);
+}
+
+QList<quint64> rangeOf(const TimestampIndex& index, qint64 from, qint64 to)
+{
+    const std::vector<quint64> ids = index.range(from, to);
+    return QList<quint64>(ids.begin(), ids.end());
+}
+}
+
+class TestTimestampIndex : public QObject
+{
+    Q_OBJECT
+    
+private slots:
+    void range_data();
+    void range();
+    void sortsOutOfOrderInserts();
+    void removesEntries();
+    void newestBefore();
+};
+
+void TestTimestampIndex::range_data()
+{
+    QTest::addColumn<qint64>("from");
+    QTest::addColumn<qint64>("to");
+    QTest::addColumn<QList<quint64>>("ids");
+    
+    QTest::newRow("everything") << qint64(0) << qint64(10000) << QList<quint64>{4, 3, 2, 1};
+    QTest::newRow("from is inclusive") << qint64(1000) << qint64(1001) << QList<quint64>{1};
+    QTest::newRow("to is exclusive") << qint64(1000) << qint64(2000) << QList<quint64>{1};
+    QTest::newRow("same millisecond") << qint64(2000) << qint64(3000) << QList<quint64>{3, 2};
+    QTest::newRow("between entries") << qint64(1001) << qint64(2000) << QList<quint64>();
+    QTest::newRow("after the newest") << qint64(3001) << qint64(10000) << QList<quint64>();
+    QTest::newRow("before the oldest") << qint64(0) << qint64(1000) << QList<quint64>();
+    QTest::newRow("empty range") << qint64(2000) << qint64(2000) << QList<quint64>();
+    QTest::newRow("reversed range") << qint64(3000) << qint64(1000) << QList<quint64>();
+}
+
+void TestTimestampIndex::range()
+{
+    QFETCH(qint64, from);
+    QFETCH(qint64, to);
+    QFETCH(QList<quint64>, ids);
+    
+    TimestampIndex index;
+    fill(&index);
+    QCOMPARE(rangeOf(index, from, to), ids);
+    QCOMPARE(index.count(from, to), int(ids.size()));
+}
+
+void TestTimestampIndex::sortsOutOfOrderInserts()
+{
+    // A bulk load, e.g. a replayed log, in no particular order
+    TimestampIndex index;
+    index.insert(3000, 4);
+    index.insert(1000, 1);
+    index.insert(2000, 3);
+    index.insert(2000, 2);
+    QCOMPARE(index.size(), 4);
+    QCOMPARE(rangeOf(index, 0, 10000), (QList<quint64>{4, 3, 2, 1}));
+    
+    // Sorted once; later inserts in order keep it that way
+    index.insert(4000, 5);
+    QCOMPARE(rangeOf(index, 2000, 5000), (QList<quint64>{5, 4, 3, 2}));
+}
+
+void TestTimestampIndex::removesEntries()
+{
+    TimestampIndex index;
+    fill(&index);
+    
+    // Matched on both time and id
+    index.remove(2000, 4);
+    index.remove(2000, 2);
+    QCOMPARE(rangeOf(index, 0, 10000), (QList<quint64>{4, 3, 1}));
+    
+    index.remove(QSet<quint64>{1, 4, 42});
+    QCOMPARE(rangeOf(index, 0, 10000), (QList<quint64>{3}));
+    
+    index.clear();
+    QCOMPARE(index.size(), 0);
+    QVERIFY(index.range(0, 10000).empty());
+}
+
+void TestTimestampIndex::newestBefore()
+{
+    TimestampIndex index;
+    QCOMPARE(index.newestBefore(1000), quint64(0));
+    
+    fill(&index);
+    QCOMPARE(index.newestBefore(1000), quint64(0));
+    QCOMPARE(index.newestBefore(1001), quint64(1));
+    QCOMPARE(index.newestBefore(2500), quint64(3));
+    QCOMPARE(index.newestBefore(10000), quint64(4));
+}
+
+QTEST_GUILESS_MAIN(TestTimestampIndex)
+#include "tst_timestampindex.moc"